@@ -3,84 +3,982 @@
 #include <lprefix.h> // must include first
 
 #include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 #include <limits.h>
 
 #include <lauxlib.h>
 #include <lua.h>
+#include <luautil.h>
 
-// the number of bits in an unsigned integer
-#define BITS_PER_WORD (CHAR_BIT * sizeof(unsigned int))
+/*
+** Two kinds of bit array share the Lua interface below:
+** "LuaBook.array", a plain bitmap in 64-bit words, and
+** "LuaBook.sparsearray", a compressed one for large sparse sets, split into
+** chunks of 65536 bits like a roaring bitmap. A chunk holding at most 4096
+** bits is a sorted array of uint16_t, a fuller one is a 8KB bitmap, chunks
+** without any bit set take no memory at all.
+** Lua index i (1-based) is bit i-1.
+*/
+
+#define ARRAY_TYPE "LuaBook.array"
+#define SPARSE_TYPE "LuaBook.sparsearray"
+
+// the number of bits in a word
+#define BITS_PER_WORD 64
 // computes the word that stores the bit corresponding to a given index
 // for n bit array, i: [0, n-1]
-#define I_WORD(i) ((unsigned int)(i) / BITS_PER_WORD)
+#define I_WORD(i) ((size_t)(i) / BITS_PER_WORD)
 // computes a mask to access the correct bit inside this word
-#define I_BIT(i) (1 << ((unsigned int)(i) % BITS_PER_WORD))
+#define I_BIT(i) (UINT64_C(1) << ((size_t)(i) % BITS_PER_WORD))
 // mask for bits higher then i in this word, include i
-#define I_HIGHER(i) ((unsigned int)(-1) << (((unsigned int)(i) % BITS_PER_WORD)))
-// get position of the first 1 in a binary unsigned int
-#define FIRST_ONE(w) binpos((w & (w - 1)) ^ w)
+#define I_HIGHER(i) (~UINT64_C(0) << ((size_t)(i) % BITS_PER_WORD))
+// mask for bits lower then i in this word, exclude i
+#define I_LOWER(i) (~I_HIGHER(i))
+// number of words for n bits
+#define N_WORDS(n) (((size_t)(n) + BITS_PER_WORD - 1) / BITS_PER_WORD)
+
+/*
+** {======================================================
+** Word kernels
+** =======================================================
+*/
 
-// optimized and wide version: luaO_ceillog2
-static int binpos(unsigned int index) {
-  int cnt = 0;
-  while (index) { // position of first bit is 1
-    index >>= 1;
-    cnt++;
+// bit counts of a nonzero word
+#if defined(_MSC_VER)
+#include <intrin.h>
+static int countzero(uint64_t w) {
+  unsigned long i;
+#if defined(_M_X64)
+  _BitScanForward64(&i, w);
+#else
+  if (!_BitScanForward(&i, (unsigned long)w)) {
+    _BitScanForward(&i, (unsigned long)(w >> 32));
+    i += 32;
   }
+#endif
+  return (int)i;
+}
+#else
+#define countzero(w) __builtin_ctzll(w)
+#endif
+
+#if defined(__POPCNT__)
+#define popcount(w) __builtin_popcountll(w)
+#else
+static int popcount(uint64_t w) { // no popcnt instruction, libgcc falls back to a table
+  w = w - ((w >> 1) & UINT64_C(0x5555555555555555));
+  w = (w & UINT64_C(0x3333333333333333)) + ((w >> 2) & UINT64_C(0x3333333333333333));
+  w = (w + (w >> 4)) & UINT64_C(0x0f0f0f0f0f0f0f0f);
+  return (int)((w * UINT64_C(0x0101010101010101)) >> 56);
+}
+#endif
+
+typedef enum {
+  OP_AND,
+  OP_OR,
+  OP_XOR,
+  OP_ANDNOT,
+} BitOp;
+static const char* const bitops[] = {"and", "or", "xor", "andnot", NULL};
+
+#if defined(__AVX2__)
+
+#include <immintrin.h>
+
+#define VEC_WORDS 4
+typedef __m256i Vec;
+#define vec_load(p) _mm256_loadu_si256((const __m256i*)(p))
+#define vec_store(p, v) _mm256_storeu_si256((__m256i*)(p), v)
+#define vec_and(a, b) _mm256_and_si256(a, b)
+#define vec_or(a, b) _mm256_or_si256(a, b)
+#define vec_xor(a, b) _mm256_xor_si256(a, b)
+#define vec_andnot(a, b) _mm256_andnot_si256(b, a) // a & ~b
+#define vec_set8(c) _mm256_set1_epi8((char)(c))
+#define vec_srl(v, n) _mm256_srli_epi64(v, n)
+#define vec_sub(a, b) _mm256_sub_epi8(a, b)
+#define vec_add(a, b) _mm256_add_epi8(a, b)
+#define vec_sumbytes(v) _mm256_sad_epu8(v, _mm256_setzero_si256())
+#define vec_add64(a, b) _mm256_add_epi64(a, b)
+#define vec_zero() _mm256_setzero_si256()
+
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+
+#include <emmintrin.h>
+
+#define VEC_WORDS 2
+typedef __m128i Vec;
+#define vec_load(p) _mm_loadu_si128((const __m128i*)(p))
+#define vec_store(p, v) _mm_storeu_si128((__m128i*)(p), v)
+#define vec_and(a, b) _mm_and_si128(a, b)
+#define vec_or(a, b) _mm_or_si128(a, b)
+#define vec_xor(a, b) _mm_xor_si128(a, b)
+#define vec_andnot(a, b) _mm_andnot_si128(b, a) // a & ~b
+#define vec_set8(c) _mm_set1_epi8((char)(c))
+#define vec_srl(v, n) _mm_srli_epi64(v, n)
+#define vec_sub(a, b) _mm_sub_epi8(a, b)
+#define vec_add(a, b) _mm_add_epi8(a, b)
+#define vec_sumbytes(v) _mm_sad_epu8(v, _mm_setzero_si128())
+#define vec_add64(a, b) _mm_add_epi64(a, b)
+#define vec_zero() _mm_setzero_si128()
+
+#endif
+
+#define DEFINE_WORDS_OP(name, wordop, vecop) \
+  static void name(uint64_t* dst, const uint64_t* a, const uint64_t* b, size_t n) { \
+    size_t i = 0; \
+    VECTOR_LOOP(vecop) \
+    for (; i < n; i++) \
+      dst[i] = wordop(a[i], b[i]); \
+  }
+#if defined(VEC_WORDS)
+#define VECTOR_LOOP(vecop) \
+  for (; i + VEC_WORDS <= n; i += VEC_WORDS) \
+    vec_store(dst + i, vecop(vec_load(a + i), vec_load(b + i)));
+#else
+#define VECTOR_LOOP(vecop)
+#endif
+
+#define WORD_AND(x, y) ((x) & (y))
+#define WORD_OR(x, y) ((x) | (y))
+#define WORD_XOR(x, y) ((x) ^ (y))
+#define WORD_ANDNOT(x, y) ((x) & ~(y))
+
+// 'dst' may be 'a' or 'b'
+DEFINE_WORDS_OP(words_and, WORD_AND, vec_and)
+DEFINE_WORDS_OP(words_or, WORD_OR, vec_or)
+DEFINE_WORDS_OP(words_xor, WORD_XOR, vec_xor)
+DEFINE_WORDS_OP(words_andnot, WORD_ANDNOT, vec_andnot)
+
+static void words_op(uint64_t* dst, const uint64_t* a, const uint64_t* b, size_t n, BitOp op) {
+  switch (op) {
+    case OP_AND:
+      words_and(dst, a, b, n);
+      break;
+    case OP_OR:
+      words_or(dst, a, b, n);
+      break;
+    case OP_XOR:
+      words_xor(dst, a, b, n);
+      break;
+    case OP_ANDNOT:
+      words_andnot(dst, a, b, n);
+      break;
+  }
+}
+
+static size_t words_count(const uint64_t* w, size_t n) {
+  size_t i = 0, cnt = 0;
+#if defined(VEC_WORDS) && !defined(__POPCNT__)
+  // popcount of every byte, then summed into 64-bit lanes by psadbw
+  Vec acc = vec_zero();
+  const Vec m1 = vec_set8(0x55), m2 = vec_set8(0x33), m4 = vec_set8(0x0f);
+  for (; i + VEC_WORDS <= n; i += VEC_WORDS) {
+    Vec v = vec_load(w + i);
+    v = vec_sub(v, vec_and(vec_srl(v, 1), m1));
+    v = vec_add(vec_and(v, m2), vec_and(vec_srl(v, 2), m2));
+    v = vec_and(vec_add(v, vec_srl(v, 4)), m4);
+    acc = vec_add64(acc, vec_sumbytes(v));
+  }
+  uint64_t lanes[VEC_WORDS];
+  vec_store(lanes, acc);
+  for (int k = 0; k < VEC_WORDS; k++)
+    cnt += (size_t)lanes[k];
+#endif
+  for (; i < n; i++)
+    cnt += (size_t)popcount(w[i]);
   return cnt;
 }
 
-#define CHECK_ARRAY(L, idx) (BitArray*)luaL_checkudata(L, idx, "LuaBook.array")
+// set bits in [from, to) of words 'w'
+static size_t words_countrange(const uint64_t* w, size_t from, size_t to) {
+  if (from >= to)
+    return 0;
+  size_t fw = I_WORD(from), lw = I_WORD(to - 1);
+  uint64_t last = (to % BITS_PER_WORD) == 0 ? ~UINT64_C(0) : I_LOWER(to);
+  if (fw == lw)
+    return (size_t)popcount(w[fw] & I_HIGHER(from) & last);
+  size_t cnt = (size_t)popcount(w[fw] & I_HIGHER(from));
+  cnt += words_count(w + fw + 1, lw - fw - 1);
+  return cnt + (size_t)popcount(w[lw] & last);
+}
+
+// first set bit at or after 'from' in [0, nbits), or 'nbits'
+static size_t words_next(const uint64_t* w, size_t from, size_t nbits) {
+  if (from >= nbits)
+    return nbits;
+  size_t i = I_WORD(from), lw = I_WORD(nbits - 1);
+  uint64_t word = w[i] & I_HIGHER(from);
+  while (word == 0) {
+    if (++i > lw)
+      return nbits;
+    word = w[i];
+  }
+  return i * BITS_PER_WORD + (size_t)countzero(word);
+}
+
+// position of the k-th (0-based) set bit, or 'nbits' when there are not so many
+static size_t words_select(const uint64_t* w, size_t nwords, size_t k, size_t nbits) {
+  for (size_t i = 0; i < nwords; i++) {
+    size_t c = (size_t)popcount(w[i]);
+    if (k < c) {
+      uint64_t word = w[i];
+      while (k-- > 0)
+        word &= word - 1; // drop the lowest set bit
+      return i * BITS_PER_WORD + (size_t)countzero(word);
+    }
+    k -= c;
+  }
+  return nbits;
+}
+
+// set or clear bits in [from, to)
+static void words_setrange(uint64_t* w, size_t from, size_t to, int value) {
+  if (from >= to)
+    return;
+  size_t fw = I_WORD(from), lw = I_WORD(to - 1);
+  uint64_t first = I_HIGHER(from);
+  uint64_t last = (to % BITS_PER_WORD) == 0 ? ~UINT64_C(0) : I_LOWER(to);
+  if (fw == lw)
+    first &= last;
+  if (value)
+    w[fw] |= first;
+  else
+    w[fw] &= ~first;
+  if (fw == lw)
+    return;
+  if (lw > fw + 1)
+    memset(w + fw + 1, value ? 0xFF : 0, (lw - fw - 1) * sizeof(uint64_t));
+  if (value)
+    w[lw] |= last;
+  else
+    w[lw] &= ~last;
+}
+
+/* }====================================================== */
+
+/*
+** {======================================================
+** Bit array
+** =======================================================
+*/
 
 typedef struct BitArray {
-  int size;
-  unsigned int values[1]; /* variable part */
+  lua_Integer size;
+  uint64_t values[1]; /* variable part */
 } BitArray;
 
-static BitArray* allocarray(lua_State* L, int n) {
+#define CHECK_ARRAY(L, idx) (BitArray*)luaL_checkudata(L, idx, ARRAY_TYPE)
+#define TEST_ARRAY(L, idx) (BitArray*)luaL_testudata(L, idx, ARRAY_TYPE)
+
+// bits above size in the last word stay zero, counting relies on it
+#define LAST_MASK(n) (((size_t)(n) % BITS_PER_WORD) == 0 ? ~UINT64_C(0) : I_LOWER(n))
+
+static BitArray* allocarray(lua_State* L, lua_Integer n) {
   // n bit, index: [0, n-1], last bit is n-1
   // index of word for last bit: I_WORD(n-1)
-  // size of array: (I_WORD(n-1) + 1) * sizeof(unsigned int)
-  size_t nbytes = sizeof(BitArray) + I_WORD(n - 1) * sizeof(unsigned int);
+  // size of array: (I_WORD(n-1) + 1) * sizeof(uint64_t)
+  size_t nbytes = sizeof(BitArray) + I_WORD(n - 1) * sizeof(uint64_t);
   BitArray* a = (BitArray*)lua_newuserdata(L, nbytes);
   a->size = n;
-  luaL_getmetatable(L, "LuaBook.array");
-  lua_setmetatable(L, -2);
+  luaL_setmetatable(L, ARRAY_TYPE);
   return a;
 }
 
-static int newarray(lua_State* L) {
-  int i;
-  BitArray* a;
+static BitArray* newzeroarray(lua_State* L, lua_Integer n) {
+  BitArray* a = allocarray(L, n);
+  memset(a->values, 0, N_WORDS(n) * sizeof(uint64_t)); /* initialize array */
+  return a;
+}
 
-  int n = (int)luaL_checkinteger(L, 1); /* number of bits */
-  luaL_argcheck(L, n >= 1, 1, "invalid size");
+static uint64_t* getparams(lua_State* L, BitArray* a, uint64_t* mask) {
+  lua_Integer index = luaL_checkinteger(L, 2) - 1;
+  luaL_argcheck(L, 0 <= index && index < a->size, 2, "index out of range");
+
+  *mask = I_BIT(index); /* mask to access correct bit */
+  return &a->values[I_WORD(index)]; /* word address */
+}
+
+// a op b into a new array of 'size' bits, missing words of the shorter one count as zero
+static void makearray(lua_State* L, BitArray* a, BitArray* b, lua_Integer size, BitOp op) {
+  BitArray* u = allocarray(L, size); // every word is written below
+  size_t nu = N_WORDS(size);
+  size_t na = N_WORDS(a->size), nb = N_WORDS(b->size);
+  size_t common = na < nb ? na : nb;
+  if (common > nu)
+    common = nu;
+  words_op(u->values, a->values, b->values, common, op);
+  const BitArray* rest = na > nb ? a : b; // the longer one, against zero words
+  size_t nrest = (na > nb ? na : nb) < nu ? (na > nb ? na : nb) : nu;
+  if (op == OP_AND || (op == OP_ANDNOT && rest == b)) // a & 0, 0 & ~b
+    memset(u->values + common, 0, (nrest - common) * sizeof(uint64_t));
+  else // a | 0, a ^ 0, a & ~0
+    memcpy(u->values + common, rest->values + common, (nrest - common) * sizeof(uint64_t));
+  memset(u->values + nrest, 0, (nu - nrest) * sizeof(uint64_t));
+  u->values[nu - 1] &= LAST_MASK(size);
+}
+
+// a op= b, in place
+static void combinearray(BitArray* a, const BitArray* b, BitOp op) {
+  size_t na = N_WORDS(a->size), nb = N_WORDS(b->size);
+  size_t common = na < nb ? na : nb;
+  words_op(a->values, a->values, b->values, common, op);
+  if (op == OP_AND && na > common)
+    memset(a->values + common, 0, (na - common) * sizeof(uint64_t));
+  a->values[na - 1] &= LAST_MASK(a->size);
+}
+
+/* }====================================================== */
+
+/*
+** {======================================================
+** Sparse bit array, roaring style chunks
+** =======================================================
+*/
+
+#define CHUNK_BITS 65536
+#define CHUNK_WORDS (CHUNK_BITS / BITS_PER_WORD)
+#define ARRAY_MAX 4096 // beyond this a sorted array takes more room than a bitmap
+#define CHUNK_KEY(i) ((uint32_t)((i) >> 16))
+#define CHUNK_LOW(i) ((uint16_t)((i)&0xFFFF))
+#define MAX_SPARSE_SIZE ((lua_Integer)CHUNK_BITS * CHUNK_BITS)
+
+typedef struct {
+  uint16_t key; // high 16 bits of the index
+  uint16_t isbitmap;
+  uint32_t card; // bits set, never 0 in a SparseArray
+  uint32_t capacity; // entries in 'array', 0 for a bitmap
+  union {
+    uint16_t* array; // sorted low 16 bits
+    uint64_t* bitmap; // CHUNK_WORDS words
+  } u;
+} Container;
+
+typedef struct {
+  lua_Integer size;
+  Container* cs; // sorted by key
+  uint32_t n;
+  uint32_t capacity;
+} SparseArray;
+
+#define CHECK_SPARSE(L, idx) (SparseArray*)luaL_checkudata(L, idx, SPARSE_TYPE)
+#define TEST_SPARSE(L, idx) (SparseArray*)luaL_testudata(L, idx, SPARSE_TYPE)
+
+static void* allocmem(lua_State* L, void* ptr, size_t osize, size_t nsize) {
+  void* ud;
+  lua_Alloc allocf = lua_getallocf(L, &ud);
+  return allocf(ud, ptr, osize, nsize);
+}
+
+static void* checkalloc(lua_State* L, void* ptr, size_t osize, size_t nsize) {
+  void* p = allocmem(L, ptr, osize, nsize);
+  if (p == NULL && nsize > 0)
+    luaL_error(L, "not enough memory");
+  return p;
+}
+
+static size_t c_datasize(const Container* c) {
+  return c->isbitmap ? CHUNK_WORDS * sizeof(uint64_t) : c->capacity * sizeof(uint16_t);
+}
 
-  a = allocarray(L, n);
+static void c_free(lua_State* L, Container* c) {
+  if (c->u.array != NULL)
+    allocmem(L, c->u.array, c_datasize(c), 0);
+  c->u.array = NULL;
+  c->capacity = 0;
+  c->card = 0;
+}
 
-  for (i = 0; i <= (int)I_WORD(n - 1); i++)
-    a->values[i] = 0; /* initialize array */
+// lowest index in sorted 'a' holding a value >= v
+static uint32_t array_lowerbound(const uint16_t* a, uint32_t n, uint16_t v) {
+  uint32_t lo = 0, hi = n;
+  while (lo < hi) {
+    uint32_t mid = (lo + hi) / 2;
+    if (a[mid] < v)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
 
+// fill 'c' from a bitmap of 'card' bits, one allocation, may raise before touching 'c'
+static void c_setwords(lua_State* L, Container* c, const uint64_t* w, uint32_t card) {
+  if (card > ARRAY_MAX) {
+    uint64_t* bitmap = (uint64_t*)checkalloc(L, NULL, 0, CHUNK_WORDS * sizeof(uint64_t));
+    memcpy(bitmap, w, CHUNK_WORDS * sizeof(uint64_t));
+    c->u.bitmap = bitmap;
+    c->isbitmap = 1;
+    c->capacity = 0;
+  } else {
+    uint16_t* array = (uint16_t*)checkalloc(L, NULL, 0, card * sizeof(uint16_t));
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < CHUNK_WORDS && n < card; i++) {
+      for (uint64_t word = w[i]; word != 0; word &= word - 1)
+        array[n++] = (uint16_t)(i * BITS_PER_WORD + (uint32_t)countzero(word));
+    }
+    c->u.array = array;
+    c->isbitmap = 0;
+    c->capacity = card;
+  }
+  c->card = card;
+}
+
+static void c_setarray(lua_State* L, Container* c, const uint16_t* a, uint32_t card) {
+  if (card > ARRAY_MAX) {
+    uint64_t w[CHUNK_WORDS];
+    memset(w, 0, sizeof(w));
+    for (uint32_t i = 0; i < card; i++)
+      w[I_WORD(a[i])] |= I_BIT(a[i]);
+    c_setwords(L, c, w, card);
+    return;
+  }
+  uint16_t* array = (uint16_t*)checkalloc(L, NULL, 0, card * sizeof(uint16_t));
+  memcpy(array, a, card * sizeof(uint16_t));
+  c->u.array = array;
+  c->isbitmap = 0;
+  c->capacity = card;
+  c->card = card;
+}
+
+static void c_towords(const Container* c, uint64_t* w) {
+  if (c->isbitmap) {
+    memcpy(w, c->u.bitmap, CHUNK_WORDS * sizeof(uint64_t));
+  } else {
+    memset(w, 0, CHUNK_WORDS * sizeof(uint64_t));
+    for (uint32_t i = 0; i < c->card; i++)
+      w[I_WORD(c->u.array[i])] |= I_BIT(c->u.array[i]);
+  }
+}
+
+static int c_contains(const Container* c, uint16_t low) {
+  if (c->isbitmap)
+    return (c->u.bitmap[I_WORD(low)] & I_BIT(low)) != 0;
+  uint32_t i = array_lowerbound(c->u.array, c->card, low);
+  return i < c->card && c->u.array[i] == low;
+}
+
+static void c_add(lua_State* L, Container* c, uint16_t low) {
+  if (c->isbitmap) {
+    uint64_t* w = &c->u.bitmap[I_WORD(low)];
+    if ((*w & I_BIT(low)) == 0) {
+      *w |= I_BIT(low);
+      c->card++;
+    }
+    return;
+  }
+  uint32_t i = array_lowerbound(c->u.array, c->card, low);
+  if (i < c->card && c->u.array[i] == low)
+    return;
+  if (c->card == ARRAY_MAX) { // becomes a bitmap
+    Container nc;
+    uint64_t w[CHUNK_WORDS];
+    c_towords(c, w);
+    w[I_WORD(low)] |= I_BIT(low);
+    c_setwords(L, &nc, w, c->card + 1);
+    nc.key = c->key;
+    c_free(L, c);
+    *c = nc;
+    return;
+  }
+  if (c->card == c->capacity) {
+    uint32_t ncap = c->capacity < 4 ? 4 : c->capacity * 2;
+    if (ncap > ARRAY_MAX)
+      ncap = ARRAY_MAX;
+    c->u.array = (uint16_t*)checkalloc(L, c->u.array, c->capacity * sizeof(uint16_t), ncap * sizeof(uint16_t));
+    c->capacity = ncap;
+  }
+  memmove(c->u.array + i + 1, c->u.array + i, (c->card - i) * sizeof(uint16_t));
+  c->u.array[i] = low;
+  c->card++;
+}
+
+static void c_remove(lua_State* L, Container* c, uint16_t low) {
+  if (c->isbitmap) {
+    uint64_t* w = &c->u.bitmap[I_WORD(low)];
+    if ((*w & I_BIT(low)) == 0)
+      return;
+    if (c->card == ARRAY_MAX + 1) { // back to an array
+      Container nc;
+      uint64_t words[CHUNK_WORDS];
+      c_towords(c, words);
+      words[I_WORD(low)] &= ~I_BIT(low);
+      c_setwords(L, &nc, words, ARRAY_MAX);
+      nc.key = c->key;
+      c_free(L, c);
+      *c = nc;
+      return;
+    }
+    *w &= ~I_BIT(low);
+    c->card--;
+    return;
+  }
+  uint32_t i = array_lowerbound(c->u.array, c->card, low);
+  if (i < c->card && c->u.array[i] == low) {
+    memmove(c->u.array + i, c->u.array + i + 1, (c->card - i - 1) * sizeof(uint16_t));
+    c->card--;
+  }
+}
+
+// first set bit >= low, or -1
+static int32_t c_next(const Container* c, uint32_t low) {
+  if (c->isbitmap) {
+    size_t i = words_next(c->u.bitmap, low, CHUNK_BITS);
+    return i == CHUNK_BITS ? -1 : (int32_t)i;
+  }
+  if (low >= CHUNK_BITS)
+    return -1;
+  uint32_t i = array_lowerbound(c->u.array, c->card, (uint16_t)low);
+  return i < c->card ? (int32_t)c->u.array[i] : -1;
+}
+
+// set bits < low
+static uint32_t c_rank(const Container* c, uint32_t low) {
+  if (c->isbitmap)
+    return (uint32_t)words_countrange(c->u.bitmap, 0, low);
+  if (low >= CHUNK_BITS)
+    return c->card;
+  return array_lowerbound(c->u.array, c->card, (uint16_t)low);
+}
+
+static uint32_t c_select(const Container* c, uint32_t k) { // k < card
+  if (c->isbitmap)
+    return (uint32_t)words_select(c->u.bitmap, CHUNK_WORDS, k, CHUNK_BITS);
+  return c->u.array[k];
+}
+
+// sorted merge of two arrays, keeps a value by where it appears
+static uint32_t array_op(const uint16_t* a, uint32_t na, const uint16_t* b, uint32_t nb, BitOp op, uint16_t* out) {
+  int keepa = op != OP_AND; // only in a
+  int keepb = op == OP_OR || op == OP_XOR; // only in b
+  int keepboth = op == OP_AND || op == OP_OR;
+  uint32_t i = 0, j = 0, n = 0;
+  while (i < na && j < nb) {
+    if (a[i] < b[j]) {
+      if (keepa)
+        out[n++] = a[i];
+      i++;
+    } else if (a[i] > b[j]) {
+      if (keepb)
+        out[n++] = b[j];
+      j++;
+    } else {
+      if (keepboth)
+        out[n++] = a[i];
+      i++;
+      j++;
+    }
+  }
+  if (keepa)
+    for (; i < na; i++)
+      out[n++] = a[i];
+  if (keepb)
+    for (; j < nb; j++)
+      out[n++] = b[j];
+  return n;
+}
+
+static void c_oparrays(lua_State* L, Container* out, const Container* a, const Container* b, BitOp op) {
+  uint16_t merged[2 * ARRAY_MAX];
+  uint32_t n = array_op(a->u.array, a->card, b->u.array, b->card, op, merged);
+  if (n > 0)
+    c_setarray(L, out, merged, n);
+}
+
+static void c_opwords(lua_State* L, Container* out, const Container* a, const Container* b, BitOp op) {
+  uint64_t wa[CHUNK_WORDS], wb[CHUNK_WORDS];
+  c_towords(a, wa);
+  const uint64_t* pb = b->u.bitmap;
+  if (!b->isbitmap) {
+    c_towords(b, wb);
+    pb = wb;
+  }
+  words_op(wa, wa, pb, CHUNK_WORDS, op);
+  uint32_t card = (uint32_t)words_count(wa, CHUNK_WORDS);
+  if (card > 0)
+    c_setwords(L, out, wa, card);
+}
+
+/*
+** a op b into 'out', whose data must be empty, 'out' keeps card 0 when the
+** result is empty. The result is built on the C stack and copied with a
+** single allocation, so an error leaves nothing behind.
+*/
+static void c_op(lua_State* L, Container* out, const Container* a, const Container* b, BitOp op) {
+  out->key = a->key;
+  out->card = 0;
+  out->capacity = 0;
+  out->isbitmap = 0;
+  out->u.array = NULL;
+  if (!a->isbitmap && !b->isbitmap)
+    c_oparrays(L, out, a, b, op);
+  else
+    c_opwords(L, out, a, b, op);
+}
+
+static void c_copy(lua_State* L, Container* out, const Container* c) {
+  out->key = c->key;
+  if (c->isbitmap)
+    c_setwords(L, out, c->u.bitmap, c->card);
+  else
+    c_setarray(L, out, c->u.array, c->card);
+}
+
+// index of the container with 'key', or where it goes
+static uint32_t sparse_find(const SparseArray* s, uint32_t key, int* found) {
+  uint32_t lo = 0, hi = s->n;
+  while (lo < hi) {
+    uint32_t mid = (lo + hi) / 2;
+    if (s->cs[mid].key < key)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  *found = lo < s->n && s->cs[lo].key == key;
+  return lo;
+}
+
+static void sparse_reserve(lua_State* L, SparseArray* s, uint32_t n) {
+  if (s->n + n <= s->capacity)
+    return;
+  uint32_t ncap = s->capacity < 4 ? 4 : s->capacity;
+  while (ncap < s->n + n)
+    ncap *= 2;
+  s->cs = (Container*)checkalloc(L, s->cs, s->capacity * sizeof(Container), ncap * sizeof(Container));
+  s->capacity = ncap;
+}
+
+// insert an empty container with 'key' at 'i', capacity must be reserved
+static Container* sparse_insertat(SparseArray* s, uint32_t i, uint32_t key) {
+  memmove(s->cs + i + 1, s->cs + i, (s->n - i) * sizeof(Container));
+  s->n++;
+  Container* c = &s->cs[i];
+  memset(c, 0, sizeof(Container));
+  c->key = (uint16_t)key;
+  return c;
+}
+
+static void sparse_removeat(lua_State* L, SparseArray* s, uint32_t i) {
+  c_free(L, &s->cs[i]);
+  memmove(s->cs + i, s->cs + i + 1, (s->n - i - 1) * sizeof(Container));
+  s->n--;
+}
+
+static void sparse_clear(lua_State* L, SparseArray* s) {
+  for (uint32_t i = 0; i < s->n; i++)
+    c_free(L, &s->cs[i]);
+  if (s->cs != NULL)
+    allocmem(L, s->cs, s->capacity * sizeof(Container), 0);
+  s->cs = NULL;
+  s->n = 0;
+  s->capacity = 0;
+}
+
+static SparseArray* newsparse(lua_State* L, lua_Integer n) {
+  SparseArray* s = (SparseArray*)lua_newuserdata(L, sizeof(SparseArray));
+  memset(s, 0, sizeof(SparseArray));
+  s->size = n;
+  luaL_setmetatable(L, SPARSE_TYPE);
+  return s;
+}
+
+static int sparse_get(const SparseArray* s, size_t index) {
+  int found;
+  uint32_t i = sparse_find(s, CHUNK_KEY(index), &found);
+  return found && c_contains(&s->cs[i], CHUNK_LOW(index));
+}
+
+static void sparse_set(lua_State* L, SparseArray* s, size_t index, int value) {
+  int found;
+  uint32_t i = sparse_find(s, CHUNK_KEY(index), &found);
+  if (value && found) {
+    c_add(L, &s->cs[i], CHUNK_LOW(index));
+  } else if (value) {
+    Container c;
+    memset(&c, 0, sizeof(Container));
+    c.key = (uint16_t)CHUNK_KEY(index);
+    sparse_reserve(L, s, 1); // before anything to release
+    c_add(L, &c, CHUNK_LOW(index));
+    *sparse_insertat(s, i, CHUNK_KEY(index)) = c;
+  } else if (found) {
+    c_remove(L, &s->cs[i], CHUNK_LOW(index));
+    if (s->cs[i].card == 0)
+      sparse_removeat(L, s, i);
+  }
+}
+
+static void sparse_setchunkrange(lua_State* L, SparseArray* s, uint32_t key, uint32_t from, uint32_t to, int value);
+
+/*
+** a op b into a new sparse array of 'size' bits, pushed first so that an
+** allocation error leaves every built container to its __gc
+*/
+static SparseArray* makesparse(lua_State* L, const SparseArray* a, const SparseArray* b, lua_Integer size, BitOp op) {
+  SparseArray* u = newsparse(L, size);
+  uint32_t maxkey = CHUNK_KEY(size - 1);
+  uint32_t i = 0, j = 0;
+  int keepb = op == OP_OR || op == OP_XOR; // containers only in b reach the result
+  /* every step writes at u->n, which stays below the steps taken on a (and b if kept) */
+  sparse_reserve(L, u, a->n + (keepb ? b->n : 0));
+  while (i < a->n || (keepb && j < b->n)) {
+    const Container* ca = i < a->n ? &a->cs[i] : NULL;
+    const Container* cb = j < b->n ? &b->cs[j] : NULL;
+    Container* out = &u->cs[u->n];
+    memset(out, 0, sizeof(Container));
+    if (cb == NULL || (ca != NULL && ca->key < cb->key)) { // only in a
+      if (op != OP_AND && ca->key <= maxkey)
+        c_copy(L, out, ca);
+      i++;
+    } else if (ca == NULL || cb->key < ca->key) { // only in b
+      if (keepb && cb->key <= maxkey)
+        c_copy(L, out, cb);
+      j++;
+    } else {
+      if (ca->key <= maxkey)
+        c_op(L, out, ca, cb, op);
+      i++;
+      j++;
+    }
+    if (out->card > 0)
+      u->n++;
+  }
+  if ((size < a->size || size < b->size) && CHUNK_LOW(size - 1) < CHUNK_BITS - 1) // bits above 'size' in its last chunk
+    sparse_setchunkrange(L, u, maxkey, (uint32_t)CHUNK_LOW(size - 1) + 1, CHUNK_BITS, 0);
+  return u;
+}
+
+// set or clear [from, to) of chunk 'key'
+static void sparse_setchunkrange(lua_State* L, SparseArray* s, uint32_t key, uint32_t from, uint32_t to, int value) {
+  int found;
+  uint32_t i = sparse_find(s, key, &found);
+  if (!found && !value)
+    return;
+  Container range; // on the C stack, only read by c_op
+  uint64_t rw[CHUNK_WORDS];
+  uint16_t ra[ARRAY_MAX];
+  range.key = (uint16_t)key;
+  range.card = to - from;
+  if (range.card > ARRAY_MAX) {
+    memset(rw, 0, sizeof(rw));
+    words_setrange(rw, from, to, 1);
+    range.isbitmap = 1;
+    range.u.bitmap = rw;
+  } else {
+    for (uint32_t k = from; k < to; k++)
+      ra[k - from] = (uint16_t)k;
+    range.isbitmap = 0;
+    range.u.array = ra;
+  }
+  Container out;
+  if (!found) {
+    sparse_reserve(L, s, 1); // before anything to release
+    c_copy(L, &out, &range);
+    *sparse_insertat(s, i, key) = out;
+    return;
+  }
+  c_op(L, &out, &s->cs[i], &range, value ? OP_OR : OP_ANDNOT);
+  c_free(L, &s->cs[i]);
+  if (out.card == 0)
+    sparse_removeat(L, s, i);
+  else
+    s->cs[i] = out;
+}
+
+static size_t sparse_count(const SparseArray* s) {
+  size_t cnt = 0;
+  for (uint32_t i = 0; i < s->n; i++)
+    cnt += s->cs[i].card;
+  return cnt;
+}
+
+// set bits below 'index'
+static size_t sparse_rank(const SparseArray* s, size_t index) {
+  size_t cnt = 0;
+  uint32_t key = CHUNK_KEY(index);
+  for (uint32_t i = 0; i < s->n && s->cs[i].key <= key; i++) {
+    if (s->cs[i].key < key)
+      cnt += s->cs[i].card;
+    else
+      cnt += c_rank(&s->cs[i], CHUNK_LOW(index));
+  }
+  return cnt;
+}
+
+static size_t sparse_memsize(const SparseArray* s) {
+  size_t sz = sizeof(SparseArray) + s->capacity * sizeof(Container);
+  for (uint32_t i = 0; i < s->n; i++)
+    sz += c_datasize(&s->cs[i]);
+  return sz;
+}
+
+/* }====================================================== */
+
+/*
+** {======================================================
+** Serialization, native byte order
+** dense:  "BA64" u64 size, words
+** sparse: "BR32" u64 size, u32 n, n * {u16 key, u16 isbitmap, u32 card, data}
+** =======================================================
+*/
+
+#define MAGIC_ARRAY "BA64"
+#define MAGIC_SPARSE "BR32"
+#define MAGIC_SIZE 4
+#define HEADER_SIZE (MAGIC_SIZE + sizeof(uint64_t))
+
+static void _releaseBuffer(const luaL_MemBuffer* mb) {
+  free(mb->ptr);
+}
+
+static uint8_t* newbuffer(lua_State* L, size_t sz, const char* magic, lua_Integer size) {
+  uint8_t* buf = (uint8_t*)malloc(sz);
+  if (buf == NULL)
+    luaL_error(L, "not enough memory");
+  luaL_MemBuffer* mb = luaL_newmembuffer(L);
+  MEMBUFFER_SETREPLACE(mb, buf, sz, _releaseBuffer, NULL);
+  uint64_t n = (uint64_t)size;
+  memcpy(buf, magic, MAGIC_SIZE);
+  memcpy(buf + MAGIC_SIZE, &n, sizeof(n));
+  return buf + HEADER_SIZE;
+}
+
+static void array_dump(lua_State* L, const BitArray* a) {
+  size_t nbytes = N_WORDS(a->size) * sizeof(uint64_t);
+  uint8_t* p = newbuffer(L, HEADER_SIZE + nbytes, MAGIC_ARRAY, a->size);
+  memcpy(p, a->values, nbytes);
+}
+
+static void sparse_dump(lua_State* L, const SparseArray* s) {
+  size_t sz = HEADER_SIZE + sizeof(uint32_t);
+  for (uint32_t i = 0; i < s->n; i++) {
+    const Container* c = &s->cs[i];
+    sz += 2 * sizeof(uint16_t) + sizeof(uint32_t);
+    sz += c->isbitmap ? CHUNK_WORDS * sizeof(uint64_t) : c->card * sizeof(uint16_t);
+  }
+  uint8_t* p = newbuffer(L, sz, MAGIC_SPARSE, s->size);
+  memcpy(p, &s->n, sizeof(uint32_t));
+  p += sizeof(uint32_t);
+  for (uint32_t i = 0; i < s->n; i++) {
+    const Container* c = &s->cs[i];
+    memcpy(p, &c->key, sizeof(uint16_t));
+    memcpy(p + sizeof(uint16_t), &c->isbitmap, sizeof(uint16_t));
+    memcpy(p + 2 * sizeof(uint16_t), &c->card, sizeof(uint32_t));
+    p += 2 * sizeof(uint16_t) + sizeof(uint32_t);
+    size_t nbytes = c->isbitmap ? CHUNK_WORDS * sizeof(uint64_t) : c->card * sizeof(uint16_t);
+    memcpy(p, c->u.array, nbytes);
+    p += nbytes;
+  }
+}
+
+#define CORRUPTED(L) luaL_error(L, "corrupted boolarray data")
+
+static void array_undump(lua_State* L, const uint8_t* p, size_t len, lua_Integer size) {
+  if (size < 1 || len != N_WORDS(size) * sizeof(uint64_t))
+    CORRUPTED(L);
+  BitArray* a = allocarray(L, size);
+  memcpy(a->values, p, len);
+  if (a->values[N_WORDS(size) - 1] & ~LAST_MASK(size))
+    CORRUPTED(L);
+}
+
+static void sparse_undump(lua_State* L, const uint8_t* p, size_t len, lua_Integer size) {
+  uint32_t n;
+  if (size < 1 || size > MAX_SPARSE_SIZE || len < sizeof(uint32_t))
+    CORRUPTED(L);
+  memcpy(&n, p, sizeof(uint32_t));
+  p += sizeof(uint32_t);
+  len -= sizeof(uint32_t);
+  SparseArray* s = newsparse(L, size);
+  sparse_reserve(L, s, n <= CHUNK_KEY(size - 1) + 1 ? n : 0);
+  for (uint32_t i = 0; i < n; i++) {
+    Container head;
+    uint64_t w[CHUNK_WORDS];
+    uint16_t a[ARRAY_MAX];
+    if (len < 2 * sizeof(uint16_t) + sizeof(uint32_t))
+      CORRUPTED(L);
+    memcpy(&head.key, p, sizeof(uint16_t));
+    memcpy(&head.isbitmap, p + sizeof(uint16_t), sizeof(uint16_t));
+    memcpy(&head.card, p + 2 * sizeof(uint16_t), sizeof(uint32_t));
+    p += 2 * sizeof(uint16_t) + sizeof(uint32_t);
+    len -= 2 * sizeof(uint16_t) + sizeof(uint32_t);
+    if ((i > 0 && head.key <= s->cs[i - 1].key) || head.key > CHUNK_KEY(size - 1) || head.card == 0 || i >= s->capacity)
+      CORRUPTED(L);
+    uint32_t maxlow = head.key == CHUNK_KEY(size - 1) ? CHUNK_LOW(size - 1) : CHUNK_BITS - 1;
+    Container* c = &s->cs[i];
+    memset(c, 0, sizeof(Container));
+    c->key = head.key;
+    if (head.isbitmap) {
+      if (head.card <= ARRAY_MAX || len < sizeof(w))
+        CORRUPTED(L);
+      memcpy(w, p, sizeof(w));
+      if (words_count(w, CHUNK_WORDS) != head.card || words_next(w, maxlow + 1, CHUNK_BITS) != CHUNK_BITS)
+        CORRUPTED(L);
+      c_setwords(L, c, w, head.card);
+      p += sizeof(w);
+      len -= sizeof(w);
+    } else {
+      if (head.card > ARRAY_MAX || len < head.card * sizeof(uint16_t))
+        CORRUPTED(L);
+      memcpy(a, p, head.card * sizeof(uint16_t));
+      for (uint32_t k = 0; k < head.card; k++)
+        if ((k > 0 && a[k] <= a[k - 1]) || a[k] > maxlow)
+          CORRUPTED(L);
+      c_setarray(L, c, a, head.card);
+      p += head.card * sizeof(uint16_t);
+      len -= head.card * sizeof(uint16_t);
+    }
+    s->n++;
+  }
+  if (len != 0)
+    CORRUPTED(L);
+}
+
+/* }====================================================== */
+
+/*
+** {======================================================
+** Lua interface
+** =======================================================
+*/
+
+// one of the two kinds at 'idx', the other pointer is NULL
+static void checkkind(lua_State* L, int idx, BitArray** a, SparseArray** s) {
+  *a = TEST_ARRAY(L, idx);
+  *s = *a == NULL ? TEST_SPARSE(L, idx) : NULL;
+  if (*a == NULL && *s == NULL)
+    luaL_argerror(L, idx, "boolarray expected");
+}
+
+static lua_Integer kindsize(BitArray* a, SparseArray* s) {
+  return a != NULL ? a->size : s->size;
+}
+
+static int newarray(lua_State* L) {
+  lua_Integer n = luaL_checkinteger(L, 1); /* number of bits */
+  luaL_argcheck(L, n >= 1, 1, "invalid size");
+  newzeroarray(L, n);
   return 1; /* new userdata is already on the stack */
 }
 
-static int getsize(lua_State* L) {
-  lua_pushinteger(L, (CHECK_ARRAY(L, 1))->size);
+static int newsparsearray(lua_State* L) {
+  lua_Integer n = luaL_checkinteger(L, 1); /* number of bits */
+  luaL_argcheck(L, n >= 1 && n <= MAX_SPARSE_SIZE, 1, "invalid size");
+  newsparse(L, n);
   return 1;
 }
 
-static unsigned int* getparams(lua_State* L, unsigned int* mask) {
-  BitArray* a = CHECK_ARRAY(L, 1);
-  int index = (int)luaL_checkinteger(L, 2) - 1;
-  luaL_argcheck(L, 0 <= index && index < a->size, 2, "index out of range");
-
-  *mask = I_BIT(index); /* mask to access correct bit */
-  return &a->values[I_WORD(index)]; /* word address */
+static int getsize(lua_State* L) {
+  BitArray* a;
+  SparseArray* s;
+  checkkind(L, 1, &a, &s);
+  lua_pushinteger(L, kindsize(a, s));
+  return 1;
 }
 
 static int setarray(lua_State* L) {
-  unsigned int mask;
-  unsigned int* entry = getparams(L, &mask);
+  uint64_t mask;
+  uint64_t* entry = getparams(L, CHECK_ARRAY(L, 1), &mask);
   luaL_checkany(L, 3);
   if (lua_toboolean(L, 3))
     *entry |= mask;
@@ -91,97 +989,304 @@ static int setarray(lua_State* L) {
 }
 
 static int getarray(lua_State* L) {
-  unsigned int mask;
-  unsigned int* entry = getparams(L, &mask);
-  lua_pushboolean(L, *entry & mask);
+  uint64_t mask;
+  uint64_t* entry = getparams(L, CHECK_ARRAY(L, 1), &mask);
+  lua_pushboolean(L, (*entry & mask) != 0);
   return 1;
 }
 
-#define CHECK_TWO_ARRAY(large, small) \
-  do { \
-    BitArray* a = CHECK_ARRAY(L, 1); \
-    BitArray* b = CHECK_ARRAY(L, 2); \
-    if (a->size > b->size) { \
-      large = a; \
-      small = b; \
-    } else { \
-      large = b; \
-      small = a; \
-    } \
-  } while (0)
+static lua_Integer checksparseindex(lua_State* L, SparseArray* s, int arg) {
+  lua_Integer index = luaL_checkinteger(L, arg) - 1;
+  luaL_argcheck(L, 0 <= index && index < s->size, arg, "index out of range");
+  return index;
+}
 
-static int makeintersection(lua_State* L) {
-  BitArray* large = NULL;
-  BitArray* small = NULL;
-  CHECK_TWO_ARRAY(large, small);
+static int setsparse(lua_State* L) {
+  SparseArray* s = CHECK_SPARSE(L, 1);
+  lua_Integer index = checksparseindex(L, s, 2);
+  luaL_checkany(L, 3);
+  sparse_set(L, s, (size_t)index, lua_toboolean(L, 3));
+  return 0;
+}
 
-  BitArray* u = allocarray(L, small->size);
+static int getsparse(lua_State* L) {
+  SparseArray* s = CHECK_SPARSE(L, 1);
+  lua_Integer index = checksparseindex(L, s, 2);
+  lua_pushboolean(L, sparse_get(s, (size_t)index));
+  return 1;
+}
 
-  for (int i = 0; i <= (int)I_WORD(small->size - 1); i++) {
-    u->values[i] = large->values[i] & small->values[i];
+static lua_Integer opsize(lua_Integer sa, lua_Integer sb, BitOp op) {
+  switch (op) {
+    case OP_AND:
+      return sa < sb ? sa : sb;
+    case OP_ANDNOT:
+      return sa;
+    default:
+      return sa > sb ? sa : sb;
   }
+}
 
+static int makeop(lua_State* L, BitOp op) {
+  BitArray *a, *b;
+  SparseArray *sa, *sb;
+  checkkind(L, 1, &a, &sa);
+  checkkind(L, 2, &b, &sb);
+  luaL_argcheck(L, (a == NULL) == (b == NULL), 2, "arrays of different kinds");
+  if (a != NULL)
+    makearray(L, a, b, opsize(a->size, b->size, op), op);
+  else
+    makesparse(L, sa, sb, opsize(sa->size, sb->size, op), op);
   return 1;
 }
 
+static int makeintersection(lua_State* L) {
+  return makeop(L, OP_AND);
+}
+
 static int makeunion(lua_State* L) {
-  BitArray* large = NULL;
-  BitArray* small = NULL;
-  CHECK_TWO_ARRAY(large, small);
+  return makeop(L, OP_OR);
+}
+
+static int makexor(lua_State* L) {
+  return makeop(L, OP_XOR);
+}
 
-  BitArray* u = allocarray(L, large->size);
+static int makedifference(lua_State* L) {
+  return makeop(L, OP_ANDNOT);
+}
 
-  for (int i = 0; i <= (int)I_WORD(small->size - 1); i++) {
-    u->values[i] = large->values[i] | small->values[i];
+// a op= b, returns a
+static int combine(lua_State* L) {
+  BitArray *a, *b;
+  SparseArray *sa, *sb;
+  checkkind(L, 1, &a, &sa);
+  BitOp op = (BitOp)luaL_checkoption(L, 2, NULL, bitops);
+  checkkind(L, 3, &b, &sb);
+  luaL_argcheck(L, (a == NULL) == (b == NULL), 3, "arrays of different kinds");
+  if (a != NULL) {
+    combinearray(a, b, op);
+  } else {
+    SparseArray* u = makesparse(L, sa, sb, sa->size, op);
+    SparseArray tmp = *sa; // the old containers go with 'u' to its __gc
+    *sa = *u;
+    *u = tmp;
+    sparse_clear(L, u);
   }
-  for (int i = (int)I_WORD(small->size - 1) + 1; i <= (int)I_WORD(large->size - 1); i++) {
-    u->values[i] = large->values[i];
+  lua_settop(L, 1);
+  return 1;
+}
+
+// index, number of bits in [1, index]
+static size_t countbelow(BitArray* a, SparseArray* s, lua_Integer index) {
+  if (a != NULL)
+    return words_countrange(a->values, 0, (size_t)index);
+  return sparse_rank(s, (size_t)index);
+}
+
+static int count(lua_State* L) {
+  BitArray* a;
+  SparseArray* s;
+  checkkind(L, 1, &a, &s);
+  lua_Integer size = kindsize(a, s);
+  lua_Integer i = luaL_optinteger(L, 2, 1);
+  lua_Integer j = luaL_optinteger(L, 3, size);
+  if (i < 1)
+    i = 1;
+  if (j > size)
+    j = size;
+  if (i > j) {
+    lua_pushinteger(L, 0);
+  } else if (i == 1 && j == size) {
+    lua_pushinteger(L, (lua_Integer)(a != NULL ? words_count(a->values, N_WORDS(a->size)) : sparse_count(s)));
+  } else {
+    lua_pushinteger(L, (lua_Integer)(countbelow(a, s, j) - countbelow(a, s, i - 1)));
   }
+  return 1;
+}
 
+// number of set bits in [1, i]
+static int rank(lua_State* L) {
+  BitArray* a;
+  SparseArray* s;
+  checkkind(L, 1, &a, &s);
+  lua_Integer size = kindsize(a, s);
+  lua_Integer i = luaL_checkinteger(L, 2);
+  if (i < 0)
+    i = 0;
+  if (i > size)
+    i = size;
+  lua_pushinteger(L, (lua_Integer)countbelow(a, s, i));
   return 1;
 }
 
+// index of the k-th set bit, or nil
+static int selectbit(lua_State* L) {
+  BitArray* a;
+  SparseArray* s;
+  checkkind(L, 1, &a, &s);
+  lua_Integer k = luaL_checkinteger(L, 2);
+  if (k < 1)
+    return 0;
+  size_t rest = (size_t)(k - 1);
+  if (a != NULL) {
+    size_t i = words_select(a->values, N_WORDS(a->size), rest, (size_t)a->size);
+    if (i == (size_t)a->size)
+      return 0;
+    lua_pushinteger(L, (lua_Integer)i + 1);
+    return 1;
+  }
+  for (uint32_t i = 0; i < s->n; i++) {
+    const Container* c = &s->cs[i];
+    if (rest < c->card) {
+      lua_pushinteger(L, (lua_Integer)c->key * CHUNK_BITS + c_select(c, (uint32_t)rest) + 1);
+      return 1;
+    }
+    rest -= c->card;
+  }
+  return 0;
+}
+
+// set every bit in [i, j] to the truth of v
+static int setrange(lua_State* L) {
+  BitArray* a;
+  SparseArray* s;
+  checkkind(L, 1, &a, &s);
+  lua_Integer size = kindsize(a, s);
+  lua_Integer i = luaL_checkinteger(L, 2);
+  lua_Integer j = luaL_checkinteger(L, 3);
+  luaL_checkany(L, 4);
+  int value = lua_toboolean(L, 4);
+  luaL_argcheck(L, 1 <= i && i <= size + 1, 2, "index out of range");
+  luaL_argcheck(L, 0 <= j && j <= size, 3, "index out of range");
+  if (i > j)
+    return 0;
+  size_t from = (size_t)i - 1, to = (size_t)j; // [from, to)
+  if (a != NULL) {
+    words_setrange(a->values, from, to, value);
+    return 0;
+  }
+  for (uint32_t key = CHUNK_KEY(from); key <= CHUNK_KEY(to - 1); key++) {
+    uint32_t lo = key == CHUNK_KEY(from) ? CHUNK_LOW(from) : 0;
+    uint32_t hi = key == CHUNK_KEY(to - 1) ? (uint32_t)CHUNK_LOW(to - 1) + 1 : CHUNK_BITS;
+    sparse_setchunkrange(L, s, key, lo, hi, value);
+  }
+  return 0;
+}
+
 static int nextforarray(lua_State* L) {
-  BitArray* a = CHECK_ARRAY(L, 1);
-  int index = (int)luaL_checkinteger(L, 2);
-  luaL_argcheck(L, 0 <= index && index <= a->size, 2, "index out of range");
-  if (index == a->size) { // last one?
+  BitArray* a;
+  SparseArray* s;
+  checkkind(L, 1, &a, &s);
+  lua_Integer size = kindsize(a, s);
+  lua_Integer index = luaL_checkinteger(L, 2);
+  luaL_argcheck(L, 0 <= index && index <= size, 2, "index out of range");
+  if (index == size) { // last one?
     return 0;
   }
   // for Lua: index is "current index of value"
   // for C: index is "next index of value"
-  int fwindex = I_WORD(index); // first word index
-  int lwindex = I_WORD(a->size - 1); // last word index
-  unsigned int mask = I_HIGHER(index); // include index
-  unsigned int mask_zero = I_HIGHER(0); // mark all
-  for (int i = fwindex; i <= lwindex; i++) { // for each word
-    unsigned int word = a->values[i] & mask;
-    if (word) {
-      lua_pushinteger(L, i * BITS_PER_WORD + FIRST_ONE(word));
+  size_t from = (size_t)index;
+  if (a != NULL) {
+    size_t i = words_next(a->values, from, (size_t)size);
+    if (i == (size_t)size)
+      return 0;
+    lua_pushinteger(L, (lua_Integer)i + 1);
+    lua_pushboolean(L, 1);
+    return 2;
+  }
+  int found;
+  for (uint32_t i = sparse_find(s, CHUNK_KEY(from), &found); i < s->n; i++) {
+    const Container* c = &s->cs[i];
+    int32_t low = c_next(c, c->key == CHUNK_KEY(from) ? CHUNK_LOW(from) : 0);
+    if (low >= 0) {
+      lua_pushinteger(L, (lua_Integer)c->key * CHUNK_BITS + low + 1);
       lua_pushboolean(L, 1);
       return 2;
     }
-    mask = mask_zero;
   }
   return 0;
 }
 
 static int pairsarray(lua_State* L) {
-  CHECK_ARRAY(L, 1);
+  BitArray* a;
+  SparseArray* s;
+  checkkind(L, 1, &a, &s);
   lua_pushcfunction(L, nextforarray);
   lua_pushvalue(L, 1);
   lua_pushinteger(L, 0);
   return 3;
 }
 
+static int tobuffer(lua_State* L) {
+  BitArray* a;
+  SparseArray* s;
+  checkkind(L, 1, &a, &s);
+  if (a != NULL)
+    array_dump(L, a);
+  else
+    sparse_dump(L, s);
+  return 1;
+}
+
+static int frombuffer(lua_State* L) {
+  size_t len;
+  const uint8_t* p = (const uint8_t*)luaL_checklbuffer(L, 1, &len);
+  uint64_t size;
+  if (len < HEADER_SIZE)
+    return CORRUPTED(L);
+  memcpy(&size, p + MAGIC_SIZE, sizeof(size));
+  if (size > (uint64_t)LUA_MAXINTEGER)
+    return CORRUPTED(L);
+  if (memcmp(p, MAGIC_ARRAY, MAGIC_SIZE) == 0)
+    array_undump(L, p + HEADER_SIZE, len - HEADER_SIZE, (lua_Integer)size);
+  else if (memcmp(p, MAGIC_SPARSE, MAGIC_SIZE) == 0)
+    sparse_undump(L, p + HEADER_SIZE, len - HEADER_SIZE, (lua_Integer)size);
+  else
+    return CORRUPTED(L);
+  return 1;
+}
+
+// bytes held by the array, the sparse ones live outside of the Lua heap
+static int memsize(lua_State* L) {
+  BitArray* a;
+  SparseArray* s;
+  checkkind(L, 1, &a, &s);
+  if (a != NULL)
+    lua_pushinteger(L, (lua_Integer)(sizeof(BitArray) + I_WORD(a->size - 1) * sizeof(uint64_t)));
+  else
+    lua_pushinteger(L, (lua_Integer)sparse_memsize(s));
+  return 1;
+}
+
 static int array2string(lua_State* L) {
-  lua_pushfstring(L, "array(%d)", (CHECK_ARRAY(L, 1))->size);
+  lua_pushfstring(L, "array(%I)", (CHECK_ARRAY(L, 1))->size);
+  return 1;
+}
+
+static int sparse2string(lua_State* L) {
+  SparseArray* s = CHECK_SPARSE(L, 1);
+  lua_pushfstring(L, "sparsearray(%I): %d chunks", s->size, (int)s->n);
   return 1;
 }
 
+static int sparsegc(lua_State* L) {
+  sparse_clear(L, CHECK_SPARSE(L, 1));
+  return 0;
+}
+
 static const struct luaL_Reg arraylib_f[] = {
     {"new", newarray},
+    {"sparse", newsparsearray},
     {"next", nextforarray},
+    {"combine", combine},
+    {"count", count},
+    {"rank", rank},
+    {"select", selectbit},
+    {"setrange", setrange},
+    {"tobuffer", tobuffer},
+    {"frombuffer", frombuffer},
+    {"memsize", memsize},
     {NULL, NULL},
 };
 
@@ -191,14 +1296,38 @@ static const struct luaL_Reg arraylib_m[] = {
     {"__len", getsize},
     {"__mul", makeintersection},
     {"__add", makeunion},
+    {"__band", makeintersection},
+    {"__bor", makeunion},
+    {"__bxor", makexor},
+    {"__sub", makedifference},
     {"__pairs", pairsarray},
     {"__tostring", array2string},
     {NULL, NULL},
 };
 
+static const struct luaL_Reg sparselib_m[] = {
+    {"__newindex", setsparse},
+    {"__index", getsparse},
+    {"__len", getsize},
+    {"__mul", makeintersection},
+    {"__add", makeunion},
+    {"__band", makeintersection},
+    {"__bor", makeunion},
+    {"__bxor", makexor},
+    {"__sub", makedifference},
+    {"__pairs", pairsarray},
+    {"__tostring", sparse2string},
+    {"__gc", sparsegc},
+    {NULL, NULL},
+};
+
 LUAMOD_API int luaopen_libboolarray(lua_State* L) {
-  luaL_newmetatable(L, "LuaBook.array");
+  luaL_newmetatable(L, ARRAY_TYPE);
   luaL_setfuncs(L, arraylib_m, 0);
+  luaL_newmetatable(L, SPARSE_TYPE);
+  luaL_setfuncs(L, sparselib_m, 0);
   luaL_newlib(L, arraylib_f);
   return 1;
 }
+
+/* }====================================================== */
@@ -0,0 +1,520 @@
+#define LUA_LIB // for export function
+
+#include <lprefix.h> // must include first
+
+#include <stdint.h>
+#include <string.h>
+
+#include <lauxlib.h>
+#include <lua.h>
+#include <luautil.h>
+
+/*
+** Open addressing hash map from 64-bit integer keys to 64-bit integers or
+** doubles, laid out like a swiss table: every slot has one control byte,
+** EMPTY, DELETED or the low 7 bits of the key hash. A lookup compares the
+** control bytes of a whole group of slots at once and only reads the keys
+** whose 7 bits match. An entry costs 17 bytes at a load factor up to 7/8,
+** a Lua table Node costs 32 bytes plus the power of two slack.
+*/
+
+#define CTRL_EMPTY ((uint8_t)0x80)
+#define CTRL_DELETED ((uint8_t)0xFE)
+#define ISFULL(c) (((c)&0x80) == 0)
+
+/*
+** {======================================================
+** Group of control bytes, SSE2 when available, 8 bytes in a word otherwise
+** =======================================================
+*/
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+
+#include <emmintrin.h>
+
+#define GROUP_WIDTH 16
+typedef uint32_t BitMask; // one bit per slot
+
+static BitMask group_match(const uint8_t* ctrl, uint8_t h2) {
+  __m128i g = _mm_loadu_si128((const __m128i*)ctrl);
+  return (BitMask)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8((char)h2), g));
+}
+static BitMask group_matchempty(const uint8_t* ctrl) {
+  return group_match(ctrl, CTRL_EMPTY);
+}
+static BitMask group_matchfree(const uint8_t* ctrl) { // EMPTY or DELETED, the only ones with the high bit
+  return (BitMask)_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)ctrl));
+}
+#define BITMASK_NEXT(m) ((m) & ((m)-1))
+#define BITMASK_TRAILING(m) countzero(m) // slot of the lowest bit
+#define BITMASK_LEADING(m) (countleading(m) - 48) // slots above the highest bit
+
+#else
+
+#define GROUP_WIDTH 8
+typedef uint64_t BitMask; // high bit of each byte
+
+#define LSBS UINT64_C(0x0101010101010101)
+#define MSBS UINT64_C(0x8080808080808080)
+
+static uint64_t group_load(const uint8_t* ctrl) {
+  uint64_t w;
+  memcpy(&w, ctrl, sizeof(w));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  w = __builtin_bswap64(w);
+#endif
+  return w;
+}
+static BitMask group_match(const uint8_t* ctrl, uint8_t h2) { // may report false positives, keys are compared anyway
+  uint64_t x = group_load(ctrl) ^ (LSBS * h2);
+  return (x - LSBS) & ~x & MSBS;
+}
+static BitMask group_matchempty(const uint8_t* ctrl) {
+  uint64_t w = group_load(ctrl);
+  return w & (~w << 6) & MSBS;
+}
+static BitMask group_matchfree(const uint8_t* ctrl) {
+  uint64_t w = group_load(ctrl);
+  return w & (~w << 7) & MSBS;
+}
+#define BITMASK_NEXT(m) ((m) & ((m)-1))
+#define BITMASK_TRAILING(m) (countzero(m) >> 3)
+#define BITMASK_LEADING(m) (countleading(m) >> 3)
+
+#endif
+
+// bit counts of a nonzero mask
+#if defined(_MSC_VER)
+#include <intrin.h>
+static int countzero(uint64_t m) {
+  unsigned long i;
+#if defined(_M_X64)
+  _BitScanForward64(&i, m);
+#else
+  if (!_BitScanForward(&i, (unsigned long)m)) {
+    _BitScanForward(&i, (unsigned long)(m >> 32));
+    i += 32;
+  }
+#endif
+  return (int)i;
+}
+static int countleading(uint64_t m) {
+  unsigned long i;
+#if defined(_M_X64)
+  _BitScanReverse64(&i, m);
+#else
+  if (_BitScanReverse(&i, (unsigned long)(m >> 32)))
+    i += 32;
+  else
+    _BitScanReverse(&i, (unsigned long)m);
+#endif
+  return 63 - (int)i;
+}
+#else
+#define countzero(m) __builtin_ctzll(m)
+#define countleading(m) __builtin_clzll(m)
+#endif
+
+#if defined(__GNUC__)
+#define prefetch(p) __builtin_prefetch(p)
+#else
+#define prefetch(p) ((void)(p))
+#endif
+
+/* }====================================================== */
+
+/*
+** {======================================================
+** Hash table
+** =======================================================
+*/
+
+typedef union {
+  int64_t i;
+  double d;
+} Value;
+
+typedef struct {
+  int64_t key;
+  Value value;
+} Slot;
+
+typedef struct {
+  uint8_t* ctrl; // capacity + GROUP_WIDTH bytes, the tail mirrors the first group
+  Slot* slots;
+  size_t capacity; // power of 2, 0 before the first insertion
+  size_t count;
+  size_t growthleft; // insertions into EMPTY slots before a rehash
+  int isdouble;
+} IntMap;
+
+#define INTMAP_TYPE "IntMap*"
+#define INTMAP_FUNCTION(name) intmap_##name
+#define CHECK_INTMAP(L, idx) (IntMap*)luaL_checkudata(L, idx, INTMAP_TYPE)
+
+static uint64_t hashkey(int64_t key) { // splitmix64 finalizer
+  uint64_t x = (uint64_t)key;
+  x ^= x >> 30;
+  x *= UINT64_C(0xbf58476d1ce4e5b9);
+  x ^= x >> 27;
+  x *= UINT64_C(0x94d049bb133111eb);
+  x ^= x >> 31;
+  return x;
+}
+#define H1(h) ((size_t)((h) >> 7))
+#define H2(h) ((uint8_t)((h)&0x7F))
+
+#define maxload(cap) ((cap) - (cap) / 8)
+
+static void setctrl(IntMap* m, size_t i, uint8_t c) {
+  m->ctrl[i] = c;
+  if (i < GROUP_WIDTH) // keep the mirrored tail in sync
+    m->ctrl[m->capacity + i] = c;
+}
+
+static size_t memsize(const IntMap* m) {
+  return m->capacity == 0 ? 0 : m->capacity * sizeof(Slot) + m->capacity + GROUP_WIDTH;
+}
+
+static void* allocmem(lua_State* L, void* ptr, size_t osize, size_t nsize) {
+  void* ud;
+  lua_Alloc allocf = lua_getallocf(L, &ud);
+  return allocf(ud, ptr, osize, nsize);
+}
+
+// slot index of 'key', or -1
+static ptrdiff_t findslot(const IntMap* m, int64_t key) {
+  if (m->capacity == 0)
+    return -1;
+  uint64_t h = hashkey(key);
+  size_t mask = m->capacity - 1;
+  size_t pos = H1(h) & mask;
+  size_t step = 0;
+  prefetch(m->slots + pos); // the key usually sits near the start of the group, load it with the ctrl bytes
+  for (;;) {
+    const uint8_t* g = m->ctrl + pos;
+    for (BitMask b = group_match(g, H2(h)); b != 0; b = BITMASK_NEXT(b)) {
+      size_t i = (pos + BITMASK_TRAILING(b)) & mask;
+      if (m->slots[i].key == key)
+        return (ptrdiff_t)i;
+    }
+    if (group_matchempty(g) != 0)
+      return -1;
+    step += GROUP_WIDTH; // triangular probing visits every group once
+    pos = (pos + step) & mask;
+  }
+}
+
+// first EMPTY or DELETED slot on the probe sequence of 'h'
+static size_t findfree(const IntMap* m, uint64_t h) {
+  size_t mask = m->capacity - 1;
+  size_t pos = H1(h) & mask;
+  size_t step = 0;
+  for (;;) {
+    BitMask b = group_matchfree(m->ctrl + pos);
+    if (b != 0)
+      return (pos + BITMASK_TRAILING(b)) & mask;
+    step += GROUP_WIDTH;
+    pos = (pos + step) & mask;
+  }
+}
+
+static void resize(lua_State* L, IntMap* m, size_t ncap) {
+  size_t osize = memsize(m);
+  uint8_t* octrl = m->ctrl;
+  Slot* oslots = m->slots;
+  size_t ocap = m->capacity;
+  size_t nsize = ncap * sizeof(Slot) + ncap + GROUP_WIDTH;
+  uint8_t* block = (uint8_t*)allocmem(L, NULL, 0, nsize);
+  if (block == NULL)
+    luaL_error(L, "not enough memory");
+  m->slots = (Slot*)block; // slots first, they need the alignment
+  m->ctrl = block + ncap * sizeof(Slot);
+  m->capacity = ncap;
+  m->growthleft = maxload(ncap) - m->count;
+  memset(m->ctrl, CTRL_EMPTY, ncap + GROUP_WIDTH);
+  for (size_t i = 0; i < ocap; i++) {
+    if (ISFULL(octrl[i])) {
+      uint64_t h = hashkey(oslots[i].key);
+      size_t j = findfree(m, h);
+      setctrl(m, j, H2(h));
+      m->slots[j] = oslots[i];
+    }
+  }
+  if (oslots != NULL)
+    allocmem(L, oslots, osize, 0);
+}
+
+// room for 'n' more entries without rehashing
+static void reserve(lua_State* L, IntMap* m, size_t n) {
+  if (n <= m->growthleft)
+    return;
+  size_t need = m->count + n;
+  size_t ncap = m->capacity == 0 ? GROUP_WIDTH : m->capacity;
+  // dropping the tombstones in place only pays when it frees at least 3/32 of
+  // the slots, near the 7/8 limit churn would rehash on every insertion
+  while (maxload(ncap) < need || (ncap == m->capacity && need > ncap * 25 / 32)) {
+    if (ncap > (((size_t)-1) >> 1) / sizeof(Slot))
+      luaL_error(L, "intmap too large");
+    ncap <<= 1;
+  }
+  resize(L, m, ncap); // same capacity drops the tombstones
+}
+
+static Slot* insert(lua_State* L, IntMap* m, int64_t key) {
+  ptrdiff_t i = findslot(m, key);
+  if (i >= 0)
+    return &m->slots[i];
+  reserve(L, m, 1);
+  uint64_t h = hashkey(key);
+  size_t j = findfree(m, h);
+  if (m->ctrl[j] == CTRL_EMPTY)
+    m->growthleft--; // reusing a tombstone does not take new room
+  setctrl(m, j, H2(h));
+  m->slots[j].key = key;
+  m->count++;
+  return &m->slots[j];
+}
+
+static void erase(IntMap* m, size_t i) {
+  size_t mask = m->capacity - 1;
+  size_t before = (i - GROUP_WIDTH) & mask;
+  // a probe stops at a group holding an EMPTY slot, if every window that
+  // contains 'i' has one, no probe can have passed 'i' and it can be EMPTY
+  BitMask emptyafter = group_matchempty(m->ctrl + i);
+  BitMask emptybefore = group_matchempty(m->ctrl + before);
+  int wasneverfull = emptyafter != 0 && emptybefore != 0 &&
+                     BITMASK_TRAILING(emptyafter) + BITMASK_LEADING(emptybefore) < GROUP_WIDTH;
+  setctrl(m, i, wasneverfull ? CTRL_EMPTY : CTRL_DELETED);
+  if (wasneverfull)
+    m->growthleft++;
+  m->count--;
+}
+
+/* }====================================================== */
+
+/*
+** {======================================================
+** Lua interface
+** =======================================================
+*/
+
+static void pushvalue(lua_State* L, const IntMap* m, const Slot* s) {
+  if (m->isdouble)
+    lua_pushnumber(L, (lua_Number)s->value.d);
+  else
+    lua_pushinteger(L, (lua_Integer)s->value.i);
+}
+
+static void checkvalue(lua_State* L, const IntMap* m, int idx, Value* v) {
+  if (m->isdouble)
+    v->d = (double)luaL_checknumber(L, idx);
+  else
+    v->i = (int64_t)luaL_checkinteger(L, idx);
+}
+
+// keys are integers or floats with an exact integer value, strings are not converted
+static int tokey(lua_State* L, int idx, int64_t* key) {
+  int isint = 0;
+  if (lua_type(L, idx) == LUA_TNUMBER)
+    *key = (int64_t)lua_tointegerx(L, idx, &isint);
+  return isint;
+}
+
+static int64_t checkkey(lua_State* L, int idx) {
+  luaL_checktype(L, idx, LUA_TNUMBER);
+  return (int64_t)luaL_checkinteger(L, idx);
+}
+
+static int INTMAP_FUNCTION(new)(lua_State* L) {
+  static const char* const kinds[] = {"integer", "number", NULL};
+  int isdouble = luaL_checkoption(L, 1, "integer", kinds);
+  lua_Integer n = luaL_optinteger(L, 2, 0);
+  luaL_argcheck(L, n >= 0, 2, "invalid size");
+  IntMap* m = (IntMap*)lua_newuserdata(L, sizeof(IntMap));
+  memset(m, 0, sizeof(IntMap));
+  m->isdouble = isdouble;
+  luaL_setmetatable(L, INTMAP_TYPE);
+  if (n > 0)
+    reserve(L, m, (size_t)n);
+  return 1;
+}
+
+static int INTMAP_FUNCTION(get)(lua_State* L) {
+  IntMap* m = CHECK_INTMAP(L, 1);
+  int64_t key = 0;
+  ptrdiff_t i = tokey(L, 2, &key) ? findslot(m, key) : -1;
+  if (i < 0)
+    lua_pushnil(L);
+  else
+    pushvalue(L, m, &m->slots[i]);
+  return 1;
+}
+
+static int INTMAP_FUNCTION(set)(lua_State* L) {
+  IntMap* m = CHECK_INTMAP(L, 1);
+  int64_t key = checkkey(L, 2);
+  if (lua_isnil(L, 3)) {
+    ptrdiff_t i = findslot(m, key);
+    if (i >= 0)
+      erase(m, (size_t)i);
+  } else {
+    Value v;
+    checkvalue(L, m, 3, &v);
+    insert(L, m, key)->value = v;
+  }
+  return 0;
+}
+
+static int INTMAP_FUNCTION(len)(lua_State* L) {
+  lua_pushinteger(L, (lua_Integer)(CHECK_INTMAP(L, 1))->count);
+  return 1;
+}
+
+// slot index after the one holding the key at 'idx' (nil for the first)
+static size_t nextindex(lua_State* L, const IntMap* m, int idx) {
+  if (lua_isnil(L, idx))
+    return 0;
+  ptrdiff_t i = findslot(m, checkkey(L, idx));
+  if (i < 0)
+    luaL_error(L, "invalid key to 'next'");
+  return (size_t)i + 1;
+}
+
+static int pushentry(lua_State* L, const IntMap* m, size_t i) {
+  for (; i < m->capacity; i++) {
+    if (ISFULL(m->ctrl[i])) {
+      lua_pushinteger(L, (lua_Integer)m->slots[i].key);
+      pushvalue(L, m, &m->slots[i]);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static int INTMAP_FUNCTION(next)(lua_State* L) {
+  IntMap* m = CHECK_INTMAP(L, 1);
+  lua_settop(L, 2);
+  if (!pushentry(L, m, nextindex(L, m, 2))) {
+    lua_pushnil(L);
+    return 1;
+  }
+  return 2;
+}
+
+// iterator from __pairs, keeps the slot index so entries can be removed while traversing
+static int INTMAP_FUNCTION(iter)(lua_State* L) {
+  IntMap* m = CHECK_INTMAP(L, 1);
+  size_t i = (size_t)lua_tointeger(L, lua_upvalueindex(1));
+  for (; i < m->capacity; i++) {
+    if (ISFULL(m->ctrl[i])) {
+      lua_pushinteger(L, (lua_Integer)(i + 1));
+      lua_replace(L, lua_upvalueindex(1));
+      lua_pushinteger(L, (lua_Integer)m->slots[i].key);
+      pushvalue(L, m, &m->slots[i]);
+      return 2;
+    }
+  }
+  lua_pushinteger(L, (lua_Integer)i);
+  lua_replace(L, lua_upvalueindex(1));
+  return 0;
+}
+
+static int INTMAP_FUNCTION(pairs)(lua_State* L) {
+  CHECK_INTMAP(L, 1);
+  lua_pushinteger(L, 0);
+  lua_pushcclosure(L, INTMAP_FUNCTION(iter), 1);
+  lua_pushvalue(L, 1);
+  lua_pushnil(L);
+  return 3;
+}
+
+/*
+** insert packed records { int64 key; int64 or double value } in native
+** byte order, from a string or a MemBuffer, returns the number of records
+*/
+static int INTMAP_FUNCTION(insert)(lua_State* L) {
+  IntMap* m = CHECK_INTMAP(L, 1);
+  size_t len;
+  const uint8_t* ptr = (const uint8_t*)luaL_checklbuffer(L, 2, &len);
+  luaL_argcheck(L, len % sizeof(Slot) == 0, 2, "size is not a multiple of the record size");
+  size_t n = len / sizeof(Slot);
+  reserve(L, m, n); // may reserve too much if keys repeat, never rehashes midway
+  for (size_t k = 0; k < n; k++) {
+    Slot s;
+    memcpy(&s, ptr + k * sizeof(Slot), sizeof(Slot));
+    insert(L, m, s.key)->value = s.value;
+  }
+  lua_pushinteger(L, (lua_Integer)n);
+  return 1;
+}
+
+static int INTMAP_FUNCTION(reserve)(lua_State* L) {
+  IntMap* m = CHECK_INTMAP(L, 1);
+  lua_Integer n = luaL_checkinteger(L, 2);
+  luaL_argcheck(L, n >= 0, 2, "invalid size");
+  reserve(L, m, (size_t)n);
+  return 0;
+}
+
+static int INTMAP_FUNCTION(clear)(lua_State* L) {
+  IntMap* m = CHECK_INTMAP(L, 1);
+  if (m->capacity > 0) {
+    memset(m->ctrl, CTRL_EMPTY, m->capacity + GROUP_WIDTH);
+    m->count = 0;
+    m->growthleft = maxload(m->capacity);
+  }
+  return 0;
+}
+
+// same results as debug.tablemem: total bytes, capacity, count
+static int INTMAP_FUNCTION(memsize)(lua_State* L) {
+  IntMap* m = CHECK_INTMAP(L, 1);
+  lua_pushinteger(L, (lua_Integer)(sizeof(IntMap) + memsize(m)));
+  lua_pushinteger(L, (lua_Integer)m->capacity);
+  lua_pushinteger(L, (lua_Integer)m->count);
+  return 3;
+}
+
+static int INTMAP_FUNCTION(tostring)(lua_State* L) {
+  IntMap* m = CHECK_INTMAP(L, 1);
+  lua_pushfstring(L, "intmap(%s): %p, count: %I", m->isdouble ? "number" : "integer", m, (lua_Integer)m->count);
+  return 1;
+}
+
+static int INTMAP_FUNCTION(gc)(lua_State* L) {
+  IntMap* m = CHECK_INTMAP(L, 1);
+  if (m->slots != NULL)
+    allocmem(L, m->slots, memsize(m), 0);
+  memset(m, 0, sizeof(IntMap));
+  return 0;
+}
+
+static const luaL_Reg intmap_funcs[] = {
+    {"new", INTMAP_FUNCTION(new)},
+    {"next", INTMAP_FUNCTION(next)},
+    {"insert", INTMAP_FUNCTION(insert)},
+    {"reserve", INTMAP_FUNCTION(reserve)},
+    {"clear", INTMAP_FUNCTION(clear)},
+    {"memsize", INTMAP_FUNCTION(memsize)},
+    {NULL, NULL},
+};
+
+static const luaL_Reg intmap_metafuncs[] = {
+    {"__index", INTMAP_FUNCTION(get)},
+    {"__newindex", INTMAP_FUNCTION(set)},
+    {"__len", INTMAP_FUNCTION(len)},
+    {"__pairs", INTMAP_FUNCTION(pairs)},
+    {"__tostring", INTMAP_FUNCTION(tostring)},
+    {"__gc", INTMAP_FUNCTION(gc)},
+    {NULL, NULL},
+};
+
+LUAMOD_API int luaopen_libintmap(lua_State* L) {
+  luaL_newmetatable(L, INTMAP_TYPE);
+  luaL_setfuncs(L, intmap_metafuncs, 0);
+  luaL_newlib(L, intmap_funcs);
+  return 1;
+}
+
+/* }====================================================== */
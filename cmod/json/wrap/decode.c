@@ -0,0 +1,773 @@
+#define decode_c
+#include <json_wrap.h>
+
+#include <stdint.h>
+#include <string.h>
+
+/*
+** Single pass JSON decoder, values go straight onto the Lua stack, no
+** cJSON tree in between. Elements of an array or an object are parsed onto
+** the stack in batches, so a table is created with lua_createtable at its
+** final size unless it has more elements than a batch. Whitespace and
+** plain string bytes are skipped 16 at a time with SSE2, strings without
+** escapes are pushed straight from the input.
+*/
+
+#define BATCH_ARRAY 64
+#define BATCH_OBJECT 32 // key value pairs
+#define MAX_NUMBER_LEN 200 // same as Lua, L_MAXLENNUM
+
+#define ISDIGIT(c) ((unsigned)((c) - '0') < 10)
+#define ISSPACE(c) ((c) == ' ' || (c) == '\n' || (c) == '\r' || (c) == '\t')
+
+/*
+** {======================================================
+** Scanning
+** =======================================================
+*/
+
+static const char* skipspace(const char* p, const char* end) {
+  while (p < end) {
+    if ((unsigned char)*p > ' ') // common case, a value or a separator right away
+      return p;
+#if defined(USE_SSE2)
+    if (p + 16 <= end) {
+      __m128i v = load16(p);
+      __m128i ws = _mm_or_si128(_mm_or_si128(eq8(v, ' '), eq8(v, '\n')), _mm_or_si128(eq8(v, '\r'), eq8(v, '\t')));
+      unsigned m = mask16(ws) ^ 0xFFFF; // bytes that are not whitespace
+      if (m != 0)
+        return p + countzero(m);
+      p += 16;
+      continue;
+    }
+#endif
+    if (!ISSPACE(*p))
+      return p;
+    p++;
+  }
+  return p;
+}
+
+// next '"' or '\\' at or after 'i', or 'n'
+static uint32_t findquote(const char* s, uint32_t i, uint32_t n) {
+#if defined(USE_SSE2)
+  for (; i + 16 <= n; i += 16) {
+    __m128i v = load16(s + i);
+    unsigned m = mask16(_mm_or_si128(eq8(v, '"'), eq8(v, '\\')));
+    if (m != 0)
+      return i + (uint32_t)countzero(m);
+  }
+#endif
+  for (; i < n; i++)
+    if (s[i] == '"' || s[i] == '\\')
+      return i;
+  return n;
+}
+
+// next '"', '[', ']', '{' or '}' at or after 'i', or 'n'
+static uint32_t findstructural(const char* s, uint32_t i, uint32_t n) {
+#if defined(USE_SSE2)
+  for (; i + 16 <= n; i += 16) {
+    __m128i v = load16(s + i);
+    __m128i folded = _mm_or_si128(v, _mm_set1_epi8(0x20)); // '[' -> '{', ']' -> '}'
+    unsigned m = mask16(_mm_or_si128(eq8(v, '"'), _mm_or_si128(eq8(folded, '{'), eq8(folded, '}'))));
+    if (m != 0)
+      return i + (uint32_t)countzero(m);
+  }
+#endif
+  for (; i < n; i++) {
+    char c = s[i];
+    if (c == '"' || c == '[' || c == ']' || c == '{' || c == '}')
+      return i;
+  }
+  return n;
+}
+
+/* }====================================================== */
+
+/*
+** {======================================================
+** Parser
+** =======================================================
+*/
+
+typedef struct {
+  lua_State* L;
+  const char* start;
+  const char* p;
+  const char* end;
+  int depth;
+  int nullidx; // stack index of the value for null, 0 for nil
+} Parser;
+
+static void parse_error(Parser* P, const char* what) {
+  luaL_error(P->L, "json: %s at position %I", what, (lua_Integer)(P->p - P->start) + 1);
+}
+
+static void parse_value(Parser* P);
+
+// one UTF-8 sequence starting with a byte >= 0x80, returns the byte after it
+static const char* skiputf8(Parser* P, const char* p) {
+  const unsigned char* s = (const unsigned char*)p;
+  unsigned c = s[0], cp, min;
+  int n;
+  if (c >= 0xC2 && c <= 0xDF) {
+    n = 1, cp = c & 0x1F, min = 0x80;
+  } else if (c >= 0xE0 && c <= 0xEF) {
+    n = 2, cp = c & 0x0F, min = 0x800;
+  } else if (c >= 0xF0 && c <= 0xF4) {
+    n = 3, cp = c & 0x07, min = 0x10000;
+  } else {
+    P->p = p;
+    parse_error(P, "invalid UTF-8 in string");
+    return NULL;
+  }
+  int valid = P->end - p > n;
+  for (int i = 1; valid && i <= n; i++) {
+    valid = (s[i] & 0xC0) == 0x80;
+    cp = (cp << 6) | (s[i] & 0x3F);
+  }
+  if (!valid || cp < min || cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF)) {
+    P->p = p;
+    parse_error(P, "invalid UTF-8 in string");
+  }
+  return p + n + 1;
+}
+
+// first '"' or '\\' at or after 'p', checking control characters and UTF-8 on the way
+static const char* scanstring(Parser* P, const char* p) {
+  const char* end = P->end;
+  for (;;) {
+#if defined(USE_SSE2)
+    while (p + 16 <= end) {
+      __m128i v = load16(p);
+      __m128i ctrl = eq8(_mm_max_epu8(v, _mm_set1_epi8(0x1F)), 0x1F); // v <= 0x1F
+      __m128i special = _mm_or_si128(_mm_or_si128(eq8(v, '"'), eq8(v, '\\')), ctrl);
+      unsigned m = mask16(special) | mask16(v); // and every byte with the high bit
+      if (m == 0) {
+        p += 16;
+        continue;
+      }
+      p += countzero(m);
+      break;
+    }
+#endif
+    if (p >= end) {
+      P->p = p;
+      parse_error(P, "unterminated string");
+    }
+    unsigned char c = (unsigned char)*p;
+    if (c == '"' || c == '\\')
+      return p;
+    if (c < 0x20) {
+      P->p = p;
+      parse_error(P, "control character in string");
+    }
+    p = c < 0x80 ? p + 1 : skiputf8(P, p);
+  }
+}
+
+static int hexvalue(const char* p) {
+  int v = 0;
+  for (int i = 0; i < 4; i++) {
+    char c = p[i];
+    v <<= 4;
+    if (ISDIGIT(c))
+      v |= c - '0';
+    else if (c >= 'a' && c <= 'f')
+      v |= c - 'a' + 10;
+    else if (c >= 'A' && c <= 'F')
+      v |= c - 'A' + 10;
+    else
+      return -1;
+  }
+  return v;
+}
+
+static void addutf8(luaL_Buffer* b, unsigned long x) {
+  char buff[4];
+  int n;
+  if (x < 0x80) {
+    buff[0] = (char)x;
+    n = 1;
+  } else if (x < 0x800) {
+    buff[0] = (char)(0xC0 | (x >> 6));
+    buff[1] = (char)(0x80 | (x & 0x3F));
+    n = 2;
+  } else if (x < 0x10000) {
+    buff[0] = (char)(0xE0 | (x >> 12));
+    buff[1] = (char)(0x80 | ((x >> 6) & 0x3F));
+    buff[2] = (char)(0x80 | (x & 0x3F));
+    n = 3;
+  } else {
+    buff[0] = (char)(0xF0 | (x >> 18));
+    buff[1] = (char)(0x80 | ((x >> 12) & 0x3F));
+    buff[2] = (char)(0x80 | ((x >> 6) & 0x3F));
+    buff[3] = (char)(0x80 | (x & 0x3F));
+    n = 4;
+  }
+  luaL_addlstring(b, buff, n);
+}
+
+// escape sequence at 'p', returns the byte after it
+static const char* parse_escape(Parser* P, const char* p, luaL_Buffer* b) {
+  P->p = p;
+  if (P->end - p < 2)
+    parse_error(P, "unterminated string");
+  switch (p[1]) {
+    case '"':
+    case '\\':
+    case '/':
+      luaL_addchar(b, p[1]);
+      return p + 2;
+    case 'b':
+      luaL_addchar(b, '\b');
+      return p + 2;
+    case 'f':
+      luaL_addchar(b, '\f');
+      return p + 2;
+    case 'n':
+      luaL_addchar(b, '\n');
+      return p + 2;
+    case 'r':
+      luaL_addchar(b, '\r');
+      return p + 2;
+    case 't':
+      luaL_addchar(b, '\t');
+      return p + 2;
+    case 'u': {
+      int cp = P->end - p >= 6 ? hexvalue(p + 2) : -1;
+      if (cp < 0)
+        parse_error(P, "invalid unicode escape");
+      p += 6;
+      if (cp >= 0xDC00 && cp <= 0xDFFF)
+        parse_error(P, "invalid unicode surrogate");
+      if (cp >= 0xD800 && cp <= 0xDBFF) { // needs the low half right after
+        int lo = P->end - p >= 6 && p[0] == '\\' && p[1] == 'u' ? hexvalue(p + 2) : -1;
+        if (lo < 0xDC00 || lo > 0xDFFF)
+          parse_error(P, "invalid unicode surrogate");
+        addutf8(b, 0x10000 + (((unsigned long)cp - 0xD800) << 10) + ((unsigned long)lo - 0xDC00));
+        return p + 6;
+      }
+      addutf8(b, (unsigned long)cp);
+      return p;
+    }
+    default:
+      parse_error(P, "invalid escape");
+      return NULL;
+  }
+}
+
+static void parse_string(Parser* P) {
+  const char* s = P->p + 1;
+  const char* q = scanstring(P, s);
+  if (*q == '"') { // no escape, straight from the input
+    lua_pushlstring(P->L, s, q - s);
+    P->p = q + 1;
+    return;
+  }
+  luaL_Buffer b;
+  luaL_buffinit(P->L, &b);
+  for (;;) {
+    luaL_addlstring(&b, s, q - s);
+    if (*q == '"')
+      break;
+    s = parse_escape(P, q, &b);
+    q = scanstring(P, s);
+  }
+  luaL_pushresult(&b);
+  P->p = q + 1;
+}
+
+static const double pow10exact[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+#define NUMBER_ERROR(P, at) \
+  do { \
+    (P)->p = (at); \
+    parse_error(P, "invalid number"); \
+  } while (0)
+
+/*
+** integers of up to 19 digits that fit are pushed as integers, floats with
+** at most 2^53 as significand and an exponent in [-22, 22] are one exact
+** multiplication or division, anything else goes through lua_stringtonumber
+*/
+static void parse_number(Parser* P) {
+  const char* s = P->p;
+  const char* p = s;
+  const char* end = P->end;
+  int neg = 0, isfloat = 0, ndigits = 0, truncated = 0, exp10 = 0;
+  uint64_t mant = 0;
+  if (*p == '-') {
+    neg = 1;
+    p++;
+  }
+  if (p >= end || !ISDIGIT(*p))
+    NUMBER_ERROR(P, p);
+  if (*p == '0') {
+    p++;
+    if (p < end && ISDIGIT(*p))
+      NUMBER_ERROR(P, p);
+  } else {
+    for (; p < end && ISDIGIT(*p); p++) {
+      if (ndigits < 19) {
+        mant = mant * 10 + (uint64_t)(*p - '0');
+        ndigits++;
+      } else {
+        truncated = 1;
+      }
+    }
+  }
+  if (p < end && *p == '.') {
+    isfloat = 1;
+    p++;
+    if (p >= end || !ISDIGIT(*p))
+      NUMBER_ERROR(P, p);
+    for (; p < end && ISDIGIT(*p); p++) {
+      if (mant == 0 && *p == '0') {
+        exp10--; // leading zeros of the fraction
+      } else if (ndigits < 19) {
+        mant = mant * 10 + (uint64_t)(*p - '0');
+        ndigits++;
+        exp10--;
+      } else {
+        truncated = 1;
+      }
+    }
+  }
+  if (p < end && (*p == 'e' || *p == 'E')) {
+    int eneg = 0, e = 0;
+    isfloat = 1;
+    p++;
+    if (p < end && (*p == '+' || *p == '-'))
+      eneg = *p++ == '-';
+    if (p >= end || !ISDIGIT(*p))
+      NUMBER_ERROR(P, p);
+    for (; p < end && ISDIGIT(*p); p++)
+      if (e < 100000)
+        e = e * 10 + (*p - '0');
+    exp10 += eneg ? -e : e;
+  }
+  P->p = p;
+  if (!isfloat && !truncated) {
+    if (mant <= (uint64_t)INT64_MAX) {
+      lua_pushinteger(P->L, neg ? -(lua_Integer)mant : (lua_Integer)mant);
+      return;
+    }
+    if (neg && mant == (uint64_t)INT64_MAX + 1) {
+      lua_pushinteger(P->L, (lua_Integer)INT64_MIN);
+      return;
+    }
+  }
+  if (!truncated && mant <= (UINT64_C(1) << 53) && exp10 >= -22 && exp10 <= 22) {
+    double d = (double)mant;
+    d = exp10 < 0 ? d / pow10exact[-exp10] : d * pow10exact[exp10];
+    lua_pushnumber(P->L, (lua_Number)(neg ? -d : d));
+    return;
+  }
+  char buff[MAX_NUMBER_LEN + 1];
+  size_t len = (size_t)(p - s);
+  if (len > MAX_NUMBER_LEN)
+    NUMBER_ERROR(P, s);
+  memcpy(buff, s, len);
+  buff[len] = '\0';
+  if (lua_stringtonumber(P->L, buff) == 0) // too large integers become floats
+    NUMBER_ERROR(P, s);
+}
+
+static void parse_literal(Parser* P, const char* word, size_t len) {
+  if ((size_t)(P->end - P->p) < len || memcmp(P->p, word, len) != 0)
+    parse_error(P, "invalid literal");
+  P->p += len;
+}
+
+static void enterlevel(Parser* P, int slots) {
+  if (++P->depth > JSON_MAXDEPTH)
+    parse_error(P, "too many nested levels");
+  luaL_checkstack(P->L, slots + LUA_MINSTACK, "json too many nested levels");
+}
+
+// the ',' or the closing bracket after an element
+static int nextelement(Parser* P, char close) {
+  P->p = skipspace(P->p, P->end);
+  if (P->p < P->end) {
+    char c = *P->p;
+    if (c == ',') {
+      P->p = skipspace(P->p + 1, P->end);
+      return 1;
+    }
+    if (c == close) {
+      P->p++;
+      return 0;
+    }
+  }
+  parse_error(P, close == ']' ? "expected ',' or ']'" : "expected ',' or '}'");
+  return 0;
+}
+
+// table below the 'n' values on top of the stack, returns its index
+static int createtable(lua_State* L, int n, int narr, int nrec) {
+  lua_createtable(L, narr, nrec);
+  lua_insert(L, -(n + 1));
+  return lua_gettop(L) - n;
+}
+
+static void flusharray(lua_State* L, int t, lua_Integer total, int n) {
+  for (int i = n; i > 0; i--) {
+    if (lua_isnil(L, -1))
+      lua_pop(L, 1); // null leaves a hole, as the cJSON path does
+    else
+      lua_rawseti(L, t, total + i);
+  }
+}
+
+static void parse_array(Parser* P) {
+  lua_State* L = P->L;
+  enterlevel(P, BATCH_ARRAY);
+  P->p = skipspace(P->p + 1, P->end);
+  int t = 0, n = 0;
+  lua_Integer total = 0;
+  if (P->p < P->end && *P->p == ']') {
+    P->p++;
+  } else {
+    do {
+      parse_value(P);
+      if (++n == BATCH_ARRAY) {
+        if (t == 0)
+          t = createtable(L, n, BATCH_ARRAY * 2, 0);
+        flusharray(L, t, total, n);
+        total += n;
+        n = 0;
+      }
+    } while (nextelement(P, ']'));
+  }
+  if (t == 0)
+    t = createtable(L, n, n, 0);
+  flusharray(L, t, total, n);
+  P->depth--;
+}
+
+// pairs in order, so a repeated key keeps its last value
+static void flushobject(lua_State* L, int t, int n) {
+  int base = lua_gettop(L) - 2 * n;
+  for (int i = 1; i <= n; i++) {
+    if (lua_isnil(L, base + 2 * i))
+      continue;
+    lua_pushvalue(L, base + 2 * i - 1);
+    lua_pushvalue(L, base + 2 * i);
+    lua_rawset(L, t);
+  }
+  lua_settop(L, base);
+}
+
+static void parse_object(Parser* P) {
+  lua_State* L = P->L;
+  enterlevel(P, BATCH_OBJECT * 2);
+  P->p = skipspace(P->p + 1, P->end);
+  int t = 0, n = 0;
+  if (P->p < P->end && *P->p == '}') {
+    P->p++;
+  } else {
+    do {
+      if (P->p >= P->end || *P->p != '"')
+        parse_error(P, "expected string key");
+      parse_string(P);
+      P->p = skipspace(P->p, P->end);
+      if (P->p >= P->end || *P->p != ':')
+        parse_error(P, "expected ':'");
+      P->p = skipspace(P->p + 1, P->end);
+      parse_value(P);
+      if (++n == BATCH_OBJECT) {
+        if (t == 0)
+          t = createtable(L, 2 * n, 0, BATCH_OBJECT * 2);
+        flushobject(L, t, n);
+        n = 0;
+      }
+    } while (nextelement(P, '}'));
+  }
+  if (t == 0)
+    t = createtable(L, 2 * n, 0, n);
+  flushobject(L, t, n);
+  P->depth--;
+}
+
+static void parse_value(Parser* P) {
+  if (P->p >= P->end)
+    parse_error(P, "unexpected end of input");
+  switch (*P->p) {
+    case '{':
+      parse_object(P);
+      break;
+    case '[':
+      parse_array(P);
+      break;
+    case '"':
+      parse_string(P);
+      break;
+    case 't':
+      parse_literal(P, "true", 4);
+      lua_pushboolean(P->L, 1);
+      break;
+    case 'f':
+      parse_literal(P, "false", 5);
+      lua_pushboolean(P->L, 0);
+      break;
+    case 'n':
+      parse_literal(P, "null", 4);
+      if (P->nullidx != 0)
+        lua_pushvalue(P->L, P->nullidx);
+      else
+        lua_pushnil(P->L);
+      break;
+    default:
+      if (*P->p == '-' || ISDIGIT(*P->p))
+        parse_number(P);
+      else
+        parse_error(P, "unexpected character");
+      break;
+  }
+}
+
+// decode(ptr, len, null) => value, raises on error
+static int decode_protected(lua_State* L) {
+  Parser P[1];
+  P->L = L;
+  P->start = (const char*)lua_touserdata(L, 1);
+  P->p = P->start;
+  P->end = P->start + (size_t)lua_tointeger(L, 2);
+  P->depth = 0;
+  P->nullidx = lua_isnil(L, 3) ? 0 : 3;
+  P->p = skipspace(P->p, P->end);
+  parse_value(P);
+  P->p = skipspace(P->p, P->end);
+  if (P->p != P->end)
+    parse_error(P, "unexpected data after the value");
+  return 1;
+}
+
+// value on top, or nil and the error message
+static int decode_buffer(lua_State* L, const char* s, size_t len, int nullidx) {
+  lua_pushcfunction(L, decode_protected);
+  lua_pushlightuserdata(L, (void*)s);
+  lua_pushinteger(L, (lua_Integer)len);
+  lua_pushvalue(L, nullidx);
+  if (lua_pcall(L, 3, 1, 0) != LUA_OK) {
+    lua_pushnil(L);
+    lua_insert(L, -2);
+    return 0;
+  }
+  return 1;
+}
+
+// decode(string/MemBuffer, null) => value / nil, errmsg
+int JSON_FUNCTION(decode)(lua_State* L) {
+  size_t len;
+  const char* s = (const char*)luaL_checklbuffer(L, 1, &len);
+  lua_settop(L, 2);
+  return decode_buffer(L, s, len, 2) ? 1 : 2;
+}
+
+/* }====================================================== */
+
+/*
+** {======================================================
+** Streaming decoder
+** Input arrives in chunks. A resumable scan over the new bytes only
+** tracks strings and bracket depth to find where the next document ends,
+** then that document is decoded in one pass. Documents may follow each
+** other directly or be separated by whitespace, as in NDJSON.
+** =======================================================
+*/
+
+enum {
+  SCAN_IDLE, // before a document
+  SCAN_CONTAINER,
+  SCAN_STRING, // inside a string inside a container
+  SCAN_TOPSTRING, // a string document
+  SCAN_SCALAR, // a number or literal document, ends at a delimiter or at finish
+};
+
+typedef struct {
+  luaL_ByteBuffer buf; // the next document starts at the read position
+  uint32_t scanned; // bytes after the read position already scanned
+  int depth;
+  int state;
+  int finished;
+} JsonDecoder;
+
+#define CHECK_DECODER(L, idx) (JsonDecoder*)luaL_checkudata(L, idx, JSON_DECODER_TYPE)
+
+#define ISDELIMITER(c) (ISSPACE(c) || (c) == ',' || (c) == ':' || (c) == '"' || \
+                        (c) == '[' || (c) == ']' || (c) == '{' || (c) == '}')
+
+// size of the next complete document, 0 when more input is needed
+static uint32_t decoder_scan(JsonDecoder* d) {
+  const char* s = (const char*)luaBB_readbytes(&d->buf, 0);
+  uint32_t n = luaBB_getremainforread(&d->buf);
+  uint32_t i = d->scanned;
+  while (i < n) {
+    switch (d->state) {
+      case SCAN_IDLE: {
+        uint32_t ws = (uint32_t)(skipspace(s, s + n) - s);
+        luaBB_readbytes(&d->buf, ws); // whitespace between documents
+        s += ws;
+        n -= ws;
+        if (n == 0)
+          break;
+        char c = s[0];
+        i = 1;
+        if (c == '[' || c == '{') {
+          d->state = SCAN_CONTAINER;
+          d->depth = 1;
+        } else if (c == '"') {
+          d->state = SCAN_TOPSTRING;
+        } else if (ISDELIMITER(c)) {
+          return 1; // a stray delimiter, the parser reports it
+        } else {
+          d->state = SCAN_SCALAR;
+        }
+        break;
+      }
+      case SCAN_CONTAINER: {
+        i = findstructural(s, i, n);
+        if (i >= n)
+          break;
+        char c = s[i++];
+        if (c == '"')
+          d->state = SCAN_STRING;
+        else if (c == '[' || c == '{')
+          d->depth++;
+        else if (--d->depth == 0)
+          return i;
+        break;
+      }
+      case SCAN_STRING:
+      case SCAN_TOPSTRING: {
+        i = findquote(s, i, n);
+        if (i >= n)
+          break;
+        if (s[i] == '\\') {
+          if (i + 1 >= n) { // the escaped byte is still to come
+            d->scanned = i;
+            return 0;
+          }
+          i += 2;
+          break;
+        }
+        i++;
+        if (d->state == SCAN_TOPSTRING)
+          return i;
+        d->state = SCAN_CONTAINER;
+        break;
+      }
+      case SCAN_SCALAR: {
+        while (i < n && !ISDELIMITER(s[i]))
+          i++;
+        if (i < n)
+          return i;
+        break;
+      }
+    }
+  }
+  if (d->state == SCAN_SCALAR && d->finished && n > 0)
+    return n;
+  d->scanned = i;
+  return 0;
+}
+
+// decoder(null) => JsonDecoder
+int JSON_FUNCTION(decoder)(lua_State* L) {
+  lua_settop(L, 1);
+  JsonDecoder* d = (JsonDecoder*)lua_newuserdata(L, sizeof(JsonDecoder));
+  memset(d, 0, sizeof(JsonDecoder));
+  luaBB_init(&d->buf, 0);
+  d->state = SCAN_IDLE;
+  luaL_setmetatable(L, JSON_DECODER_TYPE);
+  lua_pushvalue(L, 1);
+  lua_setuservalue(L, -2);
+  return 1;
+}
+
+// feed(self, string/MemBuffer) => void
+static int JSON_FUNCTION(decoder_feed)(lua_State* L) {
+  JsonDecoder* d = CHECK_DECODER(L, 1);
+  size_t len;
+  const uint8_t* ptr = (const uint8_t*)luaL_checklbuffer(L, 2, &len);
+  luaL_argcheck(L, len <= (size_t)(UINT32_MAX / 2) - d->buf.n, 2, "too much pending input");
+  if (len > 0)
+    luaBB_addbytes(&d->buf, ptr, (uint32_t)len);
+  return 0;
+}
+
+// next(self) => true, value / false (needs more input) / nil, errmsg
+static int JSON_FUNCTION(decoder_next)(lua_State* L) {
+  JsonDecoder* d = CHECK_DECODER(L, 1);
+  lua_settop(L, 1);
+  uint32_t len = decoder_scan(d);
+  if (len == 0) {
+    lua_pushboolean(L, 0);
+    return 1;
+  }
+  const char* s = (const char*)luaBB_readbytes(&d->buf, len); // consumed even when broken
+  d->scanned = 0;
+  d->depth = 0;
+  d->state = SCAN_IDLE;
+  lua_getuservalue(L, 1);
+  if (!decode_buffer(L, s, len, 2))
+    return 2;
+  lua_pushboolean(L, 1);
+  lua_insert(L, -2);
+  return 2;
+}
+
+// finish(self) => void, the input is complete, a trailing number ends here
+static int JSON_FUNCTION(decoder_finish)(lua_State* L) {
+  JsonDecoder* d = CHECK_DECODER(L, 1);
+  d->finished = 1;
+  return 0;
+}
+
+// pending(self) => integer, bytes not decoded yet
+static int JSON_FUNCTION(decoder_pending)(lua_State* L) {
+  JsonDecoder* d = CHECK_DECODER(L, 1);
+  lua_pushinteger(L, (lua_Integer)luaBB_getremainforread(&d->buf));
+  return 1;
+}
+
+static int JSON_FUNCTION(decoder_reset)(lua_State* L) {
+  JsonDecoder* d = CHECK_DECODER(L, 1);
+  luaBB_clear(&d->buf);
+  d->scanned = 0;
+  d->depth = 0;
+  d->state = SCAN_IDLE;
+  d->finished = 0;
+  return 0;
+}
+
+static int JSON_FUNCTION(decoder_gc)(lua_State* L) {
+  JsonDecoder* d = CHECK_DECODER(L, 1);
+  luaBB_destroy(&d->buf);
+  return 0;
+}
+
+static const luaL_Reg decoder_metafuncs[] = {
+    {"feed", JSON_FUNCTION(decoder_feed)},
+    {"next", JSON_FUNCTION(decoder_next)},
+    {"finish", JSON_FUNCTION(decoder_finish)},
+    {"pending", JSON_FUNCTION(decoder_pending)},
+    {"reset", JSON_FUNCTION(decoder_reset)},
+    {"__gc", JSON_FUNCTION(decoder_gc)},
+    {NULL, NULL},
+};
+
+void JSON_FUNCTION(decoder_init_metatable)(lua_State* L) {
+  luaL_newmetatable(L, JSON_DECODER_TYPE);
+  luaL_setfuncs(L, decoder_metafuncs, 0);
+  lua_pushvalue(L, -1);
+  lua_setfield(L, -2, "__index");
+  lua_pop(L, 1);
+}
+
+/* }====================================================== */
@@ -0,0 +1,780 @@
+#define encode_c
+#include <json_wrap.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+/*
+** JSON encoder, walks Lua values straight into a growable luaL_ByteBuffer
+** and hands the bytes over as a luaL_MemBuffer, no cJSON tree and no Lua
+** string in between. Integers are written two digits at a time, floats with
+** Grisu2 which always round trips and is the shortest form in nearly every
+** case. Tables on the current path are kept in a small stack for cycle
+** detection, the depth limit bounds it.
+*/
+
+#define MAX_NUMBER_TEXT 32
+#define STRING_PIECE 1024 // input bytes escaped per reservation, output may be 6 times
+
+typedef struct {
+  lua_State* L;
+  luaL_ByteBuffer* b;
+  luaL_ByteBuffer* keys; // SortKey stack when sorting keys, NULL otherwise
+  luaL_ByteBuffer* numkeys; // text of number keys being sorted
+  lua_Integer sparse; // holes allowed in an array, as a ratio of max index to count
+  int uselength; // #t decides arrays, other keys are ignored
+  int emptyobject; // empty table as {} instead of []
+  int nullidx; // stack index of the value for null, 0 for none
+  int depth;
+  const void* path[JSON_MAXDEPTH]; // tables being written
+} Encoder;
+
+static char* reserve(Encoder* E, uint32_t len) {
+  luaL_ByteBuffer* b = E->b;
+  if (b->size - b->n < len) {
+    if (len > UINT32_MAX - b->n || luaBB_appendbytes(b, len) == NULL)
+      luaL_error(E->L, "json: output too large");
+    b->n -= len;
+  }
+  return (char*)b->b + b->n;
+}
+#define commit(E, len) ((E)->b->n += (uint32_t)(len))
+
+static void addchar(Encoder* E, char c) {
+  *reserve(E, 1) = c;
+  commit(E, 1);
+}
+
+static void addlstring(Encoder* E, const char* s, uint32_t len) {
+  memcpy(reserve(E, len), s, len);
+  commit(E, len);
+}
+#define addliteral(E, s) addlstring(E, "" s, sizeof(s) - 1)
+
+/*
+** {======================================================
+** Numbers
+** =======================================================
+*/
+
+static const char DIGITS2[] =
+    "0001020304050607080910111213141516171819"
+    "2021222324252627282930313233343536373839"
+    "4041424344454647484950515253545556575859"
+    "6061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+static int format_integer(char* buf, lua_Integer v) {
+  char tmp[24];
+  char* p = tmp + sizeof(tmp);
+  uint64_t u = v < 0 ? 0 - (uint64_t)v : (uint64_t)v;
+  while (u >= 100) {
+    unsigned d = (unsigned)(u % 100) * 2;
+    u /= 100;
+    *--p = DIGITS2[d + 1];
+    *--p = DIGITS2[d];
+  }
+  if (u >= 10) {
+    unsigned d = (unsigned)u * 2;
+    *--p = DIGITS2[d + 1];
+    *--p = DIGITS2[d];
+  } else {
+    *--p = (char)('0' + u);
+  }
+  if (v < 0)
+    *--p = '-';
+  int len = (int)(tmp + sizeof(tmp) - p);
+  memcpy(buf, p, len);
+  return len;
+}
+
+/*
+** Grisu2, after Florian Loitsch, "Printing Floating-Point Numbers Quickly
+** and Accurately with Integers", laid out as in Milo Yip's dtoa.
+*/
+
+typedef struct {
+  uint64_t f;
+  int e;
+} DiyFp;
+
+#define DP_SIGNIFICAND_SIZE 52
+#define DP_EXPONENT_BIAS (0x3FF + DP_SIGNIFICAND_SIZE)
+#define DP_MIN_EXPONENT (-DP_EXPONENT_BIAS)
+#define DP_EXPONENT_MASK UINT64_C(0x7FF0000000000000)
+#define DP_SIGNIFICAND_MASK UINT64_C(0x000FFFFFFFFFFFFF)
+#define DP_HIDDEN_BIT UINT64_C(0x0010000000000000)
+
+// 10^k normalized, for k = -348, -340, ..., 340
+static const uint64_t CACHED_POWERS_F[] = {
+    UINT64_C(0xfa8fd5a0081c0288), UINT64_C(0xbaaee17fa23ebf76), UINT64_C(0x8b16fb203055ac76),
+    UINT64_C(0xcf42894a5dce35ea), UINT64_C(0x9a6bb0aa55653b2d), UINT64_C(0xe61acf033d1a45df),
+    UINT64_C(0xab70fe17c79ac6ca), UINT64_C(0xff77b1fcbebcdc4f), UINT64_C(0xbe5691ef416bd60c),
+    UINT64_C(0x8dd01fad907ffc3c), UINT64_C(0xd3515c2831559a83), UINT64_C(0x9d71ac8fada6c9b5),
+    UINT64_C(0xea9c227723ee8bcb), UINT64_C(0xaecc49914078536d), UINT64_C(0x823c12795db6ce57),
+    UINT64_C(0xc21094364dfb5637), UINT64_C(0x9096ea6f3848984f), UINT64_C(0xd77485cb25823ac7),
+    UINT64_C(0xa086cfcd97bf97f4), UINT64_C(0xef340a98172aace5), UINT64_C(0xb23867fb2a35b28e),
+    UINT64_C(0x84c8d4dfd2c63f3b), UINT64_C(0xc5dd44271ad3cdba), UINT64_C(0x936b9fcebb25c996),
+    UINT64_C(0xdbac6c247d62a584), UINT64_C(0xa3ab66580d5fdaf6), UINT64_C(0xf3e2f893dec3f126),
+    UINT64_C(0xb5b5ada8aaff80b8), UINT64_C(0x87625f056c7c4a8b), UINT64_C(0xc9bcff6034c13053),
+    UINT64_C(0x964e858c91ba2655), UINT64_C(0xdff9772470297ebd), UINT64_C(0xa6dfbd9fb8e5b88f),
+    UINT64_C(0xf8a95fcf88747d94), UINT64_C(0xb94470938fa89bcf), UINT64_C(0x8a08f0f8bf0f156b),
+    UINT64_C(0xcdb02555653131b6), UINT64_C(0x993fe2c6d07b7fac), UINT64_C(0xe45c10c42a2b3b06),
+    UINT64_C(0xaa242499697392d3), UINT64_C(0xfd87b5f28300ca0e), UINT64_C(0xbce5086492111aeb),
+    UINT64_C(0x8cbccc096f5088cc), UINT64_C(0xd1b71758e219652c), UINT64_C(0x9c40000000000000),
+    UINT64_C(0xe8d4a51000000000), UINT64_C(0xad78ebc5ac620000), UINT64_C(0x813f3978f8940984),
+    UINT64_C(0xc097ce7bc90715b3), UINT64_C(0x8f7e32ce7bea5c70), UINT64_C(0xd5d238a4abe98068),
+    UINT64_C(0x9f4f2726179a2245), UINT64_C(0xed63a231d4c4fb27), UINT64_C(0xb0de65388cc8ada8),
+    UINT64_C(0x83c7088e1aab65db), UINT64_C(0xc45d1df942711d9a), UINT64_C(0x924d692ca61be758),
+    UINT64_C(0xda01ee641a708dea), UINT64_C(0xa26da3999aef774a), UINT64_C(0xf209787bb47d6b85),
+    UINT64_C(0xb454e4a179dd1877), UINT64_C(0x865b86925b9bc5c2), UINT64_C(0xc83553c5c8965d3d),
+    UINT64_C(0x952ab45cfa97a0b3), UINT64_C(0xde469fbd99a05fe3), UINT64_C(0xa59bc234db398c25),
+    UINT64_C(0xf6c69a72a3989f5c), UINT64_C(0xb7dcbf5354e9bece), UINT64_C(0x88fcf317f22241e2),
+    UINT64_C(0xcc20ce9bd35c78a5), UINT64_C(0x98165af37b2153df), UINT64_C(0xe2a0b5dc971f303a),
+    UINT64_C(0xa8d9d1535ce3b396), UINT64_C(0xfb9b7cd9a4a7443c), UINT64_C(0xbb764c4ca7a44410),
+    UINT64_C(0x8bab8eefb6409c1a), UINT64_C(0xd01fef10a657842c), UINT64_C(0x9b10a4e5e9913129),
+    UINT64_C(0xe7109bfba19c0c9d), UINT64_C(0xac2820d9623bf429), UINT64_C(0x80444b5e7aa7cf85),
+    UINT64_C(0xbf21e44003acdd2d), UINT64_C(0x8e679c2f5e44ff8f), UINT64_C(0xd433179d9c8cb841),
+    UINT64_C(0x9e19db92b4e31ba9), UINT64_C(0xeb96bf6ebadf77d9), UINT64_C(0xaf87023b9bf0ee6b)
+};
+static const int16_t CACHED_POWERS_E[] = {
+    -1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980, -954, -927, -901, -874, -847,
+    -821, -794, -768, -741, -715, -688, -661, -635, -608, -582, -555, -529, -502, -475, -449,
+    -422, -396, -369, -343, -316, -289, -263, -236, -210, -183, -157, -130, -103, -77, -50,
+    -24, 3, 30, 56, 83, 109, 136, 162, 189, 216, 242, 269, 295, 322, 348,
+    375, 402, 428, 455, 481, 508, 534, 561, 588, 614, 641, 667, 694, 720, 747,
+    774, 800, 827, 853, 880, 907, 933, 960, 986, 1013, 1039, 1066
+};
+
+static const uint64_t POW10[] = {
+    UINT64_C(1), UINT64_C(10), UINT64_C(100), UINT64_C(1000), UINT64_C(10000),
+    UINT64_C(100000), UINT64_C(1000000), UINT64_C(10000000), UINT64_C(100000000),
+    UINT64_C(1000000000), UINT64_C(10000000000), UINT64_C(100000000000),
+    UINT64_C(1000000000000), UINT64_C(10000000000000), UINT64_C(100000000000000),
+    UINT64_C(1000000000000000), UINT64_C(10000000000000000), UINT64_C(100000000000000000),
+    UINT64_C(1000000000000000000), UINT64_C(10000000000000000000),
+};
+
+static DiyFp makefp(uint64_t f, int e) {
+  DiyFp r;
+  r.f = f;
+  r.e = e;
+  return r;
+}
+
+static DiyFp diyfp_fromdouble(double d) {
+  uint64_t u;
+  memcpy(&u, &d, sizeof(u));
+  int biased = (int)((u & DP_EXPONENT_MASK) >> DP_SIGNIFICAND_SIZE);
+  uint64_t significand = u & DP_SIGNIFICAND_MASK;
+  if (biased != 0)
+    return makefp(significand + DP_HIDDEN_BIT, biased - DP_EXPONENT_BIAS);
+  return makefp(significand, DP_MIN_EXPONENT + 1); // subnormal
+}
+
+static DiyFp diyfp_multiply(DiyFp x, DiyFp y) {
+#if defined(__SIZEOF_INT128__)
+  __uint128_t p = (__uint128_t)x.f * y.f;
+  uint64_t h = (uint64_t)(p >> 64);
+  uint64_t l = (uint64_t)p;
+  if (l & (UINT64_C(1) << 63)) // rounding
+    h++;
+  return makefp(h, x.e + y.e + 64);
+#else
+  const uint64_t M32 = 0xFFFFFFFF;
+  uint64_t a = x.f >> 32, b = x.f & M32, c = y.f >> 32, d = y.f & M32;
+  uint64_t ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+  uint64_t tmp = (bd >> 32) + (ad & M32) + (bc & M32);
+  tmp += UINT64_C(1) << 31; // rounding
+  return makefp(ac + (ad >> 32) + (bc >> 32) + (tmp >> 32), x.e + y.e + 64);
+#endif
+}
+
+static DiyFp diyfp_normalize(DiyFp v) {
+  while (!(v.f & (UINT64_C(1) << 63))) {
+    v.f <<= 1;
+    v.e--;
+  }
+  return v;
+}
+
+static void normalized_boundaries(DiyFp v, DiyFp* minus, DiyFp* plus) {
+  DiyFp pl = makefp((v.f << 1) + 1, v.e - 1);
+  while (!(pl.f & (DP_HIDDEN_BIT << 1))) {
+    pl.f <<= 1;
+    pl.e--;
+  }
+  pl.f <<= 64 - DP_SIGNIFICAND_SIZE - 2;
+  pl.e -= 64 - DP_SIGNIFICAND_SIZE - 2;
+  DiyFp mi = v.f == DP_HIDDEN_BIT ? makefp((v.f << 2) - 1, v.e - 2) : makefp((v.f << 1) - 1, v.e - 1);
+  mi.f <<= mi.e - pl.e;
+  mi.e = pl.e;
+  *minus = mi;
+  *plus = pl;
+}
+
+static DiyFp cached_power(int e, int* K) {
+  double dk = (-61 - e) * 0.30102999566398114 + 347; // positive, so ceil by hand
+  int k = (int)dk;
+  if (dk - k > 0.0)
+    k++;
+  unsigned index = (unsigned)((k >> 3) + 1);
+  *K = -(-348 + (int)(index << 3));
+  return makefp(CACHED_POWERS_F[index], CACHED_POWERS_E[index]);
+}
+
+static void grisu_round(char* buffer, int len, uint64_t delta, uint64_t rest, uint64_t tenkappa, uint64_t wpw) {
+  while (rest < wpw && delta - rest >= tenkappa &&
+         (rest + tenkappa < wpw || wpw - rest > rest + tenkappa - wpw)) {
+    buffer[len - 1]--;
+    rest += tenkappa;
+  }
+}
+
+static int count_digits32(uint32_t n) {
+  if (n < 10) return 1;
+  if (n < 100) return 2;
+  if (n < 1000) return 3;
+  if (n < 10000) return 4;
+  if (n < 100000) return 5;
+  if (n < 1000000) return 6;
+  if (n < 10000000) return 7;
+  if (n < 100000000) return 8;
+  return 9; // p1 never reaches 10 digits
+}
+
+static void digit_gen(DiyFp W, DiyFp Mp, uint64_t delta, char* buffer, int* len, int* K) {
+  const DiyFp one = makefp(UINT64_C(1) << -Mp.e, Mp.e);
+  const uint64_t wpw = Mp.f - W.f;
+  uint32_t p1 = (uint32_t)(Mp.f >> -one.e);
+  uint64_t p2 = Mp.f & (one.f - 1);
+  int kappa = count_digits32(p1);
+  *len = 0;
+  while (kappa > 0) {
+    uint32_t d = p1 / (uint32_t)POW10[kappa - 1];
+    p1 %= (uint32_t)POW10[kappa - 1];
+    if (d || *len)
+      buffer[(*len)++] = (char)('0' + d);
+    kappa--;
+    uint64_t tmp = ((uint64_t)p1 << -one.e) + p2;
+    if (tmp <= delta) {
+      *K += kappa;
+      grisu_round(buffer, *len, delta, tmp, POW10[kappa] << -one.e, wpw);
+      return;
+    }
+  }
+  for (;;) { // kappa <= 0
+    p2 *= 10;
+    delta *= 10;
+    char d = (char)(p2 >> -one.e);
+    if (d || *len)
+      buffer[(*len)++] = (char)('0' + d);
+    p2 &= one.f - 1;
+    kappa--;
+    if (p2 < delta) {
+      *K += kappa;
+      int index = -kappa;
+      grisu_round(buffer, *len, delta, p2, one.f, wpw * (index < 20 ? POW10[index] : 0));
+      return;
+    }
+  }
+}
+
+// digits of a positive finite 'value', value = digits * 10^K
+static void grisu2(double value, char* buffer, int* len, int* K) {
+  const DiyFp v = diyfp_fromdouble(value);
+  DiyFp wm, wp;
+  normalized_boundaries(v, &wm, &wp);
+  const DiyFp cmk = cached_power(wp.e, K);
+  const DiyFp W = diyfp_multiply(diyfp_normalize(v), cmk);
+  DiyFp Wp = diyfp_multiply(wp, cmk);
+  DiyFp Wm = diyfp_multiply(wm, cmk);
+  Wm.f++;
+  Wp.f--;
+  digit_gen(W, Wp, Wp.f - Wm.f, buffer, len, K);
+}
+
+static char* write_exponent(int K, char* p) {
+  if (K < 0) {
+    *p++ = '-';
+    K = -K;
+  }
+  if (K >= 100) {
+    *p++ = (char)('0' + K / 100);
+    K %= 100;
+    *p++ = DIGITS2[K * 2];
+    *p++ = DIGITS2[K * 2 + 1];
+  } else if (K >= 10) {
+    *p++ = DIGITS2[K * 2];
+    *p++ = DIGITS2[K * 2 + 1];
+  } else {
+    *p++ = (char)('0' + K);
+  }
+  return p;
+}
+
+// always keeps a '.' or an exponent, so the value decodes back as a float
+static char* prettify(char* buffer, int len, int k) {
+  const int kk = len + k; // 10^(kk-1) <= v < 10^kk
+  if (0 <= k && kk <= 21) { // 1234e7 -> 12340000000.0
+    for (int i = len; i < kk; i++)
+      buffer[i] = '0';
+    buffer[kk] = '.';
+    buffer[kk + 1] = '0';
+    return buffer + kk + 2;
+  } else if (0 < kk && kk <= 21) { // 1234e-2 -> 12.34
+    memmove(buffer + kk + 1, buffer + kk, len - kk);
+    buffer[kk] = '.';
+    return buffer + len + 1;
+  } else if (-6 < kk && kk <= 0) { // 1234e-6 -> 0.001234
+    const int offset = 2 - kk;
+    memmove(buffer + offset, buffer, len);
+    buffer[0] = '0';
+    buffer[1] = '.';
+    for (int i = 2; i < offset; i++)
+      buffer[i] = '0';
+    return buffer + len + offset;
+  } else if (len == 1) { // 1e30
+    buffer[1] = 'e';
+    return write_exponent(kk - 1, buffer + 2);
+  } else { // 1234e30 -> 1.234e33
+    memmove(buffer + 2, buffer + 1, len - 1);
+    buffer[1] = '.';
+    buffer[len + 1] = 'e';
+    return write_exponent(kk - 1, buffer + len + 2);
+  }
+}
+
+// finite 'd' only
+static int format_float(char* buf, double d) {
+  char* p = buf;
+  if (d == 0) {
+    if (signbit(d))
+      *p++ = '-';
+    memcpy(p, "0.0", 3);
+    return (int)(p + 3 - buf);
+  }
+  if (d < 0) {
+    *p++ = '-';
+    d = -d;
+  }
+  int len, K;
+  grisu2(d, p, &len, &K);
+  return (int)(prettify(p, len, K) - buf);
+}
+
+// nan and inf have no JSON form, they are written as null as cJSON does
+static int format_number(lua_State* L, int idx, char* buf) {
+  if (lua_isinteger(L, idx))
+    return format_integer(buf, lua_tointeger(L, idx));
+  double d = (double)lua_tonumber(L, idx);
+  if (d != d || d - d != 0) {
+    memcpy(buf, "null", 4);
+    return 4;
+  }
+  return format_float(buf, d);
+}
+
+static void encode_number(Encoder* E, int idx) {
+  commit(E, format_number(E->L, idx, reserve(E, MAX_NUMBER_TEXT)));
+}
+
+/* }====================================================== */
+
+/*
+** {======================================================
+** Strings
+** =======================================================
+*/
+
+// next byte at or after 'i' that needs an escape, or 'n'
+static size_t findescape(const char* s, size_t i, size_t n) {
+#if defined(USE_SSE2)
+  const __m128i ctrl = _mm_set1_epi8(0x1F);
+  for (; i + 16 <= n; i += 16) {
+    __m128i v = load16(s + i);
+    __m128i control = _mm_cmpeq_epi8(_mm_max_epu8(v, ctrl), ctrl); // v <= 0x1F
+    unsigned m = mask16(_mm_or_si128(control, _mm_or_si128(eq8(v, '"'), eq8(v, '\\'))));
+    if (m != 0)
+      return i + (size_t)countzero(m);
+  }
+#endif
+  for (; i < n; i++) {
+    unsigned char c = (unsigned char)s[i];
+    if (c < 0x20 || c == '"' || c == '\\')
+      return i;
+  }
+  return n;
+}
+
+static const char HEXDIGITS[] = "0123456789abcdef";
+
+static char* write_escape(char* d, unsigned char c) {
+  *d++ = '\\';
+  switch (c) {
+    case '"': *d++ = '"'; break;
+    case '\\': *d++ = '\\'; break;
+    case '\b': *d++ = 'b'; break;
+    case '\f': *d++ = 'f'; break;
+    case '\n': *d++ = 'n'; break;
+    case '\r': *d++ = 'r'; break;
+    case '\t': *d++ = 't'; break;
+    default:
+      memcpy(d, "u00", 3);
+      d[3] = HEXDIGITS[c >> 4];
+      d[4] = HEXDIGITS[c & 0xF];
+      d += 5;
+      break;
+  }
+  return d;
+}
+
+// bytes are written as they are, Lua strings are expected to hold UTF-8
+static void encode_string(Encoder* E, const char* s, size_t len) {
+  addchar(E, '"');
+  while (len > 0) {
+    size_t piece = len < STRING_PIECE ? len : STRING_PIECE;
+    char* start = reserve(E, (uint32_t)(piece * 6));
+    char* d = start;
+    size_t i = 0;
+    while (i < piece) {
+      size_t j = findescape(s, i, piece);
+      memcpy(d, s + i, j - i);
+      d += j - i;
+      if (j == piece)
+        break;
+      d = write_escape(d, (unsigned char)s[j]);
+      i = j + 1;
+    }
+    commit(E, d - start);
+    s += piece;
+    len -= piece;
+  }
+  addchar(E, '"');
+}
+
+/* }====================================================== */
+
+/*
+** {======================================================
+** Tables
+** =======================================================
+*/
+
+static void encode_value(Encoder* E, int idx);
+
+#define isnullvalue(E, idx) ((E)->nullidx != 0 && lua_rawequal((E)->L, idx, (E)->nullidx))
+
+// number of items when the table at 'idx' is written as an array, -1 for an object
+static lua_Integer array_length(Encoder* E, int idx) {
+  lua_State* L = E->L;
+  if (E->uselength) {
+    lua_Integer n = (lua_Integer)lua_rawlen(L, idx);
+    if (n > 0)
+      return n;
+  } else {
+    lua_Integer count = 0, max = 0;
+    lua_pushnil(L);
+    while (lua_next(L, idx) != 0) {
+      lua_pop(L, 1);
+      lua_Integer k;
+      if (!lua_isinteger(L, -1) || (k = lua_tointeger(L, -1)) < 1) {
+        lua_pop(L, 1);
+        return -1;
+      }
+      count++;
+      if (k > max)
+        max = k;
+    }
+    if (count == 0)
+      return E->emptyobject ? -1 : 0;
+    if (max == count)
+      return max;
+    if (E->sparse > 0 && (max / E->sparse < count || (max / E->sparse == count && max % E->sparse == 0)))
+      return max; // max <= count * sparse, holes are written as null
+    return -1;
+  }
+  lua_pushnil(L);
+  if (lua_next(L, idx) != 0) {
+    lua_pop(L, 2);
+    return -1;
+  }
+  return E->emptyobject ? -1 : 0;
+}
+
+static void encode_array(Encoder* E, int idx, lua_Integer n) {
+  lua_State* L = E->L;
+  addchar(E, '[');
+  for (lua_Integer i = 1; i <= n; i++) {
+    if (i > 1)
+      addchar(E, ',');
+    lua_rawgeti(L, idx, i);
+    encode_value(E, lua_gettop(L));
+    lua_pop(L, 1);
+  }
+  addchar(E, ']');
+}
+
+// number keys become strings, so every key is written quoted
+static void encode_key(Encoder* E, int idx) {
+  lua_State* L = E->L;
+  switch (lua_type(L, idx)) {
+    case LUA_TSTRING: {
+      size_t len;
+      const char* s = lua_tolstring(L, idx, &len);
+      encode_string(E, s, len);
+      break;
+    }
+    case LUA_TNUMBER: {
+      addchar(E, '"');
+      encode_number(E, idx);
+      addchar(E, '"');
+      break;
+    }
+    default:
+      luaL_error(L, "json: table key of type %s is not supported", luaL_typename(L, idx));
+  }
+}
+
+static void encode_object(Encoder* E, int idx) {
+  lua_State* L = E->L;
+  int first = 1;
+  addchar(E, '{');
+  lua_pushnil(L);
+  while (lua_next(L, idx) != 0) {
+    if (!first)
+      addchar(E, ',');
+    first = 0;
+    encode_key(E, -2);
+    addchar(E, ':');
+    encode_value(E, lua_gettop(L));
+    lua_pop(L, 1);
+  }
+  addchar(E, '}');
+}
+
+typedef struct {
+  const char* s; // a string key, or the text of a number key while sorting
+  size_t len;
+  size_t off; // text of a number key in 'numkeys', which may move
+  lua_Integer i;
+  lua_Number n;
+  int kind; // LUA_TSTRING, or LUA_TNUMBER with 'isint'
+  int isint;
+} SortKey;
+
+static int compare_key(const void* a, const void* b) {
+  const SortKey* ka = (const SortKey*)a;
+  const SortKey* kb = (const SortKey*)b;
+  size_t len = ka->len < kb->len ? ka->len : kb->len;
+  int c = memcmp(ka->s, kb->s, len);
+  if (c != 0)
+    return c;
+  return ka->len < kb->len ? -1 : ka->len > kb->len;
+}
+
+// keys of this object are pushed on 'keys', nested objects push theirs after
+static void encode_sorted(Encoder* E, int idx) {
+  lua_State* L = E->L;
+  uint32_t base = E->keys->n;
+  uint32_t numbase = E->numkeys->n;
+  size_t nkeys = 0;
+  lua_pushnil(L);
+  while (lua_next(L, idx) != 0) {
+    lua_pop(L, 1);
+    SortKey k;
+    memset(&k, 0, sizeof(k));
+    k.kind = lua_type(L, -1);
+    if (k.kind == LUA_TSTRING) {
+      k.s = lua_tolstring(L, -1, &k.len);
+    } else if (k.kind == LUA_TNUMBER) {
+      char buf[MAX_NUMBER_TEXT];
+      k.isint = lua_isinteger(L, -1);
+      if (k.isint)
+        k.i = lua_tointeger(L, -1);
+      else
+        k.n = lua_tonumber(L, -1);
+      k.len = (size_t)format_number(L, -1, buf);
+      k.off = E->numkeys->n - numbase;
+      luaBB_addbytes(E->numkeys, (const uint8_t*)buf, (uint32_t)k.len);
+    } else {
+      luaL_error(L, "json: table key of type %s is not supported", luaL_typename(L, -1));
+    }
+    luaBB_addbytes(E->keys, (const uint8_t*)&k, sizeof(k));
+    nkeys++;
+  }
+  SortKey* keys = (SortKey*)(E->keys->b + base);
+  for (size_t i = 0; i < nkeys; i++)
+    if (keys[i].kind == LUA_TNUMBER)
+      keys[i].s = (const char*)E->numkeys->b + numbase + keys[i].off;
+  qsort(keys, nkeys, sizeof(SortKey), compare_key);
+  addchar(E, '{');
+  for (size_t i = 0; i < nkeys; i++) {
+    SortKey k = ((SortKey*)(E->keys->b + base))[i]; // a copy, nested objects may move the stack
+    if (i > 0)
+      addchar(E, ',');
+    if (k.kind == LUA_TSTRING) {
+      encode_string(E, k.s, k.len);
+      lua_pushlstring(L, k.s, k.len);
+    } else {
+      addchar(E, '"');
+      addlstring(E, (const char*)E->numkeys->b + numbase + k.off, (uint32_t)k.len);
+      addchar(E, '"');
+      if (k.isint)
+        lua_pushinteger(L, k.i);
+      else
+        lua_pushnumber(L, k.n);
+    }
+    addchar(E, ':');
+    lua_rawget(L, idx);
+    encode_value(E, lua_gettop(L));
+    lua_pop(L, 1);
+  }
+  addchar(E, '}');
+  E->keys->n = base;
+  E->numkeys->n = numbase;
+}
+
+static void encode_table(Encoder* E, int idx) {
+  lua_State* L = E->L;
+  const void* t = lua_topointer(L, idx);
+  for (int i = 0; i < E->depth; i++)
+    if (E->path[i] == t)
+      luaL_error(L, "json: table contains a cycle");
+  if (E->depth >= JSON_MAXDEPTH)
+    luaL_error(L, "json: nesting deeper than %d", JSON_MAXDEPTH);
+  luaL_checkstack(L, 3, "json: nesting too deep");
+  E->path[E->depth++] = t;
+  lua_Integer n = array_length(E, idx);
+  if (n >= 0)
+    encode_array(E, idx, n);
+  else if (E->keys != NULL)
+    encode_sorted(E, idx);
+  else
+    encode_object(E, idx);
+  E->depth--;
+}
+
+static void encode_value(Encoder* E, int idx) {
+  lua_State* L = E->L;
+  switch (lua_type(L, idx)) {
+    case LUA_TNIL:
+      addliteral(E, "null");
+      break;
+    case LUA_TBOOLEAN:
+      if (lua_toboolean(L, idx))
+        addliteral(E, "true");
+      else
+        addliteral(E, "false");
+      break;
+    case LUA_TNUMBER:
+      encode_number(E, idx);
+      break;
+    case LUA_TSTRING: {
+      size_t len;
+      const char* s = lua_tolstring(L, idx, &len);
+      encode_string(E, s, len);
+      break;
+    }
+    case LUA_TTABLE:
+      if (isnullvalue(E, idx))
+        addliteral(E, "null");
+      else
+        encode_table(E, idx);
+      break;
+    default:
+      if (isnullvalue(E, idx))
+        addliteral(E, "null");
+      else
+        luaL_error(L, "json: value of type %s is not supported", luaL_typename(L, idx));
+      break;
+  }
+}
+
+/* }====================================================== */
+
+/*
+** {======================================================
+** Entry
+** =======================================================
+*/
+
+// encode(Encoder*, value, null)
+static int encode_protected(lua_State* L) {
+  Encoder* E = (Encoder*)lua_touserdata(L, 1);
+  E->L = L;
+  E->nullidx = lua_isnil(L, 3) ? 0 : 3;
+  E->depth = 0;
+  encode_value(E, 2);
+  return 0;
+}
+
+static void _releaseBuffer(const luaL_MemBuffer* mb) {
+  luaBB_destroybuffer((uint8_t*)mb->ptr);
+}
+
+static int getoption(lua_State* L, const char* name) {
+  lua_getfield(L, 2, name);
+  int b = lua_toboolean(L, -1);
+  lua_pop(L, 1);
+  return b;
+}
+
+// encode(value, opts) => MemBuffer / nil, errmsg
+// opts: sortkeys, uselength, sparse, emptyobject, null
+int JSON_FUNCTION(encode)(lua_State* L) {
+  Encoder E[1];
+  luaL_ByteBuffer b[1], keys[1], numkeys[1];
+  luaL_checkany(L, 1);
+  lua_settop(L, 2);
+  E->keys = NULL;
+  E->numkeys = NULL;
+  E->uselength = 0;
+  E->emptyobject = 0;
+  E->sparse = 0;
+  if (lua_isnil(L, 2)) {
+    lua_pushnil(L);
+  } else {
+    luaL_checktype(L, 2, LUA_TTABLE);
+    if (getoption(L, "sortkeys")) {
+      E->keys = keys;
+      E->numkeys = numkeys;
+    }
+    E->uselength = getoption(L, "uselength");
+    E->emptyobject = getoption(L, "emptyobject");
+    lua_getfield(L, 2, "sparse");
+    E->sparse = luaL_optinteger(L, -1, 0);
+    lua_pop(L, 1);
+    lua_getfield(L, 2, "null");
+  }
+  E->b = b;
+  luaBB_init(b, 0);
+  if (E->keys != NULL) {
+    luaBB_init(keys, 0);
+    luaBB_init(numkeys, 0);
+  }
+  lua_pushcfunction(L, encode_protected);
+  lua_pushlightuserdata(L, (void*)E);
+  lua_pushvalue(L, 1);
+  lua_pushvalue(L, 3);
+  int status = lua_pcall(L, 3, 0, 0);
+  if (E->keys != NULL) {
+    luaBB_destroy(keys);
+    luaBB_destroy(numkeys);
+  }
+  if (status != LUA_OK) {
+    luaBB_destroy(b);
+    lua_pushnil(L);
+    lua_insert(L, -2);
+    return 2;
+  }
+  uint32_t len = 0;
+  const uint8_t* ptr = luaBB_movebuffer(b, &len);
+  luaL_MemBuffer* mb = luaL_newmembuffer(L);
+  MEMBUFFER_SETINIT(mb, ptr, len, _releaseBuffer, NULL);
+  return 1;
+}
+
+/* }====================================================== */
@@ -1,9 +1,7 @@
 /* Lua C Library */
 
 #define json_c
-#define LUA_LIB // for export function
-
-#include <lprefix.h> // must include first
+#include <json_wrap.h>
 
 #ifdef _WIN32
 #include <malloc.h>
@@ -17,9 +15,6 @@
 #include <string.h>
 #include <assert.h>
 
-#include <lauxlib.h>
-#include <lua.h>
-
 #include <cJSON.h>
 
 // parse(string) => cJsonPtr, lenUsed
@@ -314,10 +309,14 @@ static luaL_Reg luaLoadFun[] = {
     {"for_each_object_subitem", json_for_each_object_subitem},
     {"minify", json_minify},
     {"set_realloc_cb", json_set_realloc_cb},
+    {"decode", JSON_FUNCTION(decode)},
+    {"decoder", JSON_FUNCTION(decoder)},
+    {"encode", JSON_FUNCTION(encode)},
     {NULL, NULL},
 };
 
 LUAMOD_API int luaopen_libjson(lua_State* L) {
+  JSON_FUNCTION(decoder_init_metatable)(L);
   luaL_newlib(L, luaLoadFun);
   // luaL_newlib will check lua runtime and runtime version
   // Use Marco for version number (when compile this module, the lua version
@@ -0,0 +1,45 @@
+#ifndef _JSON_WRAP_H_
+#define _JSON_WRAP_H_
+
+#define LUA_LIB // for export function
+
+#include <lprefix.h> // must include first
+
+#include <lua.h>
+#include <lauxlib.h>
+#include <luautil.h>
+
+#define JSON_FUNCTION(name) json_##name
+
+#define JSON_DECODER_TYPE "JsonDecoder*"
+
+#define JSON_MAXDEPTH 1000
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define USE_SSE2 1
+#define load16(p) _mm_loadu_si128((const __m128i*)(p))
+#define eq8(v, c) _mm_cmpeq_epi8(v, _mm_set1_epi8((char)(c)))
+#define mask16(v) ((unsigned)_mm_movemask_epi8(v))
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+static int countzero(unsigned m) {
+  unsigned long i;
+  _BitScanForward(&i, m);
+  return (int)i;
+}
+#else
+#define countzero(m) __builtin_ctz(m)
+#endif
+
+// decode.c
+int JSON_FUNCTION(decode)(lua_State* L);
+int JSON_FUNCTION(decoder)(lua_State* L);
+void JSON_FUNCTION(decoder_init_metatable)(lua_State* L);
+
+// encode.c
+int JSON_FUNCTION(encode)(lua_State* L);
+
+#endif /* _JSON_WRAP_H_ */
@@ -0,0 +1,171 @@
+#include <lproc.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#define REGISTRY_BUCKETS 64
+#define RING_INIT_SIZE 16
+
+/* only taken to find or create a channel, each channel has its own lock for the queue */
+static pthread_mutex_t registry_access = PTHREAD_MUTEX_INITIALIZER;
+static Channel* registry[REGISTRY_BUCKETS];
+
+static unsigned int _hashName(const char* name, size_t len) {
+  unsigned int h = 2166136261u;
+  size_t i;
+  for (i = 0; i < len; i++) {
+    h = (h ^ (unsigned char)name[i]) * 16777619u;
+  }
+  return h;
+}
+
+static Channel* _newChannel(const char* name, size_t len) {
+  Channel* ch = (Channel*)malloc(sizeof(Channel) + len);
+  Message** ring = (Message**)malloc(sizeof(Message*) * RING_INIT_SIZE);
+  if (ch == NULL || ring == NULL) {
+    free(ch);
+    free(ring);
+    return NULL;
+  }
+  pthread_mutex_init(&ch->lock, NULL);
+  pthread_cond_init(&ch->notEmpty, NULL);
+  pthread_cond_init(&ch->notFull, NULL);
+  ch->ring = ring;
+  ch->size = RING_INIT_SIZE;
+  ch->head = 0;
+  ch->count = 0;
+  ch->capacity = 0;
+  ch->waitrecv = 0;
+  ch->len = len;
+  memcpy(ch->name, name, len);
+  ch->name[len] = '\0';
+  return ch;
+}
+
+Channel* ch_get(const char* name, size_t len) {
+  unsigned int slot = _hashName(name, len) % REGISTRY_BUCKETS;
+  Channel* ch;
+  pthread_mutex_lock(&registry_access);
+  for (ch = registry[slot]; ch != NULL; ch = ch->next) {
+    if (ch->len == len && memcmp(ch->name, name, len) == 0) {
+      break;
+    }
+  }
+  if (ch == NULL) {
+    ch = _newChannel(name, len);
+    if (ch != NULL) {
+      ch->next = registry[slot];
+      registry[slot] = ch;
+    }
+  }
+  pthread_mutex_unlock(&registry_access);
+  return ch;
+}
+
+static void _deadline(struct timespec* ts, double timeout) {
+  clock_gettime(CLOCK_REALTIME, ts);
+  time_t sec = (time_t)timeout;
+  long nsec = ts->tv_nsec + (long)((timeout - (double)sec) * 1e9);
+  ts->tv_sec += sec + nsec / 1000000000;
+  ts->tv_nsec = nsec % 1000000000;
+}
+
+/* wait once, returns 0 when the deadline passed */
+static int _wait(pthread_cond_t* cond, pthread_mutex_t* lock, const struct timespec* ts) {
+  if (ts == NULL) {
+    pthread_cond_wait(cond, lock);
+    return 1;
+  }
+  return pthread_cond_timedwait(cond, lock, ts) != ETIMEDOUT;
+}
+
+#define CAN_PUSH(ch) ((ch)->count < (ch)->capacity + (ch)->waitrecv)
+
+static int _growRing(Channel* ch) {
+  size_t size = ch->size * 2;
+  Message** ring = (Message**)malloc(sizeof(Message*) * size);
+  size_t i;
+  if (ring == NULL) {
+    return 0;
+  }
+  for (i = 0; i < ch->count; i++) {
+    ring[i] = ch->ring[(ch->head + i) & (ch->size - 1)];
+  }
+  free(ch->ring);
+  ch->ring = ring;
+  ch->size = size;
+  ch->head = 0;
+  return 1;
+}
+
+int ch_push(Channel* ch, Message* m, double timeout) {
+  struct timespec ts;
+  int ok = 1;
+  if (timeout > 0) {
+    _deadline(&ts, timeout);
+  }
+  pthread_mutex_lock(&ch->lock);
+  while (!CAN_PUSH(ch)) {
+    if (timeout == 0 || !_wait(&ch->notFull, &ch->lock, timeout > 0 ? &ts : NULL)) {
+      ok = CAN_PUSH(ch);
+      break;
+    }
+  }
+  if (ok && ch->count == ch->size && !_growRing(ch)) {
+    ok = 0;
+  }
+  if (ok) {
+    ch->ring[(ch->head + ch->count) & (ch->size - 1)] = m;
+    ch->count++;
+    pthread_cond_signal(&ch->notEmpty);
+  }
+  pthread_mutex_unlock(&ch->lock);
+  return ok;
+}
+
+Message* ch_pop(Channel* ch, double timeout) {
+  struct timespec ts;
+  Message* m = NULL;
+  pthread_mutex_lock(&ch->lock);
+  if (ch->count == 0 && timeout != 0) {
+    if (timeout > 0) {
+      _deadline(&ts, timeout);
+    }
+    ch->waitrecv++;
+    pthread_cond_signal(&ch->notFull); /* a rendezvous sender may go on now */
+    while (ch->count == 0) {
+      if (!_wait(&ch->notEmpty, &ch->lock, timeout > 0 ? &ts : NULL)) {
+        break;
+      }
+    }
+    ch->waitrecv--;
+  }
+  if (ch->count > 0) {
+    m = ch->ring[ch->head];
+    ch->head = (ch->head + 1) & (ch->size - 1);
+    ch->count--;
+    if (CAN_PUSH(ch)) {
+      pthread_cond_signal(&ch->notFull);
+    }
+  }
+  pthread_mutex_unlock(&ch->lock);
+  return m;
+}
+
+void ch_setcapacity(Channel* ch, size_t capacity) {
+  pthread_mutex_lock(&ch->lock);
+  ch->capacity = capacity;
+  if (CAN_PUSH(ch)) {
+    pthread_cond_broadcast(&ch->notFull);
+  }
+  pthread_mutex_unlock(&ch->lock);
+}
+
+void ch_stat(Channel* ch, size_t* capacity, size_t* count) {
+  pthread_mutex_lock(&ch->lock);
+  *capacity = ch->capacity;
+  *count = ch->count;
+  pthread_mutex_unlock(&ch->lock);
+}
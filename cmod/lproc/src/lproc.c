@@ -1,158 +1,113 @@
-#define LUA_LIB // for export function
-
-#include <lprefix.h> // must include first
+#include <lproc.h>
 
 #include <string.h>
 #include <stdio.h>
-#include <pthread.h>
-
-#include <lua.h>
-#include <lualib.h>
-#include <lauxlib.h>
-
-typedef struct Proc {
-  lua_State* L;
-  pthread_t thread;
-  pthread_cond_t cond;
-  const char* channel;
-  struct Proc *previous, *next;
-} Proc;
-static Proc* waitsend = NULL;
-static Proc* waitreceive = NULL;
-
-static pthread_mutex_t kernel_access = PTHREAD_MUTEX_INITIALIZER;
-
-static Proc mainproc; // Proc for main thread
-
-__attribute__((constructor)) static void lib_initializer(void) {
-  mainproc.channel = NULL;
-  mainproc.L = NULL;
-  mainproc.thread = pthread_self();
-  mainproc.next = mainproc.previous = NULL;
-  pthread_cond_init(&mainproc.cond, NULL);
-}
-
-__attribute__((destructor)) static void lib_finalizer(void) {
-  pthread_cond_destroy(&mainproc.cond);
-}
-
-static Proc* getself(lua_State* L) {
-  if (pthread_equal(pthread_self(), mainproc.thread)) {
-    mainproc.L = L;
-    return &mainproc;
-  }
-  Proc* p;
-  lua_getfield(L, LUA_REGISTRYINDEX, "_SELF");
-  p = (Proc*)lua_touserdata(L, -1);
+#include <time.h>
+
+static char channelCacheKey; /* per state table, channel name -> Channel* */
+
+static Channel* getchannel(lua_State* L, int idx) {
+  size_t len;
+  const char* name = luaL_checklstring(L, idx, &len);
+  Channel* ch;
+  lua_rawgetp(L, LUA_REGISTRYINDEX, &channelCacheKey);
+  lua_pushvalue(L, idx);
+  lua_rawget(L, -2);
+  ch = (Channel*)lua_touserdata(L, -1);
   lua_pop(L, 1);
-  return p;
-}
-
-static void movevalues(lua_State* send, lua_State* rec) {
-  int n = lua_gettop(send);
-  int i;
-  luaL_checkstack(rec, n, "too many results");
-  for (i = 2; i <= n; i++) { /* move values to receiver */
-    switch (lua_type(send, i)) {
-      case LUA_TSTRING:
-        lua_pushstring(rec, lua_tostring(send, i));
-        break;
-      case LUA_TNUMBER:
-        if (lua_isinteger(send, i)) {
-          lua_pushinteger(rec, lua_tointeger(send, i));
-        } else {
-          lua_pushnumber(rec, lua_tonumber(send, i));
-        }
-        break;
-      default:
-        lua_pushboolean(rec, lua_toboolean(send, i));
-        break;
+  if (ch == NULL) {
+    ch = ch_get(name, len);
+    if (ch == NULL) {
+      luaL_error(L, "unable to create channel %s", name);
     }
+    lua_pushvalue(L, idx);
+    lua_pushlightuserdata(L, ch);
+    lua_rawset(L, -3);
   }
+  lua_pop(L, 1);
+  return ch;
 }
 
-static Proc* searchmatch(const char* channel, Proc** list) {
-  Proc* node = *list;
-  if (*list == NULL) {
-    return NULL;
-  }
-  if (strcmp(channel, node->channel) == 0) { /* is this node the first element? */
-    *list = (node->next == node) ? NULL : node->next;
-    node->previous->next = node->next;
-    node->next->previous = node->previous;
-    return node;
-  }
-  /* traverse the list */
-  for (node = (*list)->next; node != *list; node = node->next) {
-    if (strcmp(channel, node->channel) == 0) { /* match? */
-      /* remove node from the list */
-      node->previous->next = node->next;
-      node->next->previous = node->previous;
-      return node;
-    }
-  }
-  return NULL; /* no match found */
+static double checktimeout(lua_State* L, int idx) {
+  double timeout = (double)luaL_checknumber(L, idx);
+  return timeout < 0 ? 0 : timeout;
 }
 
-static void waitonlist(lua_State* L, const char* channel, Proc** list) {
-  Proc* p = getself(L);
-
-  /* link itself at the end of the list */
-  if (*list == NULL) { /* empty list? */
-    *list = p;
-    p->previous = p->next = p;
-  } else {
-    p->previous = (*list)->previous;
-    p->next = *list;
-    p->previous->next = p->next->previous = p;
+/* pack outside of the channel lock, queue it, values are moved only if queued */
+static int sendvalues(lua_State* L, Channel* ch, int first, double timeout) {
+  MessageWriter w;
+  Message* m = msg_pack(L, first, &w);
+  if (m == NULL) {
+    return luaL_error(L, "send to %s: %s", ch->name, w.err);
   }
-
-  p->channel = channel; /* waiting channel */
-
-  do { /* wait on its condition variable */
-    pthread_cond_wait(&p->cond, &kernel_access);
-  } while (p->channel);
+  if (ch_push(ch, m, timeout)) {
+    msg_commit(L, &w);
+    return 1;
+  }
+  msg_abort(L, &w, m);
+  return 0;
 }
 
 static int ll_send(lua_State* L) {
-  Proc* p;
-  const char* channel = luaL_checkstring(L, 1);
-
-  pthread_mutex_lock(&kernel_access);
-
-  p = searchmatch(channel, &waitreceive);
-
-  if (p) { /* found a matching receiver? */
-    movevalues(L, p->L); /* move values to receiver */
-    p->channel = NULL; /* mark receiver as not waiting */
-    pthread_cond_signal(&p->cond); /* wake it up */
-  } else
-    waitonlist(L, channel, &waitsend);
-
-  pthread_mutex_unlock(&kernel_access);
+  Channel* ch = getchannel(L, 1);
+  sendvalues(L, ch, 2, -1);
   return 0;
 }
 
 static int ll_receive(lua_State* L) {
-  Proc* p;
-  const char* channel = luaL_checkstring(L, 1);
+  Channel* ch = getchannel(L, 1);
   lua_settop(L, 1);
+  return msg_unpack(L, ch_pop(ch, -1));
+}
 
-  pthread_mutex_lock(&kernel_access);
+static int ll_try_send(lua_State* L) {
+  Channel* ch = getchannel(L, 1);
+  lua_pushboolean(L, sendvalues(L, ch, 2, 0));
+  return 1;
+}
 
-  p = searchmatch(channel, &waitsend);
+static int ll_try_recv(lua_State* L) {
+  Channel* ch = getchannel(L, 1);
+  Message* m = ch_pop(ch, 0);
+  lua_settop(L, 1);
+  lua_pushboolean(L, m != NULL);
+  return m == NULL ? 1 : 1 + msg_unpack(L, m);
+}
+
+static int ll_send_timeout(lua_State* L) {
+  Channel* ch = getchannel(L, 1);
+  double timeout = checktimeout(L, 2);
+  lua_pushboolean(L, sendvalues(L, ch, 3, timeout));
+  return 1;
+}
 
-  if (p) { /* found a matching sender? */
-    movevalues(p->L, L); /* get values from sender */
-    p->channel = NULL; /* mark sender as not waiting */
-    pthread_cond_signal(&p->cond); /* wake it up */
-  } else
-    waitonlist(L, channel, &waitreceive);
+static int ll_receive_timeout(lua_State* L) {
+  Channel* ch = getchannel(L, 1);
+  Message* m = ch_pop(ch, checktimeout(L, 2));
+  lua_settop(L, 1);
+  lua_pushboolean(L, m != NULL);
+  return m == NULL ? 1 : 1 + msg_unpack(L, m);
+}
 
-  pthread_mutex_unlock(&kernel_access);
+static int ll_channel(lua_State* L) {
+  Channel* ch = getchannel(L, 1);
+  size_t capacity, count;
+  if (!lua_isnoneornil(L, 2)) {
+    lua_Integer cap = luaL_checkinteger(L, 2);
+    luaL_argcheck(L, cap >= 0, 2, "capacity must not be negative");
+    ch_setcapacity(ch, (size_t)cap);
+  }
+  ch_stat(ch, &capacity, &count);
+  lua_pushinteger(L, (lua_Integer)capacity);
+  lua_pushinteger(L, (lua_Integer)count);
+  return 2;
+}
 
-  /* return all stack values except the channel */
-  return lua_gettop(L) - 1;
+static int ll_now(lua_State* L) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  lua_pushnumber(L, (lua_Number)ts.tv_sec + (lua_Number)ts.tv_nsec / 1e9);
+  return 1;
 }
 
 static void registerlib(lua_State* L, const char* name, lua_CFunction f) {
@@ -166,7 +121,8 @@ static void registerlib(lua_State* L, const char* name, lua_CFunction f) {
 static void openlibs(lua_State* L) {
   luaL_requiref(L, "_G", luaopen_base, 1);
   luaL_requiref(L, "package", luaopen_package, 1);
-  lua_pop(L, 2); /* remove results from previous calls */
+  luaL_requiref(L, LUA_UTILLIBNAME, luaopen_util, 1); /* MemBuffer metatable */
+  lua_pop(L, 3); /* remove results from previous calls */
   registerlib(L, "coroutine", luaopen_coroutine);
   registerlib(L, "table", luaopen_table);
   registerlib(L, "io", luaopen_io);
@@ -181,42 +137,45 @@ LUAMOD_API int luaopen_liblproc(lua_State* L);
 
 static void* ll_thread(void* arg) {
   lua_State* L = (lua_State*)arg;
-  Proc* self; /* own control block */
 
   openlibs(L); /* open standard libraries */
   luaL_requiref(L, "liblproc", luaopen_liblproc, 1);
   lua_pop(L, 1); /* remove result from previous call */
 
-  self = (Proc*)lua_newuserdata(L, sizeof(Proc));
-  lua_setfield(L, LUA_REGISTRYINDEX, "_SELF");
-  self->L = L;
-  self->thread = pthread_self();
-  self->channel = NULL;
-  pthread_cond_init(&self->cond, NULL);
+  if (lua_pcall(L, 1, 0, 0) != 0) /* call main chunk with the worker index */
+    fprintf(stderr, "thread error: %s\n", lua_tostring(L, -1));
 
-  if (lua_pcall(L, 0, 0, 0) != 0) /* call main chunk */
-    fprintf(stderr, "thread error: %s", lua_tostring(L, -1));
-
-  pthread_cond_destroy(&getself(L)->cond);
   lua_close(L);
   return NULL;
 }
 
 static int ll_start(lua_State* L) {
   pthread_t thread;
-  const char* chunk = luaL_checkstring(L, 1);
-  lua_State* L1 = luaL_newstate();
+  size_t len;
+  const char* chunk = luaL_checklstring(L, 1, &len);
+  lua_Integer n = luaL_optinteger(L, 2, 1);
+  lua_Integer i;
 
-  if (L1 == NULL)
-    luaL_error(L, "unable to create new state");
+  for (i = 1; i <= n; i++) {
+    lua_State* L1 = luaL_newstate();
 
-  if (luaL_loadstring(L1, chunk) != 0)
-    luaL_error(L, "error in thread body: %s", lua_tostring(L1, -1));
+    if (L1 == NULL)
+      return luaL_error(L, "unable to create new state");
 
-  if (pthread_create(&thread, NULL, ll_thread, L1) != 0)
-    luaL_error(L, "unable to create new thread");
+    if (luaL_loadbuffer(L1, chunk, len, "=lproc") != 0) {
+      lua_pushstring(L, lua_tostring(L1, -1));
+      lua_close(L1);
+      return luaL_error(L, "error in thread body: %s", lua_tostring(L, -1));
+    }
+    lua_pushinteger(L1, i);
 
-  pthread_detach(thread);
+    if (pthread_create(&thread, NULL, ll_thread, L1) != 0) {
+      lua_close(L1);
+      return luaL_error(L, "unable to create new thread");
+    }
+
+    pthread_detach(thread);
+  }
   return 0;
 }
 
@@ -230,11 +189,19 @@ static const struct luaL_Reg ll_funcs[] = {
     {"start", ll_start},
     {"send", ll_send},
     {"receive", ll_receive},
+    {"try_send", ll_try_send},
+    {"try_recv", ll_try_recv},
+    {"send_timeout", ll_send_timeout},
+    {"receive_timeout", ll_receive_timeout},
+    {"channel", ll_channel},
+    {"now", ll_now},
     {"exit", ll_exit},
     {NULL, NULL},
 };
 
 LUAMOD_API int luaopen_liblproc(lua_State* L) {
+  lua_newtable(L);
+  lua_rawsetp(L, LUA_REGISTRYINDEX, &channelCacheKey);
   luaL_newlib(L, ll_funcs); /* open library */
   return 1;
 }
@@ -0,0 +1,96 @@
+#ifndef _LPROC_H_
+#define _LPROC_H_
+
+#define LUA_LIB // for export function
+
+#include <lprefix.h> // must include first
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include <lua.h>
+#include <lualib.h>
+#include <lauxlib.h>
+#include <luautil.h>
+
+#define LPROC_MAXDEPTH 100 // nested tables in one message
+#define LPROC_INLINE 256 // messages up to this size are encoded without heap growth
+
+/*
+** {======================================================
+** Message, values serialized out of one lua_State and into another
+** =======================================================
+*/
+
+typedef struct Message {
+  size_t len; // bytes in data
+  uint32_t nvals; // top-level values
+  uint32_t nmb; // MemBuffers moved with this message, live in mbs
+  luaL_MemBuffer* mbs;
+  uint8_t data[1];
+} Message;
+
+typedef struct MessageWriter {
+  uint8_t* b;
+  size_t n;
+  size_t size;
+  luaL_MemBuffer** srcs; // MemBuffer userdata to be cleared once the message is delivered
+  uint32_t nmb;
+  uint32_t mbsize;
+  const char* err;
+  luaL_MemBuffer* srcinl[8];
+  uint8_t inl[LPROC_INLINE];
+} MessageWriter;
+
+/*
+** encode stack values [first, top] of L, returns NULL and leaves the error in w->err on failure,
+** MemBuffers which are references or thread local (luaL_isMemLocal) are copied, others are moved
+*/
+Message* msg_pack(lua_State* L, int first, MessageWriter* w);
+/* the message was queued, source userdata become empty, copied ones are released on this thread */
+void msg_commit(lua_State* L, MessageWriter* w);
+/* the message was not queued, MemBuffers stay with the sender */
+void msg_abort(lua_State* L, MessageWriter* w, Message* m);
+/* push all values of m, returns the count, m is freed even when it raises an error */
+int msg_unpack(lua_State* L, Message* m);
+void msg_free(Message* m);
+
+/* }====================================================== */
+
+/*
+** {======================================================
+** Channel, bounded MPMC queue of messages
+** =======================================================
+*/
+
+/*
+ * capacity 0 is a rendezvous channel, send completes only when a receiver
+ * is waiting for the message. Otherwise up to 'capacity' messages are buffered.
+ */
+typedef struct Channel {
+  struct Channel* next; // registry bucket chain
+  pthread_mutex_t lock;
+  pthread_cond_t notEmpty;
+  pthread_cond_t notFull;
+  Message** ring;
+  size_t size; // ring slots, power of 2
+  size_t head;
+  size_t count;
+  size_t capacity;
+  size_t waitrecv; // receivers blocked in pop, each one may take a message beyond capacity
+  size_t len;
+  char name[1];
+} Channel;
+
+/* channels live until process exit */
+Channel* ch_get(const char* name, size_t len);
+/* timeout < 0 waits forever, timeout == 0 never waits, returns 1 on success */
+int ch_push(Channel* ch, Message* m, double timeout);
+Message* ch_pop(Channel* ch, double timeout);
+void ch_setcapacity(Channel* ch, size_t capacity);
+void ch_stat(Channel* ch, size_t* capacity, size_t* count);
+
+/* }====================================================== */
+
+#endif /* _LPROC_H_ */
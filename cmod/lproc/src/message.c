@@ -0,0 +1,384 @@
+#include <lproc.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+enum {
+  MT_NIL,
+  MT_FALSE,
+  MT_TRUE,
+  MT_INTEGER,
+  MT_NUMBER,
+  MT_STRING,
+  MT_TABLE, // u32 narr, u32 nhash, narr values, nhash key value pairs
+  MT_LIGHTUD,
+  MT_MEMBUF, // u32 index into mbs
+};
+
+/*
+** {======================================================
+** Writer
+** =======================================================
+*/
+
+static uint8_t* _reserve(MessageWriter* w, size_t len) {
+  if (w->n + len > w->size) {
+    size_t size = w->size * 2;
+    uint8_t* b;
+    while (size < w->n + len) {
+      size *= 2;
+    }
+    if (w->b == w->inl) {
+      b = (uint8_t*)malloc(size);
+      if (b != NULL) {
+        memcpy(b, w->inl, w->n);
+      }
+    } else {
+      b = (uint8_t*)realloc(w->b, size);
+    }
+    if (b == NULL) {
+      w->err = "not enough memory";
+      return NULL;
+    }
+    w->b = b;
+    w->size = size;
+  }
+  uint8_t* p = w->b + w->n;
+  w->n += len;
+  return p;
+}
+
+#define WRITE_TAG(w, t) \
+  do { \
+    uint8_t* p_ = _reserve(w, 1); \
+    if (p_ == NULL) \
+      return; \
+    *p_ = (uint8_t)(t); \
+  } while (0)
+
+#define WRITE_RAW(w, t, v) \
+  do { \
+    uint8_t* p_ = _reserve(w, 1 + sizeof(v)); \
+    if (p_ == NULL) \
+      return; \
+    *p_ = (uint8_t)(t); \
+    memcpy(p_ + 1, &(v), sizeof(v)); \
+  } while (0)
+
+static void _writeMemBuffer(MessageWriter* w, luaL_MemBuffer* mb) {
+  uint32_t i;
+  for (i = 0; i < w->nmb; i++) {
+    if (w->srcs[i] == mb) {
+      w->err = "the same MemBuffer can only be moved once";
+      return;
+    }
+  }
+  if (w->nmb == w->mbsize) {
+    uint32_t size = w->mbsize * 2;
+    luaL_MemBuffer** srcs = (luaL_MemBuffer**)malloc(sizeof(luaL_MemBuffer*) * size);
+    if (srcs == NULL) {
+      w->err = "not enough memory";
+      return;
+    }
+    memcpy(srcs, w->srcs, sizeof(luaL_MemBuffer*) * w->nmb);
+    if (w->srcs != w->srcinl) {
+      free(w->srcs);
+    }
+    w->srcs = srcs;
+    w->mbsize = size;
+  }
+  uint32_t idx = w->nmb++;
+  w->srcs[idx] = mb;
+  WRITE_RAW(w, MT_MEMBUF, idx);
+}
+
+static void _writeValue(lua_State* L, MessageWriter* w, int idx, int depth);
+
+static void _writeTable(lua_State* L, MessageWriter* w, int idx, int depth) {
+  if (depth > LPROC_MAXDEPTH) {
+    w->err = "table too deep or contains a ring";
+    return;
+  }
+  if (!lua_checkstack(L, 3)) {
+    w->err = "stack overflow";
+    return;
+  }
+  uint32_t narr = (uint32_t)lua_rawlen(L, idx);
+  uint32_t nhash = 0;
+  uint32_t i;
+  WRITE_RAW(w, MT_TABLE, narr);
+  size_t countAt = w->n;
+  if (_reserve(w, sizeof(nhash)) == NULL) {
+    return;
+  }
+  for (i = 1; i <= narr && w->err == NULL; i++) {
+    lua_rawgeti(L, idx, i);
+    _writeValue(L, w, lua_gettop(L), depth + 1);
+    lua_pop(L, 1);
+  }
+  lua_pushnil(L);
+  while (w->err == NULL && lua_next(L, idx)) {
+    if (lua_isinteger(L, -2)) {
+      lua_Integer k = lua_tointeger(L, -2);
+      if (k >= 1 && k <= (lua_Integer)narr) { /* already in the array part */
+        lua_pop(L, 1);
+        continue;
+      }
+    }
+    int top = lua_gettop(L);
+    _writeValue(L, w, top - 1, depth + 1);
+    if (w->err == NULL) {
+      _writeValue(L, w, top, depth + 1);
+    }
+    nhash++;
+    lua_pop(L, 1);
+  }
+  if (w->err != NULL) {
+    return;
+  }
+  memcpy(w->b + countAt, &nhash, sizeof(nhash));
+}
+
+static void _writeValue(lua_State* L, MessageWriter* w, int idx, int depth) {
+  switch (lua_type(L, idx)) {
+    case LUA_TNIL:
+      WRITE_TAG(w, MT_NIL);
+      break;
+    case LUA_TBOOLEAN:
+      WRITE_TAG(w, lua_toboolean(L, idx) ? MT_TRUE : MT_FALSE);
+      break;
+    case LUA_TNUMBER:
+      if (lua_isinteger(L, idx)) {
+        lua_Integer i = lua_tointeger(L, idx);
+        WRITE_RAW(w, MT_INTEGER, i);
+      } else {
+        lua_Number n = lua_tonumber(L, idx);
+        WRITE_RAW(w, MT_NUMBER, n);
+      }
+      break;
+    case LUA_TSTRING: {
+      size_t len;
+      const char* str = lua_tolstring(L, idx, &len);
+      WRITE_RAW(w, MT_STRING, len);
+      uint8_t* p = _reserve(w, len);
+      if (p != NULL) {
+        memcpy(p, str, len);
+      }
+      break;
+    }
+    case LUA_TTABLE:
+      _writeTable(L, w, idx, depth);
+      break;
+    case LUA_TLIGHTUSERDATA: {
+      void* ptr = lua_touserdata(L, idx);
+      WRITE_RAW(w, MT_LIGHTUD, ptr);
+      break;
+    }
+    case LUA_TUSERDATA: {
+      luaL_MemBuffer* mb = (luaL_MemBuffer*)luaL_testudata(L, idx, LUA_MEMBUFFER_TYPE);
+      if (mb != NULL) {
+        _writeMemBuffer(w, mb);
+        break;
+      }
+    } /* FALLTHROUGH */
+    default:
+      w->err = "unsupported value type, only nil, boolean, number, string, table, lightuserdata and MemBuffer";
+      break;
+  }
+}
+
+static void _writerFree(MessageWriter* w) {
+  if (w->b != w->inl) {
+    free(w->b);
+  }
+  if (w->srcs != w->srcinl) {
+    free(w->srcs);
+  }
+  w->b = w->inl;
+  w->srcs = w->srcinl;
+}
+
+#define ALIGN_MB(n) (((n) + sizeof(void*) - 1) & ~(sizeof(void*) - 1))
+
+Message* msg_pack(lua_State* L, int first, MessageWriter* w) {
+  int top = lua_gettop(L);
+  int i;
+  w->b = w->inl;
+  w->n = 0;
+  w->size = LPROC_INLINE;
+  w->srcs = w->srcinl;
+  w->nmb = 0;
+  w->mbsize = sizeof(w->srcinl) / sizeof(w->srcinl[0]);
+  w->err = NULL;
+  for (i = first; i <= top && w->err == NULL; i++) {
+    _writeValue(L, w, i, 0);
+  }
+  if (w->err != NULL) {
+    _writerFree(w);
+    return NULL;
+  }
+  size_t offset = ALIGN_MB(offsetof(Message, data) + w->n);
+  Message* m = (Message*)malloc(offset + sizeof(luaL_MemBuffer) * w->nmb);
+  if (m == NULL) {
+    w->err = "not enough memory";
+    _writerFree(w);
+    return NULL;
+  }
+  m->len = w->n;
+  m->nvals = (uint32_t)(top >= first ? top - first + 1 : 0);
+  m->nmb = w->nmb;
+  m->mbs = (luaL_MemBuffer*)((char*)m + offset);
+  memcpy(m->data, w->b, w->n);
+  for (i = 0; i < (int)w->nmb; i++) {
+    if (!luaL_isMemLocal(L, w->srcs[i])) {
+      m->mbs[i] = *w->srcs[i];
+    } else if (!luaL_copyMemBuffer(w->srcs[i], m->mbs + i)) {
+      m->nmb = (uint32_t)i;
+      w->err = "not enough memory";
+      msg_abort(L, w, m);
+      return NULL;
+    }
+  }
+  return m;
+}
+
+void msg_commit(lua_State* L, MessageWriter* w) {
+  uint32_t i;
+  for (i = 0; i < w->nmb; i++) {
+    if (luaL_isMemLocal(L, w->srcs[i])) {
+      MEMBUFFER_RELEASE(w->srcs[i]);
+    } else {
+      MEMBUFFER_SETNULL(w->srcs[i]);
+    }
+  }
+  _writerFree(w);
+}
+
+void msg_abort(lua_State* L, MessageWriter* w, Message* m) {
+  uint32_t i;
+  for (i = 0; i < m->nmb; i++) {
+    if (luaL_isMemLocal(L, w->srcs[i])) {
+      MEMBUFFER_RELEASE(m->mbs + i);
+    }
+  }
+  _writerFree(w);
+  free(m);
+}
+
+/* }====================================================== */
+
+/*
+** {======================================================
+** Reader
+** =======================================================
+*/
+
+typedef struct {
+  Message* m;
+  const uint8_t* p;
+} MessageReader;
+
+#define READ_RAW(r, v) \
+  memcpy(&(v), (r)->p, sizeof(v)); \
+  (r)->p += sizeof(v)
+
+static void _readValue(lua_State* L, MessageReader* r) {
+  uint8_t tag = *r->p++;
+  switch (tag) {
+    case MT_NIL:
+      lua_pushnil(L);
+      break;
+    case MT_FALSE:
+    case MT_TRUE:
+      lua_pushboolean(L, tag == MT_TRUE);
+      break;
+    case MT_INTEGER: {
+      lua_Integer i;
+      READ_RAW(r, i);
+      lua_pushinteger(L, i);
+      break;
+    }
+    case MT_NUMBER: {
+      lua_Number n;
+      READ_RAW(r, n);
+      lua_pushnumber(L, n);
+      break;
+    }
+    case MT_STRING: {
+      size_t len;
+      READ_RAW(r, len);
+      lua_pushlstring(L, (const char*)r->p, len);
+      r->p += len;
+      break;
+    }
+    case MT_TABLE: {
+      uint32_t narr, nhash, i;
+      READ_RAW(r, narr);
+      READ_RAW(r, nhash);
+      luaL_checkstack(L, 3, "message too deep");
+      lua_createtable(L, (int)narr, (int)nhash);
+      for (i = 1; i <= narr; i++) {
+        _readValue(L, r);
+        lua_rawseti(L, -2, i);
+      }
+      for (i = 0; i < nhash; i++) {
+        _readValue(L, r);
+        _readValue(L, r);
+        lua_rawset(L, -3);
+      }
+      break;
+    }
+    case MT_LIGHTUD: {
+      void* ptr;
+      READ_RAW(r, ptr);
+      lua_pushlightuserdata(L, ptr);
+      break;
+    }
+    case MT_MEMBUF: {
+      uint32_t idx;
+      READ_RAW(r, idx);
+      luaL_MemBuffer* mb = r->m->mbs + idx;
+      luaL_pushmembuffer(L, mb);
+      break;
+    }
+    default:
+      lua_assert(0);
+      break;
+  }
+}
+
+static int _unpackProtected(lua_State* L) {
+  Message* m = (Message*)lua_touserdata(L, 1);
+  MessageReader r;
+  uint32_t i;
+  r.m = m;
+  r.p = m->data;
+  luaL_checkstack(L, (int)m->nvals + 1, "too many results");
+  for (i = 0; i < m->nvals; i++) {
+    _readValue(L, &r);
+  }
+  lua_assert(r.p == m->data + m->len);
+  return (int)m->nvals;
+}
+
+int msg_unpack(lua_State* L, Message* m) {
+  int top = lua_gettop(L);
+  lua_pushcfunction(L, _unpackProtected);
+  lua_pushlightuserdata(L, (void*)m);
+  int status = lua_pcall(L, 1, LUA_MULTRET, 0);
+  msg_free(m); /* MemBuffers already pushed were moved out of it */
+  if (status != LUA_OK) {
+    return lua_error(L);
+  }
+  return lua_gettop(L) - top;
+}
+
+void msg_free(Message* m) {
+  uint32_t i;
+  for (i = 0; i < m->nmb; i++) {
+    MEMBUFFER_RELEASE(m->mbs + i);
+  }
+  free(m);
+}
+
+/* }====================================================== */
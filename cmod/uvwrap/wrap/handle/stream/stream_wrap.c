@@ -135,14 +135,9 @@ typedef struct {
   size_t nread;
   luaL_MemBuffer mb;
 } StreamReadResult;
-static void srr_set(StreamReadResult* srr, size_t nread, const uv_buf_t* buf) {
+static void srr_set(StreamReadResult* srr, uv_stream_t* handle, size_t nread, const uv_buf_t* buf) {
   srr->nread = nread;
-  MEMBUFFER_SETNULL(&srr->mb);
-  if (srr->nread > 0) {
-    (void)MEMORY_FUNCTION(buf_moveToMemBuffer)(uv_buf_init(buf->base, nread), &srr->mb);
-  } else {
-    (void)MEMORY_FUNCTION(buf_free)(buf);
-  }
+  (void)MEMORY_FUNCTION(buf_moveRead)((uv_handle_t*)handle, nread, buf, &srr->mb);
 }
 static int srr_push(StreamReadResult* srr, lua_State* L) {
   lua_pushinteger(L, srr->nread); // nread == 0 means No data in buffer, nread == UV_EOF means EOF
@@ -160,16 +155,16 @@ static void srr_clear(void* obj) {
     MEMBUFFER_RELEASE(&srr->mb);
   }
 }
-static int pushReadResult(lua_State* L, ssize_t nread, const uv_buf_t* buf) {
+static int pushReadResult(lua_State* L, uv_stream_t* handle, ssize_t nread, const uv_buf_t* buf) {
   StreamReadResult srr;
-  srr_set(&srr, nread, buf);
+  srr_set(&srr, handle, nread, buf);
   return srr_push(&srr, L);
 }
 static void STREAM_CALLBACK(readStartAsync)(uv_stream_t* handle, ssize_t nread, const uv_buf_t* buf) {
   lua_State* L;
   PUSH_HANDLE_CALLBACK_FOR_INVOKE(L, handle, IDX_STREAM_READ_START);
-  int n = pushReadResult(L, nread, buf);
-  // (void)MEMORY_FUNCTION(buf_free)(buf); // buf will move to membuffer, so no need to free
+  int n = pushReadResult(L, handle, nread, buf);
+  // buf is carved from the ReadPool of the handle and moves to membuffer, so no need to free
   PUSH_HANDLE_ITSELF(L, handle);
   CALL_LUA_FUNCTION(L, n + 1);
 }
@@ -177,14 +172,16 @@ static int STREAM_FUNCTION(readStartAsync)(lua_State* L) {
   uv_stream_t* handle = luaL_checkstream(L, 1);
   luaL_checktype(L, 2, LUA_TFUNCTION);
 
-  int err = uv_read_start(handle, MEMORY_FUNCTION(buf_alloc), STREAM_CALLBACK(readStartAsync));
+  int err = uv_read_start(handle, MEMORY_FUNCTION(buf_alloc_pool), STREAM_CALLBACK(readStartAsync));
   CHECK_ERROR(L, err);
+  (void)EXTENSION_FUNCTION(release)((uv_handle_t*)handle);
+  (void)EXTENSION_FUNCTION(setReadPool)((uv_handle_t*)handle, READ_POOL_BLOCK_SIZE);
   HOLD_CALLBACK_FOR_HANDLE(L, handle, 1, 2);
   return 0;
 }
 
 static void STREAM_CALLBACK(readStartCache)(uv_stream_t* handle, ssize_t nread, const uv_buf_t* buf) {
-  ASYNC_RESUME_CACHE(Stream, readStartCache, pushReadResult, srr_set, StreamReadResult, handle, nread, buf);
+  ASYNC_RESUME_CACHE(Stream, readStartCache, pushReadResult, srr_set, StreamReadResult, handle, handle, nread, buf);
 }
 static int STREAM_FUNCTION(readStartCache)(lua_State* co) {
   CHECK_COROUTINE(co);
@@ -192,8 +189,9 @@ static int STREAM_FUNCTION(readStartCache)(lua_State* co) {
   uint16_t max = (uint16_t)luaL_optinteger(co, 2, 8);
 
   SET_HANDLE_NEW_CACHE(handle, StreamReadResult, max, co, srr_clear);
+  (void)EXTENSION_FUNCTION(setReadPool)((uv_handle_t*)handle, READ_POOL_BLOCK_SIZE);
 
-  int err = uv_read_start(handle, MEMORY_FUNCTION(buf_alloc), STREAM_CALLBACK(readStartCache));
+  int err = uv_read_start(handle, MEMORY_FUNCTION(buf_alloc_pool), STREAM_CALLBACK(readStartCache));
   CHECK_ERROR(co, err);
   HOLD_COROUTINE_FOR_HANDLE_CACHE(co, handle);
   return 0;
@@ -204,6 +202,133 @@ static int STREAM_FUNCTION(readCacheWait)(lua_State* co) {
   PUSH_CACHE_RESULT_OR_YIELD(handle, srr_push, StreamReadResult);
 }
 
+/*
+** Batch read: all reads completed in one loop iteration are collected, and
+** a check handle delivers them with one lua call after the poll phase.
+*/
+typedef struct {
+  HandleExtension ext[1];
+  uv_stream_t* handle;
+  uv_check_t* check; // data is this state, NULL after the state released
+  bool bContiguous;
+  ssize_t status; // pending error, delivered after the pending data
+  size_t total;
+  size_t num;
+  size_t cap;
+  luaL_MemBuffer* mbs;
+} ReadBatchState;
+
+static void STREAM_CALLBACK(readBatchCheckClose)(uv_handle_t* check) {
+  (void)MEMORY_FUNCTION(free)(check);
+}
+static void rbs_release(HandleExtension* ext) {
+  ReadBatchState* rbs = (ReadBatchState*)ext;
+  for (size_t i = 0; i < rbs->num; i++) {
+    MEMBUFFER_RELEASE(&rbs->mbs[i]);
+  }
+  (void)MEMORY_FUNCTION(free)(rbs->mbs);
+  uv_handle_set_data((uv_handle_t*)rbs->check, NULL);
+  uv_close((uv_handle_t*)rbs->check, STREAM_CALLBACK(readBatchCheckClose));
+  (void)MEMORY_FUNCTION(free)(rbs);
+}
+static luaL_MemBuffer* rbs_add(ReadBatchState* rbs) {
+  if (rbs->num == rbs->cap) {
+    size_t cap = rbs->cap * 2;
+    luaL_MemBuffer* mbs = (luaL_MemBuffer*)MEMORY_FUNCTION(malloc)(sizeof(luaL_MemBuffer) * cap);
+    memcpy(mbs, rbs->mbs, sizeof(luaL_MemBuffer) * rbs->num);
+    (void)MEMORY_FUNCTION(free)(rbs->mbs);
+    rbs->mbs = mbs;
+    rbs->cap = cap;
+  }
+  return &rbs->mbs[rbs->num++];
+}
+// [-0, +1], move the pending buffers to a MemBuffer or an array of them
+static void rbs_push(ReadBatchState* rbs, lua_State* L) {
+  if (rbs->bContiguous) {
+    luaL_MemBuffer* mb = luaL_newmembuffer(L);
+    (void)rp_concat(rbs->mbs, rbs->num, rbs->total, mb);
+  } else {
+    lua_createtable(L, (int)rbs->num, 0);
+    for (size_t i = 0; i < rbs->num; i++) {
+      luaL_pushmembuffer(L, &rbs->mbs[i]);
+      lua_rawseti(L, -2, (lua_Integer)(i + 1));
+    }
+  }
+  rbs->num = 0;
+  rbs->total = 0;
+}
+
+static void STREAM_CALLBACK(readBatchFlush)(uv_check_t* check) {
+  ReadBatchState* rbs = (ReadBatchState*)uv_handle_get_data((uv_handle_t*)check);
+  (void)uv_check_stop(check);
+  uv_stream_t* handle = rbs->handle;
+  lua_State* L;
+  if (rbs->num > 0) {
+    PUSH_HANDLE_CALLBACK_FOR_INVOKE(L, handle, IDX_STREAM_READ_START);
+    lua_pushinteger(L, (lua_Integer)rbs->total);
+    (void)rbs_push(rbs, L);
+    PUSH_HANDLE_ITSELF(L, handle);
+    CALL_LUA_FUNCTION(L, 3);
+    // the callback may stop reading or close the handle, which releases the state
+    rbs = (ReadBatchState*)uv_handle_get_data((uv_handle_t*)check);
+    if (rbs == NULL) {
+      return;
+    }
+  }
+  if (rbs->status < 0) {
+    ssize_t status = rbs->status;
+    rbs->status = 0;
+    PUSH_HANDLE_CALLBACK_FOR_INVOKE(L, handle, IDX_STREAM_READ_START);
+    lua_pushinteger(L, status);
+    lua_pushnil(L);
+    PUSH_HANDLE_ITSELF(L, handle);
+    CALL_LUA_FUNCTION(L, 3);
+  }
+}
+static void STREAM_CALLBACK(readStartBatchAsync)(uv_stream_t* handle, ssize_t nread, const uv_buf_t* buf) {
+  ReadBatchState* rbs = (ReadBatchState*)GET_EXTENSION((uv_handle_t*)handle);
+  if (nread > 0) {
+    (void)MEMORY_FUNCTION(buf_moveRead)((uv_handle_t*)handle, nread, buf, rbs_add(rbs));
+    rbs->total += (size_t)nread;
+  } else if (nread < 0) {
+    rbs->status = nread;
+  } else {
+    return; // nread == 0, EAGAIN
+  }
+  (void)uv_check_start(rbs->check, STREAM_CALLBACK(readBatchFlush));
+}
+// callback(nread, data, handle), data is an array of MemBuffer, or one MemBuffer when 'contiguous'
+static int STREAM_FUNCTION(readStartBatchAsync)(lua_State* L) {
+  uv_stream_t* handle = luaL_checkstream(L, 1);
+  luaL_checktype(L, 2, LUA_TFUNCTION);
+  bool bContiguous = (bool)lua_toboolean(L, 3);
+  size_t blockSize = (size_t)luaL_optinteger(L, 4, READ_POOL_BLOCK_SIZE);
+  luaL_argcheck(L, blockSize >= 1024, 4, "block size should not less than 1024");
+
+  int err = uv_read_start(handle, MEMORY_FUNCTION(buf_alloc_pool), STREAM_CALLBACK(readStartBatchAsync));
+  CHECK_ERROR(L, err);
+
+  ReadBatchState* rbs = (ReadBatchState*)MEMORY_FUNCTION(malloc)(sizeof(ReadBatchState));
+  rbs->ext->release = rbs_release;
+  rbs->ext->pool = NULL;
+  rbs->handle = handle;
+  rbs->check = (uv_check_t*)MEMORY_FUNCTION(malloc)(sizeof(uv_check_t));
+  (void)uv_check_init(uv_handle_get_loop((uv_handle_t*)handle), rbs->check);
+  uv_handle_set_data((uv_handle_t*)rbs->check, (void*)rbs);
+  uv_unref((uv_handle_t*)rbs->check);
+  rbs->bContiguous = bContiguous;
+  rbs->status = 0;
+  rbs->total = 0;
+  rbs->num = 0;
+  rbs->cap = 8;
+  rbs->mbs = (luaL_MemBuffer*)MEMORY_FUNCTION(malloc)(sizeof(luaL_MemBuffer) * rbs->cap);
+  (void)EXTENSION_FUNCTION(set)((uv_handle_t*)handle, rbs->ext);
+  (void)EXTENSION_FUNCTION(setReadPool)((uv_handle_t*)handle, blockSize);
+
+  HOLD_CALLBACK_FOR_HANDLE(L, handle, 1, 2);
+  return 0;
+}
+
 static int STREAM_FUNCTION(readStop)(lua_State* L) {
   uv_stream_t* handle = luaL_checkstream(L, 1);
   RELEASE_HANDLE_CACHE(handle);
@@ -216,7 +341,8 @@ static int STREAM_FUNCTION(readStop)(lua_State* L) {
 static void STREAM_CALLBACK(writeAsync)(uv_write_t* req, int status) {
   lua_State* L;
   PUSH_REQ_CALLBACK_CLEAN_FOR_INVOKE(L, req);
-  RELEASE_UNHOLD_REQ_BUFFER(L, req, 1);
+  UNHOLD_REQ_PARAM(L, req, 1);
+  (void)WRITE_REQ_FUNCTION(release)((uvwrap_write_req_t*)req);
   if (lua_isfunction(L, -1)) {
     lua_pushinteger(L, status);
     PUSH_REQ_PARAM_CLEAN(L, req, 2);
@@ -228,28 +354,24 @@ static void STREAM_CALLBACK(writeAsync)(uv_write_t* req, int status) {
     lua_pop(L, 2); // pop the value and msgh
   }
 }
+// data: string, MemBuffer or an array of them, MemBuffer will move into the request
 static int STREAM_FUNCTION(writeAsync)(lua_State* L) {
   uv_stream_t* handle = luaL_checkstream(L, 1);
-  size_t len;
-  const char* data = luaL_checklbuffer(L, 2, &len);
   IS_FUNCTION_OR_MAKE_NIL(L, 3);
 
-  uv_write_t* req = (uv_write_t*)MEMORY_FUNCTION(malloc_req)(sizeof(uv_write_t));
-  BUFS_INIT(data, len);
-  int err = uv_write(req, handle, BUFS, NBUFS, STREAM_CALLBACK(writeAsync));
-  CHECK_ERROR(L, err);
+  uvwrap_write_req_t* wr = WRITE_REQ_FUNCTION(create)(L, 2);
+  uv_write_t* req = &wr->u.write;
+  int err = uv_write(req, handle, wr->bufs, wr->nbufs, STREAM_CALLBACK(writeAsync));
+  CHECK_WRITE_REQ_ERROR(L, wr, err);
   HOLD_REQ_CALLBACK(L, req, 3);
-  HOLD_REQ_PARAM(L, req, 1, 2);
+  HOLD_REQ_PARAM(L, req, 1, -1); // strings of the data
   HOLD_REQ_PARAM(L, req, 2, 1);
   return 0;
 }
 
 static void STREAM_CALLBACK(writeAsyncWait)(uv_write_t* req, int status) {
-  // before resume the coroutine, we should release the 'mb'
-  luaL_MemBuffer* mb = (luaL_MemBuffer*)uv_req_get_data((uv_req_t*)req);
-  if (mb != NULL) {
-    MEMBUFFER_RELEASE(mb);
-  }
+  // before resume the coroutine, we should release the buffers
+  (void)WRITE_REQ_FUNCTION(release)((uvwrap_write_req_t*)req);
   // now we call free the req and resume coroutine
   REQ_ASYNC_WAIT_PREPARE();
   lua_pushinteger(co, status);
@@ -258,18 +380,12 @@ static void STREAM_CALLBACK(writeAsyncWait)(uv_write_t* req, int status) {
 static int STREAM_FUNCTION(writeAsyncWait)(lua_State* co) {
   CHECK_COROUTINE(co);
   uv_stream_t* handle = luaL_checkstream(co, 1);
-  luaL_MemBuffer stackMemBuffer = MEMBUFFER_NULL;
-  luaL_MemBuffer* mb = luaL_tomembuffer(co, 2, &stackMemBuffer);
 
-  uv_write_t* req = (uv_write_t*)MEMORY_FUNCTION(malloc_req)(sizeof(uv_write_t));
-  // we just pass the 'mb' pointer, no need to hold the MemBuffer in Lua
-  // because when yield, the co stack still here and hold the MemBuffer until we resume it
-  // so, we should use 'mb' pointer before resume this coroutine
-  uv_req_set_data((uv_req_t*)req, mb != &stackMemBuffer ? (void*)mb : NULL);
-
-  BUFS_INIT(mb->ptr, mb->sz);
-  int err = uv_write(req, handle, BUFS, NBUFS, STREAM_CALLBACK(writeAsyncWait));
-  CHECK_ERROR(co, err);
+  // strings are held in the co stack until we resume it, MemBuffers are owned by the request
+  uvwrap_write_req_t* wr = WRITE_REQ_FUNCTION(create)(co, 2);
+  uv_write_t* req = &wr->u.write;
+  int err = uv_write(req, handle, wr->bufs, wr->nbufs, STREAM_CALLBACK(writeAsyncWait));
+  CHECK_WRITE_REQ_ERROR(co, wr, err);
   HOLD_COROUTINE_FOR_REQ(co);
   return lua_yield(co, 0);
 }
@@ -277,7 +393,8 @@ static int STREAM_FUNCTION(writeAsyncWait)(lua_State* co) {
 static void STREAM_CALLBACK(write2Async)(uv_write_t* req, int status) {
   lua_State* L;
   PUSH_REQ_CALLBACK_CLEAN_FOR_INVOKE(L, req);
-  RELEASE_UNHOLD_REQ_BUFFER(L, req, 1);
+  UNHOLD_REQ_PARAM(L, req, 1);
+  (void)WRITE_REQ_FUNCTION(release)((uvwrap_write_req_t*)req);
   UNHOLD_REQ_PARAM(L, req, 2);
   if (lua_isfunction(L, -1)) {
     lua_pushinteger(L, status);
@@ -292,28 +409,23 @@ static void STREAM_CALLBACK(write2Async)(uv_write_t* req, int status) {
 }
 static int STREAM_FUNCTION(write2Async)(lua_State* L) {
   uv_stream_t* handle = luaL_checkstream(L, 1);
-  size_t len;
-  const char* data = luaL_checklbuffer(L, 2, &len);
   uv_stream_t* send_handle = luaL_checkstream(L, 3);
   IS_FUNCTION_OR_MAKE_NIL(L, 4);
 
-  uv_write_t* req = (uv_write_t*)MEMORY_FUNCTION(malloc_req)(sizeof(uv_write_t));
-  BUFS_INIT(data, len);
-  int err = uv_write2(req, handle, BUFS, NBUFS, send_handle, STREAM_CALLBACK(write2Async));
-  CHECK_ERROR(L, err);
+  uvwrap_write_req_t* wr = WRITE_REQ_FUNCTION(create)(L, 2);
+  uv_write_t* req = &wr->u.write;
+  int err = uv_write2(req, handle, wr->bufs, wr->nbufs, send_handle, STREAM_CALLBACK(write2Async));
+  CHECK_WRITE_REQ_ERROR(L, wr, err);
   HOLD_REQ_CALLBACK(L, req, 4);
-  HOLD_REQ_PARAM(L, req, 1, 2);
+  HOLD_REQ_PARAM(L, req, 1, -1); // strings of the data
   HOLD_REQ_PARAM(L, req, 2, 3);
   HOLD_REQ_PARAM(L, req, 3, 1);
   return 0;
 }
 
 static void STREAM_CALLBACK(write2AsyncWait)(uv_write_t* req, int status) {
-  // before resume the coroutine, we should release the 'mb'
-  luaL_MemBuffer* mb = (luaL_MemBuffer*)uv_req_get_data((uv_req_t*)req);
-  if (mb != NULL) {
-    MEMBUFFER_RELEASE(mb);
-  }
+  // before resume the coroutine, we should release the buffers
+  (void)WRITE_REQ_FUNCTION(release)((uvwrap_write_req_t*)req);
   // now we call free the req and resume coroutine
   REQ_ASYNC_WAIT_PREPARE();
   lua_pushinteger(co, status);
@@ -322,33 +434,26 @@ static void STREAM_CALLBACK(write2AsyncWait)(uv_write_t* req, int status) {
 static int STREAM_FUNCTION(write2AsyncWait)(lua_State* co) {
   CHECK_COROUTINE(co);
   uv_stream_t* handle = luaL_checkstream(co, 1);
-  luaL_MemBuffer stackMemBuffer = MEMBUFFER_NULL;
-  luaL_MemBuffer* mb = luaL_tomembuffer(co, 2, &stackMemBuffer);
   uv_stream_t* send_handle = luaL_checkstream(co, 3);
 
-  uv_write_t* req = (uv_write_t*)MEMORY_FUNCTION(malloc_req)(sizeof(uv_write_t));
-  // we just pass the 'mb' pointer, no need to hold the MemBuffer in Lua
-  // because when yield, the co stack still here and hold the MemBuffer until we resume it
-  // so, we should use 'mb' pointer before resume this coroutine
-  uv_req_set_data((uv_req_t*)req, mb != &stackMemBuffer ? (void*)mb : NULL);
-
-  BUFS_INIT(mb->ptr, mb->sz);
-  int err = uv_write2(req, handle, BUFS, NBUFS, send_handle, STREAM_CALLBACK(write2AsyncWait));
-  CHECK_ERROR(co, err);
+  // strings are held in the co stack until we resume it, MemBuffers are owned by the request
+  uvwrap_write_req_t* wr = WRITE_REQ_FUNCTION(create)(co, 2);
+  uv_write_t* req = &wr->u.write;
+  int err = uv_write2(req, handle, wr->bufs, wr->nbufs, send_handle, STREAM_CALLBACK(write2AsyncWait));
+  CHECK_WRITE_REQ_ERROR(co, wr, err);
   HOLD_COROUTINE_FOR_REQ(co);
   return lua_yield(co, 0);
 }
 
+// MemBuffers are released after trying, even if only part of them was written
 static int STREAM_FUNCTION(tryWrite)(lua_State* L) {
   uv_stream_t* handle = luaL_checkstream(L, 1);
-  size_t len;
-  const char* data = luaL_checklbuffer(L, 2, &len);
 
-  BUFS_INIT(data, len);
-  int err = uv_try_write(handle, BUFS, NBUFS);
+  uvwrap_write_req_t* wr = WRITE_REQ_FUNCTION(create)(L, 2);
+  int err = uv_try_write(handle, wr->bufs, wr->nbufs);
+  (void)WRITE_REQ_FUNCTION(release)(wr);
+  (void)MEMORY_FUNCTION(free_req)(wr);
   lua_pushinteger(L, err);
-
-  luaL_releasebuffer(L, 2);
   return 1;
 }
 
@@ -394,6 +499,7 @@ static const luaL_Reg uvwrap_stream_metafuncs[] = {
     EMPLACE_STREAM_FUNCTION(readStartAsync),
     EMPLACE_STREAM_FUNCTION(readStartCache),
     EMPLACE_STREAM_FUNCTION(readCacheWait),
+    EMPLACE_STREAM_FUNCTION(readStartBatchAsync),
     EMPLACE_STREAM_FUNCTION(readStop),
     EMPLACE_STREAM_FUNCTION(writeAsync),
     EMPLACE_STREAM_FUNCTION(writeAsyncWait),
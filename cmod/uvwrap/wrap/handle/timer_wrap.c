@@ -149,8 +149,351 @@ static const luaL_Reg TIMER_FUNCTION(metafuncs)[] = {
     {NULL, NULL},
 };
 
+/*
+** {======================================================
+** TimerWheel, many coarse timers on one uv_timer_t
+** =======================================================
+*/
+
+/*
+ * Hierarchical wheel of 256 near slots and 4 levels of 64 slots, in ticks.
+ * Timers are nodes in one array, linked in circular lists whose heads are
+ * the first TW_SLOTS nodes, so start/stop/again are O(1). The uv timer
+ * repeats every tick while any timer is pending and reports everything
+ * expired since the last callback in one Lua call.
+ */
+
+#define TW_NEAR_BITS 8
+#define TW_NEAR (1 << TW_NEAR_BITS)
+#define TW_NEAR_MASK (TW_NEAR - 1)
+#define TW_LEVEL_BITS 6
+#define TW_LEVEL (1 << TW_LEVEL_BITS)
+#define TW_LEVEL_MASK (TW_LEVEL - 1)
+#define TW_LEVELS 4
+#define TW_SLOTS (TW_NEAR + TW_LEVELS * TW_LEVEL)
+#define TW_LEVEL_HEAD(level, idx) (TW_NEAR + (level)*TW_LEVEL + (idx))
+
+typedef struct {
+  uint32_t prev;
+  uint32_t next; // next free node when not linked
+  uint32_t expire; // tick
+  uint32_t gen; // bumped when freed, so stale ids never match
+} WheelNode;
+
+typedef struct {
+  HandleExtension ext[1];
+  WheelNode* nodes;
+  uint32_t size; // nodes allocated, the first TW_SLOTS are list heads
+  uint32_t used; // nodes ever handed out
+  uint32_t freeList; // 0 for empty, node 0 is a list head
+  uint32_t time; // current tick
+  uint64_t tick; // ms per tick
+  uint64_t last; // loop time of the current tick
+  size_t count; // pending timers
+} TimerWheel;
+
+// gen is kept to 31 bits in the id, so the shift stays in range and ids stay positive
+#define TW_GEN(w, i) ((w)->nodes[i].gen & 0x7fffffffu)
+#define TW_ID(w, i) ((lua_Integer)((lua_Unsigned)TW_GEN(w, i) << 32 | (lua_Unsigned)(i)))
+
+static void tw_release(HandleExtension* ext) {
+  TimerWheel* w = (TimerWheel*)ext;
+  (void)MEMORY_FUNCTION(free)(w->nodes);
+  (void)MEMORY_FUNCTION(free)(w);
+}
+
+static TimerWheel* tw_create(uint64_t tick) {
+  TimerWheel* w = (TimerWheel*)MEMORY_FUNCTION(malloc)(sizeof(TimerWheel));
+  w->ext->release = tw_release;
+  w->ext->pool = NULL;
+  w->size = TW_SLOTS * 2;
+  w->nodes = (WheelNode*)MEMORY_FUNCTION(malloc)(sizeof(WheelNode) * w->size);
+  for (uint32_t i = 0; i < TW_SLOTS; i++) {
+    w->nodes[i].prev = i;
+    w->nodes[i].next = i;
+  }
+  w->used = TW_SLOTS;
+  w->freeList = 0;
+  w->time = 0;
+  w->tick = tick;
+  w->last = 0;
+  w->count = 0;
+  return w;
+}
+
+static uint32_t tw_alloc(TimerWheel* w) {
+  uint32_t i = w->freeList;
+  if (i != 0) {
+    w->freeList = w->nodes[i].next;
+    return i;
+  }
+  if (w->used == w->size) {
+    if (w->size > UINT32_MAX / 2) {
+      return 0;
+    }
+    WheelNode* nodes = (WheelNode*)MEMORY_FUNCTION(malloc)(sizeof(WheelNode) * w->size * 2);
+    memcpy(nodes, w->nodes, sizeof(WheelNode) * w->size);
+    (void)MEMORY_FUNCTION(free)(w->nodes);
+    w->nodes = nodes;
+    w->size *= 2;
+  }
+  i = w->used++;
+  w->nodes[i].gen = 0;
+  return i;
+}
+
+static void tw_free(TimerWheel* w, uint32_t i) {
+  w->nodes[i].gen++;
+  w->nodes[i].next = w->freeList;
+  w->freeList = i;
+}
+
+static void tw_link(TimerWheel* w, uint32_t head, uint32_t i) {
+  WheelNode* nodes = w->nodes;
+  uint32_t tail = nodes[head].prev;
+  nodes[i].prev = tail;
+  nodes[i].next = head;
+  nodes[tail].next = i;
+  nodes[head].prev = i;
+}
+
+static void tw_unlink(TimerWheel* w, uint32_t i) {
+  WheelNode* nodes = w->nodes;
+  nodes[nodes[i].prev].next = nodes[i].next;
+  nodes[nodes[i].next].prev = nodes[i].prev;
+}
+
+static void tw_add(TimerWheel* w, uint32_t i) {
+  uint32_t expire = w->nodes[i].expire;
+  uint32_t current = w->time;
+  if ((expire | TW_NEAR_MASK) == (current | TW_NEAR_MASK)) {
+    tw_link(w, expire & TW_NEAR_MASK, i);
+    return;
+  }
+  uint32_t mask = TW_NEAR << TW_LEVEL_BITS;
+  int level = 0;
+  for (; level < TW_LEVELS - 1; level++) {
+    if ((expire | (mask - 1)) == (current | (mask - 1))) {
+      break;
+    }
+    mask <<= TW_LEVEL_BITS;
+  }
+  uint32_t idx = (expire >> (TW_NEAR_BITS + level * TW_LEVEL_BITS)) & TW_LEVEL_MASK;
+  tw_link(w, TW_LEVEL_HEAD(level, idx), i);
+}
+
+/* re-add every node of a level slot, they land in lower levels */
+static void tw_cascade(TimerWheel* w, int level, uint32_t idx) {
+  uint32_t head = TW_LEVEL_HEAD(level, idx);
+  uint32_t i = w->nodes[head].next;
+  w->nodes[head].prev = head;
+  w->nodes[head].next = head;
+  while (i != head) {
+    uint32_t next = w->nodes[i].next;
+    tw_add(w, i);
+    i = next;
+  }
+}
+
+static void tw_shift(TimerWheel* w) {
+  uint32_t ct = ++w->time;
+  if (ct == 0) {
+    tw_cascade(w, TW_LEVELS - 1, 0);
+    return;
+  }
+  uint32_t mask = TW_NEAR;
+  uint32_t time = ct >> TW_NEAR_BITS;
+  for (int level = 0; (ct & (mask - 1)) == 0 && level < TW_LEVELS; level++) {
+    uint32_t idx = time & TW_LEVEL_MASK;
+    if (idx != 0) {
+      tw_cascade(w, level, idx);
+      break;
+    }
+    mask <<= TW_LEVEL_BITS;
+    time >>= TW_LEVEL_BITS;
+  }
+}
+
+/* move the current near slot into the table at top, nodes are freed */
+static void tw_expire(TimerWheel* w, lua_State* L, lua_Integer* n) {
+  uint32_t head = w->time & TW_NEAR_MASK;
+  uint32_t i = w->nodes[head].next;
+  while (i != head) {
+    uint32_t next = w->nodes[i].next;
+    lua_pushinteger(L, TW_ID(w, i));
+    lua_rawseti(L, -2, ++(*n));
+    tw_free(w, i);
+    w->count--;
+    i = next;
+  }
+  w->nodes[head].prev = head;
+  w->nodes[head].next = head;
+}
+
+/* node of a pending timer id, 0 for stale ids */
+static uint32_t tw_find(TimerWheel* w, lua_Integer id) {
+  uint32_t i = (uint32_t)(id & 0xFFFFFFFF);
+  if (i < TW_SLOTS || i >= w->used || TW_GEN(w, i) != (uint32_t)((lua_Unsigned)id >> 32)) {
+    return 0;
+  }
+  return i;
+}
+
+static TimerWheel* tw_check(lua_State* L, uv_timer_t* handle) {
+  TimerWheel* w = (TimerWheel*)GET_EXTENSION((uv_handle_t*)handle);
+  if (w == NULL) {
+    luaL_error(L, "this TimerWheel(%p) has been closed", handle);
+  }
+  return w;
+}
+
+/* expire in ticks for timeout ms from now, never early */
+static uint32_t tw_expireof(lua_State* L, TimerWheel* w, uv_timer_t* handle, int idx) {
+  lua_Integer timeout = luaL_checkinteger(L, idx);
+  luaL_argcheck(L, timeout >= 0, idx, "timeout should >= 0");
+  uint64_t pass = w->count == 0 ? 0 : uv_now(uv_handle_get_loop((uv_handle_t*)handle)) - w->last;
+  uint64_t ticks = ((uint64_t)timeout + pass + w->tick - 1) / w->tick;
+  luaL_argcheck(L, ticks < UINT32_MAX, idx, "timeout too large for the tick");
+  return w->time + (ticks == 0 ? 1 : (uint32_t)ticks);
+}
+
+static void TIMER_CALLBACK(wheelTick)(uv_timer_t* handle) {
+  TimerWheel* w = (TimerWheel*)GET_EXTENSION((uv_handle_t*)handle);
+  uint64_t now = uv_now(uv_handle_get_loop((uv_handle_t*)handle));
+  uint64_t ticks = (now - w->last) / w->tick;
+  w->last += ticks * w->tick;
+
+  lua_State* L = GET_MAIN_LUA_STATE();
+  lua_checkstack(L, LUA_MINSTACK);
+  lua_Integer n = 0;
+  while (ticks-- > 0) {
+    tw_shift(w);
+    uint32_t head = w->time & TW_NEAR_MASK;
+    if (w->nodes[head].next != head) {
+      if (n == 0) {
+        lua_createtable(L, 0, 0);
+      }
+      tw_expire(w, L, &n);
+    }
+  }
+  if (n > 0) {
+    PUSH_HANDLE_ITSELF(L, handle); /* held while the uv timer runs */
+  }
+  if (w->count == 0) {
+    uv_timer_stop(handle);
+    UNHOLD_HANDLE_ITSELF(L, handle);
+  }
+  if (n == 0) {
+    return;
+  }
+  lua_pushcfunction(L, luaL_msgh);
+  lua_getuservalue(L, -2); /* callback */
+  lua_rotate(L, -4, 2); /* msgh, callback, ids, wheel */
+  lua_pushinteger(L, n);
+  lua_insert(L, -2);
+  CALL_LUA_FUNCTION(L, 3);
+}
+
+// start(timeout) => id
+static int TIMER_FUNCTION(wheelStart)(lua_State* L) {
+  uv_timer_t* handle = luaL_checktimerwheel(L, 1);
+  TimerWheel* w = tw_check(L, handle);
+  uint32_t expire = tw_expireof(L, w, handle, 2);
+  if (w->count == 0) { /* the uv timer runs only while some timer is pending */
+    int err = uv_timer_start(handle, TIMER_CALLBACK(wheelTick), w->tick, w->tick);
+    CHECK_ERROR(L, err);
+    w->last = uv_now(uv_handle_get_loop((uv_handle_t*)handle));
+    HOLD_HANDLE_ITSELF(L, handle, 1);
+  }
+  uint32_t i = tw_alloc(w);
+  if (i == 0) {
+    return luaL_error(L, "TimerWheel is full");
+  }
+  w->nodes[i].expire = expire;
+  tw_add(w, i);
+  w->count++;
+  lua_pushinteger(L, TW_ID(w, i));
+  return 1;
+}
+
+// stop(id) => boolean, false if the timer already fired or stopped
+static int TIMER_FUNCTION(wheelStop)(lua_State* L) {
+  uv_timer_t* handle = luaL_checktimerwheel(L, 1);
+  TimerWheel* w = tw_check(L, handle);
+  uint32_t i = tw_find(w, luaL_checkinteger(L, 2));
+  if (i != 0) {
+    tw_unlink(w, i);
+    tw_free(w, i);
+    if (--w->count == 0) {
+      uv_timer_stop(handle);
+      UNHOLD_HANDLE_ITSELF(L, handle);
+    }
+  }
+  lua_pushboolean(L, i != 0);
+  return 1;
+}
+
+// again(id, timeout) => boolean, reschedule a pending timer, keeps its id
+static int TIMER_FUNCTION(wheelAgain)(lua_State* L) {
+  uv_timer_t* handle = luaL_checktimerwheel(L, 1);
+  TimerWheel* w = tw_check(L, handle);
+  uint32_t i = tw_find(w, luaL_checkinteger(L, 2));
+  if (i != 0) {
+    w->nodes[i].expire = tw_expireof(L, w, handle, 3);
+    tw_unlink(w, i);
+    tw_add(w, i);
+  }
+  lua_pushboolean(L, i != 0);
+  return 1;
+}
+
+static int TIMER_FUNCTION(wheelGetCount)(lua_State* L) {
+  uv_timer_t* handle = luaL_checktimerwheel(L, 1);
+  lua_pushinteger(L, (lua_Integer)tw_check(L, handle)->count);
+  return 1;
+}
+
+static int TIMER_FUNCTION(wheelGetTick)(lua_State* L) {
+  uv_timer_t* handle = luaL_checktimerwheel(L, 1);
+  lua_pushinteger(L, (lua_Integer)tw_check(L, handle)->tick);
+  return 1;
+}
+
+static const luaL_Reg TIMER_FUNCTION(wheelMetafuncs)[] = {
+    {"start", TIMER_FUNCTION(wheelStart)},
+    {"stop", TIMER_FUNCTION(wheelStop)},
+    {"again", TIMER_FUNCTION(wheelAgain)},
+    {"getCount", TIMER_FUNCTION(wheelGetCount)},
+    {"getTick", TIMER_FUNCTION(wheelGetTick)},
+    {"__gc", HANDLE_FUNCTION(__gc)},
+    {NULL, NULL},
+};
+
+// TimerWheel(loop, tick, callback), callback(ids, n, wheel) gets every timer expired since the last tick
+int TIMER_FUNCTION(TimerWheel)(lua_State* L) {
+  uv_loop_t* loop = luaL_checkuvloop(L, 1);
+  lua_Integer tick = luaL_checkinteger(L, 2);
+  luaL_argcheck(L, tick > 0, 2, "tick should > 0");
+  luaL_checktype(L, 3, LUA_TFUNCTION);
+
+  uv_timer_t* handle = (uv_timer_t*)lua_newuserdata(L, sizeof(uv_timer_t));
+
+  int err = uv_timer_init(loop, handle);
+  CHECK_ERROR(L, err);
+
+  luaL_setmetatable(L, UVWRAP_TIMER_WHEEL_TYPE);
+  (void)HANDLE_FUNCTION(ctor)(L, (uv_handle_t*)handle);
+  (void)EXTENSION_FUNCTION(set)((uv_handle_t*)handle, (HandleExtension*)tw_create((uint64_t)tick));
+  lua_pushvalue(L, 3);
+  lua_setuservalue(L, -2); // not in the registry, an idle wheel can be collected with its callback
+  return 1;
+}
+
+/* }====================================================== */
+
 static void TIMER_FUNCTION(init_metatable)(lua_State* L) {
   REGISTER_METATABLE_INHERIT(UVWRAP_TIMER_TYPE, TIMER_FUNCTION(metafuncs), UVWRAP_HANDLE_TYPE);
+  REGISTER_METATABLE_INHERIT(UVWRAP_TIMER_WHEEL_TYPE, TIMER_FUNCTION(wheelMetafuncs), UVWRAP_HANDLE_TYPE);
 }
 
 int TIMER_FUNCTION(Timer)(lua_State* L) {
@@ -168,6 +511,7 @@ int TIMER_FUNCTION(Timer)(lua_State* L) {
 
 static const luaL_Reg TIMER_FUNCTION(funcs)[] = {
     EMPLACE_TIMER_FUNCTION(Timer),
+    EMPLACE_TIMER_FUNCTION(TimerWheel),
     {NULL, NULL},
 };
 
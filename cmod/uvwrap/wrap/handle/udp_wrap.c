@@ -102,7 +102,8 @@ static int UDP_FUNCTION(setTtl)(lua_State* L) {
 static void UDP_CALLBACK(sendAsync)(uv_udp_send_t* req, int status) {
   lua_State* L;
   PUSH_REQ_CALLBACK_CLEAN_FOR_INVOKE(L, req);
-  RELEASE_UNHOLD_REQ_BUFFER(L, req, 1);
+  UNHOLD_REQ_PARAM(L, req, 1);
+  (void)WRITE_REQ_FUNCTION(release)((uvwrap_write_req_t*)req);
   if (lua_isfunction(L, -1)) {
     lua_pushinteger(L, status);
     PUSH_REQ_PARAM_CLEAN(L, req, 2);
@@ -114,29 +115,25 @@ static void UDP_CALLBACK(sendAsync)(uv_udp_send_t* req, int status) {
     lua_pop(L, 2); // pop the value and msgh
   }
 }
+// data: string, MemBuffer or an array of them sent as one datagram, MemBuffer will move into the request
 static int UDP_FUNCTION(sendAsync)(lua_State* L) {
   uv_udp_t* handle = luaL_checkudp(L, 1);
-  size_t len;
-  const char* data = luaL_checklbuffer(L, 2, &len);
   struct sockaddr* addr = luaL_checksockaddr(L, 3);
   IS_FUNCTION_OR_MAKE_NIL(L, 4);
 
-  uv_udp_send_t* req = (uv_udp_send_t*)MEMORY_FUNCTION(malloc_req)(sizeof(uv_udp_send_t));
-  BUFS_INIT(data, len);
-  int err = uv_udp_send(req, handle, BUFS, NBUFS, addr, UDP_CALLBACK(sendAsync)); // bufs and addr are passed by value
-  CHECK_ERROR(L, err);
+  uvwrap_write_req_t* wr = WRITE_REQ_FUNCTION(create)(L, 2);
+  uv_udp_send_t* req = &wr->u.send;
+  int err = uv_udp_send(req, handle, wr->bufs, wr->nbufs, addr, UDP_CALLBACK(sendAsync)); // bufs and addr are passed by value
+  CHECK_WRITE_REQ_ERROR(L, wr, err);
   HOLD_REQ_CALLBACK(L, req, 4);
-  HOLD_REQ_PARAM(L, req, 1, 2);
+  HOLD_REQ_PARAM(L, req, 1, -1); // strings of the data
   HOLD_REQ_PARAM(L, req, 2, 1);
   return 0;
 }
 
 static void UDP_CALLBACK(sendAsyncWait)(uv_udp_send_t* req, int status) {
-  // before resume the coroutine, we should release the 'mb'
-  luaL_MemBuffer* mb = (luaL_MemBuffer*)uv_req_get_data((uv_req_t*)req);
-  if (mb != NULL) {
-    MEMBUFFER_RELEASE(mb);
-  }
+  // before resume the coroutine, we should release the buffers
+  (void)WRITE_REQ_FUNCTION(release)((uvwrap_write_req_t*)req);
   // now we call free the req and resume coroutine
   REQ_ASYNC_WAIT_PREPARE();
   lua_pushinteger(co, status);
@@ -145,35 +142,28 @@ static void UDP_CALLBACK(sendAsyncWait)(uv_udp_send_t* req, int status) {
 static int UDP_FUNCTION(sendAsyncWait)(lua_State* co) {
   CHECK_COROUTINE(co);
   uv_udp_t* handle = luaL_checkudp(co, 1);
-  luaL_MemBuffer stackMemBuffer = MEMBUFFER_NULL;
-  luaL_MemBuffer* mb = luaL_tomembuffer(co, 2, &stackMemBuffer);
   struct sockaddr* addr = luaL_checksockaddr(co, 3);
 
-  uv_udp_send_t* req = (uv_udp_send_t*)MEMORY_FUNCTION(malloc_req)(sizeof(uv_udp_send_t));
-  // we just pass the 'mb' pointer, no need to hold the MemBuffer in Lua
-  // because when yield, the co stack still here and hold the MemBuffer until we resume it
-  // so, we should use 'mb' pointer before resume this coroutine
-  uv_req_set_data((uv_req_t*)req, mb != &stackMemBuffer ? (void*)mb : NULL);
-
-  BUFS_INIT(mb->ptr, mb->sz);
-  int err = uv_udp_send(req, handle, BUFS, NBUFS, addr, UDP_CALLBACK(sendAsyncWait)); // bufs and addr are passed by value
-  CHECK_ERROR(co, err);
+  // strings are held in the co stack until we resume it, MemBuffers are owned by the request
+  uvwrap_write_req_t* wr = WRITE_REQ_FUNCTION(create)(co, 2);
+  uv_udp_send_t* req = &wr->u.send;
+  int err = uv_udp_send(req, handle, wr->bufs, wr->nbufs, addr, UDP_CALLBACK(sendAsyncWait)); // bufs and addr are passed by value
+  CHECK_WRITE_REQ_ERROR(co, wr, err);
   HOLD_COROUTINE_FOR_REQ(co);
   return lua_yield(co, 0);
 }
 
+// MemBuffers are released after trying
 static int UDP_FUNCTION(trySend)(lua_State* L) {
   uv_udp_t* handle = luaL_checkudp(L, 1);
-  size_t len;
-  const char* data = luaL_checklbuffer(L, 2, &len);
   struct sockaddr* addr = luaL_checksockaddr(L, 3);
 
-  BUFS_INIT(data, len);
-  int err = uv_udp_try_send(handle, BUFS, NBUFS, addr);
+  uvwrap_write_req_t* wr = WRITE_REQ_FUNCTION(create)(L, 2);
+  int err = uv_udp_try_send(handle, wr->bufs, wr->nbufs, addr);
+  (void)WRITE_REQ_FUNCTION(release)(wr);
+  (void)MEMORY_FUNCTION(free_req)(wr);
   lua_pushinteger(L, err);
-
-  luaL_releasebuffer(L, 2);
-  return 0;
+  return 1;
 }
 
 typedef struct {
@@ -265,6 +255,321 @@ static int UDP_FUNCTION(recvCacheWait)(lua_State* co) {
   PUSH_CACHE_RESULT_OR_YIELD(handle, urr_push, UdpRecvResult);
 }
 
+/*
+** Batch receive: datagrams land in fixed size slots of a slab. On linux the
+** recv callback drains the socket with recvmmsg, other platforms collect what
+** libuv delivers, a check handle calls lua once after the poll phase, or
+** earlier when all slots are used.
+*/
+typedef struct {
+  HandleExtension ext[1];
+  uv_udp_t* handle;
+  uv_check_t* check; // data is this state, NULL after the state released
+  bool bWithAddr;
+  ssize_t status; // pending error, delivered after the pending datagrams
+  unsigned int max;
+  unsigned int num;
+  size_t slotSize;
+  char* slab;
+  size_t* lens;
+  struct sockaddr_storage* addrs;
+#if defined(__linux__)
+  struct mmsghdr* msgs;
+  struct iovec* iovs;
+#endif
+} UdpBatchState;
+
+static void UDP_CALLBACK(recvBatchCheckClose)(uv_handle_t* check) {
+  (void)MEMORY_FUNCTION(free)(check);
+}
+static void ubs_release(HandleExtension* ext) {
+  UdpBatchState* ubs = (UdpBatchState*)ext;
+  uv_handle_set_data((uv_handle_t*)ubs->check, NULL);
+  uv_close((uv_handle_t*)ubs->check, UDP_CALLBACK(recvBatchCheckClose));
+  (void)MEMORY_FUNCTION(free_buf)(ubs->slab);
+  (void)MEMORY_FUNCTION(free)(ubs->lens);
+  (void)MEMORY_FUNCTION(free)(ubs->addrs);
+#if defined(__linux__)
+  (void)MEMORY_FUNCTION(free)(ubs->msgs);
+  (void)MEMORY_FUNCTION(free)(ubs->iovs);
+#endif
+  (void)MEMORY_FUNCTION(free)(ubs);
+}
+#define ubs_slot(ubs, i) ((ubs)->slab + (size_t)(i) * (ubs)->slotSize)
+
+static void UDP_CALLBACK(recvBatchAlloc)(uv_handle_t* handle, size_t suggested_size, uv_buf_t* buf) {
+  UdpBatchState* ubs = (UdpBatchState*)GET_EXTENSION(handle);
+  *buf = uv_buf_init(ubs_slot(ubs, ubs->num), (unsigned int)ubs->slotSize);
+}
+// recvmmsg into the free slots, without blocking
+static void ubs_drain(UdpBatchState* ubs) {
+#if defined(__linux__)
+  uv_os_fd_t fd;
+  if (uv_fileno((uv_handle_t*)ubs->handle, &fd) != UVWRAP_OK) {
+    return;
+  }
+  unsigned int start = ubs->num;
+  unsigned int n = ubs->max - start;
+  for (unsigned int i = 0; i < n; i++) {
+    struct iovec* iov = &ubs->iovs[i];
+    iov->iov_base = ubs_slot(ubs, start + i);
+    iov->iov_len = ubs->slotSize;
+    struct msghdr* hdr = &ubs->msgs[i].msg_hdr;
+    memset(hdr, 0, sizeof(struct msghdr));
+    if (ubs->bWithAddr) {
+      hdr->msg_name = &ubs->addrs[start + i];
+      hdr->msg_namelen = sizeof(struct sockaddr_storage);
+    }
+    hdr->msg_iov = iov;
+    hdr->msg_iovlen = 1;
+  }
+  int ret;
+  do {
+    ret = recvmmsg(fd, ubs->msgs, n, MSG_DONTWAIT, NULL);
+  } while (ret == -1 && errno == EINTR);
+  if (ret > 0) {
+    for (int i = 0; i < ret; i++) {
+      ubs->lens[start + i] = ubs->msgs[i].msg_len;
+    }
+    ubs->num += (unsigned int)ret;
+  }
+#else
+  (void)ubs;
+#endif
+}
+// [-0, +3], datagrams packed back to back in one MemBuffer, their sizes, their addresses or nil
+static void ubs_push(UdpBatchState* ubs, lua_State* L) {
+  size_t total = 0;
+  for (unsigned int i = 0; i < ubs->num; i++) {
+    total += ubs->lens[i];
+  }
+  char* ptr = (char*)MEMORY_FUNCTION(malloc_buf)(total > 0 ? total : 1);
+  luaL_MemBuffer* mb = luaL_newmembuffer(L);
+  lua_createtable(L, (int)ubs->num, 0);
+  size_t offset = 0;
+  for (unsigned int i = 0; i < ubs->num; i++) {
+    memcpy(ptr + offset, ubs_slot(ubs, i), ubs->lens[i]);
+    offset += ubs->lens[i];
+    lua_pushinteger(L, (lua_Integer)ubs->lens[i]);
+    lua_rawseti(L, -2, (lua_Integer)(i + 1));
+  }
+  (void)MEMORY_FUNCTION(buf_moveToMemBuffer)(uv_buf_init(ptr, (unsigned int)total), mb);
+  if (ubs->bWithAddr) {
+    lua_createtable(L, (int)ubs->num, 0);
+    for (unsigned int i = 0; i < ubs->num; i++) {
+      lua_pushsockaddr(L, (const struct sockaddr*)&ubs->addrs[i]);
+      lua_rawseti(L, -2, (lua_Integer)(i + 1));
+    }
+  } else {
+    lua_pushnil(L);
+  }
+  ubs->num = 0;
+}
+// deliver the pending datagrams then the pending error, stop when the callback releases the state
+static void ubs_flush(UdpBatchState* ubs) {
+  uv_check_t* check = ubs->check;
+  uv_udp_t* handle = ubs->handle;
+  (void)uv_check_stop(check);
+  lua_State* L;
+  if (ubs->num > 0) {
+    PUSH_HANDLE_CALLBACK_FOR_INVOKE(L, handle, IDX_UDP_RECV_START);
+    lua_pushinteger(L, (lua_Integer)ubs->num);
+    (void)ubs_push(ubs, L);
+    PUSH_HANDLE_ITSELF(L, handle);
+    CALL_LUA_FUNCTION(L, 5);
+    ubs = (UdpBatchState*)uv_handle_get_data((uv_handle_t*)check);
+    if (ubs == NULL) {
+      return;
+    }
+  }
+  if (ubs->status < 0) {
+    ssize_t status = ubs->status;
+    ubs->status = 0;
+    PUSH_HANDLE_CALLBACK_FOR_INVOKE(L, handle, IDX_UDP_RECV_START);
+    lua_pushinteger(L, status);
+    lua_pushnil(L);
+    lua_pushnil(L);
+    lua_pushnil(L);
+    PUSH_HANDLE_ITSELF(L, handle);
+    CALL_LUA_FUNCTION(L, 5);
+  }
+}
+static void UDP_CALLBACK(recvBatchFlush)(uv_check_t* check) {
+  (void)ubs_flush((UdpBatchState*)uv_handle_get_data((uv_handle_t*)check));
+}
+static void UDP_CALLBACK(recvStartBatchAsync)(uv_udp_t* handle, ssize_t nread, const uv_buf_t* buf, const struct sockaddr* addr,
+                                              unsigned flags) {
+  UdpBatchState* ubs = (UdpBatchState*)GET_EXTENSION((uv_handle_t*)handle);
+  if (nread < 0) {
+    ubs->status = nread;
+  } else if (addr != NULL) { // datagram in slot 'num', maybe empty
+    ubs->lens[ubs->num] = (size_t)nread;
+    if (ubs->bWithAddr) {
+      util_copySockAddr(addr, &ubs->addrs[ubs->num]);
+    }
+    ubs->num++;
+    (void)ubs_drain(ubs);
+    if (ubs->num == ubs->max) {
+      (void)ubs_flush(ubs);
+      return;
+    }
+  } else {
+    return; // nothing to read
+  }
+  (void)uv_check_start(ubs->check, UDP_CALLBACK(recvBatchFlush));
+}
+// callback(count, data, lens, addrs, handle), count < 0 means error
+// datagrams longer than 'slotSize' are truncated
+static int UDP_FUNCTION(recvStartBatchAsync)(lua_State* L) {
+  uv_udp_t* handle = luaL_checkudp(L, 1);
+  luaL_checktype(L, 2, LUA_TFUNCTION);
+  lua_Integer max = luaL_optinteger(L, 3, 64);
+  lua_Integer slotSize = luaL_optinteger(L, 4, 2048);
+  bool bWithAddr = lua_isnoneornil(L, 5) || lua_toboolean(L, 5);
+  luaL_argcheck(L, max > 0 && max <= 1024, 3, "max datagrams should in [1, 1024]");
+  luaL_argcheck(L, slotSize > 0 && slotSize <= 65536, 4, "slot size should in [1, 65536]");
+
+  int err = uv_udp_recv_start(handle, UDP_CALLBACK(recvBatchAlloc), UDP_CALLBACK(recvStartBatchAsync));
+  CHECK_ERROR(L, err);
+
+  UdpBatchState* ubs = (UdpBatchState*)MEMORY_FUNCTION(malloc)(sizeof(UdpBatchState));
+  ubs->ext->release = ubs_release;
+  ubs->ext->pool = NULL;
+  ubs->handle = handle;
+  ubs->check = (uv_check_t*)MEMORY_FUNCTION(malloc)(sizeof(uv_check_t));
+  (void)uv_check_init(uv_handle_get_loop((uv_handle_t*)handle), ubs->check);
+  uv_handle_set_data((uv_handle_t*)ubs->check, (void*)ubs);
+  uv_unref((uv_handle_t*)ubs->check);
+  ubs->bWithAddr = bWithAddr;
+  ubs->status = 0;
+  ubs->max = (unsigned int)max;
+  ubs->num = 0;
+  ubs->slotSize = (size_t)slotSize;
+  ubs->slab = (char*)MEMORY_FUNCTION(malloc_buf)(ubs->slotSize * ubs->max);
+  ubs->lens = (size_t*)MEMORY_FUNCTION(malloc)(sizeof(size_t) * ubs->max);
+  ubs->addrs = (struct sockaddr_storage*)MEMORY_FUNCTION(malloc)(sizeof(struct sockaddr_storage) * ubs->max);
+#if defined(__linux__)
+  ubs->msgs = (struct mmsghdr*)MEMORY_FUNCTION(malloc)(sizeof(struct mmsghdr) * ubs->max);
+  ubs->iovs = (struct iovec*)MEMORY_FUNCTION(malloc)(sizeof(struct iovec) * ubs->max);
+#endif
+  (void)EXTENSION_FUNCTION(set)((uv_handle_t*)handle, ubs->ext);
+
+  HOLD_CALLBACK_FOR_HANDLE(L, handle, 1, 2);
+  return 0;
+}
+
+#define UDP_SEND_BATCH 64
+// [-0, +0], datagram 'i' of the array at 'idx'
+static uv_buf_t UDP_FUNCTION(checkDatagram)(lua_State* L, int idx, lua_Integer i) {
+  size_t sz = 0;
+  const char* ptr = NULL;
+  lua_rawgeti(L, idx, i);
+  if (lua_type(L, -1) == LUA_TSTRING) {
+    ptr = lua_tolstring(L, -1, &sz);
+  } else {
+    luaL_MemBuffer* mb = (luaL_MemBuffer*)luaL_testudata(L, -1, LUA_MEMBUFFER_TYPE);
+    if (mb == NULL) {
+      luaL_error(L, "datagram %d should be string or MemBuffer", (int)i);
+    }
+    ptr = (const char*)mb->ptr;
+    sz = mb->sz;
+  }
+  lua_pop(L, 1); // the array holds it
+  return uv_buf_init((char*)ptr, (unsigned int)sz);
+}
+// [-0, +0], address of datagram 'i', NULL for connected udp
+static const struct sockaddr* UDP_FUNCTION(checkBatchAddr)(lua_State* L, int idx, lua_Integer i) {
+  if (lua_isnoneornil(L, idx)) {
+    return NULL;
+  }
+  if (!lua_istable(L, idx)) {
+    return luaL_checksockaddr(L, idx);
+  }
+  lua_rawgeti(L, idx, i);
+  const struct sockaddr* addr = (const struct sockaddr*)luaL_testudata(L, -1, UVWRAP_SOCKADDR_TYPE);
+  if (addr == NULL) {
+    luaL_error(L, "address %d should be sockaddr", (int)i);
+  }
+  lua_pop(L, 1); // the array holds it
+  return addr;
+}
+// Send an array of datagrams now, with sendmmsg on linux. Nothing is moved,
+// the caller keeps the MemBuffers. addrs: one sockaddr for all, an array of
+// sockaddr, or nil for connected udp.
+// Return the number of datagrams sent, or the error when none is sent.
+static int UDP_FUNCTION(sendBatch)(lua_State* L) {
+  uv_udp_t* handle = luaL_checkudp(L, 1);
+  luaL_checktype(L, 2, LUA_TTABLE);
+  lua_Integer count = (lua_Integer)luaL_len(L, 2);
+  lua_Integer sent = 0;
+  if (uv_udp_get_send_queue_count(handle) > 0) { // keep the order with the queued sends
+    lua_pushinteger(L, UV_EAGAIN);
+    return 1;
+  }
+#if defined(__linux__)
+  uv_os_fd_t fd;
+  if (count > 0 && uv_fileno((uv_handle_t*)handle, &fd) != UVWRAP_OK) {
+    // the socket is created on first send, let libuv bind it
+    uv_buf_t buf = UDP_FUNCTION(checkDatagram)(L, 2, 1);
+    int err = uv_udp_try_send(handle, &buf, 1, UDP_FUNCTION(checkBatchAddr)(L, 3, 1));
+    if (err < 0) {
+      lua_pushinteger(L, err);
+      return 1;
+    }
+    sent = 1;
+    (void)uv_fileno((uv_handle_t*)handle, &fd);
+  }
+  struct mmsghdr msgs[UDP_SEND_BATCH];
+  struct iovec iovs[UDP_SEND_BATCH];
+  while (sent < count) {
+    int n = 0;
+    for (; n < UDP_SEND_BATCH && sent + n < count; n++) {
+      uv_buf_t buf = UDP_FUNCTION(checkDatagram)(L, 2, sent + n + 1);
+      const struct sockaddr* addr = UDP_FUNCTION(checkBatchAddr)(L, 3, sent + n + 1);
+      iovs[n].iov_base = buf.base;
+      iovs[n].iov_len = buf.len;
+      struct msghdr* hdr = &msgs[n].msg_hdr;
+      memset(hdr, 0, sizeof(struct msghdr));
+      if (addr != NULL) {
+        hdr->msg_name = (void*)addr;
+        hdr->msg_namelen = addr->sa_family == AF_INET ? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6);
+      }
+      hdr->msg_iov = &iovs[n];
+      hdr->msg_iovlen = 1;
+    }
+    int ret;
+    do {
+      ret = sendmmsg(fd, msgs, (unsigned int)n, 0);
+    } while (ret == -1 && errno == EINTR);
+    if (ret < 0) {
+      if (sent == 0) {
+        lua_pushinteger(L, (errno == EAGAIN || errno == EWOULDBLOCK) ? UV_EAGAIN : -errno);
+        return 1;
+      }
+      break;
+    }
+    sent += ret;
+    if (ret < n) {
+      break;
+    }
+  }
+#else
+  for (; sent < count; sent++) {
+    uv_buf_t buf = UDP_FUNCTION(checkDatagram)(L, 2, sent + 1);
+    int err = uv_udp_try_send(handle, &buf, 1, UDP_FUNCTION(checkBatchAddr)(L, 3, sent + 1));
+    if (err < 0) {
+      if (sent == 0) {
+        lua_pushinteger(L, err);
+        return 1;
+      }
+      break;
+    }
+  }
+#endif
+  lua_pushinteger(L, sent);
+  return 1;
+}
+
 static int UDP_FUNCTION(recvStop)(lua_State* L) {
   uv_udp_t* handle = luaL_checkudp(L, 1);
   RELEASE_HANDLE_CACHE(handle);
@@ -309,9 +614,11 @@ const luaL_Reg UDP_FUNCTION(metafuncs)[] = {
     EMPLACE_UDP_FUNCTION(sendAsync),
     EMPLACE_UDP_FUNCTION(sendAsyncWait),
     EMPLACE_UDP_FUNCTION(trySend),
+    EMPLACE_UDP_FUNCTION(sendBatch),
     EMPLACE_UDP_FUNCTION(recvStartAsync),
     EMPLACE_UDP_FUNCTION(recvStartCache),
     EMPLACE_UDP_FUNCTION(recvCacheWait),
+    EMPLACE_UDP_FUNCTION(recvStartBatchAsync),
     EMPLACE_UDP_FUNCTION(recvStop),
     EMPLACE_UDP_FUNCTION(getSendQueueSize),
     EMPLACE_UDP_FUNCTION(getSendQueueCount),
@@ -0,0 +1,418 @@
+#define luawork_c
+#include <uvwrap.h>
+
+#include <lualib.h>
+
+/*
+** {======================================================
+** Lua worker pool on the libuv threadpool
+** =======================================================
+*/
+
+/*
+ * Each threadpool thread owns one lua_State, created on its first job and
+ * kept until process exit. States open the standard libraries, copy
+ * package.path/cpath of the state which configured the pool, and require
+ * the preload modules once. Arguments and results cross threads in the
+ * luaL_serialize format.
+ */
+
+#define LUAWORK_WARM_TIMEOUT 1000000000 // ns, warm jobs wait this long for each other
+
+typedef struct {
+  uv_work_t req;
+  luaL_ByteBuffer buf[1]; // arguments, then results or the error message
+  bool ok;
+  char name[1]; // function to run, NULL terminated
+} LuaWork;
+
+typedef struct {
+  bool started; // config is frozen once the first job was queued, main thread only
+  unsigned int poolSize;
+  char* path;
+  char* cpath;
+  char** preload; // NULL terminated
+  uv_mutex_t lock;
+  uv_cond_t warmCond;
+  unsigned int warmArrived;
+  unsigned int warmPending; // main thread only
+  size_t states;
+  size_t queued; // waiting for a thread
+  size_t running;
+  uv_key_t key;
+} LuaWorkPool;
+
+static LuaWorkPool pool;
+static uv_once_t poolOnce = UV_ONCE_INIT;
+
+static void luawork_initPool(void) {
+  const char* val = getenv("UV_THREADPOOL_SIZE"); // same rule as libuv threadpool.c
+  pool.poolSize = val != NULL ? (unsigned int)atoi(val) : 4;
+  if (pool.poolSize == 0) {
+    pool.poolSize = 1;
+  }
+  if (pool.poolSize > 1024) {
+    pool.poolSize = 1024;
+  }
+  if (uv_mutex_init(&pool.lock) || uv_cond_init(&pool.warmCond) || uv_key_create(&pool.key)) {
+    abort();
+  }
+}
+
+static char* luawork_strdup(const char* str) {
+  if (str == NULL) {
+    return NULL;
+  }
+  size_t len = strlen(str) + 1;
+  char* dup = (char*)MEMORY_FUNCTION(malloc)(len);
+  memcpy(dup, str, len);
+  return dup;
+}
+
+static void luawork_freeConfig(void) {
+  (void)MEMORY_FUNCTION(free)(pool.path);
+  (void)MEMORY_FUNCTION(free)(pool.cpath);
+  if (pool.preload != NULL) {
+    for (char** p = pool.preload; *p != NULL; p++) {
+      (void)MEMORY_FUNCTION(free)(*p);
+    }
+    (void)MEMORY_FUNCTION(free)(pool.preload);
+  }
+  pool.path = NULL;
+  pool.cpath = NULL;
+  pool.preload = NULL;
+}
+
+/* copy package.path/cpath of L and the preload list at idx (0 for none) */
+static void luawork_config(lua_State* L, int idx) {
+  luawork_freeConfig();
+  if (lua_getglobal(L, "package") == LUA_TTABLE) {
+    lua_getfield(L, -1, "path");
+    pool.path = luawork_strdup(lua_tostring(L, -1));
+    lua_getfield(L, -2, "cpath");
+    pool.cpath = luawork_strdup(lua_tostring(L, -1));
+    lua_pop(L, 2);
+  }
+  lua_pop(L, 1);
+  size_t n = idx == 0 ? 0 : luaL_len(L, idx);
+  pool.preload = (char**)MEMORY_FUNCTION(malloc)(sizeof(char*) * (n + 1));
+  for (size_t i = 0; i < n; i++) {
+    lua_geti(L, idx, (lua_Integer)i + 1);
+    pool.preload[i] = luawork_strdup(lua_tostring(L, -1));
+    lua_pop(L, 1);
+  }
+  pool.preload[n] = NULL;
+}
+
+static void luawork_checkConfig(lua_State* L, int idx) {
+  uv_once(&poolOnce, luawork_initPool);
+  if (!pool.started) {
+    if (idx != 0 || pool.preload == NULL) {
+      luawork_config(L, idx);
+    }
+  } else if (idx != 0) {
+    luaL_error(L, "lua work pool is already running");
+  }
+}
+
+/* }====================================================== */
+
+/*
+** {======================================================
+** Worker thread side
+** =======================================================
+*/
+
+static void luawork_setPackage(lua_State* L, const char* field, const char* value) {
+  if (value != NULL && lua_getglobal(L, "package") == LUA_TTABLE) {
+    lua_pushstring(L, value);
+    lua_setfield(L, -2, field);
+  }
+  lua_pop(L, 1);
+}
+
+static lua_State* luawork_getState(void) {
+  lua_State* L = (lua_State*)uv_key_get(&pool.key);
+  if (L != NULL) {
+    return L;
+  }
+  L = luaL_newstate();
+  if (L == NULL) {
+    return NULL;
+  }
+  luaL_openlibs(L);
+  luawork_setPackage(L, "path", pool.path);
+  luawork_setPackage(L, "cpath", pool.cpath);
+  for (char** p = pool.preload; p != NULL && *p != NULL; p++) {
+    lua_getglobal(L, "require");
+    lua_pushstring(L, *p);
+    if (lua_pcall(L, 1, 0, 0) != LUA_OK) {
+      fprintf(stderr, "lua work preload '%s' error: %s\n", *p, lua_tostring(L, -1));
+      lua_pop(L, 1);
+    }
+  }
+  lua_newtable(L); // resolved functions, name -> function
+  lua_rawsetp(L, LUA_REGISTRYINDEX, (void*)&pool);
+  uv_key_set(&pool.key, (void*)L);
+  uv_mutex_lock(&pool.lock);
+  pool.states++;
+  uv_mutex_unlock(&pool.lock);
+  return L;
+}
+
+/* name is 'global' or 'module.function', the module part goes through require */
+static void luawork_pushFunction(lua_State* L, const char* name) {
+  lua_rawgetp(L, LUA_REGISTRYINDEX, (void*)&pool);
+  if (lua_getfield(L, -1, name) == LUA_TFUNCTION) {
+    lua_remove(L, -2);
+    return;
+  }
+  lua_pop(L, 1);
+  const char* dot = strrchr(name, '.');
+  if (dot == NULL) {
+    lua_getglobal(L, name);
+  } else {
+    lua_getglobal(L, "require");
+    lua_pushlstring(L, name, dot - name);
+    lua_call(L, 1, 1);
+    if (!lua_istable(L, -1)) {
+      lua_pushlstring(L, name, dot - name);
+      luaL_error(L, "module '%s' is not a table", lua_tostring(L, -1));
+    }
+    lua_getfield(L, -1, dot + 1);
+    lua_remove(L, -2);
+  }
+  if (!lua_isfunction(L, -1)) {
+    luaL_error(L, "'%s' is not a function", name);
+  }
+  lua_pushvalue(L, -1);
+  lua_setfield(L, -3, name);
+  lua_remove(L, -2);
+}
+
+static int luawork_run(lua_State* L) {
+  LuaWork* work = (LuaWork*)lua_touserdata(L, 1);
+  lua_settop(L, 0);
+  luawork_pushFunction(L, work->name);
+  int nargs = luaL_deserialize(L, work->buf->b, work->buf->n);
+  lua_call(L, nargs, LUA_MULTRET);
+  luaBB_clear(work->buf);
+  luaL_serialize(L, 1, lua_gettop(L), work->buf);
+  return 0;
+}
+
+static int luawork_serialize(lua_State* L) {
+  LuaWork* work = (LuaWork*)lua_touserdata(L, 1);
+  luaL_serialize(L, 2, lua_gettop(L) - 1, work->buf);
+  return 0;
+}
+
+static void luawork_worker(uv_work_t* req) {
+  LuaWork* work = (LuaWork*)req;
+  uv_mutex_lock(&pool.lock);
+  pool.queued--;
+  pool.running++;
+  uv_mutex_unlock(&pool.lock);
+  lua_State* L = luawork_getState();
+  work->ok = false;
+  if (L == NULL) {
+    luaBB_clear(work->buf);
+  } else {
+    lua_pushcfunction(L, luawork_run);
+    lua_pushlightuserdata(L, (void*)work);
+    work->ok = lua_pcall(L, 1, 0, 0) == LUA_OK;
+    if (!work->ok) {
+      const char* msg = lua_tostring(L, -1);
+      if (msg == NULL) {
+        msg = lua_pushfstring(L, "(error object is a %s value)", luaL_typename(L, -1));
+      }
+      luaBB_clear(work->buf);
+      lua_pushcfunction(L, luawork_serialize);
+      lua_pushlightuserdata(L, (void*)work);
+      lua_pushstring(L, msg);
+      if (lua_pcall(L, 2, 0, 0) != LUA_OK) {
+        luaBB_clear(work->buf);
+      }
+    }
+    lua_settop(L, 0);
+  }
+  uv_mutex_lock(&pool.lock);
+  pool.running--;
+  uv_mutex_unlock(&pool.lock);
+}
+
+/* create the state of this thread and wait for the other warm jobs, so each one lands on its own thread */
+static void luawork_warm(uv_work_t* req) {
+  (void)luawork_getState();
+  uv_mutex_lock(&pool.lock);
+  pool.queued--;
+  pool.warmArrived++;
+  if (pool.warmArrived % pool.poolSize == 0) {
+    uv_cond_broadcast(&pool.warmCond);
+  } else {
+    unsigned int round = pool.warmArrived / pool.poolSize;
+    while (pool.warmArrived / pool.poolSize == round) {
+      if (uv_cond_timedwait(&pool.warmCond, &pool.lock, LUAWORK_WARM_TIMEOUT) != 0) {
+        break; // busy or smaller threadpool, give up spreading
+      }
+    }
+  }
+  uv_mutex_unlock(&pool.lock);
+}
+
+/* }====================================================== */
+
+/*
+** {======================================================
+** Lua API
+** =======================================================
+*/
+
+static void callback_luawork_warm(uv_work_t* req, int status) {
+  (void)MEMORY_FUNCTION(free_req)(req);
+  if (--pool.warmPending != 0) {
+    return;
+  }
+  lua_State* L = GET_MAIN_LUA_STATE();
+  PREPARE_CALL_LUA(L);
+  if (lua_rawgetp(L, LUA_REGISTRYINDEX, (void*)&pool.warmPending) == LUA_TFUNCTION) {
+    lua_pushnil(L);
+    lua_rawsetp(L, LUA_REGISTRYINDEX, (void*)&pool.warmPending);
+    CALL_LUA_FUNCTION(L, 0);
+  } else {
+    lua_pop(L, 2); // pop the value and msgh
+  }
+}
+
+// luaWorkSetup(loop, preload, callback), preload is a list of module names, callback runs once all states are warm
+int uvwrap_luaWorkSetup(lua_State* L) {
+  uv_loop_t* loop = luaL_checkuvloop(L, 1);
+  if (!lua_isnoneornil(L, 2)) {
+    luaL_checktype(L, 2, LUA_TTABLE);
+  }
+  IS_FUNCTION_OR_MAKE_NIL(L, 3);
+  luawork_checkConfig(L, lua_istable(L, 2) ? 2 : 0);
+  if (pool.warmPending != 0) {
+    return luaL_error(L, "lua work pool is warming");
+  }
+  for (unsigned int i = 0; i < pool.poolSize; i++) {
+    uv_work_t* req = (uv_work_t*)MEMORY_FUNCTION(malloc_req)(sizeof(uv_work_t));
+    uv_mutex_lock(&pool.lock);
+    pool.queued++;
+    uv_mutex_unlock(&pool.lock);
+    int err = uv_queue_work(loop, req, luawork_warm, callback_luawork_warm);
+    if (err != UVWRAP_OK) {
+      uv_mutex_lock(&pool.lock);
+      pool.queued--;
+      uv_mutex_unlock(&pool.lock);
+      (void)MEMORY_FUNCTION(free_req)(req);
+      CHECK_ERROR(L, err);
+    }
+    pool.warmPending++;
+  }
+  pool.started = true;
+  lua_pushvalue(L, 3);
+  lua_rawsetp(L, LUA_REGISTRYINDEX, (void*)&pool.warmPending);
+  return 0;
+}
+
+static int luawork_deserialize(lua_State* L) {
+  LuaWork* work = (LuaWork*)lua_touserdata(L, 1);
+  return luaL_deserialize(L, work->buf->b, work->buf->n);
+}
+
+static void callback_luawork(uv_work_t* req, int status) {
+  LuaWork* work = (LuaWork*)req;
+  lua_State* L;
+  PUSH_REQ_CALLBACK_CLEAN_FOR_INVOKE(L, req);
+  if (lua_isfunction(L, -1)) {
+    int n;
+    if (status == UV_ECANCELED) {
+      lua_pushboolean(L, 0);
+      lua_pushstring(L, uv_strerror(status));
+      n = 1;
+    } else if (!work->ok && work->buf->n == 0) { // no state for this thread, or out of memory
+      lua_pushboolean(L, 0);
+      lua_pushliteral(L, "lua work failed to run");
+      n = 1;
+    } else { // the results may not fit the stack, errors must not leak work
+      lua_pushboolean(L, work->ok);
+      int top = lua_gettop(L);
+      lua_pushcfunction(L, luawork_deserialize);
+      lua_pushlightuserdata(L, (void*)work);
+      if (lua_pcall(L, 1, LUA_MULTRET, 0) == LUA_OK) {
+        n = lua_gettop(L) - top;
+      } else {
+        lua_pushboolean(L, 0);
+        lua_replace(L, top);
+        n = 1;
+      }
+    }
+    luaBB_destroy(work->buf);
+    (void)MEMORY_FUNCTION(free)((void*)work);
+    CALL_LUA_FUNCTION(L, n + 1);
+  } else {
+    luaBB_destroy(work->buf);
+    (void)MEMORY_FUNCTION(free)((void*)work);
+    lua_pop(L, 2); // pop the value and msgh
+  }
+}
+
+// queueLuaWork(loop, name, callback, ...), callback(ok, ...) gets the results or the error like pcall
+int uvwrap_queueLuaWork(lua_State* L) {
+  uv_loop_t* loop = luaL_checkuvloop(L, 1);
+  size_t len;
+  const char* name = luaL_checklstring(L, 2, &len);
+  IS_FUNCTION_OR_MAKE_NIL(L, 3);
+  luawork_checkConfig(L, 0);
+
+  LuaWork* work = (LuaWork*)MEMORY_FUNCTION(malloc)(sizeof(LuaWork) + len);
+  memcpy(work->name, name, len + 1);
+  work->ok = false;
+  luaBB_init(work->buf, 0);
+
+  int top = lua_gettop(L);
+  lua_pushcfunction(L, luawork_serialize);
+  lua_pushlightuserdata(L, (void*)work);
+  for (int i = 4; i <= top; i++) {
+    lua_pushvalue(L, i);
+  }
+  if (lua_pcall(L, top - 3 + 1, 0, 0) != LUA_OK) {
+    luaBB_destroy(work->buf);
+    (void)MEMORY_FUNCTION(free)((void*)work);
+    return lua_error(L);
+  }
+
+  pool.started = true;
+  uv_mutex_lock(&pool.lock);
+  pool.queued++;
+  uv_mutex_unlock(&pool.lock);
+  int err = uv_queue_work(loop, (uv_work_t*)work, luawork_worker, callback_luawork);
+  if (err != UVWRAP_OK) {
+    uv_mutex_lock(&pool.lock);
+    pool.queued--;
+    uv_mutex_unlock(&pool.lock);
+    luaBB_destroy(work->buf);
+    (void)MEMORY_FUNCTION(free)((void*)work);
+  }
+  CHECK_ERROR(L, err);
+  HOLD_REQ_CALLBACK(L, work, 3);
+  return 0;
+}
+
+// luaWorkStat() => poolSize, states, queued, running
+int uvwrap_luaWorkStat(lua_State* L) {
+  uv_once(&poolOnce, luawork_initPool);
+  uv_mutex_lock(&pool.lock);
+  size_t states = pool.states;
+  size_t queued = pool.queued;
+  size_t running = pool.running;
+  uv_mutex_unlock(&pool.lock);
+  lua_pushinteger(L, (lua_Integer)pool.poolSize);
+  lua_pushinteger(L, (lua_Integer)states);
+  lua_pushinteger(L, (lua_Integer)queued);
+  lua_pushinteger(L, (lua_Integer)running);
+  return 4;
+}
+
+/* }====================================================== */
@@ -7,145 +7,246 @@
 ** =======================================================
 */
 
-typedef struct {
-  luaL_ByteBuffer tmp[1];
-  luaL_ByteBuffer b[1];
-  luaL_ByteBuffer bc[1]; // byte buffer for cache
-  luaL_MemBuffer cache[1];
-} PacketManager;
-
 typedef enum {
   PS_OK,
   PS_NeedMore,
   PS_ErrorLength,
 } PacketStatus;
 
-static void _packLengthToBuffer(luaL_ByteBuffer* b, uint32_t len) {
-  do {
-    luaBB_addbyte(b, (uint8_t)(len | 0x80));
+// Frame: varint(typeLen) typeName varint(dataLen) data
+#define PM_VARINT_MAX 5
+#define PM_HEADER_INLINE 64
+
+// bytes added by addPackData, or a frame assembled from several of them
+typedef struct {
+  luaL_MemBuffer mb;
+  size_t ref; // one for the PacketManager while parsing it, one for each slice
+} PacketChunk;
+
+typedef struct {
+  luaL_ByteBuffer tmp[1]; // output of packPacket
+  luaL_ByteBuffer carry[1]; // the head of a frame which crosses chunks, never a complete frame
+  PacketChunk* chunk; // data waiting for parse
+  size_t pos; // parsed bytes in chunk
+} PacketManager;
+
+typedef struct {
+  const char* typeName;
+  const uint8_t* ptrBuffer;
+  uint32_t typeLen;
+  uint32_t ptrLen;
+  PacketChunk* chunk; // holds the memory of the packet until pm_releasePacket
+} Packet;
+
+static uint8_t* _packLength(uint8_t* ptr, uint32_t len) {
+  while (len >= 0x80) {
+    *ptr++ = (uint8_t)(len | 0x80);
     len >>= 7;
-  } while (len >= 0x80);
-  luaBB_addbyte(b, (uint8_t)len);
+  }
+  *ptr++ = (uint8_t)len;
+  return ptr;
+}
+static size_t _packHeader(uint8_t* ptr, const char* typeName, uint32_t typeLen, uint32_t ptrLen) {
+  uint8_t* p = _packLength(ptr, typeLen);
+  memcpy(p, typeName, typeLen);
+  p = _packLength(p + typeLen, ptrLen);
+  return (size_t)(p - ptr);
 }
+#define HEADER_SIZE(typeLen) ((typeLen) + PM_VARINT_MAX * 2)
 
-static PacketStatus _unpackLengthFromBuffer(luaL_ByteBuffer* b, uint32_t* outLen) {
-  uint32_t len = 0;
-  const int maxByte = (sizeof(*outLen) * 8 + 6) / 7;
-  for (int i = 0; i < maxByte; i++) {
-    const uint8_t* byte = luaBB_readbytes(b, 1);
-    if (byte == NULL) {
+static PacketStatus _unpackLength(const uint8_t* ptr, size_t len, size_t* pos, uint32_t* outLen) {
+  uint32_t value = 0;
+  for (int i = 0; i < PM_VARINT_MAX; i++) {
+    if (*pos >= len) {
       return PS_NeedMore;
     }
-    len |= (uint32_t)(*byte & 0x7F) << (7 * i);
-    if ((*byte & 0x80) == 0) {
-      *outLen = len;
+    const uint8_t byte = ptr[(*pos)++];
+    value |= (uint32_t)(byte & 0x7F) << (7 * i);
+    if ((byte & 0x80) == 0) {
+      *outLen = value;
       return PS_OK;
     }
   }
   return PS_ErrorLength;
 }
+// parse the frame at the head of [ptr, ptr + len), '*size' is the frame size when PS_OK,
+// or the bytes known to be needed when PS_NeedMore
+static PacketStatus _unpackFrame(const uint8_t* ptr, size_t len, Packet* packet, size_t* size) {
+  size_t pos = 0;
+  PacketStatus status = _unpackLength(ptr, len, &pos, &packet->typeLen);
+  if (status == PS_OK) {
+    if (len - pos < packet->typeLen) {
+      *size = pos + packet->typeLen + 1;
+      return PS_NeedMore;
+    }
+    packet->typeName = (const char*)ptr + pos;
+    pos += packet->typeLen;
+    status = _unpackLength(ptr, len, &pos, &packet->ptrLen);
+    if (status == PS_OK) {
+      if (len - pos < packet->ptrLen) {
+        *size = pos + packet->ptrLen;
+        return PS_NeedMore;
+      }
+      packet->ptrBuffer = ptr + pos;
+      *size = pos + packet->ptrLen;
+      return PS_OK;
+    }
+  }
+  *size = len + 1;
+  return status;
+}
+
+static void pc_unref(PacketChunk* chunk) {
+  if (--chunk->ref == 0) {
+    MEMBUFFER_RELEASE(&chunk->mb);
+    (void)MEMORY_FUNCTION(free)(chunk);
+  }
+}
+static void pc_mb_release(const luaL_MemBuffer* mb) {
+  (void)pc_unref((PacketChunk*)mb->ud);
+}
+// take the ownership of 'mb'
+static PacketChunk* pc_create(luaL_MemBuffer* mb) {
+  PacketChunk* chunk = (PacketChunk*)MEMORY_FUNCTION(malloc)(sizeof(PacketChunk));
+  MEMBUFFER_MOVEINIT(mb, &chunk->mb);
+  chunk->ref = 1;
+  return chunk;
+}
+static void pc_carry_release(const luaL_MemBuffer* mb) {
+  luaBB_destroybuffer((uint8_t*)mb->ptr);
+}
+// slice of the packet data, share the memory with its chunk
+static void pc_slice(PacketChunk* chunk, const uint8_t* ptr, size_t sz, luaL_MemBuffer* mb) {
+  chunk->ref++;
+  MEMBUFFER_SETINIT(mb, ptr, sz, pc_mb_release, chunk);
+}
 
 static void pm_init(PacketManager* pm) {
   luaBB_init(pm->tmp, BASE_BUFFER_SIZE);
-  luaBB_init(pm->b, BASE_BUFFER_SIZE);
-  luaBB_static(pm->bc, NULL, 0, true, false);
-  MEMBUFFER_SETNULL(pm->cache);
+  luaBB_init(pm->carry, BASE_BUFFER_SIZE);
+  pm->chunk = NULL;
+  pm->pos = 0;
+}
+
+static void pm_dropChunk(PacketManager* pm) {
+  if (pm->chunk != NULL) {
+    (void)pc_unref(pm->chunk);
+    pm->chunk = NULL;
+    pm->pos = 0;
+  }
+}
+static size_t pm_chunkRemain(PacketManager* pm) {
+  return pm->chunk != NULL ? pm->chunk->mb.sz - pm->pos : 0;
+}
+#define pm_chunkPtr(pm) ((const uint8_t*)(pm)->chunk->mb.ptr + (pm)->pos)
+static void pm_addCarry(PacketManager* pm, const uint8_t* ptr, size_t len) {
+  if (pm->carry->b == NULL) { // moved out to a chunk
+    luaBB_init(pm->carry, (uint32_t)len);
+  }
+  luaBB_addbytes(pm->carry, ptr, (uint32_t)len);
 }
 
 static void pm_destroy(PacketManager* pm) {
   luaBB_destroy(pm->tmp);
-  luaBB_destroy(pm->b);
-  luaBB_destroy(pm->bc);
-  MEMBUFFER_RELEASE(pm->cache);
+  luaBB_destroy(pm->carry);
+  pm_dropChunk(pm);
 }
 
-typedef struct {
-  const char* typeName;
-  const uint8_t* ptrBuffer;
-  uint32_t typeLen;
-  uint32_t ptrLen;
-} Packet;
-
 static const uint8_t* pm_packPacket(PacketManager* pm, const Packet* packet, size_t* sz) {
   luaBB_clear(pm->tmp);
-  _packLengthToBuffer(pm->tmp, packet->typeLen);
-  luaBB_addbytes(pm->tmp, (const uint8_t*)packet->typeName, packet->typeLen);
-  _packLengthToBuffer(pm->tmp, packet->ptrLen);
-  luaBB_addbytes(pm->tmp, packet->ptrBuffer, packet->ptrLen);
+  uint8_t* ptr = luaBB_appendbytes(pm->tmp, HEADER_SIZE(packet->typeLen) + packet->ptrLen);
+  size_t n = _packHeader(ptr, packet->typeName, packet->typeLen, packet->ptrLen);
+  memcpy(ptr + n, packet->ptrBuffer, packet->ptrLen);
+  pm->tmp->n = (uint32_t)(n + packet->ptrLen);
   if (sz) {
     *sz = pm->tmp->n;
   }
   return pm->tmp->b;
 }
 
-static void pm_appendCache(PacketManager* pm) {
-  uint32_t count = luaBB_getremainforread(pm->bc);
-  if (count > 0) {
-    const uint8_t* ptr = luaBB_readbytes(pm->bc, count);
-    luaBB_addbytes(pm->b, (const uint8_t*)ptr, (uint32_t)count);
-  }
-  MEMBUFFER_RELEASE(pm->cache);
-}
+// MemBuffer with release moves in without copy, drain the packets before adding more to keep it so
 static void pm_addPackData(PacketManager* pm, luaL_MemBuffer* mb) {
-  pm_appendCache(pm);
-  if (MEMBUFFER_CAN_CACHE(mb)) {
-    luaBB_static(pm->bc, (uint8_t*)mb->ptr, (uint32_t)mb->sz, true, false);
-    MEMBUFFER_MOVEINIT(mb, pm->cache);
-  } else {
-    luaBB_addbytes(pm->b, (const uint8_t*)mb->ptr, (uint32_t)mb->sz);
+  const size_t remain = pm_chunkRemain(pm);
+  if (remain > 0 || !MEMBUFFER_CAN_CACHE(mb)) {
+    uint8_t* ptr = (uint8_t*)MEMORY_FUNCTION(malloc_buf)(remain + mb->sz);
+    if (remain > 0) {
+      memcpy(ptr, pm_chunkPtr(pm), remain);
+    }
+    memcpy(ptr + remain, mb->ptr, mb->sz);
+    luaL_MemBuffer copy[1] = {MEMBUFFER_NULL};
+    (void)MEMORY_FUNCTION(buf_moveToMemBuffer)(uv_buf_init((char*)ptr, (unsigned int)(remain + mb->sz)), copy);
     MEMBUFFER_RELEASE(mb);
+    pm_dropChunk(pm);
+    pm->chunk = pc_create(copy);
+  } else {
+    pm_dropChunk(pm);
+    pm->chunk = pc_create(mb);
   }
+  pm->pos = 0;
 }
 
-static PacketStatus _unpackTuple(luaL_ByteBuffer* b, const uint8_t** outPtr, uint32_t* outLen) {
-  uint32_t len = 0;
-  PacketStatus status = _unpackLengthFromBuffer(b, &len);
-  if (status == PS_OK) {
-    const uint8_t* ptr = luaBB_readbytes(b, (uint32_t)len);
-    if (ptr == NULL) {
-      status = PS_NeedMore;
-    } else {
-      *outPtr = ptr;
-      *outLen = len;
+static PacketStatus pm_error(PacketManager* pm, PacketStatus status) {
+  luaBB_clear(pm->carry);
+  pm_dropChunk(pm);
+  return status;
+}
+// complete the frame in carry with the bytes from chunk
+static PacketStatus pm_nextPacketCarry(PacketManager* pm, Packet* outPacket) {
+  for (;;) {
+    size_t need;
+    const PacketStatus status = _unpackFrame(pm->carry->b, pm->carry->n, outPacket, &need);
+    if (status == PS_OK) {
+      uint32_t len = 0;
+      const uint8_t* ptr = luaBB_movebuffer(pm->carry, &len);
+      luaL_MemBuffer mb[1];
+      MEMBUFFER_SETINIT(mb, ptr, len, pc_carry_release, NULL);
+      outPacket->chunk = pc_create(mb);
+      return PS_OK;
+    }
+    if (status != PS_NeedMore) {
+      return pm_error(pm, status);
+    }
+    size_t remain = pm_chunkRemain(pm);
+    if (remain == 0) {
+      pm_dropChunk(pm);
+      return PS_NeedMore;
     }
+    size_t n = need - pm->carry->n;
+    n = n < remain ? n : remain;
+    pm_addCarry(pm, pm_chunkPtr(pm), n);
+    pm->pos += n;
   }
-  return status;
 }
-static PacketStatus pm_nextPacketByteBuffer(luaL_ByteBuffer* b, Packet* outPacket) {
-  luaBB_flushread(b);
-  PacketStatus status = _unpackTuple(b, (const uint8_t**)&outPacket->typeName, &outPacket->typeLen);
-  if (status == PS_OK) {
-    status = _unpackTuple(b, (const uint8_t**)&outPacket->ptrBuffer, &outPacket->ptrLen);
+static PacketStatus pm_nextPacket(PacketManager* pm, Packet* outPacket) {
+  if (pm->carry->n > 0) {
+    return pm_nextPacketCarry(pm, outPacket);
   }
+  size_t remain = pm_chunkRemain(pm);
+  if (remain == 0) {
+    pm_dropChunk(pm);
+    return PS_NeedMore;
+  }
+  size_t size;
+  const PacketStatus status = _unpackFrame(pm_chunkPtr(pm), remain, outPacket, &size);
   switch (status) {
     case PS_OK:
+      pm->pos += size;
+      pm->chunk->ref++;
+      outPacket->chunk = pm->chunk;
       break;
-    case PS_NeedMore:
-      luaBB_undoread(b);
+    case PS_NeedMore: // the head of a frame, carry it to the next chunk
+      pm_addCarry(pm, pm_chunkPtr(pm), remain);
+      pm_dropChunk(pm);
       break;
     case PS_ErrorLength:
       /* fall through */
     default:
-      luaBB_clear(b);
-      break;
+      return pm_error(pm, status);
   }
   return status;
 }
-static PacketStatus pm_nextPacket(PacketManager* pm, Packet* outPacket) {
-again:
-  if (!luaBB_isemptyforread(pm->b)) {
-    const PacketStatus status = pm_nextPacketByteBuffer(pm->b, outPacket);
-    if (status == PS_NeedMore && !luaBB_isemptyforread(pm->bc)) {
-      pm_appendCache(pm);
-      goto again;
-    }
-    return status;
-  }
-  if (!luaBB_isemptyforread(pm->bc)) {
-    return pm_nextPacketByteBuffer(pm->bc, outPacket);
-  }
-  MEMBUFFER_RELEASE(pm->cache);
-  return PS_NeedMore;
+static void pm_releasePacket(Packet* packet) {
+  (void)pc_unref(packet->chunk);
 }
 
 /* }====================================================== */
@@ -160,6 +261,7 @@ again:
 
 #define luaL_checkpacketmanager(L, idx) (PacketManager*)luaL_checkudata(L, idx, PACKET_MANATER_TYPE)
 
+// copy the frame into one buffer, the MemBuffer is valid until the next call of packPacket
 static int PM_FUNCTION(packPacket)(lua_State* L) {
   PacketManager* pm = luaL_checkpacketmanager(L, 1);
   size_t typeLen = 0;
@@ -168,7 +270,7 @@ static int PM_FUNCTION(packPacket)(lua_State* L) {
   const uint8_t* ptrBuffer = (const uint8_t*)luaL_checklbuffer(L, 3, &ptrLen);
   const bool bUseString = luaL_optboolean(L, 4, false);
 
-  const Packet packet = {typeName, ptrBuffer, (uint32_t)typeLen, (uint32_t)ptrLen};
+  const Packet packet = {typeName, ptrBuffer, (uint32_t)typeLen, (uint32_t)ptrLen, NULL};
   size_t sz;
   const uint8_t* ptr = pm_packPacket(pm, &packet, &sz);
 
@@ -181,6 +283,35 @@ static int PM_FUNCTION(packPacket)(lua_State* L) {
   }
   return 1;
 }
+// no copy of data: return {header, data}, ready for writeAsync, reuse 'iov' if given
+static int PM_FUNCTION(packFrame)(lua_State* L) {
+  luaL_checkpacketmanager(L, 1);
+  size_t typeLen = 0;
+  const char* typeName = luaL_checklstring(L, 2, &typeLen);
+  size_t ptrLen;
+  (void)luaL_checklbuffer(L, 3, &ptrLen);
+  luaL_argcheck(L, ptrLen <= UINT32_MAX, 3, "data too large for a frame");
+  if (lua_istable(L, 4)) {
+    lua_settop(L, 4);
+  } else {
+    lua_settop(L, 3);
+    lua_createtable(L, 2, 0);
+  }
+
+  if (HEADER_SIZE(typeLen) <= PM_HEADER_INLINE) {
+    uint8_t header[PM_HEADER_INLINE];
+    size_t n = _packHeader(header, typeName, (uint32_t)typeLen, (uint32_t)ptrLen);
+    lua_pushlstring(L, (const char*)header, n);
+  } else {
+    luaL_Buffer b;
+    uint8_t* header = (uint8_t*)luaL_buffinitsize(L, &b, HEADER_SIZE(typeLen));
+    luaL_pushresultsize(&b, _packHeader(header, typeName, (uint32_t)typeLen, (uint32_t)ptrLen));
+  }
+  lua_rawseti(L, 4, 1);
+  lua_pushvalue(L, 3);
+  lua_rawseti(L, 4, 2);
+  return 1;
+}
 static int PM_FUNCTION(addPackData)(lua_State* L) {
   PacketManager* pm = luaL_checkpacketmanager(L, 1);
   luaL_MemBuffer membuf = MEMBUFFER_NULL;
@@ -189,14 +320,19 @@ static int PM_FUNCTION(addPackData)(lua_State* L) {
   pm_addPackData(pm, mb);
   return 0;
 }
-static int _pushPacket(lua_State* L, Packet* packet, bool bUseString) {
-  lua_pushlstring(L, packet->typeName, packet->typeLen);
+// [-0, +1], data as string or a MemBuffer slice which keeps its memory alive
+static void _pushPacketData(lua_State* L, Packet* packet, bool bUseString) {
   if (bUseString) {
     lua_pushlstring(L, (const char*)packet->ptrBuffer, packet->ptrLen);
   } else {
     luaL_MemBuffer* mb = luaL_newmembuffer(L);
-    MEMBUFFER_SETINIT_REF(mb, packet->ptrBuffer, packet->ptrLen);
+    pc_slice(packet->chunk, packet->ptrBuffer, packet->ptrLen, mb);
   }
+}
+static int _pushPacket(lua_State* L, Packet* packet, bool bUseString) {
+  lua_pushlstring(L, packet->typeName, packet->typeLen);
+  _pushPacketData(L, packet, bUseString);
+  pm_releasePacket(packet);
   return 2;
 }
 static int PM_FUNCTION(getPacket)(lua_State* L) {
@@ -211,6 +347,33 @@ static int PM_FUNCTION(getPacket)(lua_State* L) {
   }
   return 1;
 }
+// all complete packets in one call: types[i], datas[i] for i in [1, n], return n and the status after them
+static int PM_FUNCTION(getPackets)(lua_State* L) {
+  PacketManager* pm = luaL_checkpacketmanager(L, 1);
+  luaL_checktype(L, 2, LUA_TTABLE);
+  luaL_checktype(L, 3, LUA_TTABLE);
+  const bool bUseString = luaL_optboolean(L, 4, false);
+
+  lua_Integer n = 0;
+  Packet packet[1];
+  PacketStatus status;
+  while ((status = pm_nextPacket(pm, packet)) == PS_OK) {
+    n++;
+    lua_pushlstring(L, packet->typeName, packet->typeLen);
+    lua_rawseti(L, 2, n);
+    _pushPacketData(L, packet, bUseString);
+    lua_rawseti(L, 3, n);
+    pm_releasePacket(packet);
+  }
+  // end the arrays for ipairs
+  lua_pushnil(L);
+  lua_rawseti(L, 2, n + 1);
+  lua_pushnil(L);
+  lua_rawseti(L, 3, n + 1);
+  lua_pushinteger(L, n);
+  lua_pushinteger(L, (int)status);
+  return 2;
+}
 static int _nextPacket(lua_State* L) {
   PacketManager* pm = luaL_checkpacketmanager(L, 1);
 
@@ -234,9 +397,7 @@ static int PM_FUNCTION(eachPacket)(lua_State* L) {
 }
 static int PM_FUNCTION(getRemainForRead)(lua_State* L) {
   PacketManager* pm = luaL_checkpacketmanager(L, 1);
-  uint32_t n1 = luaBB_getremainforread(pm->b);
-  uint32_t n2 = luaBB_getremainforread(pm->bc);
-  lua_pushinteger(L, n1 + n2);
+  lua_pushinteger(L, (lua_Integer)(pm->carry->n + pm_chunkRemain(pm)));
   return 1;
 }
 static int PM_FUNCTION(__gc)(lua_State* L) {
@@ -249,8 +410,10 @@ static int PM_FUNCTION(__gc)(lua_State* L) {
   { "" #name, PM_FUNCTION(name) }
 static const luaL_Reg PM_FUNCTION(metafuncs)[] = {
     EMPLACE_PM_FUNCTION(packPacket),
+    EMPLACE_PM_FUNCTION(packFrame),
     EMPLACE_PM_FUNCTION(addPackData),
     EMPLACE_PM_FUNCTION(getPacket),
+    EMPLACE_PM_FUNCTION(getPackets),
     EMPLACE_PM_FUNCTION(eachPacket),
     EMPLACE_PM_FUNCTION(getRemainForRead),
     EMPLACE_PM_FUNCTION(__gc),
@@ -284,6 +447,7 @@ void PM_FUNCTION(init)(lua_State* L) {
   luaL_setfuncs(L, PM_FUNCTION(funcs), 0);
   REGISTER_ENUM_UVWRAP(packet_status);
   INVOKE_INIT_METATABLE(pm);
+  luaL_localMemRelease(L, pc_mb_release); // the chunk refcount has no lock
 }
 
 /* }====================================================== */
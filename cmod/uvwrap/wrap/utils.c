@@ -86,11 +86,17 @@ DEFINE_MEMORY_POOL(buf_1k, 1024, 8);
 DEFINE_MEMORY_POOL(buf_4k, 4096, 4);
 DEFINE_MEMORY_POOL(buf_64k, 65536, 2);
 
-void MEMORY_FUNCTION(init)() {
+static void MEMORY_FUNCTION(mb_free_buf)(const luaL_MemBuffer* mb);
+static void rp_mb_release(const luaL_MemBuffer* mb);
+
+void MEMORY_FUNCTION(init)(lua_State* L) {
   MEMORY_POOL_INIT(req);
   MEMORY_POOL_INIT(buf_1k);
   MEMORY_POOL_INIT(buf_4k);
   MEMORY_POOL_INIT(buf_64k);
+  // pools and ReadPool have no lock, these buffers are copied when sent to another thread
+  luaL_localMemRelease(L, MEMORY_FUNCTION(mb_free_buf));
+  luaL_localMemRelease(L, rp_mb_release);
 }
 
 static void* MEMORY_FUNCTION(malloc_req_internal)(size_t size) {
@@ -146,6 +152,101 @@ void MEMORY_FUNCTION(buf_moveToMemBuffer)(uv_buf_t buf, luaL_MemBuffer* mb) {
 
 /* }====================================================== */
 
+/*
+** {======================================================
+** Write request
+** =======================================================
+*/
+
+static bool WRITE_REQ_FUNCTION(isstring)(lua_State* L, int idx, bool element) {
+  if (element ? lua_type(L, idx) == LUA_TSTRING : lua_isstring(L, idx)) {
+    return true;
+  }
+  if (luaL_testudata(L, idx, LUA_MEMBUFFER_TYPE) == NULL) {
+    luaL_error(L, "write buffer must be string or luaL_MemBuffer, got %s", luaL_typename(L, idx));
+  }
+  return false;
+}
+
+static void WRITE_REQ_FUNCTION(set)(lua_State* L, uvwrap_write_req_t* wr, unsigned int i, int idx) {
+  if (lua_isstring(L, idx)) {
+    size_t len;
+    const char* str = lua_tolstring(L, idx, &len);
+    wr->bufs[i] = uv_buf_init((char*)str, (unsigned int)len);
+    MEMBUFFER_SETNULL(&wr->mbs[i]);
+  } else {
+    luaL_MemBuffer* mb = luaL_checkmembuffer(L, idx);
+    wr->bufs[i] = uv_buf_init((char*)mb->ptr, (unsigned int)mb->sz);
+    MEMBUFFER_MOVEINIT(mb, &wr->mbs[i]);
+  }
+}
+
+uvwrap_write_req_t* WRITE_REQ_FUNCTION(create)(lua_State* L, int idx) {
+  idx = lua_absindex(L, idx);
+  unsigned int nbufs = 1;
+  int nstr = 0;
+  bool isArray = lua_type(L, idx) == LUA_TTABLE;
+  // check everything first, no MemBuffer moves when raise error
+  if (isArray) {
+    nbufs = (unsigned int)luaL_len(L, idx);
+    luaL_argcheck(L, nbufs > 0, idx, "empty buffer array");
+    for (unsigned int i = 1; i <= nbufs; i++) {
+      lua_rawgeti(L, idx, i);
+      nstr += WRITE_REQ_FUNCTION(isstring)(L, -1, true);
+      lua_pop(L, 1);
+    }
+    if (nstr > 0) {
+      lua_createtable(L, nstr, 0); // strings only, the array may change before the callback
+    } else {
+      lua_pushnil(L);
+    }
+  } else if (WRITE_REQ_FUNCTION(isstring)(L, idx, false)) {
+    (void)lua_tolstring(L, idx, NULL); // number converts in place, before the copy
+    lua_pushvalue(L, idx);
+  } else {
+    lua_pushnil(L);
+  }
+
+  uvwrap_write_req_t* wr = (uvwrap_write_req_t*)MEMORY_FUNCTION(malloc_req)(sizeof(uvwrap_write_req_t));
+  wr->nbufs = nbufs;
+  if (nbufs <= WRITE_REQ_NBUFS) {
+    wr->bufs = wr->bufsml;
+    wr->mbs = wr->mbsml;
+  } else {
+    wr->mbs = (luaL_MemBuffer*)MEMORY_FUNCTION(malloc)(nbufs * (sizeof(luaL_MemBuffer) + sizeof(uv_buf_t)));
+    wr->bufs = (uv_buf_t*)(wr->mbs + nbufs);
+  }
+  if (isArray) {
+    int anchor = lua_gettop(L);
+    int n = 0;
+    for (unsigned int i = 0; i < nbufs; i++) {
+      lua_rawgeti(L, idx, i + 1);
+      WRITE_REQ_FUNCTION(set)(L, wr, i, -1);
+      if (nstr > 0 && lua_type(L, -1) == LUA_TSTRING) {
+        lua_rawseti(L, anchor, ++n);
+      } else {
+        lua_pop(L, 1);
+      }
+    }
+  } else {
+    WRITE_REQ_FUNCTION(set)(L, wr, 0, idx);
+  }
+  return wr;
+}
+
+void WRITE_REQ_FUNCTION(release)(uvwrap_write_req_t* wr) {
+  for (unsigned int i = 0; i < wr->nbufs; i++) {
+    MEMBUFFER_RELEASE(&wr->mbs[i]);
+  }
+  if (wr->mbs != wr->mbsml) {
+    (void)MEMORY_FUNCTION(free)(wr->mbs);
+  }
+  wr->nbufs = 0;
+  wr->mbs = wr->mbsml;
+}
+
+/* }====================================================== */
+
 /*
 ** {======================================================
 ** Error check
@@ -164,12 +265,17 @@ int ERROR_FUNCTION(check)(lua_State* L, int err) {
 ** =======================================================
 */
 
+// t[key] = top, the literal 'key' is pushed through an atom, no hashing
+#define SET_TOP(key) \
+  luaL_pushatomliteral(L, key); \
+  lua_insert(L, -2); \
+  lua_rawset(L, -3)
 #define SET_FIELD(type, key, value) \
   lua_push##type(L, value); \
-  lua_setfield(L, -2, key)
+  SET_TOP(key)
 #define SET_FIELD_2(type, key, value, arg) \
   lua_push##type(L, value, arg); \
-  lua_setfield(L, -2, key)
+  SET_TOP(key)
 
 #define SET_STAT_INT(name) \
   SET_FIELD(integer, #name, stat->st_##name)
@@ -177,7 +283,7 @@ int ERROR_FUNCTION(check)(lua_State* L, int err) {
   lua_createtable(L, 0, 2); \
   SET_FIELD(integer, "sec", stat->st_##name.tv_sec); \
   SET_FIELD(integer, "nsec", stat->st_##name.tv_nsec); \
-  lua_setfield(L, -2, #name)
+  SET_TOP(#name)
 
 void UTILS_PUSH_FUNCTION(uv_stat_t)(lua_State* L, const uv_stat_t* stat) {
   lua_createtable(L, 0, 16);
@@ -278,7 +384,7 @@ void UTILS_PUSH_FUNCTION(uv_passwd_t)(lua_State* L, const uv_passwd_t* pwd) {
   lua_createtable(L, 0, 2); \
   SET_FIELD(integer, "sec", rusage->ru_##name.tv_sec); \
   SET_FIELD(integer, "usec", rusage->ru_##name.tv_usec); \
-  lua_setfield(L, -2, #name)
+  SET_TOP(#name)
 #define SET_RUSAGE_INT(name) \
   SET_FIELD(integer, #name, rusage->ru_##name)
 
@@ -314,7 +420,7 @@ void UTILS_PUSH_FUNCTION(uv_rusage_t)(lua_State* L, const uv_rusage_t* rusage) {
   SET_FIELD(integer, "sys", cpu_info->name.sys); \
   SET_FIELD(integer, "idle", cpu_info->name.idle); \
   SET_FIELD(integer, "irq", cpu_info->name.irq); \
-  lua_setfield(L, -2, #name)
+  SET_TOP(#name)
 
 void UTILS_PUSH_FUNCTION(uv_cpu_info_t)(lua_State* L, const uv_cpu_info_t* cpu_info) {
   lua_createtable(L, 0, 3);
@@ -346,7 +452,7 @@ void UTILS_PUSH_FUNCTION(uv_statfs_t)(lua_State* L, const uv_statfs_t* statfs) {
   SET_STATFS_SPARE(1);
   SET_STATFS_SPARE(2);
   SET_STATFS_SPARE(3);
-  lua_setfield(L, -2, "spare");
+  SET_TOP("spare");
 }
 
 /* }====================================================== */
@@ -363,8 +469,11 @@ void EXTENSION_FUNCTION(init)(uv_handle_t* handle) {
 void EXTENSION_FUNCTION(release)(uv_handle_t* handle) {
   HandleExtension* ext = GET_EXTENSION(handle);
   if (ext != NULL) {
+    ReadPool* pool = ext->pool;
     if (ext->release != NULL)
       ext->release(ext);
+    if (pool != NULL)
+      (void)rp_release(pool);
     SET_EXTENSION(handle, NULL);
   }
 }
@@ -373,6 +482,186 @@ void EXTENSION_FUNCTION(set)(uv_handle_t* handle, HandleExtension* ext) {
   SET_EXTENSION(handle, ext);
 }
 
+static void EXTENSION_FUNCTION(free)(HandleExtension* ext) {
+  (void)MEMORY_FUNCTION(free)(ext);
+}
+void EXTENSION_FUNCTION(setReadPool)(uv_handle_t* handle, size_t blockSize) {
+  HandleExtension* ext = GET_EXTENSION(handle);
+  if (ext == NULL) {
+    ext = (HandleExtension*)MEMORY_FUNCTION(malloc)(sizeof(HandleExtension));
+    ext->release = EXTENSION_FUNCTION(free);
+    ext->pool = NULL;
+    SET_EXTENSION(handle, ext);
+  }
+  if (ext->pool != NULL) {
+    (void)rp_release(ext->pool);
+  }
+  ext->pool = rp_create(blockSize);
+}
+
+/* }====================================================== */
+
+/*
+** {======================================================
+** ReadPool
+** =======================================================
+*/
+
+typedef struct ReadBlock ReadBlock;
+struct ReadBlock {
+  ReadPool* pool;
+  ReadBlock* next; // in the free list
+  size_t ref; // MemBuffers in this block, plus one while it is the current block
+  char data[1];
+};
+struct ReadPool {
+  size_t blockSize;
+  size_t minTail; // start a new block when the current one has less space than this
+  size_t ref; // blocks out of the free list, plus one for the handle
+  ReadBlock* current;
+  size_t used; // bytes used in the current block
+  ReadBlock* free;
+  size_t numFree;
+  bool bOwned; // the handle still holds the pool
+};
+
+#define READ_BLOCK_ALLOC_SIZE(pool) (offsetof(ReadBlock, data) + (pool)->blockSize)
+
+static void rp_freePool(ReadPool* pool) {
+  (void)MEMORY_FUNCTION(free)(pool);
+}
+static void rp_unrefBlock(ReadBlock* block) {
+  if (--block->ref > 0) {
+    return;
+  }
+  ReadPool* pool = block->pool;
+  if (pool->bOwned && pool->numFree < READ_POOL_MAX_FREE) {
+    block->next = pool->free;
+    pool->free = block;
+    pool->numFree++;
+  } else {
+    (void)MEMORY_FUNCTION(free_buf)(block);
+  }
+  if (--pool->ref == 0) {
+    (void)rp_freePool(pool);
+  }
+}
+static void rp_mb_release(const luaL_MemBuffer* mb) {
+  (void)rp_unrefBlock((ReadBlock*)mb->ud);
+}
+static ReadBlock* rp_newBlock(ReadPool* pool) {
+  ReadBlock* block = pool->free;
+  if (block != NULL) {
+    pool->free = block->next;
+    pool->numFree--;
+  } else {
+    block = (ReadBlock*)MEMORY_FUNCTION(malloc_buf)(READ_BLOCK_ALLOC_SIZE(pool));
+    block->pool = pool;
+  }
+  block->next = NULL;
+  block->ref = 1;
+  pool->ref++;
+  return block;
+}
+
+ReadPool* rp_create(size_t blockSize) {
+  ReadPool* pool = (ReadPool*)MEMORY_FUNCTION(malloc)(sizeof(ReadPool));
+  pool->blockSize = blockSize;
+  pool->minTail = blockSize / 16;
+  pool->ref = 1;
+  pool->current = NULL;
+  pool->used = 0;
+  pool->free = NULL;
+  pool->numFree = 0;
+  pool->bOwned = true;
+  return pool;
+}
+void rp_release(ReadPool* pool) {
+  pool->bOwned = false;
+  while (pool->free != NULL) {
+    ReadBlock* block = pool->free;
+    pool->free = block->next;
+    (void)MEMORY_FUNCTION(free_buf)(block);
+  }
+  pool->numFree = 0;
+  if (pool->current != NULL) {
+    ReadBlock* block = pool->current;
+    pool->current = NULL;
+    (void)rp_unrefBlock(block);
+  }
+  if (--pool->ref == 0) {
+    (void)rp_freePool(pool);
+  }
+}
+void rp_alloc(ReadPool* pool, uv_buf_t* buf) {
+  if (pool->current == NULL || pool->blockSize - pool->used < pool->minTail) {
+    if (pool->current != NULL) {
+      (void)rp_unrefBlock(pool->current);
+    }
+    pool->current = rp_newBlock(pool);
+    pool->used = 0;
+  }
+  buf->base = pool->current->data + pool->used;
+  buf->len = pool->blockSize - pool->used;
+}
+void rp_commit(ReadPool* pool, const uv_buf_t* buf, size_t nread, luaL_MemBuffer* mb) {
+  ReadBlock* block = pool->current;
+  assert(block != NULL && buf->base == block->data + pool->used && nread <= buf->len);
+  (void)buf;
+  block->ref++;
+  pool->used += nread;
+  MEMBUFFER_SETINIT(mb, block->data + pool->used - nread, nread, rp_mb_release, block);
+}
+void rp_concat(luaL_MemBuffer* mbs, size_t num, size_t total, luaL_MemBuffer* mb) {
+  bool bAdjacent = true;
+  for (size_t i = 0; i < num; i++) {
+    if (mbs[i].release != rp_mb_release || mbs[i].ud != mbs[0].ud || (i > 0 && (char*)mbs[i - 1].ptr + mbs[i - 1].sz != (char*)mbs[i].ptr)) {
+      bAdjacent = false;
+      break;
+    }
+  }
+  if (bAdjacent) {
+    ReadBlock* block = (ReadBlock*)mbs[0].ud;
+    block->ref -= num - 1; // one reference for the merged buffer, never drops to zero here
+    MEMBUFFER_SETINIT(mb, mbs[0].ptr, total, rp_mb_release, block);
+    for (size_t i = 0; i < num; i++) {
+      MEMBUFFER_SETNULL(&mbs[i]);
+    }
+    return;
+  }
+  char* ptr = (char*)MEMORY_FUNCTION(malloc_buf)(total);
+  size_t offset = 0;
+  for (size_t i = 0; i < num; i++) {
+    memcpy(ptr + offset, mbs[i].ptr, mbs[i].sz);
+    offset += mbs[i].sz;
+    MEMBUFFER_RELEASE(&mbs[i]);
+  }
+  MEMBUFFER_SETINIT(mb, NULL, 0, NULL, NULL);
+  (void)MEMORY_FUNCTION(buf_moveToMemBuffer)(uv_buf_init(ptr, (unsigned int)total), mb);
+}
+
+void MEMORY_FUNCTION(buf_alloc_pool)(uv_handle_t* handle, size_t suggested_size, uv_buf_t* buf) {
+  HandleExtension* ext = GET_EXTENSION(handle);
+  if (ext != NULL && ext->pool != NULL) {
+    (void)rp_alloc(ext->pool, buf);
+  } else {
+    (void)MEMORY_FUNCTION(buf_alloc)(handle, suggested_size, buf);
+  }
+}
+void MEMORY_FUNCTION(buf_moveRead)(uv_handle_t* handle, ssize_t nread, const uv_buf_t* buf, luaL_MemBuffer* mb) {
+  MEMBUFFER_SETNULL(mb);
+  HandleExtension* ext = GET_EXTENSION(handle);
+  if (ext != NULL && ext->pool != NULL) {
+    if (nread > 0) {
+      (void)rp_commit(ext->pool, buf, (size_t)nread, mb);
+    } // the unused tail stays in the current block
+  } else if (nread > 0) {
+    (void)MEMORY_FUNCTION(buf_moveToMemBuffer)(uv_buf_init(buf->base, (unsigned int)nread), mb);
+  } else {
+    (void)MEMORY_FUNCTION(buf_free)(buf);
+  }
+}
+
 /* }====================================================== */
 
 /*
@@ -384,6 +673,7 @@ void EXTENSION_FUNCTION(set)(uv_handle_t* handle, HandleExtension* ext) {
 AsyncCacheState* acs_create(uint16_t sizeOfStruct, uint16_t max, lua_State* co, ObjectReleaser objReleaser) {
   AsyncCacheState* acs = MEMORY_FUNCTION(malloc)(sizeof(AsyncCacheState) + sizeOfStruct * max);
   acs->ext->release = acs_release;
+  acs->ext->pool = NULL;
   acs->co = co;
   acs->objRelease = objReleaser;
   acs->max = max;
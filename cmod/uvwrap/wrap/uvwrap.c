@@ -141,6 +141,9 @@ static const luaL_Reg uvwrap_funcs[] = {
     {"translate_sys_error", uvwrap_translate_sys_error},
     {"guess_handle", uvwrap_guess_handle},
     {"queue_work", uvwrap_queue_work},
+    {"luaWorkSetup", uvwrap_luaWorkSetup},
+    {"queueLuaWork", uvwrap_queueLuaWork},
+    {"luaWorkStat", uvwrap_luaWorkStat},
     {"replStart", uvwrap_replStart},
     {"replInitOneShot", uvwrap_replInitOneShot},
     {"replNext", uvwrap_replNext},
@@ -201,7 +204,7 @@ LUAMOD_API int luaopen_libuvwrap(lua_State* L) {
   CHECK_ERROR(L, err);
 
   luaL_newlib(L, uvwrap_funcs);
-  (void)MEMORY_FUNCTION(init)();
+  (void)MEMORY_FUNCTION(init)(L);
 
   REGISTER_ENUM_UVWRAP(err_code);
   REGISTER_ENUM_UVWRAP(handle_type);
@@ -14,6 +14,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <assert.h>
 
 #define UVWRAP_OK 0
 #if defined(_WIN32)
@@ -96,6 +98,7 @@ DECLARE_HANDLE_API(process)
 #define UVWRAP_SIGNAL_TYPE "uv_signal_t*"
 DECLARE_HANDLE_API(signal)
 #define UVWRAP_TIMER_TYPE "uv_timer_t*"
+#define UVWRAP_TIMER_WHEEL_TYPE "uv_timer_wheel_t*"
 DECLARE_HANDLE_API(timer)
 #define UVWRAP_UDP_TYPE "uv_udp_t*"
 DECLARE_HANDLE_API(udp)
@@ -195,7 +198,7 @@ typedef enum {
 typedef void (*MEMORY_FUNCTION(memcb))(void* ud, void* old_ptr, void* new_ptr, size_t new_size, uvwrap_alloc_type at);
 void MEMORY_FUNCTION(set_memcb)(MEMORY_FUNCTION(memcb) fn, void* ud);
 
-void MEMORY_FUNCTION(init)(void);
+void MEMORY_FUNCTION(init)(lua_State* L);
 
 void* MEMORY_FUNCTION(malloc_req)(size_t size);
 void MEMORY_FUNCTION(free_req)(void* ptr);
@@ -394,6 +397,44 @@ extern lua_State* staticL;
 
 /* }====================================================== */
 
+/*
+** {======================================================
+** Write request, owns the buffers of uv_write and uv_udp_send
+** =======================================================
+*/
+
+#define WRITE_REQ_NBUFS 4
+
+typedef struct {
+  union {
+    uv_req_t req;
+    uv_write_t write;
+    uv_udp_send_t send;
+  } u; // must be the first field, callbacks cast the req back
+  unsigned int nbufs;
+  uv_buf_t* bufs;
+  luaL_MemBuffer* mbs; // moved in from Lua, MemBuffer for string is NULL
+  uv_buf_t bufsml[WRITE_REQ_NBUFS];
+  luaL_MemBuffer mbsml[WRITE_REQ_NBUFS];
+} uvwrap_write_req_t;
+
+#define WRITE_REQ_FUNCTION(name) UVWRAP_FUNCTION(write_req, name)
+
+// [-0, +1], data at 'idx' is a string, a MemBuffer, or an array of them
+// MemBuffers move into the request, push the value keeping the strings alive, or nil
+uvwrap_write_req_t* WRITE_REQ_FUNCTION(create)(lua_State* L, int idx);
+// release the buffers, the request memory is freed by free_req
+void WRITE_REQ_FUNCTION(release)(uvwrap_write_req_t* wr);
+
+#define CHECK_WRITE_REQ_ERROR(L, wr, err) \
+  if (err != UVWRAP_OK) { \
+    (void)WRITE_REQ_FUNCTION(release)(wr); \
+    (void)MEMORY_FUNCTION(free_req)(wr); \
+    return ERROR_FUNCTION(check)(L, err); \
+  }
+
+/* }====================================================== */
+
 /*
 ** {======================================================
 ** Lua style function
@@ -416,6 +457,7 @@ extern lua_State* staticL;
 #define luaL_checkprocess(L, idx) (uv_process_t*)luaL_checkudata(L, idx, UVWRAP_PROCESS_TYPE)
 #define luaL_checksignal(L, idx) (uv_signal_t*)luaL_checkudata(L, idx, UVWRAP_SIGNAL_TYPE)
 #define luaL_checktimer(L, idx) (uv_timer_t*)luaL_checkudata(L, idx, UVWRAP_TIMER_TYPE)
+#define luaL_checktimerwheel(L, idx) (uv_timer_t*)luaL_checkudata(L, idx, UVWRAP_TIMER_WHEEL_TYPE)
 #define luaL_checkudp(L, idx) (uv_udp_t*)luaL_checkudata(L, idx, UVWRAP_UDP_TYPE)
 
 #define luaL_checksockaddr(L, idx) (struct sockaddr*)luaL_checkudata(L, idx, UVWRAP_SOCKADDR_TYPE)
@@ -469,6 +511,18 @@ void uvwrap_replInitMetatable(lua_State* L);
 
 /* }====================================================== */
 
+/*
+** {======================================================
+** Lua worker pool
+** =======================================================
+*/
+
+int uvwrap_luaWorkSetup(lua_State* L);
+int uvwrap_queueLuaWork(lua_State* L);
+int uvwrap_luaWorkStat(lua_State* L);
+
+/* }====================================================== */
+
 /*
 ** {======================================================
 ** HandleExtension
@@ -477,16 +531,48 @@ void uvwrap_replInitMetatable(lua_State* L);
 
 #define EXTENSION_FUNCTION(name) UVWRAP_FUNCTION(extension, name)
 
+typedef struct ReadPool ReadPool;
 typedef struct HandleExtension HandleExtension;
 typedef void (*ExtensionReleaser)(HandleExtension* ext);
 struct HandleExtension {
   ExtensionReleaser release;
+  ReadPool* pool; // read buffers of this handle, released with the extension
 };
 #define GET_EXTENSION(handle) (HandleExtension*)uv_handle_get_data(handle)
 #define SET_EXTENSION(handle, ext) uv_handle_set_data(handle, (void*)ext)
 void EXTENSION_FUNCTION(init)(uv_handle_t* handle);
 void EXTENSION_FUNCTION(release)(uv_handle_t* handle);
 void EXTENSION_FUNCTION(set)(uv_handle_t* handle, HandleExtension* ext);
+// attach a new ReadPool to the extension of handle, create a bare extension if there is none
+void EXTENSION_FUNCTION(setReadPool)(uv_handle_t* handle, size_t blockSize);
+
+/* }====================================================== */
+
+/*
+** {======================================================
+** ReadPool, per handle slab for read buffers
+** =======================================================
+*/
+
+// Reads are carved one after another from the tail of the current block,
+// every MemBuffer holds a reference of its block, and the block goes back to
+// the free list of the pool when the last one is released.
+// The pool lives until its handle releases it and all MemBuffers are gone.
+
+#define READ_POOL_BLOCK_SIZE 65536
+#define READ_POOL_MAX_FREE 4
+
+ReadPool* rp_create(size_t blockSize);
+void rp_release(ReadPool* pool);
+void rp_alloc(ReadPool* pool, uv_buf_t* buf);
+void rp_commit(ReadPool* pool, const uv_buf_t* buf, size_t nread, luaL_MemBuffer* mb);
+// move 'num' buffers in 'mbs' to one buffer, no copy when they are adjacent in the same block
+void rp_concat(luaL_MemBuffer* mbs, size_t num, size_t total, luaL_MemBuffer* mb);
+
+// alloc_cb for read start, use the ReadPool of the handle if any
+void MEMORY_FUNCTION(buf_alloc_pool)(uv_handle_t* handle, size_t suggested_size, uv_buf_t* buf);
+// take the result of a read into 'mb' (NULL buffer when nread <= 0), pair with 'buf_alloc_pool'
+void MEMORY_FUNCTION(buf_moveRead)(uv_handle_t* handle, ssize_t nread, const uv_buf_t* buf, luaL_MemBuffer* mb);
 
 /* }====================================================== */
 
@@ -0,0 +1,63 @@
+-- Small object allocation benchmark
+-- The lua command creates its state with luaL_newstate_z (slab allocator):
+--   lua demo/bench/alloc.lua [scale]
+
+local scale = tonumber(arg and arg[1]) or 1
+local clock = os.clock
+
+local function bench(name, func, n)
+	n = n * scale
+	collectgarbage()
+	local start = clock()
+	func(n)
+	local cost = clock() - start
+	print(string.format("%-12s %10d loops %8.3f s", name, n, cost))
+	return cost
+end
+
+local function tables(n)
+	local keep = {}
+	for i = 1, n do
+		keep[i % 1000 + 1] = {i, x = i, y = i}
+	end
+end
+
+local function strings(n)
+	local keep = {}
+	for i = 1, n do
+		keep[i % 1000 + 1] = "str" .. i
+	end
+end
+
+local function closures(n)
+	local keep = {}
+	for i = 1, n do
+		keep[i % 1000 + 1] = function() return i end
+	end
+end
+
+local function coroutines(n)
+	for i = 1, n // 10 do
+		local co = coroutine.wrap(function(a) return coroutine.yield(a) + 1 end)
+		co(i)
+		co(i)
+	end
+end
+
+local total = 0
+total = total + bench("tables", tables, 3000000)
+total = total + bench("strings", strings, 3000000)
+total = total + bench("closures", closures, 3000000)
+total = total + bench("coroutines", coroutines, 3000000)
+print(string.format("%-12s %25.3f s", "total", total))
+
+local stats = debug.allocstats and debug.allocstats()
+if stats then
+	local arenas, inuse = 0, 0
+	for _, c in ipairs(stats) do
+		arenas = arenas + c.arenas
+		inuse = inuse + c.inuse
+	end
+	print(string.format("slab: %d arenas of %d bytes, %d blocks in use, %d large blocks",
+		arenas, stats.arenasize, inuse, stats.large.inuse))
+end
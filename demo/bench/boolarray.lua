@@ -0,0 +1,81 @@
+-- Large bit set benchmark for cmod/boolarray
+-- libboolarray must be reachable through package.cpath:
+--   lua demo/bench/boolarray.lua [scale]
+
+local scale = tonumber(arg and arg[1]) or 1
+local clock = os.clock
+local boolarray = require("libboolarray")
+
+local n = math.floor(100000000 * scale) -- 100M bits, 12.5MB each
+local members = math.floor(n / 1000) -- sparse membership, one bit in a thousand
+
+local function bench(name, func, loops)
+	loops = loops or 1
+	collectgarbage()
+	local start = clock()
+	local r
+	for _ = 1, loops do
+		r = func()
+	end
+	local cost = (clock() - start) / loops
+	print(string.format("%-22s %12d bits %10.3f ms", name, n, cost * 1000))
+	return r
+end
+
+local function fill(a, stride, offset)
+	for i = offset, n, stride do
+		a[i] = true
+	end
+	return a
+end
+
+math.randomseed(7)
+local picks = {}
+for i = 1, members do
+	picks[i] = math.random(1, n)
+end
+local function fillpicks(a)
+	for i = 1, members do
+		a[picks[i]] = true
+	end
+	return a
+end
+
+local a = fill(boolarray.new(n), 3, 1)
+local b = fill(boolarray.new(n), 5, 2)
+bench("dense and", function() return a * b end, 10)
+bench("dense or", function() return a + b end, 10)
+if boolarray.combine then
+	local c = a * b
+	bench("dense and in place", function() return boolarray.combine(c, "and", b) end, 10)
+	bench("dense count", function() return boolarray.count(a) end, 10)
+	bench("dense rank", function() return boolarray.rank(a, n // 2) end, 10)
+end
+
+local s = fillpicks(boolarray.new(n))
+bench("dense pairs sparse", function()
+	local cnt = 0
+	for _ in pairs(s) do
+		cnt = cnt + 1
+	end
+	return cnt
+end)
+print(string.format("dense  %8.2f MB for %d members", math.ceil(n / 8) / 2 ^ 20, members))
+
+if boolarray.sparse then
+	local r1 = fillpicks(boolarray.sparse(n))
+	local r2 = fill(boolarray.sparse(n), 997, 1)
+	bench("sparse and", function() return r1 * r2 end, 10)
+	bench("sparse or", function() return r1 + r2 end, 10)
+	bench("sparse count", function() return boolarray.count(r1) end, 10)
+	bench("sparse pairs", function()
+		local cnt = 0
+		for _ in pairs(r1) do
+			cnt = cnt + 1
+		end
+		return cnt
+	end)
+	local buf = bench("sparse tobuffer", function() return boolarray.tobuffer(r1) end, 10)
+	bench("sparse frombuffer", function() return boolarray.frombuffer(buf) end, 10)
+	print(string.format("sparse %8.2f MB for %d members", boolarray.memsize(r1) / 2 ^ 20, members))
+end
@@ -0,0 +1,65 @@
+-- Coroutine create/resume/finish latency benchmark
+-- Collected threads are pooled with their stacks and reused by
+-- coroutine.create, coroutine.recycle reuses a dead one directly:
+--   lua demo/bench/coroutine.lua [scale]
+
+local scale = tonumber(arg and arg[1]) or 1
+local clock = os.clock
+local create, resume, yield, wrap = coroutine.create, coroutine.resume, coroutine.yield, coroutine.wrap
+local recycle = coroutine.recycle
+
+local function bench(name, func, n)
+	n = n * scale
+	collectgarbage()
+	local start = clock()
+	func(n)
+	local cost = clock() - start
+	print(string.format("%-12s %10d loops %8.3f s %8.1f ns/op", name, n, cost, cost * 1e9 / n))
+	return cost
+end
+
+local function handler(req)
+	local ok = yield(req + 1) -- wait for the "response"
+	return ok and req or -1
+end
+
+local function createfinish(n) -- one coroutine per request
+	for i = 1, n do
+		local co = create(handler)
+		resume(co, i)
+		resume(co, true)
+	end
+end
+
+local function wrapfinish(n)
+	for i = 1, n do
+		local co = wrap(handler)
+		co(i)
+		co(true)
+	end
+end
+
+local function createonly(n)
+	for i = 1, n do
+		local co = create(handler)
+		resume(co, i) -- left suspended, freed by the collector
+	end
+end
+
+local function recyclefinish(n)
+	local co = create(handler)
+	for i = 1, n do
+		resume(co, i)
+		resume(co, true)
+		recycle(co, handler)
+	end
+end
+
+local total = 0
+total = total + bench("create", createfinish, 1000000)
+total = total + bench("wrap", wrapfinish, 1000000)
+total = total + bench("suspended", createonly, 1000000)
+if recycle then
+	total = total + bench("recycle", recyclefinish, 1000000)
+end
+print(string.format("%-12s %25.3f s", "total", total))
@@ -0,0 +1,33 @@
+-- Incremental vs generational collector with a big long-lived heap
+--   lua demo/bench/gcgen.lua [incremental|generational] [loops]
+
+local mode = arg and arg[1] or "generational"
+local loops = tonumber(arg and arg[2]) or 3000000
+local clock = os.clock
+
+collectgarbage(mode)
+
+-- long-lived config/registry like data
+local count = 300000
+local config = {}
+for i = 1, count do
+	config[i] = {
+		id = i,
+		name = "item" .. i,
+		list = {1, 2, 3, 4, 5, 6, 7, 8},
+		pos = {x = i, y = {i}},
+		enable = true,
+	}
+end
+collectgarbage()
+
+local start = clock()
+local sum = 0
+for i = 1, loops do
+	local req = {id = i, args = {i, i + 1}} -- short-lived garbage
+	sum = sum + req.args[2] + #config[i % count + 1].list
+end
+local cost = clock() - start
+local _, kind, minor, major = debug.getgcstate()
+print(string.format("%-12s %.3f s  minor %d  major %d  %.1f MB", kind, cost, minor, major,
+	collectgarbage("count") / 1024))
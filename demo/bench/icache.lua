@@ -0,0 +1,32 @@
+-- Inline cache benchmark for constant short string keys
+-- ('GETTABUP' for globals, 'GETTABLE' for fields, 'SELF' for methods)
+--   lua demo/bench/icache.lua [loops]
+
+local loops = tonumber(arg and arg[1]) or 20000000
+local clock = os.clock
+
+local t = {}
+for i = 1, 40 do
+	t["key" .. i] = i
+end
+t.x, t.y = 1, 2
+
+local start = clock()
+local s = 0
+for _ = 1, loops do
+	s = s + t.x + t.y + t.key17 + math.pi // 1
+end
+print(string.format("%-8s %.3f s", "field", clock() - start))
+
+local Point = {}
+Point.__index = Point
+function Point:len()
+	return self.x + self.y
+end
+local p = setmetatable({x = 3, y = 4}, Point)
+start = clock()
+s = 0
+for _ = 1, loops // 4 do
+	s = s + p:len()
+end
+print(string.format("%-8s %.3f s", "method", clock() - start))
@@ -0,0 +1,86 @@
+-- Sparse int64 keyed map benchmark, Lua table against cmod/intmap
+-- libintmap must be reachable through package.cpath:
+--   lua demo/bench/intmap.lua [scale]
+
+local scale = tonumber(arg and arg[1]) or 1
+local clock = os.clock
+local intmap = require("libintmap")
+
+local n = math.floor(2000000 * scale)
+local keys = {}
+math.randomseed(7)
+for i = 1, n do -- session ids, Lua tables hash integers by their low bits so keep them random
+	keys[i] = (math.random(0, 0x7fffffff) << 32) | math.random(0, 0xffffffff)
+end
+
+local function bench(name, func, count)
+	collectgarbage()
+	local start = clock()
+	local r = func()
+	local cost = clock() - start
+	print(string.format("%-20s %10d keys %8.3f s", name, count or n, cost))
+	return r
+end
+
+local function fill(map)
+	for i = 1, n do
+		map[keys[i]] = i
+	end
+	return map
+end
+
+local function lookup(map)
+	local sum = 0
+	for i = 1, n do
+		sum = sum + map[keys[i]]
+	end
+	return sum
+end
+
+collectgarbage()
+local before = collectgarbage("count")
+local tbl = bench("table insert", function() return fill({}) end)
+local tblbytes = (collectgarbage("count") - before) * 1024
+bench("table lookup", function() return lookup(tbl) end)
+tbl = nil
+
+local map = bench("intmap insert", function() return fill(intmap.new("integer")) end)
+bench("intmap lookup", function() return lookup(map) end)
+local mapbytes = intmap.memsize(map)
+
+local records = {}
+for i = 1, n do
+	records[i] = string.pack("=jj", keys[i], i)
+end
+local packed = table.concat(records)
+records = nil
+local bulk = bench("intmap bulk insert", function()
+	local m = intmap.new("integer")
+	intmap.insert(m, packed)
+	return m
+end)
+assert(#bulk == #map)
+bulk = nil
+
+-- remove one key and add another while the live count sits just below the 7/8 load limit,
+-- the DELETED slots left behind must not cost a rehash on every insertion
+local churn = math.floor(200000 * scale)
+local churned = bench("intmap churn", function()
+	local m = intmap.new("integer", n // 2)
+	local _, cap = intmap.memsize(m)
+	local live = math.min(cap - cap // 8 - 16, n)
+	for i = 1, live do
+		m[keys[i]] = i
+	end
+	for i = 1, churn do
+		m[keys[i]] = nil
+		m[keys[i] ~ 1] = i
+	end
+	assert(#m == live)
+	return m
+end, churn)
+print(string.format("churn capacity %d -> %d", select(2, intmap.memsize(intmap.new("integer", n // 2))), select(2, intmap.memsize(churned))))
+churned = nil
+
+print(string.format("table  %8.1f MB %6.1f bytes/key", tblbytes / 2 ^ 20, tblbytes / n))
+print(string.format("intmap %8.1f MB %6.1f bytes/key", mapbytes / 2 ^ 20, mapbytes / n))
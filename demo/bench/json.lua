@@ -0,0 +1,86 @@
+-- JSON benchmark: cJSON tree walk (lmod json.parse, json.tostring) vs json.decode, json.encode
+-- libjson must be reachable through package.cpath, lmod through package.path:
+--   lua demo/bench/json.lua [scale]
+
+local scale = tonumber(arg and arg[1]) or 1
+local clock = os.clock
+local c = require("libjson")
+local json = require("json")
+
+local function bench(name, size, func, loops)
+	loops = loops or 1
+	collectgarbage()
+	local start = clock()
+	local r
+	for _ = 1, loops do
+		r = func()
+	end
+	local cost = (clock() - start) / loops
+	print(string.format("%-26s %10d bytes %10.3f ms %8.1f MB/s", name, size, cost * 1000, size / cost / 2 ^ 20))
+	return r
+end
+
+math.randomseed(7)
+local function record(i)
+	return string.format(
+		'{"id":%d,"name":"user_%d","email":"user%d@example.com","score":%.6f,"active":%s,'
+			.. '"tags":["alpha","beta","gamma"],"pos":{"x":%d,"y":%.3f},"note":"line\\nbreak \\u00e9"}',
+		i, i, i, math.random() * 1000, i % 2 == 0 and "true" or "false", math.random(-5000, 5000), math.random())
+end
+
+local function document(size)
+	local parts, len, i = {}, 2, 0
+	while len < size do
+		i = i + 1
+		parts[i] = record(i)
+		len = len + #parts[i] + 1
+	end
+	return "[" .. table.concat(parts, ",") .. "]"
+end
+
+local sizes = {
+	{"1KB", 1024, 2000},
+	{"100KB", 100 * 1024, 20},
+	{"50MB", math.floor(50 * 2 ^ 20 * scale), 1},
+}
+for _, s in ipairs(sizes) do
+	local text = document(s[2])
+	local loops = s[3]
+	bench("cjson walk " .. s[1], #text, function() return json.parse(text) end, loops)
+	bench("decode " .. s[1], #text, function() return c.decode(text) end, loops)
+	bench("decoder 4KB chunks " .. s[1], #text, function()
+		local d = c.decoder()
+		local r
+		for pos = 1, #text, 4096 do
+			d:feed(text:sub(pos, pos + 4095))
+			local ok, v = d:next()
+			if ok then r = v end
+		end
+		return r
+	end, loops)
+	local value = c.decode(text)
+	if #text <= 2 ^ 20 then -- appending to a cJSON array walks the list, quadratic on big documents
+		bench("cjson build " .. s[1], #text, function() return json.tostring(value) end, loops)
+	end
+	bench("encode " .. s[1], #text, function() return c.encode(value) end, loops)
+	bench("encode sortkeys " .. s[1], #text, function() return c.encode(value, {sortkeys = true}) end, loops)
+end
+
+-- newline delimited stream of small documents
+local lines = {}
+for i = 1, math.floor(50000 * scale) do
+	lines[i] = record(i)
+end
+local ndjson = table.concat(lines, "\n")
+bench("decoder ndjson", #ndjson, function()
+	local d = c.decoder()
+	local cnt = 0
+	for pos = 1, #ndjson, 4096 do
+		d:feed(ndjson:sub(pos, pos + 4095))
+		while d:next() do
+			cnt = cnt + 1
+		end
+	end
+	d:finish()
+	return cnt
+end)
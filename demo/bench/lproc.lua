@@ -0,0 +1,102 @@
+-- lproc channel throughput: worker pools of 1..N threads on buffered MPMC channels
+-- liblproc must be reachable through package.cpath:
+--   lua demo/bench/lproc.lua [scale] [maxWorkers]
+
+local scale = tonumber(arg and arg[1]) or 1
+local maxWorkers = tonumber(arg and arg[2]) or 4
+local lproc = require("liblproc")
+local now = lproc.now
+
+local function bench(name, workers, count, func)
+	collectgarbage()
+	local start = now()
+	func()
+	local cost = now() - start
+	print(string.format("%-10s %2d workers %10d msgs %8.3f s %12.0f msgs/s", name, workers, count, cost, count / cost))
+	return cost
+end
+
+-- every worker answers each job on the result channel, nil stops it
+local worker = [[
+	local lproc = require("liblproc")
+	local jobs, results, work = "%s", "%s", %d
+	while true do
+		local job = lproc.receive(jobs)
+		if job == nil then break end
+		local acc = 0
+		for i = 1, work do
+			acc = acc + (job.seed * i) %% 7
+		end
+		lproc.send(results, acc, #job.payload)
+	end
+	lproc.send(results, false)
+]]
+
+local run = 0
+local function pool(name, workers, count, work, payload)
+	run = run + 1
+	local jobs, results = "jobs" .. run, "results" .. run
+	lproc.channel(jobs, 1024)
+	lproc.channel(results, 1024)
+	lproc.start(string.format(worker, jobs, results, work), workers)
+	lproc.start(string.format([[
+		local lproc = require("liblproc")
+		local payload = require("string").rep("x", %d) -- thread states only preload the standard libraries
+		for i = 1, %d do
+			lproc.send("%s", {seed = i, payload = payload, tags = {"a", "b"}})
+		end
+		for _ = 1, %d do
+			lproc.send("%s", nil)
+		end
+	]], payload, count, jobs, workers, jobs))
+	bench(name, workers, count, function()
+		local done, received = 0, 0
+		while done < workers do
+			local acc = lproc.receive(results)
+			if acc then
+				received = received + 1
+			else
+				done = done + 1
+			end
+		end
+		assert(received == count)
+	end)
+end
+
+local workers = {}
+local n = 1
+while n < maxWorkers do
+	workers[#workers + 1] = n
+	n = n * 2
+end
+workers[#workers + 1] = maxWorkers
+
+local count = math.floor(200000 * scale)
+for _, w in ipairs(workers) do
+	pool("empty", w, count, 0, 16)
+end
+for _, w in ipairs(workers) do
+	pool("cpu", w, count // 10, 2000, 16)
+end
+for _, w in ipairs(workers) do
+	pool("4KB", w, count // 4, 0, 4096)
+end
+
+-- rendezvous ping-pong latency between two threads
+lproc.start([[
+	local lproc = require("liblproc")
+	while true do
+		local v = lproc.receive("ping")
+		lproc.send("pong", v)
+		if v == nil then break end
+	end
+]])
+local loops = math.floor(50000 * scale)
+bench("pingpong", 1, loops, function()
+	for i = 1, loops do
+		lproc.send("ping", i)
+		lproc.receive("pong")
+	end
+	lproc.send("ping", nil)
+	lproc.receive("pong")
+end)
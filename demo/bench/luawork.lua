@@ -0,0 +1,91 @@
+-- uvwrap Lua worker pool: cpu bound Lua jobs inline on the loop vs libuv.queueLuaWorkAsync
+-- libuvwrap must be reachable through package.cpath, lmod through package.path,
+-- pool size follows UV_THREADPOOL_SIZE:
+--   lua demo/bench/luawork.lua [scale]
+
+local scale = tonumber(arg and arg[1]) or 1
+local libuv = require("libuv")
+local hrtime = libuv.sys.hrTime
+libuv.init()
+
+-- worker states resolve 'luawork_job.spin' through require, the module is written next to the bench
+local dir = os.getenv("TMPDIR") or "/tmp"
+local file = assert(io.open(dir .. "/luawork_job.lua", "w"))
+file:write([[
+local M = {}
+function M.spin(n, payload)
+	local acc = 0
+	for i = 1, n do
+		acc = (acc + i * 31) % 1000003
+	end
+	return acc, #payload
+end
+return M
+]])
+file:close()
+package.path = dir .. "/?.lua;" .. package.path
+local job = require("luawork_job")
+
+local count = math.floor(200 * scale)
+local work = 200000
+local payload = string.rep("x", 1024)
+
+-- a 1ms repeating timer records the longest gap the loop needed to serve it
+local function bench(name, jobs, run)
+	local timer = libuv.timer.Timer()
+	local last, maxGap = hrtime(), 0
+	timer:startAsync(1, 1, function()
+		local now = hrtime()
+		if now - last > maxGap then maxGap = now - last end
+		last = now
+	end)
+	local start = hrtime()
+	run(function()
+		local now = hrtime()
+		if now - last > maxGap then maxGap = now - last end
+		local cost = (now - start) / 1e9
+		print(string.format("%-8s %6d jobs %8.3f s %10.0f jobs/s   max loop stall %8.3f ms", name, jobs, cost, jobs / cost, maxGap / 1e6))
+		timer:closeAsync()
+	end)
+	libuv.run()
+end
+
+bench("inline", count, function(finish)
+	libuv.timer.Timer():startOneShotAsync(0, function(handle)
+		for _ = 1, count do
+			job.spin(work, payload)
+		end
+		handle:closeAsync()
+		finish()
+	end)
+end)
+
+local warmed = false
+libuv.luaWorkSetup({"luawork_job"}, function() warmed = true end)
+libuv.run()
+assert(warmed)
+bench("pool", count, function(finish)
+	local left = count
+	for _ = 1, count do
+		libuv.queueLuaWorkAsync("luawork_job.spin", function(ok, acc, len)
+			assert(ok and len == #payload, acc)
+			left = left - 1
+			if left == 0 then finish() end
+		end, work, payload)
+	end
+end)
+print("poolSize, states, queued, running", libuv.luaWorkStat())
+
+-- round trip cost of an empty job, queueing them all stalls the loop once
+local loops = math.floor(20000 * scale)
+bench("echo", loops, function(finish)
+	local left = loops
+	for _ = 1, loops do
+		libuv.queueLuaWorkAsync("select", function()
+			left = left - 1
+			if left == 0 then finish() end
+		end, "#", 1, 2, 3)
+	end
+end)
+libuv.close()
+os.remove(dir .. "/luawork_job.lua")
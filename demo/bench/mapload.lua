@@ -0,0 +1,65 @@
+-- Precompiled chunk loading benchmark: usual format vs mapped format ('luac -m')
+--   lua demo/bench/mapload.lua path/to/luac [scale]
+
+local luac = assert(arg and arg[1], "usage: lua mapload.lua path/to/luac [scale]")
+local scale = tonumber(arg[2]) or 1
+local clock = os.clock
+
+local function bench(name, func, n)
+	n = n * scale
+	collectgarbage()
+	local start = clock()
+	func(n)
+	local cost = clock() - start
+	print(string.format("%-12s %10d loops %8.3f s", name, n, cost))
+	return cost
+end
+
+-- a module of 200 functions, each with a few nested helpers that run rarely
+local src = {"local M = {}"}
+for i = 1, 200 do
+	src[#src + 1] = string.format([[
+function M.f%d(t, x)
+	local function check(v) if type(v) ~= "number" then error("f%d: bad value " .. tostring(v)) end return v end
+	local function fmt(v) return string.format("f%d(%%s) = %%s", tostring(x), tostring(v)) end
+	local s = 0
+	for k = 1, #t do s = s + check(t[k]) * %d end
+	if x == "debug" then print(fmt(s)) end
+	return s, "name_%d", "key_%d", %d.5
+end]], i, i, i, i, i, i, i)
+end
+src[#src + 1] = "return M"
+local name = os.tmpname()
+local file = assert(io.open(name, "w"))
+file:write(table.concat(src, "\n"))
+file:close()
+
+local out = {std = name .. ".luac", map = name .. ".mapped"}
+assert(os.execute(string.format("%s -o %s %s", luac, out.std, name)))
+assert(os.execute(string.format("%s -m -o %s %s", luac, out.map, name)))
+
+local function loadonly(path)
+	return function(n)
+		for _ = 1, n do
+			assert(loadfile(path))
+		end
+	end
+end
+
+local function loadrun(path)
+	return function(n)
+		for _ = 1, n do
+			local M = assert(loadfile(path))()
+			M.f1({1, 2, 3}, 0)
+		end
+	end
+end
+
+bench("load", loadonly(out.std), 2000)
+bench("load -m", loadonly(out.map), 2000)
+bench("require", loadrun(out.std), 2000)
+bench("require -m", loadrun(out.map), 2000)
+
+os.remove(name)
+os.remove(out.std)
+os.remove(out.map)
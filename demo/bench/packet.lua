@@ -0,0 +1,81 @@
+-- PacketManager framing benchmark, 64 B to 1 MB frames
+-- libuvwrap must be reachable through package.cpath, lmod through package.path:
+--   lua demo/bench/packet.lua [scale]
+
+local scale = tonumber(arg and arg[1]) or 1
+local clock = os.clock
+local libuv = require("libuv")
+local OK = libuv.packet_status.OK
+
+-- 'setup' runs before each loop and is not timed, its result is passed to 'func'
+local function bench(name, size, func, loops, setup)
+	collectgarbage()
+	local cost = 0
+	for _ = 1, loops do
+		local arg = setup and setup()
+		local start = clock()
+		func(arg)
+		cost = cost + clock() - start
+	end
+	cost = cost / loops
+	print(string.format("%-30s %10d bytes %10.3f ms %8.1f MB/s", name, size, cost * 1000, size / cost / 2 ^ 20))
+end
+
+local pm = libuv.PacketManager()
+local src = libuv.PacketManager()
+-- owned MemBuffer, like the buffers of stream reads, moves into the manager without copy
+local function owned(s)
+	local iov = src:packFrame("", s)
+	src:addPackData(iov[1] .. iov[2])
+	local _, _, mb = src:getPacket()
+	return mb
+end
+
+local total = math.floor(16 * 2 ^ 20 * scale)
+local chunkSize = 65536
+for _, frameSize in ipairs({64, 1024, 65536, 1 << 20}) do
+	local count = math.max(1, total // frameSize)
+	local data = string.rep("p", frameSize)
+	local label = frameSize >= 1 << 20 and ((frameSize >> 20) .. "MB") or frameSize >= 1024 and (frameSize // 1024 .. "KB") or (frameSize .. "B")
+	local bytes = count * frameSize
+
+	bench("packPacket copy " .. label, bytes, function()
+		for _ = 1, count do
+			pm:packPacket("msg", data)
+		end
+	end, 3)
+	local iov = {}
+	bench("packFrame iovec " .. label, bytes, function()
+		for _ = 1, count do
+			pm:packFrame("msg", data, iov)
+		end
+	end, 3)
+
+	local stream = string.rep(pm:packPacket("msg", data, true), count)
+	local function chunks()
+		local list = {}
+		for pos = 1, #stream, chunkSize do
+			list[#list + 1] = owned(stream:sub(pos, pos + chunkSize - 1))
+		end
+		return list
+	end
+	bench("getPacket copy " .. label, bytes, function(list)
+		local n = 0
+		for _, mb in ipairs(list) do
+			pm:addPackData(mb)
+			while pm:getPacket(true) == OK do
+				n = n + 1
+			end
+		end
+		assert(n == count)
+	end, 3, chunks)
+	local types, datas = {}, {}
+	bench("getPackets slice " .. label, bytes, function(list)
+		local n = 0
+		for _, mb in ipairs(list) do
+			pm:addPackData(mb)
+			n = n + pm:getPackets(types, datas)
+		end
+		assert(n == count)
+	end, 3, chunks)
+end
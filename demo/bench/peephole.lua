@@ -0,0 +1,70 @@
+-- Peephole pass and superinstructions benchmark
+-- Runs the same source loaded with mode "t" and "tO" (same as 'luac -O'):
+--   lua demo/bench/peephole.lua [scale]
+
+local scale = tonumber(arg and arg[1]) or 1
+local clock = os.clock
+
+local source = [[
+local n = ...
+local vec = {}
+function vec.len2(v) return v.x * v.x + v.y * v.y end
+
+local function lib(n) -- module fields: GETTABUP + GETTABLE
+	local s = 0
+	for i = 1, n do
+		s = s + math.abs(-i) + string.byte("a")
+	end
+	return s
+end
+
+local function chain(n) -- nested fields: GETTABLE + GETTABLE
+	local o = {pos = {x = 1, y = 2}, vel = {x = 3, y = 4}}
+	local s = 0
+	for i = 1, n do
+		s = s + o.pos.x * o.vel.y - o.pos.y * o.vel.x
+	end
+	return s
+end
+
+local function upval(n) -- upvalue fields: GETUPVAL + GETTABLE
+	local s = 0
+	for i = 1, n do
+		s = s + vec.len2({x = i, y = 1})
+	end
+	return s
+end
+
+local function swap(n) -- multiple assignment: result + MOVE
+	local a, b, c = 1, 2, 3
+	for i = 1, n do
+		a, b, c = b + i, c - i, a * 1
+	end
+	return a + b + c
+end
+
+return {lib = lib, chain = chain, upval = upval, swap = swap}
+]]
+
+local function bench(mode)
+	local suite = assert(load(source, "=peephole", mode))()
+	local total = 0
+	for _, name in ipairs({"lib", "chain", "upval", "swap"}) do
+		local n = 5000000 * scale
+		suite[name](1) -- warm up
+		local cost = math.huge
+		for _ = 1, 3 do -- best of three
+			local start = clock()
+			suite[name](n)
+			cost = math.min(cost, clock() - start)
+		end
+		print(string.format("%-3s %-8s %10d loops %8.3f s", mode, name, n, cost))
+		total = total + cost
+	end
+	print(string.format("%-12s %25.3f s", mode .. " total", total))
+	return total
+end
+
+local base = bench("t")
+local opt = bench("tO")
+print(string.format("%-12s %24.1f %%", "speedup", (base - opt) / base * 100))
@@ -0,0 +1,65 @@
+-- Sampling profiler overhead benchmark
+-- Runs the same workload with the profiler off and on (1 kHz by default),
+-- alternating for a few rounds and comparing the fastest run of each side,
+-- since a single pair is easily skewed by other load on the machine:
+--   lua demo/bench/profiler.lua [scale] [hz] [out.folded] [rounds]
+-- The folded output feeds flamegraph.pl or speedscope directly.
+
+local scale = tonumber(arg and arg[1]) or 1
+local hz = tonumber(arg and arg[2]) or 1000
+local out = arg and arg[3]
+local rounds = tonumber(arg and arg[4]) or 5
+local clock = os.clock
+
+local function fib(x)
+	if x < 2 then return x end
+	return fib(x - 1) + fib(x - 2)
+end
+
+local function strings(n)
+	local s = 0
+	for i = 1, n do
+		s = s + #string.format("%d:%s", i, "abc")
+	end
+	return s
+end
+
+local function tables(n)
+	local t = {}
+	for i = 1, n do
+		t[i % 1000 + 1] = {i, x = i}
+	end
+	return #t
+end
+
+local function workload(n)
+	for _ = 1, n do
+		fib(22)
+		strings(20000)
+		tables(20000)
+	end
+end
+
+local function bench(name, n)
+	n = n * scale
+	collectgarbage()
+	local start = clock()
+	workload(n)
+	local cost = clock() - start
+	print(string.format("%-12s %10d loops %8.3f s", name, n, cost))
+	return cost
+end
+
+workload(1) -- warm up
+local base, cost, samples = math.huge, math.huge, 0
+for _ = 1, rounds do
+	base = math.min(base, bench("off", 100))
+	profiler.start(hz)
+	cost = math.min(cost, bench("on " .. hz .. "Hz", 100))
+	samples = samples + profiler.stop()
+end
+print(string.format("%-12s %10d samples %6.2f %%", "overhead", samples // rounds, (cost - base) / base * 100))
+if out then
+	assert(profiler.dump(out))
+	print("folded stacks written to " .. out)
+end
@@ -0,0 +1,64 @@
+-- Binary serialize (util.serialize, util.deserialize) vs JSON (json.encode, json.decode) on nested config data
+-- libjson must be reachable through package.cpath:
+--   lua demo/bench/serialize.lua [scale]
+
+local scale = tonumber(arg and arg[1]) or 1
+local clock = os.clock
+local util = require("util")
+local json = require("libjson")
+
+local function bench(name, size, func, loops)
+	collectgarbage()
+	local start = clock()
+	local r
+	for _ = 1, loops do
+		r = func()
+	end
+	local cost = (clock() - start) / loops
+	print(string.format("%-26s %10d bytes %10.3f ms %8.1f MB/s", name, size, cost * 1000, size / cost / 2 ^ 20))
+	return r
+end
+
+math.randomseed(11)
+local function item(i)
+	return {
+		id = i,
+		name = "item_" .. i,
+		quality = math.random(1, 5),
+		price = math.random() * 1000,
+		stackable = i % 3 == 0,
+		attrs = {atk = math.random(1, 500), def = math.random(1, 500), crit = math.random() / 4},
+		drops = {i * 10 + 1, i * 10 + 2, i * 10 + 3},
+		desc = "level " .. (i % 60) .. " equipment, bound on pickup",
+	}
+end
+
+local function config(count)
+	local items, levels = {}, {}
+	for i = 1, count do
+		items[i] = item(i)
+	end
+	for lv = 1, math.max(1, count // 10) do
+		levels[lv] = {exp = lv * lv * 100, rewards = {gold = lv * 50, items = {lv, lv + 1}}}
+	end
+	return {version = "1.2.3", items = items, levels = levels, server = {host = "127.0.0.1", ports = {8000, 8001}}}
+end
+
+local sizes = {
+	{"small", 10, 5000},
+	{"medium", 1000, 50},
+	{"large", math.floor(100000 * scale), 1},
+}
+for _, s in ipairs(sizes) do
+	local value = config(s[2])
+	local loops = s[3]
+	local jtext = json.encode(value):toString()
+	local bin = util.serialize(value)
+	local btext = bin:toString()
+	bench("json.encode " .. s[1], #jtext, function() return json.encode(value) end, loops)
+	bench("serialize " .. s[1], #btext, function() return util.serialize(value) end, loops)
+	bench("json.decode " .. s[1], #jtext, function() return json.decode(jtext) end, loops)
+	bench("deserialize " .. s[1], #btext, function() return util.deserialize(btext) end, loops)
+	local copy = util.deserialize(bin)
+	assert(copy.items[s[2]].attrs.atk == value.items[s[2]].attrs.atk)
+end
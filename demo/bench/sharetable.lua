@@ -0,0 +1,80 @@
+-- Frozen shared table (util.freeze) vs native table: lookup cost and memory held by the lua_State
+--   lua demo/bench/sharetable.lua [scale]
+
+local scale = tonumber(arg and arg[1]) or 1
+local clock = os.clock
+local util = require("util")
+
+local function bench(name, count, func)
+	collectgarbage()
+	local start = clock()
+	local r = func()
+	local cost = clock() - start
+	print(string.format("%-26s %10d ops %10.3f ms %8.1f ns/op", name, count, cost * 1000, cost / count * 1e9))
+	return r
+end
+
+local function item(i)
+	return {
+		id = i,
+		name = "item_" .. i,
+		quality = i % 5 + 1,
+		price = i * 1.5,
+		attrs = {atk = i % 500, def = i % 300},
+		drops = {i * 10 + 1, i * 10 + 2, i * 10 + 3},
+	}
+end
+
+local function config(count)
+	local items = {}
+	for i = 1, count do
+		items[i] = item(i)
+	end
+	return {version = "1.2.3", items = items}
+end
+
+local count = math.floor(100000 * scale)
+collectgarbage()
+local base = collectgarbage("count")
+local native = config(count)
+collectgarbage()
+local nativeKB = collectgarbage("count") - base
+local shared = util.freeze(native)
+print(string.format("native %.0f KB in the lua_State, shared %.0f KB in one region", nativeKB, util.sharedSize(shared) / 1024))
+
+local loops = count * 10
+local function lookups(cfg)
+	return function()
+		local items, acc = cfg.items, 0
+		for i = 1, loops do
+			local it = items[i % count + 1]
+			acc = acc + it.attrs.atk + it.drops[2]
+		end
+		return acc
+	end
+end
+local function walk(cfg)
+	return function()
+		local n = 0
+		for _, it in ipairs(cfg.items) do
+			for _ in pairs(it) do
+				n = n + 1
+			end
+		end
+		return n
+	end
+end
+local sum = bench("native lookup", loops, lookups(native))
+local fields = bench("native pairs", count * 6, walk(native))
+
+-- the native copy is dropped first so the collector only sees what the proxies allocate
+local bin = util.serialize(native)
+native = nil
+collectgarbage()
+assert(bench("shared lookup", loops, lookups(shared)) == sum)
+assert(bench("shared pairs", count * 6, walk(shared)) == fields)
+
+-- loading the same config into another state: deserialize a private copy vs open the shared region
+bench("deserialize copy", 1, function() return util.deserialize(bin) end)
+local handle = util.sharedHandle(shared)
+bench("open shared", 1, function() return util.sharedTable(handle) end)
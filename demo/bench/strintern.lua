@@ -0,0 +1,69 @@
+-- Short string interning benchmark (internshrstr throughput and probe lengths)
+-- Build liblua with -DLUA_USE_WORDHASH=ON and OFF, then run:
+--   lua demo/bench/strintern.lua [scale]
+
+local scale = tonumber(arg and arg[1]) or 1
+local clock = os.clock
+local sub = string.sub
+
+local function bench(name, func, n)
+	n = n * scale
+	collectgarbage()
+	local start = clock()
+	func(n)
+	local cost = clock() - start
+	print(string.format("%-12s %10d loops %8.3f s", name, n, cost))
+	return cost
+end
+
+-- keys like a decoder produces them: a prefix plus a counter
+local prefix = "user.profile.address."
+local source = {}
+for i = 1, 1000 do
+	source[i] = prefix .. i .. "." .. (i * 7919 % 1000)
+end
+local text = table.concat(source, ",")
+
+local function miss(n)
+	for i = 1, n do
+		local s = prefix .. i
+	end
+end
+
+local function hit(n)
+	local len = #text - 40
+	for i = 1, n do
+		local p = i % len + 1
+		local s = sub(text, p, p + 24)
+	end
+end
+
+local function short(n)
+	for i = 1, n do
+		local p = i % 1000 + 1
+		local s = sub(text, p, p + i % 6)
+	end
+end
+
+local keep = {}
+local function report(name)
+	if debug.strtabstats then
+		local nuse, size, max, avg = debug.strtabstats()
+		print(string.format("%-12s %d strings, %d slots, max probe %d, avg probe %.3f", name, nuse, size, max, avg))
+	end
+end
+
+local total = 0
+total = total + bench("miss", miss, 3000000)
+total = total + bench("hit", hit, 5000000)
+total = total + bench("short", short, 5000000)
+print(string.format("%-12s %25.3f s", "total", total))
+for i = 1, 200000 do
+	keep[i] = prefix .. i
+end
+report("200k keys")
+for i = 1, 200000 do
+	keep[i] = string.format("%08x", i * 2654435761 % 4294967296)
+end
+collectgarbage()
+report("200k hex")
@@ -0,0 +1,52 @@
+-- Array building benchmark: append vs table.create / table.resize / table.fill
+--   lua demo/bench/tablefill.lua [scale]
+
+local scale = tonumber(arg and arg[1]) or 1
+local clock = os.clock
+local N = 1000000
+
+local function bench(name, func, n)
+	n = n * scale
+	collectgarbage()
+	local start = clock()
+	func(n)
+	local cost = clock() - start
+	print(string.format("%-12s %10d loops %8.3f s", name, n, cost))
+	return cost
+end
+
+local function append(n)
+	for _ = 1, n // N do
+		local t = {}
+		for i = 1, N do
+			t[#t + 1] = 0
+		end
+	end
+end
+
+local function create(n)
+	for _ = 1, n // N do
+		local t = table.create(N)
+		for i = 1, N do
+			t[i] = 0
+		end
+	end
+end
+
+local function fill(n)
+	for _ = 1, n // N do
+		table.fill(table.create(N), 0, 1, N)
+	end
+end
+
+local function refill(n)
+	local t = table.resize({}, N)
+	for _ = 1, n // N do
+		table.fill(t, false, 1, N)
+	end
+end
+
+bench("append", append, 50000000)
+bench("create", create, 50000000)
+bench("fill", fill, 50000000)
+bench("refill", refill, 50000000)
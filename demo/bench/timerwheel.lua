@@ -0,0 +1,87 @@
+-- uvwrap timers: one uv_timer_t per timeout (libuv heap) vs timer.TimerWheel (one uv_timer_t, O(1) wheel)
+-- libuvwrap must be reachable through package.cpath, lmod through package.path:
+--   lua demo/bench/timerwheel.lua [scale]
+
+local scale = tonumber(arg and arg[1]) or 1
+local libuv = require("libuv")
+local timer = libuv.timer
+local clock = os.clock -- cpu time, firing is measured without the waiting
+libuv.init()
+
+local function bench(name, count, func)
+	collectgarbage()
+	local start = clock()
+	func()
+	local cost = clock() - start
+	print(string.format("%-22s %8d timers %8.3f s %8.1f ns/op", name, count, cost, cost / count * 1e9))
+end
+
+-- idle timeouts spread over 'span' ms, like one per connection
+local span = 2000
+local count = math.floor(1000000 * scale)
+local timeouts = {}
+math.randomseed(3)
+for i = 1, count do
+	timeouts[i] = math.random(span // 2, span)
+end
+
+-- libuv heap: each timer is a handle with its own Lua callback
+local heapCount = count
+local handles = {}
+local fired = 0
+local function onTimer()
+	fired = fired + 1
+end
+bench("heap start", heapCount, function()
+	for i = 1, heapCount do
+		local h = timer.Timer()
+		h:startOneShotAsync(timeouts[i], onTimer)
+		handles[i] = h
+	end
+end)
+bench("heap restart", heapCount, function()
+	for i = 1, heapCount do
+		handles[i]:startOneShotAsync(timeouts[i], onTimer)
+	end
+end)
+bench("heap fire", heapCount, function()
+	libuv.run()
+end)
+assert(fired == heapCount)
+for i = 1, heapCount do
+	handles[i]:closeAsync()
+end
+handles = nil
+libuv.run()
+
+local ids = {}
+local batches = 0
+fired = 0
+local wheel = timer.TimerWheel(10, function(list, n)
+	batches = batches + 1
+	fired = fired + n
+end)
+bench("wheel start", count, function()
+	for i = 1, count do
+		ids[i] = wheel:start(timeouts[i])
+	end
+end)
+bench("wheel again", count, function()
+	for i = 1, count do
+		wheel:again(ids[i], timeouts[i])
+	end
+end)
+bench("wheel stop+start", count, function()
+	for i = 1, count do
+		wheel:stop(ids[i])
+		ids[i] = wheel:start(timeouts[i])
+	end
+end)
+bench("wheel fire", count, function()
+	libuv.run()
+end)
+assert(fired == count and wheel:getCount() == 0)
+print(string.format("wheel fired in %d batched calls", batches))
+wheel:closeAsync()
+libuv.run()
+libuv.close()
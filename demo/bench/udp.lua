@@ -0,0 +1,82 @@
+-- uvwrap udp benchmark on loopback: one datagram per call vs sendBatch + recvStartBatchAsync
+-- libuvwrap must be reachable through package.cpath, lmod through package.path:
+--   lua demo/bench/udp.lua [scale]
+
+local scale = tonumber(arg and arg[1]) or 1
+local clock = os.clock
+local libuv = require("libuv")
+local udp, network = libuv.udp, libuv.network
+libuv.init()
+
+local port = 26000 + math.random(0, 1000)
+local burst = 64 -- small enough for the socket buffer, no datagram is dropped
+local count = math.max(1, math.floor(200000 * scale / burst)) * burst
+local payload = string.rep("t", 100)
+local datagrams = {}
+for i = 1, burst do
+	datagrams[i] = payload
+end
+
+-- the sender sends the next burst when the receiver got the last one
+local function bench(name, send, recvStart)
+	port = port + 1
+	local addr = network.SockAddr()
+	addr:ip4Addr("127.0.0.1", port)
+	local receiver, sender = udp.Udp(), udp.Udp()
+	receiver:bind(addr)
+	local sent, received, calls = 0, 0, 0
+	local function next()
+		if sent < count then
+			sent = sent + send(sender, addr)
+		end
+	end
+	recvStart(receiver, function(n)
+		calls = calls + 1
+		received = received + n
+		if received == count then
+			receiver:recvStop()
+			receiver:closeAsync()
+			sender:closeAsync()
+		elseif received == sent then
+			next()
+		end
+	end)
+	collectgarbage()
+	local t = clock()
+	next()
+	libuv.run()
+	local cost = clock() - t
+	print(string.format("%-28s %8d packets %8d calls %10.3f ms %10.0f packets/s", name, received, calls, cost * 1000, received / cost))
+end
+
+bench("trySend / recvStartAsync", function(sender, addr)
+	for i = 1, burst do
+		assert(sender:trySend(payload, addr) >= 0)
+	end
+	return burst
+end, function(receiver, cb)
+	receiver:recvStartAsync(function(nread, mb)
+		if nread > 0 then cb(1) end
+	end)
+end)
+bench("sendBatch / recvStartAsync", function(sender, addr)
+	return assert(sender:sendBatch(datagrams, addr) == burst) and burst
+end, function(receiver, cb)
+	receiver:recvStartAsync(function(nread, mb)
+		if nread > 0 then cb(1) end
+	end)
+end)
+bench("sendBatch / batch recv", function(sender, addr)
+	return assert(sender:sendBatch(datagrams, addr) == burst) and burst
+end, function(receiver, cb)
+	receiver:recvStartBatchAsync(function(n, data, lens, addrs)
+		if n > 0 then cb(n) end
+	end, burst, 2048)
+end)
+bench("sendBatch / batch no addr", function(sender, addr)
+	return assert(sender:sendBatch(datagrams, addr) == burst) and burst
+end, function(receiver, cb)
+	receiver:recvStartBatchAsync(function(n, data, lens)
+		if n > 0 then cb(n) end
+	end, burst, 2048, false)
+end)
@@ -0,0 +1,76 @@
+-- uvwrap stream read benchmark: readStartAsync vs readStartBatchAsync on a loopback tcp connection
+-- libuvwrap must be reachable through package.cpath, lmod through package.path:
+--   lua demo/bench/uvread.lua [scale]
+
+local scale = tonumber(arg and arg[1]) or 1
+local clock = os.clock
+local libuv = require("libuv")
+local tcp, network = libuv.tcp, libuv.network
+local OK = libuv.err_code.OK
+libuv.init()
+
+local port = 25000 + math.random(0, 1000)
+
+-- client writes 'count' chunks, server reads them with 'start'
+local function bench(name, count, chunk, start)
+	port = port + 1
+	local addr = network.SockAddr()
+	addr:ip4Addr("127.0.0.1", port)
+	local server = tcp.Tcp()
+	server:bind(addr)
+	local bytes, calls, reads = 0, 0, 0
+	server:listenStartAsync(16, function()
+		local conn = tcp.Tcp()
+		assert(server:accept(conn) == OK)
+		start(conn, function(nread, n)
+			calls = calls + 1
+			if nread < 0 then
+				conn:closeAsync()
+				server:closeAsync()
+			else
+				bytes = bytes + nread
+				reads = reads + n
+			end
+		end)
+	end)
+	local client = tcp.Tcp()
+	client:connectAsync(addr, function(status)
+		assert(status == OK)
+		for _ = 1, count do
+			client:writeAsync(chunk)
+		end
+		client:shutdownAsync(function() client:closeAsync() end)
+	end)
+	collectgarbage()
+	local t = clock()
+	libuv.run()
+	local cost = clock() - t
+	assert(bytes == count * #chunk)
+	print(string.format("%-22s %10d bytes %8s reads %8d calls %10.3f ms %8.1f MB/s", name, bytes, reads > 0 and reads or "?", calls, cost * 1000, bytes / cost / 2 ^ 20))
+end
+
+local function readStart(conn, cb)
+	conn:readStartAsync(function(nread, mb) cb(nread, 1) end)
+end
+local function batch(contiguous, blockSize)
+	return function(conn, cb)
+		conn:readStartBatchAsync(function(nread, data) cb(nread, (contiguous or nread < 0) and 0 or #data) end, contiguous, blockSize)
+	end
+end
+
+-- small writes: a 64KB read takes everything that arrived, one read per loop iteration
+local count = math.floor(200000 * scale)
+local chunk = string.rep("x", 64)
+bench("readStartAsync", count, chunk, readStart)
+bench("batch list", count, chunk, batch(false))
+bench("batch contiguous", count, chunk, batch(true))
+bench("batch contiguous 4KB", count, chunk, batch(true, 4096))
+
+-- large writes into 4KB blocks: a read that fills its buffer makes libuv read again,
+-- up to 32 times per poll event, and the batch delivers all of them with one call
+print()
+count = math.floor(200 * scale)
+chunk = string.rep("x", 256 * 1024)
+bench("readStartAsync", count, chunk, readStart)
+bench("batch list 4KB", count, chunk, batch(false, 4096))
+bench("batch contiguous 4KB", count, chunk, batch(true, 4096))
@@ -0,0 +1,79 @@
+-- Interpreter dispatch benchmark
+-- Build liblua with -DLUA_USE_JUMPTABLE=ON and OFF, then run:
+--   lua demo/bench/vmdispatch.lua [scale]
+
+local scale = tonumber(arg and arg[1]) or 1
+local clock = os.clock
+
+local function bench(name, func, n)
+	n = n * scale
+	func(1) -- warm up
+	local start = clock()
+	func(n)
+	local cost = clock() - start
+	print(string.format("%-12s %10d loops %8.3f s", name, n, cost))
+	return cost
+end
+
+local function arith(n)
+	local a, b, c = 1, 2, 3
+	for i = 1, n do
+		a = a + i
+		b = b * 3 % 1000
+		c = (a - b) // 7 + (c & 0xff)
+	end
+	return a + b + c
+end
+
+local function branch(n)
+	local even, odd = 0, 0
+	for i = 1, n do
+		if i % 2 == 0 then
+			even = even + 1
+		elseif i % 3 == 0 then
+			odd = odd + 2
+		else
+			odd = odd + 1
+		end
+	end
+	return even + odd
+end
+
+local function field(n)
+	local t = {x = 1, y = 2, z = 3}
+	local sum = 0
+	for i = 1, n do
+		t.x = t.y + i
+		sum = sum + t.x - t.z
+	end
+	return sum
+end
+
+local function fib(x)
+	if x < 2 then return x end
+	return fib(x - 1) + fib(x - 2)
+end
+local function call(n)
+	local sum = 0
+	for _ = 1, n // 10000 do
+		sum = sum + fib(15)
+	end
+	return sum
+end
+
+local function closure(n)
+	local sum = 0
+	for i = 1, n // 10 do
+		local f = function(x) return x + i end
+		sum = f(sum)
+	end
+	return sum
+end
+
+local total = 0
+total = total + bench("arith", arith, 20000000)
+total = total + bench("branch", branch, 20000000)
+total = total + bench("field", field, 20000000)
+total = total + bench("call", call, 20000000)
+total = total + bench("closure", closure, 20000000)
+print(string.format("%-12s %25.3f s", "total", total))
@@ -476,10 +476,9 @@ static void print_lua_string_table(lua_State* L) {
   global_State* G = G(L);
   stringtable strt = G->strt;
   for (int i = 0; i < strt.size; i++) {
-    TString* str = strt.hash[i];
-    while (str != NULL) {
+    TString* str = strt.slot[i].ts;
+    if (str != NULL) {
       printf("String: %s\n", getstr(str));
-      str = str->u.hnext;
     }
   }
   // print global internal string table
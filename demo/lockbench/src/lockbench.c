@@ -0,0 +1,141 @@
+// Contention benchmark for a lua_State shared by several OS threads
+// Needs liblua built with -DLUA_USE_THREADLOCK=ON:
+//   lockbench [iterations] [sleepus]
+// Every OS thread drives its own Lua thread (lua_newthread) of one state,
+// which keeps resuming coroutines. With 'sleepus' > 0 each step also calls a
+// C function that sleeps, C functions run without the lock, so those sleeps
+// overlap instead of adding up.
+
+#define lockbench_c
+
+#include <lprefix.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include <lua.h>
+#include <lualib.h>
+#include <lauxlib.h>
+
+#if !defined(LUA_USE_THREADLOCK)
+#error "lockbench needs liblua built with LUA_USE_THREADLOCK"
+#endif
+
+#define MAX_THREADS 8
+
+static const char* bench_code = "\
+local create, resume, yield = coroutine.create, coroutine.resume, coroutine.yield\n\
+local sleepus = sleepus\n\
+local function body(n)\n\
+  local sum = 0\n\
+  while true do\n\
+    for i = 1, n do\n\
+      sum = sum + i\n\
+    end\n\
+    n = yield(sum)\n\
+  end\n\
+end\n\
+function work(iterations, pause)\n\
+  local co = create(body)\n\
+  local last\n\
+  for i = 1, iterations do\n\
+    if i % 64 == 0 then\n\
+      co = create(body)\n\
+    end\n\
+    local ok, sum = resume(co, 100)\n\
+    last = sum\n\
+    if pause > 0 then\n\
+      sleepus(pause)\n\
+    end\n\
+  end\n\
+  return last\n\
+end\n\
+";
+
+static int sleepus(lua_State* L) {
+  usleep((useconds_t)luaL_checkinteger(L, 1)); // runs outside lua_lock
+  return 0;
+}
+
+typedef struct {
+  pthread_t tid;
+  lua_State* co; // driver thread, anchored in the registry
+  int ref;
+  lua_Integer iterations;
+  lua_Integer sleepus;
+  int status;
+} Driver;
+
+static void* drive(void* arg) {
+  Driver* d = (Driver*)arg;
+  lua_getglobal(d->co, "work");
+  lua_pushinteger(d->co, d->iterations);
+  lua_pushinteger(d->co, d->sleepus);
+  d->status = lua_pcall(d->co, 2, 0, 0);
+  if (d->status != LUA_OK) {
+    fprintf(stderr, "error: %s\n", lua_tostring(d->co, -1));
+  }
+  lua_settop(d->co, 0);
+  return NULL;
+}
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static int run(lua_State* L, int nthreads, lua_Integer iterations, lua_Integer sleepus) {
+  Driver drivers[MAX_THREADS];
+  int i, status = LUA_OK;
+  for (i = 0; i < nthreads; i++) {
+    drivers[i].co = lua_newthread(L);
+    drivers[i].ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    drivers[i].iterations = iterations;
+    drivers[i].sleepus = sleepus;
+  }
+  double start = now();
+  for (i = 0; i < nthreads; i++) {
+    pthread_create(&drivers[i].tid, NULL, drive, &drivers[i]);
+  }
+  for (i = 0; i < nthreads; i++) {
+    pthread_join(drivers[i].tid, NULL);
+    if (drivers[i].status != LUA_OK)
+      status = drivers[i].status;
+    luaL_unref(L, LUA_REGISTRYINDEX, drivers[i].ref);
+  }
+  double cost = now() - start;
+  double resumes = (double)iterations * nthreads;
+  printf("%2d threads %10.0f resumes %8.3f s %12.0f resumes/s\n", nthreads, resumes, cost, resumes / cost);
+  return status;
+}
+
+int main(int argc, char* argv[]) {
+  lua_Integer iterations = argc > 1 ? (lua_Integer)atoll(argv[1]) : 200000;
+  lua_Integer pause = argc > 2 ? (lua_Integer)atoll(argv[2]) : 0;
+  lua_State* L = luaL_newstate();
+  if (L == NULL) {
+    fprintf(stderr, "cannot create state: not enough memory\n");
+    return EXIT_FAILURE;
+  }
+  luaL_openlibs(L);
+  lua_register(L, "sleepus", sleepus);
+  if (luaL_dostring(L, bench_code) != LUA_OK) {
+    fprintf(stderr, "%s\n", lua_tostring(L, -1));
+    lua_close(L);
+    return EXIT_FAILURE;
+  }
+  if (pause > 0) {
+    iterations = iterations / 100 > 0 ? iterations / 100 : 1;
+  }
+  printf("iterations per thread: %lld, sleep per step: %lld us\n", (long long)iterations, (long long)pause);
+  int status = LUA_OK;
+  for (int n = 1; n <= MAX_THREADS && status == LUA_OK; n *= 2) {
+    status = run(L, n, iterations, pause);
+  }
+  lua_close(L);
+  return status == LUA_OK ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -24,6 +24,23 @@ do
 	showarray("      b:", b)
 	showarray("a and b:", a * b)
 	showarray("a or  b:", a + b)
+
+	-- sparse operands where one side has no containers
+	local e = array.sparse(1000)
+	local s = array.sparse(1000)
+	s[5] = true
+	for _, op in ipairs({"and", "andnot", "or", "xor"}) do
+		local l, r = array.sparse(1000), array.sparse(1000)
+		r[5] = true
+		array.combine(l, op, r)
+		assert(array.count(l) == ((op == "or" or op == "xor") and 1 or 0), op)
+	end
+	assert(array.count(e * s) == 0 and array.count(e - s) == 0)
+	assert(array.count(e + s) == 1 and array.count(e ~ s) == 1)
+	assert(array.count(s * e) == 0 and array.count(s - e) == 1)
+	local far = array.sparse(1000000)
+	far[999999] = true
+	assert(array.count(s * far) == 0 and array.count(s - far) == 1)
 end
 print("======================================================================")
 do
@@ -72,6 +89,29 @@ do
 	while coroutine.status(co) ~= "dead" do print(coroutine.resume(co)) end
 end
 print("======================================================================")
+do
+	local intmap = require("libintmap")
+	local m = intmap.new("integer")
+	m[5] = 50
+	m[7.0] = 70
+	assert(m[5] == 50 and m[5.0] == 50 and m[7] == 70 and #m == 2)
+	-- keys are not converted from strings
+	assert(m["5"] == nil and m[5.5] == nil)
+	assert(not pcall(function() m["6"] = 1 end) and not pcall(function() m[6.5] = 1 end))
+	-- churn just below the load limit grows once instead of rehashing on every insertion
+	m = intmap.new("integer", 1000)
+	local _, cap = intmap.memsize(m)
+	local live = cap - cap // 8 - 1
+	for i = 1, live do m[i] = i end
+	for i = 1, 1000 do
+		m[i] = nil
+		m[live + i] = i
+	end
+	local _, ncap, count = intmap.memsize(m)
+	assert(count == live and ncap == cap * 2, ncap)
+	print("intmap:", m)
+end
+print("======================================================================")
 do
 end
 print("======================================================================")
@@ -102,5 +142,24 @@ lproc.start(receive)
 lproc.start(send)
 lproc.send("main", "liblproc", 15.5, nil)
 print("lproc: main end.")
+do -- a reference MemBuffer is copied, the receiver never sees the sender's memory
+	local util = require("util")
+	lproc.start([[
+		local lproc = require("liblproc")
+		local mb = lproc.receive("membuf")
+		lproc.send("membuf_back", mb:getType(), mb:toString())
+	]])
+	local owner = util.serialize("payload", 42)
+	local ptr, sz, release, ud = owner:getClear()
+	owner:setReplace(ptr, sz, release, ud)
+	local ref = owner:makeCopy()
+	ref:setReplace(ptr, sz)
+	local expect = owner:toString()
+	lproc.send("membuf", ref)
+	assert(ref:getSize() == 0)
+	owner:release()
+	local mt, data = lproc.receive("membuf_back")
+	assert(mt == 4 and data == expect) -- MT_Dynamic
+end
 print("======================================================================")
 lproc.exit() -- current is main thread, should wait for other thread
@@ -10,6 +10,7 @@
 #include "lprefix.h"
 
 #include <stdarg.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "lua.h"
@@ -484,7 +485,7 @@ LUA_API void lua_pushinteger(lua_State* L, lua_Integer n) {
 LUA_API const char* lua_pushlstring(lua_State* L, const char* s, size_t len) {
   TString* ts;
   lua_lock(L);
-  ts = (len == 0) ? luaS_new(L, "") : luaS_newlstr(L, s, len);
+  ts = (len == 0) ? luaS_new(L, "") : luaS_newlstrapi(L, s, len);
   setsvalue2s(L, L->top, ts);
   api_incr_top(L);
   luaC_checkGC(L);
@@ -509,6 +510,88 @@ LUA_API const char* lua_pushstring(lua_State* L, const char* s) {
   return s;
 }
 
+/*
+** {======================================================
+** Atoms: pre-interned strings pushed by id, no hashing
+** =======================================================
+*/
+
+/* process wide names, index 0 is never used */
+static const char* atomnames[LUAI_MAXATOMS];
+static int natoms = 0;
+static volatile long atomspin = 0;
+
+/* intern atom 'id' in this state, on its first push */
+static void internatom(lua_State* L, int id) {
+  global_State* g = G(L);
+  const char* name;
+  luai_atomlock(atomspin);
+  name = (0 < id && id <= natoms) ? atomnames[id] : NULL;
+  luai_atomunlock(atomspin);
+  api_check(L, name != NULL, "invalid atom");
+  if (id >= g->sizeatoms) {
+    int i, size = g->sizeatoms;
+    int newsize = (id < LUAI_MAXATOMS / 2) ? id * 2 : LUAI_MAXATOMS;
+    luaM_reallocvector(L, g->atoms, size, newsize, TString*);
+    for (i = size; i < newsize; i++)
+      g->atoms[i] = NULL;
+    g->sizeatoms = newsize;
+  }
+  /* 'markatoms' keeps it alive from now on */
+  g->atoms[id] = luaS_new(L, name);
+}
+
+/*
+** Return the id of atom 'name', creating it if needed. The same name
+** has the same id in every state, so C modules can keep ids in static
+** variables. 'name' is copied, the copy lives as long as the process,
+** as the module which created the atom may be unloaded before others.
+*/
+LUA_API int lua_newatom(lua_State* L, const char* name) {
+  int id;
+  char* copy = NULL;
+  lua_lock(L);
+  luai_atomlock(atomspin);
+  for (id = 1; id <= natoms; id++) {
+    if (strcmp(atomnames[id], name) == 0)
+      break;
+  }
+  if (id > natoms && natoms + 1 < LUAI_MAXATOMS) {
+    size_t len = strlen(name) + 1;
+    copy = (char*)malloc(len);
+    if (copy != NULL) {
+      memcpy(copy, name, len);
+      atomnames[++natoms] = copy;
+    }
+  }
+  luai_atomunlock(atomspin);
+  if (id > natoms) {
+    if (natoms + 1 < LUAI_MAXATOMS && copy == NULL)
+      luaD_throw(L, LUA_ERRMEM);
+    luaG_runerror(L, "too many atoms (limit is %d)", LUAI_MAXATOMS - 1);
+  }
+  if (id >= G(L)->sizeatoms || G(L)->atoms[id] == NULL)
+    internatom(L, id);
+  lua_unlock(L);
+  return id;
+}
+
+// [-0, +1], need 1 slot
+LUA_API const char* lua_pushatom(lua_State* L, int id) {
+  global_State* g = G(L);
+  TString* ts;
+  lua_lock(L);
+  if (cast(unsigned int, id) >= cast(unsigned int, g->sizeatoms) || g->atoms[id] == NULL)
+    internatom(L, id);
+  ts = g->atoms[id];
+  setsvalue2s(L, L->top, ts);
+  api_incr_top(L);
+  lua_unlock(L);
+  return getstr(ts);
+}
+
+/* }====================================================== */
+
 LUA_API const char* lua_pushvfstring(lua_State* L, const char* fmt, va_list argp) {
   const char* ret;
   lua_lock(L);
@@ -735,6 +818,42 @@ LUA_API void lua_rehashtable(lua_State* L, int idx) {
   lua_unlock(L);
 }
 
+// resize the array part to 'narr' slots, the hash part keeps its size
+LUA_API void lua_resizetable(lua_State* L, int idx, int narr) {
+  lua_lock(L);
+  StkId value = index2addr(L, idx);
+  api_check(L, ttistable(value), "table expected");
+  api_check(L, narr >= 0, "invalid array size");
+  luaH_resizearray(L, hvalue(value), cast(unsigned int, narr));
+  lua_unlock(L);
+}
+
+/*
+** t[i..j] = v (raw), v is the value at the top, which is popped. The
+** array part grows to hold 'j' first, so every slot is a plain store
+** and the table needs one back barrier instead of one per slot.
+*/
+LUA_API void lua_filltable(lua_State* L, int idx, lua_Integer i, lua_Integer j) {
+  lua_lock(L);
+  api_checknelems(L, 1);
+  StkId value = index2addr(L, idx);
+  api_check(L, ttistable(value), "table expected");
+  api_check(L, 1 <= i && j < MAX_INT, "invalid fill range");
+  Table* t = hvalue(value);
+  if (i <= j) {
+    if (cast(lua_Integer, t->sizearray) < j)
+      luaH_resizearray(L, t, cast(unsigned int, j));
+    const TValue* v = L->top - 1;
+    TValue* slot = &t->array[i - 1];
+    TValue* limit = &t->array[j];
+    for (; slot < limit; slot++)
+      setobj2t(L, slot, v);
+    luaC_barrierback(L, t, v);
+  }
+  L->top--;
+  lua_unlock(L);
+}
+
 // [-0, +(0|1)], need 1 slot
 LUA_API int lua_getmetatable(lua_State* L, int objindex) {
   const TValue* obj;
@@ -1021,6 +1140,18 @@ LUA_API int lua_pcallk(lua_State* L, int nargs, int nresults, int errfunc, lua_K
 }
 
 // Support text or binary
+static void setglobalenv(lua_State* L) {
+  LClosure* f = clLvalue(L->top - 1); /* get newly created function */
+  if (f->nupvalues >= 1) { /* does it have an upvalue? */
+    /* get global table from registry */
+    Table* reg = hvalue(&G(L)->l_registry);
+    const TValue* gt = luaH_getint(reg, LUA_RIDX_GLOBALS);
+    /* set global table as 1st upvalue of 'f' (may be LUA_ENV) */
+    setobj(L, f->upvals[0]->v, gt);
+    luaC_upvalbarrier(L, f->upvals[0]);
+  }
+}
+
 LUA_API int lua_load(lua_State* L, lua_Reader reader, void* data, const char* chunkname, const char* mode) {
   ZIO z;
   int status;
@@ -1028,18 +1159,59 @@ LUA_API int lua_load(lua_State* L, lua_Reader reader, void* data, const char* ch
   if (!chunkname)
     chunkname = "?";
   luaZ_init(L, &z, reader, data);
-  status = luaD_protectedparser(L, &z, chunkname, mode);
-  if (status == LUA_OK) { /* no errors? */
-    LClosure* f = clLvalue(L->top - 1); /* get newly created function */
-    if (f->nupvalues >= 1) { /* does it have an upvalue? */
-      /* get global table from registry */
-      Table* reg = hvalue(&G(L)->l_registry);
-      const TValue* gt = luaH_getint(reg, LUA_RIDX_GLOBALS);
-      /* set global table as 1st upvalue of 'f' (may be LUA_ENV) */
-      setobj(L, f->upvals[0]->v, gt);
-      luaC_upvalbarrier(L, f->upvals[0]);
-    }
+  status = luaD_protectedparser(L, &z, chunkname, mode, NULL);
+  if (status == LUA_OK) /* no errors? */
+    setglobalenv(L);
+  lua_unlock(L);
+  return status;
+}
+
+typedef struct LoadBlock {
+  const char* p;
+  size_t size;
+} LoadBlock;
+
+static const char* getblock(lua_State* L, void* ud, size_t* size) {
+  LoadBlock* b = (LoadBlock*)ud;
+  (void)L; /* not used */
+  if (b->size == 0)
+    return NULL;
+  *size = b->size;
+  b->size = 0;
+  return b->p;
+}
+
+/*
+** Load a chunk from a block that the state takes over: chunks dumped by
+** 'lua_dumpmap' are used in place, their functions keep pointing into
+** 'data' until they are collected; 'unmap' is called once nothing uses
+** the block any more (right away for other chunks or on errors).
+** 'data' must be aligned as 'malloc' or 'mmap' results are.
+*/
+LUA_API int lua_loadmap(lua_State* L, const void* data, size_t size, const char* chunkname, const char* mode, lua_Unmap unmap, void* ud) {
+  ZIO z;
+  LoadBlock b;
+  MapChunk* map;
+  int status;
+  lua_lock(L);
+  api_check(L, unmap != NULL, "no release function");
+  if (!chunkname)
+    chunkname = "?";
+  map = luaU_newmap(L, data, size, unmap, ud);
+  if (map == NULL) {
+    (*unmap)(ud, (void*)data, size);
+    setsvalue2s(L, L->top, G(L)->memerrmsg);
+    api_incr_top(L);
+    lua_unlock(L);
+    return LUA_ERRMEM;
   }
+  b.p = (const char*)data;
+  b.size = size;
+  luaZ_init(L, &z, getblock, &b);
+  status = luaD_protectedparser(L, &z, chunkname, mode, map);
+  luaU_releasemap(L, map); /* loaded functions hold their own references */
+  if (status == LUA_OK)
+    setglobalenv(L);
   lua_unlock(L);
   return status;
 }
@@ -1058,6 +1230,20 @@ LUA_API int lua_dump(lua_State* L, lua_Writer writer, void* data, int strip) {
   return status;
 }
 
+LUA_API int lua_dumpmap(lua_State* L, lua_Writer writer, void* data, int strip) {
+  int status;
+  TValue* o;
+  lua_lock(L);
+  api_checknelems(L, 1);
+  o = L->top - 1;
+  if (isLfunction(o))
+    status = luaU_dumpmap(L, getproto(o), writer, data, strip);
+  else
+    status = 1;
+  lua_unlock(L);
+  return status;
+}
+
 LUA_API int lua_status(lua_State* L) {
   return L->status;
 }
@@ -1106,7 +1292,7 @@ LUA_API int lua_gc(lua_State* L, int what, int data) {
         luaC_checkGC(L);
       }
       g->gcrunning = oldrunning; /* restore previous state */
-      if (debt > 0 && g->gcstate == GCSpause) /* end of cycle? */
+      if (debt > 0 && (g->gcstate == GCSpause || isgenerational(g))) /* end of cycle? */
         res = 1; /* signal it */
       break;
     }
@@ -1131,10 +1317,22 @@ LUA_API int lua_gc(lua_State* L, int what, int data) {
       g->gcrunning = 1; // allow GC to run
       luaC_onestep(L);
       g->gcrunning = oldrunning; // restore previous state
-      if (g->gcstate == GCSpause) // end of cycle?
+      if (g->gcstate == GCSpause || isgenerational(g)) // end of cycle?
         res = 1; // signal it
       break;
     }
+    case LUA_GCGEN: {
+      res = isgenerational(g) ? LUA_GCGEN : LUA_GCINC;
+      if (data > 0)
+        g->gcgenminormul = data;
+      luaC_changemode(L, KGC_GEN);
+      break;
+    }
+    case LUA_GCINC: {
+      res = isgenerational(g) ? LUA_GCGEN : LUA_GCINC;
+      luaC_changemode(L, KGC_NORMAL);
+      break;
+    }
     default:
       res = -1; /* invalid option */
   }
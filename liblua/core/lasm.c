@@ -180,16 +180,22 @@ static void luaA_finish(AsmState* as) {
   luaM_reallocvector(L, f->p, f->sizep, as->np, Proto*);
   f->sizep = as->np;
   updateMaxStackSize(f);
+  luaF_initicache(L, f);
 }
 
+/* called unlocked, 'fill' goes back to the core through the asm API */
 void luaA_dofill(lua_State* L, Proto* clp, lua_FillPrototype fill, lu_byte ismain) {
   AsmState as[1];
+  lua_lock(L);
   luaA_init(as, L, clp, ismain);
   if (ismain) {
     luaA_upvalue(as, 0, 0);
   }
+  lua_unlock(L);
   fill(L, (void*)as);
+  lua_lock(L);
   luaA_finish(as);
+  lua_unlock(L);
 }
 
 /* }====================================================== */
@@ -202,18 +208,20 @@ void luaA_dofill(lua_State* L, Proto* clp, lua_FillPrototype fill, lu_byte ismai
 
 static LClosure* findEmptyClosure(lua_State* L) {
   const int EMPTY_CLOSURE = 0;
-  lua_rawgetp(L, LUA_REGISTRYINDEX, (void*)&EMPTY_CLOSURE);
-  if (ttype(L->top - 1) != LUA_TLCL) {
+  if (lua_rawgetp(L, LUA_REGISTRYINDEX, (void*)&EMPTY_CLOSURE) != LUA_TFUNCTION || lua_iscfunction(L, -1)) {
+    lua_lock(L);
     LClosure* ncl = luaF_newLclosure(L, 0);
     setclLvalue(L, L->top - 1, ncl); /* replace it */
+    lua_unlock(L);
     lua_pushvalue(L, -1);
     lua_rawsetp(L, LUA_REGISTRYINDEX, (void*)&EMPTY_CLOSURE);
   }
-  LClosure* empty = clLvalue(L->top - 1);
+  LClosure* empty = (LClosure*)lua_topointer(L, -1);
   lua_pop(L, 1);
   return empty;
 }
 static void createMainLclosure(lua_State* L, Proto* p) {
+  lua_lock(L);
   LClosure* ncl = luaF_newLclosure(L, 1);
   ncl->p = p;
 
@@ -226,6 +234,7 @@ static void createMainLclosure(lua_State* L, Proto* p) {
   /* set global table as 1st upvalue of 'f' (may be LUA_ENV) */
   setobj(L, ncl->upvals[0]->v, gt);
   luaC_upvalbarrier(L, ncl->upvals[0]);
+  lua_unlock(L);
 }
 static Proto* createProto(lua_State* L, int param, int vararg) {
   Proto* clp = luaF_newproto(L);
@@ -242,9 +251,11 @@ static int fillPrototype(lua_State* L) {
 }
 LUA_API int lua_newlclosure(lua_State* L, int param, int vararg, lua_FillPrototype fill) {
   LClosure* empty = findEmptyClosure(L);
+  lua_lock(L);
   Proto* clp = createProto(L, param, vararg);
   empty->p = clp; // anchor clp to empty closure
   luaC_objbarrier(L, empty, clp);
+  lua_unlock(L);
   empty = NULL;
 
   lua_pushcfunction(L, fillPrototype);
@@ -254,18 +265,25 @@ LUA_API int lua_newlclosure(lua_State* L, int param, int vararg, lua_FillPrototy
   if (ret == LUA_OK) {
     createMainLclosure(L, clp);
   }
-  findEmptyClosure(L)->p = NULL; // undo the anchor
+  empty = findEmptyClosure(L);
+  lua_lock(L);
+  empty->p = NULL; // undo the anchor
+  lua_unlock(L);
   return ret;
 }
 
 LUA_API void lua_asmcode(lua_State* L, void* ud, lua_Instruction i) {
   (void)L;
+  lua_lock(L);
   luaA_code((AsmState*)ud, (Instruction)i);
+  lua_unlock(L);
 }
 
 LUA_API void lua_asmconstant(lua_State* L, void* ud, int idx) {
+  lua_lock(L);
   TValue* v = index2addr(L, idx);
   luaA_constant((AsmState*)ud, v);
+  lua_unlock(L);
 }
 
 LUA_API void lua_asmupvalue(lua_State* L, void* ud, int instack, int idx) {
@@ -276,13 +294,17 @@ LUA_API void lua_asmupvalue(lua_State* L, void* ud, int instack, int idx) {
       lua_error(L);
     }
   } else {
+    lua_lock(L);
     luaA_upvalue(as, (lu_byte)instack, (lu_byte)idx);
+    lua_unlock(L);
   }
 }
 
 LUA_API void lua_asmproto(lua_State* L, void* ud, int param, int vararg, lua_FillPrototype fill) {
+  lua_lock(L);
   Proto* clp = createProto(L, param, vararg);
   luaA_proto((AsmState*)ud, clp); // anchor clp to parent proto
+  lua_unlock(L);
   luaA_dofill(L, clp, fill, 0);
 }
 
@@ -925,7 +925,7 @@ void luaK_indexed(FuncState* fs, expdesc* t, expdesc* k) {
 ** Bitwise operations need operands convertible to integers; division
 ** operations cannot have 0 as divisor.
 */
-static int validop(int op, TValue* v1, TValue* v2) {
+static int validop(int op, TValue* v1, TValue* v2, int optimize) {
   switch (op) {
     case LUA_OPBAND:
     case LUA_OPBOR:
@@ -939,7 +939,10 @@ static int validop(int op, TValue* v1, TValue* v2) {
     case LUA_OPDIV:
     case LUA_OPIDIV:
     case LUA_OPMOD: /* division by 0 */
-      return (nvalue(v2) != 0);
+      if (nvalue(v2) != 0)
+        return 1;
+      /* float division by 0 gives inf (or NaN, refused by 'constfolding') */
+      return optimize && (op == LUA_OPDIV || ttisfloat(v1) || ttisfloat(v2));
     default:
       return 1; /* everything else is valid */
   }
@@ -951,7 +954,7 @@ static int validop(int op, TValue* v1, TValue* v2) {
 */
 static int constfolding(FuncState* fs, int op, expdesc* e1, const expdesc* e2) {
   TValue v1, v2, res;
-  if (!tonumeral(e1, &v1) || !tonumeral(e2, &v2) || !validop(op, &v1, &v2))
+  if (!tonumeral(e1, &v1) || !tonumeral(e2, &v2) || !validop(op, &v1, &v2, fs->ls->optimize))
     return 0; /* non-numeric operands or not safe to fold */
   luaO_arith(fs->ls->L, op, &v1, &v2, &res); /* does operation */
   if (ttisinteger(&res)) {
@@ -967,6 +970,40 @@ static int constfolding(FuncState* fs, int op, expdesc* e1, const expdesc* e2) {
   return 1;
 }
 
+/*
+** Try to fold a comparison between two numerals (only when optimizing,
+** 'luaK_infix' keeps the first one as a numeral then); return 1 iff
+** successful, with 'e1' changed to 'true' or 'false'.
+*/
+static int constcompare(FuncState* fs, BinOpr opr, expdesc* e1, const expdesc* e2) {
+  TValue v1, v2;
+  int res;
+  if (!fs->ls->optimize || !tonumeral(e1, &v1) || !tonumeral(e2, &v2))
+    return 0;
+  switch (opr) { /* numbers only, so no metamethods and no errors */
+    case OPR_EQ:
+      res = luaV_rawequalobj(&v1, &v2);
+      break;
+    case OPR_NE:
+      res = !luaV_rawequalobj(&v1, &v2);
+      break;
+    case OPR_LT:
+      res = luaV_lessthan(fs->ls->L, &v1, &v2);
+      break;
+    case OPR_LE:
+      res = luaV_lessequal(fs->ls->L, &v1, &v2);
+      break;
+    case OPR_GT:
+      res = luaV_lessthan(fs->ls->L, &v2, &v1);
+      break;
+    default: /* OPR_GE */
+      res = luaV_lessequal(fs->ls->L, &v2, &v1);
+      break;
+  }
+  e1->k = res ? VTRUE : VFALSE;
+  return 1;
+}
+
 /*
 ** Emit code for unary expressions that "produce values"
 ** (everything but 'not').
@@ -1085,7 +1122,9 @@ void luaK_infix(FuncState* fs, BinOpr op, expdesc* v) {
       break;
     }
     default: {
-      luaK_exp2RK(fs, v);
+      if (!fs->ls->optimize || !tonumeral(v, NULL))
+        luaK_exp2RK(fs, v);
+      /* else keep numeral, which may be compared with 2nd operand */
       break;
     }
   }
@@ -1149,7 +1188,11 @@ void luaK_posfix(FuncState* fs, BinOpr op, expdesc* e1, expdesc* e2, int line) {
     case OPR_NE:
     case OPR_GT:
     case OPR_GE: {
-      codecomp(fs, op, e1, e2);
+      if (!constcompare(fs, op, e1, e2)) {
+        if (tonumeral(e1, NULL)) /* kept by 'luaK_infix' */
+          luaK_exp2RK(fs, e1);
+        codecomp(fs, op, e1, e2);
+      }
       break;
     }
     default:
@@ -1184,3 +1227,254 @@ void luaK_setlist(FuncState* fs, int base, int nelems, int tostore) {
     luaX_syntaxerror(fs->ls, "constructor too long");
   fs->freereg = base + 1; /* free registers with list values */
 }
+
+/*
+** {======================================================
+** Peephole pass (load mode 'O', 'luac -O')
+** Runs on a finished function, from 'close_func': merges a MOVE into
+** the instruction computing its source, turns GETUPVAL+GETTABLE into
+** GETTABUP, and marks chained lookups as superinstructions.
+** =======================================================
+*/
+
+/* does 'i' skip (or consume) the next instruction? */
+static int skipsnext(Instruction i) {
+  switch (GET_OPCODE(i)) {
+    case OP_LOADBOOL:
+      return GETARG_C(i) != 0;
+    case OP_SETLIST:
+      return GETARG_C(i) == 0;
+    case OP_LOADKX:
+    case OP_EQ:
+    case OP_LT:
+    case OP_LE:
+    case OP_TEST:
+    case OP_TESTSET:
+    case OP_TFORCALL:
+    case OP_GETTABUP2:
+    case OP_GETTABLE2:
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+static int isjump(Instruction i) {
+  OpCode op = GET_OPCODE(i);
+  return (op == OP_JMP || op == OP_FORLOOP || op == OP_FORPREP || op == OP_TFORLOOP);
+}
+
+/* can the instruction at 'pc' be reached other than from 'pc - 1'? */
+static int isjumptarget(FuncState* fs, int pc) {
+  Instruction* code = fs->f->code;
+  int i;
+  if (pc >= 2 && skipsnext(code[pc - 2]))
+    return 1;
+  for (i = 0; i < fs->pc; i++) {
+    if (isjump(code[i]) && i + 1 + GETARG_sBx(code[i]) == pc)
+      return 1;
+  }
+  return 0;
+}
+
+/* remove instruction 'pc', which must not be a jump target */
+static void removecode(FuncState* fs, int pc) {
+  Proto* f = fs->f;
+  int i;
+  for (i = 0; i < fs->pc; i++) { /* fix jumps crossing 'pc' */
+    if (isjump(f->code[i])) {
+      int dest = i + 1 + GETARG_sBx(f->code[i]);
+      lua_assert(dest != pc);
+      if (i < pc && dest > pc)
+        SETARG_sBx(f->code[i], GETARG_sBx(f->code[i]) - 1);
+      else if (i > pc && dest < pc)
+        SETARG_sBx(f->code[i], GETARG_sBx(f->code[i]) + 1);
+    }
+  }
+  for (i = pc; i < fs->pc - 1; i++) {
+    f->code[i] = f->code[i + 1];
+    f->lineinfo[i] = f->lineinfo[i + 1];
+  }
+  fs->pc--;
+  for (i = 0; i < fs->nlocvars; i++) {
+    if (f->locvars[i].startpc > pc)
+      f->locvars[i].startpc--;
+    if (f->locvars[i].endpc > pc)
+      f->locvars[i].endpc--;
+  }
+}
+
+/* is 'reg' a temporary (not a local variable) at 'pc'? */
+static int istemp(FuncState* fs, int pc, int reg) {
+  int i;
+  int nactive = 0; /* locals live in the lowest registers */
+  for (i = 0; i < fs->nlocvars; i++) {
+    LocVar* var = &fs->f->locvars[i];
+    if (var->startpc <= pc && pc < var->endpc)
+      nactive++;
+  }
+  return reg >= nactive;
+}
+
+#define readsRK(x, reg) (!ISK(x) && (x) == (reg))
+
+/*
+** is the value of 'reg' dead after 'pc'? Follows straight code until
+** 'reg' is read or written; anything else is assumed to read it.
+*/
+static int isdeadreg(FuncState* fs, int pc, int reg) {
+  for (pc++; pc < fs->pc; pc++) {
+    Instruction i = fs->f->code[pc];
+    int a = GETARG_A(i);
+    int b = GETARG_B(i);
+    int c = GETARG_C(i);
+    switch (GET_OPCODE(i)) {
+      case OP_LOADBOOL:
+        if (c != 0)
+          return 0;
+        /* FALLTHROUGH */
+      case OP_LOADK:
+      case OP_GETUPVAL:
+      case OP_NEWTABLE:
+        break;
+      case OP_LOADNIL:
+        if (a <= reg && reg <= a + b)
+          return 1;
+        continue;
+      case OP_MOVE:
+      case OP_UNM:
+      case OP_BNOT:
+      case OP_NOT:
+      case OP_LEN:
+        if (b == reg)
+          return 0;
+        break;
+      case OP_GETTABUP:
+        if (readsRK(c, reg))
+          return 0;
+        break;
+      case OP_GETTABLE:
+      case OP_ADD:
+      case OP_SUB:
+      case OP_MUL:
+      case OP_MOD:
+      case OP_POW:
+      case OP_DIV:
+      case OP_IDIV:
+      case OP_BAND:
+      case OP_BOR:
+      case OP_BXOR:
+      case OP_SHL:
+      case OP_SHR:
+        if (readsRK(b, reg) || readsRK(c, reg))
+          return 0;
+        break;
+      case OP_SETTABUP:
+        if (readsRK(b, reg) || readsRK(c, reg))
+          return 0;
+        continue;
+      case OP_SETUPVAL:
+        if (a == reg)
+          return 0;
+        continue;
+      case OP_SETTABLE:
+        if (a == reg || readsRK(b, reg) || readsRK(c, reg))
+          return 0;
+        continue;
+      case OP_CALL: /* reads its arguments, clobbers everything above */
+        if (reg >= a)
+          return (b != 0 && reg >= a + b);
+        continue;
+      case OP_RETURN:
+        return !(reg >= a && (b == 0 || reg < a + b - 1));
+      default: /* jumps and the rest, give up */
+        return 0;
+    }
+    if (a == reg) /* written before any read */
+      return 1;
+  }
+  return 0;
+}
+
+/* can instruction 'op' have its result register changed? */
+static int isretargetable(Instruction i) {
+  switch (GET_OPCODE(i)) {
+    case OP_LOADBOOL:
+      return GETARG_C(i) == 0;
+    case OP_LOADNIL:
+      return GETARG_B(i) == 0;
+    case OP_MOVE:
+    case OP_LOADK:
+    case OP_GETUPVAL:
+    case OP_GETTABUP:
+    case OP_GETTABLE:
+    case OP_ADD:
+    case OP_SUB:
+    case OP_MUL:
+    case OP_MOD:
+    case OP_POW:
+    case OP_DIV:
+    case OP_IDIV:
+    case OP_BAND:
+    case OP_BOR:
+    case OP_BXOR:
+    case OP_SHL:
+    case OP_SHR:
+    case OP_UNM:
+    case OP_BNOT:
+    case OP_NOT:
+    case OP_LEN:
+      return 1;
+    default: /* NEWTABLE, CONCAT and CLOSURE run the GC with top at R(A + 1) */
+      return 0;
+  }
+}
+
+/*
+** try to merge instructions 'pc' and 'pc + 1' into one, at 'pc';
+** return 1 iff successful
+*/
+static int mergecode(FuncState* fs, int pc) {
+  Instruction* code = fs->f->code;
+  Instruction i = code[pc];
+  Instruction next = code[pc + 1];
+  int a = GETARG_A(i);
+  if ((pc > 0 && skipsnext(code[pc - 1])) || skipsnext(i) || isjumptarget(fs, pc + 1))
+    return 0;
+  if (GET_OPCODE(next) == OP_MOVE && GETARG_B(next) == a && isretargetable(i) &&
+      istemp(fs, pc + 1, a) && isdeadreg(fs, pc + 1, a)) {
+    /* 'x = temp' of a value just computed in 'temp': compute it in 'x' */
+    SETARG_A(code[pc], GETARG_A(next));
+  } else if (GET_OPCODE(i) == OP_GETUPVAL && GET_OPCODE(next) == OP_GETTABLE &&
+             GETARG_B(next) == a && !readsRK(GETARG_C(next), a) &&
+             (GETARG_A(next) == a || (istemp(fs, pc + 1, a) && isdeadreg(fs, pc + 1, a)))) {
+    /* 'upvalue.field' */
+    code[pc] = CREATE_ABC(OP_GETTABUP, GETARG_A(next), GETARG_B(i), GETARG_C(next));
+    fs->f->lineinfo[pc] = fs->f->lineinfo[pc + 1]; /* where an index error happens */
+  } else
+    return 0;
+  removecode(fs, pc + 1);
+  return 1;
+}
+
+void luaK_optimize(FuncState* fs) {
+  Proto* f = fs->f;
+  int pc = 0;
+  while (pc + 1 < fs->pc) {
+    if (!mergecode(fs, pc))
+      pc++;
+  }
+  /* lookup chains such as 'a.b.c', on one line for line hooks */
+  for (pc = 0; pc + 1 < fs->pc; pc++) {
+    Instruction i = f->code[pc];
+    Instruction next = f->code[pc + 1];
+    OpCode op = GET_OPCODE(i);
+    if ((op == OP_GETTABUP || op == OP_GETTABLE) && GET_OPCODE(next) == OP_GETTABLE &&
+        GETARG_B(next) == GETARG_A(i) && f->lineinfo[pc] == f->lineinfo[pc + 1]) {
+      SET_OPCODE(f->code[pc], op == OP_GETTABUP ? OP_GETTABUP2 : OP_GETTABLE2);
+      pc++; /* 'next' is now an operand */
+    }
+  }
+}
+
+/* }====================================================== */
@@ -78,7 +78,23 @@ LUA_API void lua_sethook(lua_State* L, lua_Hook func, int mask, int count) {
   L->hook = func;
   L->basehookcount = count;
   resethookcount(L);
-  L->hookmask = cast_byte(mask);
+  luai_maskclear(L->hookmask, ~MASKASYNC); /* keeps an armed asynchronous hook */
+  luai_maskset(L->hookmask, cast_byte(mask));
+}
+
+/*
+** Arm 'func' to be called once, as a count hook, by the thread running in
+** the state of 'L' at its next instruction. Unlike 'lua_sethook' it leaves
+** the hook of every thread alone and follows coroutine switches. The bit is
+** set in one atomic step, so it can be called from a signal handler on the
+** OS thread which runs the state, never from another one. 'func' must not
+** yield. NULL disarms it.
+*/
+LUA_API void lua_setasynchook(lua_State* L, lua_Hook func) {
+  global_State* g = G(L);
+  g->asynchook = func;
+  if (func != NULL)
+    luai_maskset(g->running->hookmask, MASKASYNC);
 }
 
 LUA_API lua_Hook lua_gethook(lua_State* L) {
@@ -86,7 +102,7 @@ LUA_API lua_Hook lua_gethook(lua_State* L) {
 }
 
 LUA_API int lua_gethookmask(lua_State* L) {
-  return L->hookmask;
+  return L->hookmask & ~MASKASYNC;
 }
 
 LUA_API int lua_gethookcount(lua_State* L) {
@@ -467,10 +483,12 @@ static const char* getobjname(Proto* p, int lastpc, int reg, const char** name)
         break;
       }
       case OP_GETTABUP:
-      case OP_GETTABLE: {
+      case OP_GETTABLE:
+      case OP_GETTABUP2:
+      case OP_GETTABLE2: {
         int k = GETARG_C(i); /* key index */
         int t = GETARG_B(i); /* table index */
-        const char* vn = (op == OP_GETTABLE) /* name of indexed variable */
+        const char* vn = (op == OP_GETTABLE || op == OP_GETTABLE2) /* name of indexed variable */
                              ?
                              luaF_getlocalname(p, t + 1, pc) :
                              upvalname(p, t);
@@ -699,7 +717,15 @@ l_noret luaG_runerror(lua_State* L, const char* fmt, ...) {
 void luaG_traceexec(lua_State* L) {
   CallInfo* ci = L->ci;
   lu_byte mask = L->hookmask;
-  int counthook = (--L->hookcount == 0 && (mask & LUA_MASKCOUNT));
+  int counthook;
+  if ((mask & MASKASYNC) && L->allowhook) { /* asynchronous hook armed? */
+    lua_Hook hook = G(L)->asynchook;
+    luai_maskclear(L->hookmask, MASKASYNC);
+    mask &= cast_byte(~MASKASYNC);
+    if (hook != NULL)
+      luaD_callhook(L, hook, LUA_HOOKCOUNT, -1);
+  }
+  counthook = (--L->hookcount == 0 && (mask & LUA_MASKCOUNT));
   if (counthook)
     resethookcount(L); /* reset count */
   else if (!(mask & LUA_MASKLINE))
@@ -15,6 +15,18 @@
 
 #define resethookcount(L) (L->hookcount = L->basehookcount)
 
+/* bit of 'hookmask', the thread has to call 'asynchook' */
+#define MASKASYNC (1 << 7)
+
+/* an armed asynchronous hook follows the running thread */
+#define moveasynchook(from, to) \
+  { \
+    if ((from)->hookmask & MASKASYNC) { \
+      luai_maskclear((from)->hookmask, MASKASYNC); \
+      luai_maskset((to)->hookmask, MASKASYNC); \
+    } \
+  }
+
 LUAI_FUNC l_noret luaG_typeerror(lua_State* L, const TValue* o, const char* opname);
 LUAI_FUNC l_noret luaG_concaterror(lua_State* L, const TValue* p1, const TValue* p2);
 LUAI_FUNC l_noret luaG_opinterror(lua_State* L, const TValue* p1, const TValue* p2, const char* msg);
@@ -254,7 +254,10 @@ void luaD_inctop(lua_State* L) {
 ** function, can be changed asynchronously by signals.)
 */
 void luaD_hook(lua_State* L, int event, int line) {
-  lua_Hook hook = L->hook;
+  luaD_callhook(L, L->hook, event, line);
+}
+
+void luaD_callhook(lua_State* L, lua_Hook hook, int event, int line) {
   if (hook && L->allowhook) { /* make sure there is a hook */
     CallInfo* ci = L->ci;
     ptrdiff_t top = savestack(L, L->top);
@@ -647,6 +650,7 @@ static void resume(lua_State* L, void* ud) {
 
 LUA_API int lua_resume(lua_State* L, lua_State* from, int nargs) {
   int status;
+  lua_State* running; /* thread to restore as running */
   unsigned short oldnny = L->nny; /* save "number of non-yieldable" calls */
   lua_lock(L);
   if (L->status == LUA_OK) { /* may be starting a coroutine */
@@ -660,6 +664,9 @@ LUA_API int lua_resume(lua_State* L, lua_State* from, int nargs) {
   luai_userstateresume(L, nargs);
   L->nny = 0; /* allow yields */
   api_checknelems(L, (L->status == LUA_OK) ? nargs + 1 : nargs);
+  running = G(L)->running;
+  G(L)->running = L;
+  moveasynchook(running, L);
   status = luaD_rawrunprotected(L, resume, &nargs);
   if (status == -1) /* error calling 'lua_resume'? */
     status = LUA_ERRRUN;
@@ -675,6 +682,8 @@ LUA_API int lua_resume(lua_State* L, lua_State* from, int nargs) {
     } else
       lua_assert(status == L->status); /* normal end or yield */
   }
+  G(L)->running = running;
+  moveasynchook(L, running);
   L->nny = oldnny; /* restore 'nny' */
   L->nCcalls--;
   lua_assert(L->nCcalls == ((from) ? from->nCcalls : 0));
@@ -743,6 +752,7 @@ struct SParser { /* data to 'f_parser' */
   Dyndata dyd; /* dynamic structures used by the parser */
   const char* mode;
   const char* name;
+  MapChunk* map; /* block given in place by 'lua_loadmap' */
 };
 
 // May Throw LUA_ERRSYNTAX
@@ -759,22 +769,23 @@ static void f_parser(lua_State* L, void* ud) {
   int c = zgetc(p->z); /* read first character */
   if (c == LUA_SIGNATURE[0]) {
     checkmode(L, p->mode, "binary");
-    cl = luaU_undump(L, p->z, p->name);
+    cl = luaU_undump(L, p->z, p->name, p->map);
   } else {
     checkmode(L, p->mode, "text");
-    cl = luaY_parser(L, p->z, &p->buff, &p->dyd, p->name, c);
+    cl = luaY_parser(L, p->z, &p->buff, &p->dyd, p->name, c, p->mode != NULL && strchr(p->mode, 'O') != NULL);
   }
   lua_assert(cl->nupvalues == cl->p->sizeupvalues);
   luaF_initupvals(L, cl);
 }
 
-int luaD_protectedparser(lua_State* L, ZIO* z, const char* name, const char* mode) {
+int luaD_protectedparser(lua_State* L, ZIO* z, const char* name, const char* mode, MapChunk* map) {
   struct SParser p;
   int status;
   L->nny++; /* cannot yield during parsing */
   p.z = z;
   p.name = name;
   p.mode = mode;
+  p.map = map;
   p.dyd.actvar.arr = NULL;
   p.dyd.actvar.size = 0;
   p.dyd.gt.arr = NULL;
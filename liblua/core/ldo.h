@@ -37,8 +37,9 @@
 /* type of protected functions, to be ran by 'runprotected' */
 typedef void (*Pfunc)(lua_State* L, void* ud);
 
-LUAI_FUNC int luaD_protectedparser(lua_State* L, ZIO* z, const char* name, const char* mode);
+LUAI_FUNC int luaD_protectedparser(lua_State* L, ZIO* z, const char* name, const char* mode, struct MapChunk* map);
 LUAI_FUNC void luaD_hook(lua_State* L, int event, int line);
+LUAI_FUNC void luaD_callhook(lua_State* L, lua_Hook hook, int event, int line);
 LUAI_FUNC int luaD_precall(lua_State* L, StkId func, int nresults);
 LUAI_FUNC void luaD_call(lua_State* L, StkId func, int nResults);
 LUAI_FUNC void luaD_callnoyield(lua_State* L, StkId func, int nResults);
@@ -14,6 +14,7 @@
 #include "lua.h"
 
 #include "lobject.h"
+#include "lopcodes.h"
 #include "lstate.h"
 #include "lundump.h"
 
@@ -23,6 +24,7 @@ typedef struct {
   void* data;
   int strip;
   int status;
+  size_t offset; /* bytes written so far */
 } DumpState;
 
 /*
@@ -39,6 +41,13 @@ static void DumpBlock(const void* b, size_t size, DumpState* D) {
     D->status = (*D->writer)(D->L, b, size, D->data);
     lua_lock(D->L);
   }
+  D->offset += size;
+}
+
+/* pad with zeros up to a multiple of 'align' */
+static void DumpAlign(size_t align, DumpState* D) {
+  static const char zeros[sizeof(size_t) > sizeof(Instruction) ? sizeof(size_t) : sizeof(Instruction)] = {0};
+  DumpBlock(zeros, (align - D->offset % align) % align, D);
 }
 
 #define DumpVar(x, D) DumpVector(&x, 1, D)
@@ -116,8 +125,10 @@ static void DumpProtos(const Proto* f, DumpState* D) {
   int i;
   int n = f->sizep;
   DumpInt(n, D);
-  for (i = 0; i < n; i++)
+  for (i = 0; i < n; i++) {
+    luaU_checkproto(D->L, f->p[i]); /* from a mapped chunk, not loaded yet? */
     DumpFunction(f->p[i], f->source, D);
+  }
 }
 
 static void DumpUpvalues(const Proto* f, DumpState* D) {
@@ -129,11 +140,8 @@ static void DumpUpvalues(const Proto* f, DumpState* D) {
   }
 }
 
-static void DumpDebug(const Proto* f, DumpState* D) {
+static void DumpDebugNames(const Proto* f, DumpState* D) {
   int i, n;
-  n = (D->strip) ? 0 : f->sizelineinfo;
-  DumpInt(n, D);
-  DumpVector(f->lineinfo, n, D);
   n = (D->strip) ? 0 : f->sizelocvars;
   DumpInt(n, D);
   for (i = 0; i < n; i++) {
@@ -147,6 +155,13 @@ static void DumpDebug(const Proto* f, DumpState* D) {
     DumpString(f->upvalues[i].name, D);
 }
 
+static void DumpDebug(const Proto* f, DumpState* D) {
+  int n = (D->strip) ? 0 : f->sizelineinfo;
+  DumpInt(n, D);
+  DumpVector(f->lineinfo, n, D);
+  DumpDebugNames(f, D);
+}
+
 static void DumpFunction(const Proto* f, TString* psource, DumpState* D) {
   if (D->strip || f->source == psource)
     DumpString(NULL, D); /* no debug info or same source as its parent */
@@ -164,10 +179,28 @@ static void DumpFunction(const Proto* f, TString* psource, DumpState* D) {
   DumpDebug(f, D);
 }
 
-static void DumpHeader(DumpState* D) {
+/*
+** chunks using superinstructions are marked with their own format, so
+** that a stock Lua refuses them instead of running unknown opcodes
+*/
+static int DumpFormat(lua_State* L, const Proto* f) {
+  int i;
+  for (i = 0; i < f->sizecode; i++) {
+    if (GET_OPCODE(f->code[i]) > OP_EXTRAARG)
+      return LUAC_FORMATOPT;
+  }
+  for (i = 0; i < f->sizep; i++) {
+    luaU_checkproto(L, f->p[i]);
+    if (DumpFormat(L, f->p[i]) != LUAC_FORMAT)
+      return LUAC_FORMATOPT;
+  }
+  return LUAC_FORMAT;
+}
+
+static void DumpHeader(const Proto* f, int format, DumpState* D) {
   DumpLiteral(LUA_SIGNATURE, D);
   DumpByte(LUAC_VERSION, D);
-  DumpByte(LUAC_FORMAT, D);
+  DumpByte(DumpFormat(D->L, f) | format, D);
   DumpLiteral(LUAC_DATA, D);
   DumpByte(sizeof(int), D);
   DumpByte(sizeof(size_t), D);
@@ -188,8 +221,69 @@ int luaU_dump(lua_State* L, const Proto* f, lua_Writer w, void* data, int strip)
   D.data = data;
   D.strip = strip;
   D.status = 0;
-  DumpHeader(&D);
+  D.offset = 0;
+  DumpHeader(f, LUAC_FORMAT, &D);
   DumpByte(f->sizeupvalues, &D);
   DumpFunction(f, NULL, &D);
   return D.status;
 }
+
+/*
+** dump the record of 'f' in mapped format (see lundump.c), after the
+** records of its nested functions; returns the offset of the record
+*/
+static size_t DumpRecord(const Proto* f, TString* psource, size_t prev, DumpState* D) {
+  size_t last = 0;
+  size_t offset;
+  int i;
+  for (i = 0; i < f->sizep; i++)
+    last = DumpRecord(f->p[i], f->source, last, D);
+  DumpAlign(sizeof(size_t), D);
+  offset = D->offset;
+  DumpVar(prev, D);
+  DumpVar(last, D);
+  DumpInt(f->sizep, D);
+  if (D->strip || f->source == psource)
+    DumpString(NULL, D); /* no debug info or same source as its parent */
+  else
+    DumpString(f->source, D);
+  DumpInt(f->linedefined, D);
+  DumpInt(f->lastlinedefined, D);
+  DumpByte(f->numparams, D);
+  DumpByte(f->is_vararg, D);
+  DumpByte(f->maxstacksize, D);
+  DumpInt(f->sizecode, D);
+  DumpAlign(sizeof(Instruction), D);
+  DumpVector(f->code, f->sizecode, D);
+  DumpConstants(f, D);
+  DumpUpvalues(f, D);
+  i = (D->strip) ? 0 : f->sizelineinfo;
+  DumpInt(i, D);
+  DumpAlign(sizeof(int), D);
+  DumpVector(f->lineinfo, i, D);
+  DumpDebugNames(f, D);
+  return offset;
+}
+
+/*
+** dump Lua function as precompiled chunk in mapped format, which
+** 'lua_loadmap' can use in place
+*/
+int luaU_dumpmap(lua_State* L, const Proto* f, lua_Writer w, void* data, int strip) {
+  DumpState D;
+  size_t main;
+  D.L = L;
+  D.writer = w;
+  D.data = data;
+  D.strip = strip;
+  D.status = 0;
+  D.offset = 0;
+  DumpHeader(f, LUAC_FORMATMAP, &D); /* also loads all nested functions */
+  DumpByte(f->sizeupvalues, &D);
+  main = DumpRecord(f, NULL, 0, &D);
+  DumpAlign(sizeof(size_t), &D);
+  DumpVar(main, &D);
+  main = D.offset + sizeof(size_t); /* size of the whole chunk */
+  DumpVar(main, &D);
+  return D.status;
+}
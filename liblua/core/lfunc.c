@@ -10,6 +10,7 @@
 #include "lprefix.h"
 
 #include <stddef.h>
+#include <string.h>
 
 #include "lua.h"
 
@@ -17,7 +18,9 @@
 #include "lgc.h"
 #include "lmem.h"
 #include "lobject.h"
+#include "lopcodes.h"
 #include "lstate.h"
+#include "lundump.h"
 
 CClosure* luaF_newCclosure(lua_State* L, int n) {
   GCObject* o = luaC_newobj(L, LUA_TCCL, sizeCclosure(n));
@@ -99,6 +102,7 @@ Proto* luaF_newproto(lua_State* L) {
   f->sizep = 0;
   f->code = NULL;
   f->cache = NULL;
+  f->icache = NULL;
   f->sizecode = 0;
   f->lineinfo = NULL;
   f->sizelineinfo = 0;
@@ -112,14 +116,43 @@ Proto* luaF_newproto(lua_State* L) {
   f->linedefined = 0;
   f->lastlinedefined = 0;
   f->source = NULL;
+  f->map = NULL;
+  f->lazy = 0;
   return f;
 }
 
+/*
+** 'GETTABUP', 'GETTABLE', 'SELF' and their superinstructions with a
+** constant key get one inline cache slot each, the slot is indexed by
+** pc, so allocate 'sizecode' slots when the prototype has at least
+** one such instruction. Must be called after 'code' reach its final size.
+*/
+void luaF_initicache(lua_State* L, Proto* f) {
+  int pc;
+  lua_assert(f->icache == NULL);
+  for (pc = 0; pc < f->sizecode; pc++) {
+    Instruction i = f->code[pc];
+    OpCode op = GET_OPCODE(i);
+    if ((op == OP_GETTABUP || op == OP_GETTABLE || op == OP_SELF || op == OP_GETTABUP2 || op == OP_GETTABLE2) && ISK(GETARG_C(i)))
+      break;
+  }
+  if (pc < f->sizecode) { /* found one? */
+    f->icache = luaM_newvector(L, f->sizecode, unsigned int);
+    memset(f->icache, 0, sizeof(unsigned int) * f->sizecode);
+  }
+}
+
 void luaF_freeproto(lua_State* L, Proto* f) {
-  luaM_freearray(L, f->code, f->sizecode);
+  if (f->icache != NULL)
+    luaM_freearray(L, f->icache, f->sizecode);
+  if (f->map != NULL) /* 'code' and 'lineinfo' live in the mapped chunk */
+    luaU_releasemap(L, f->map);
+  else {
+    luaM_freearray(L, f->code, f->sizecode);
+    luaM_freearray(L, f->lineinfo, f->sizelineinfo);
+  }
   luaM_freearray(L, f->p, f->sizep);
   luaM_freearray(L, f->k, f->sizek);
-  luaM_freearray(L, f->lineinfo, f->sizelineinfo);
   luaM_freearray(L, f->locvars, f->sizelocvars);
   luaM_freearray(L, f->upvalues, f->sizeupvalues);
   luaM_free(L, f);
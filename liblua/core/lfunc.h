@@ -46,6 +46,7 @@ LUAI_FUNC LClosure* luaF_newLclosure(lua_State* L, int nelems);
 LUAI_FUNC void luaF_initupvals(lua_State* L, LClosure* cl);
 LUAI_FUNC UpVal* luaF_findupval(lua_State* L, StkId level);
 LUAI_FUNC void luaF_close(lua_State* L, StkId level);
+LUAI_FUNC void luaF_initicache(lua_State* L, Proto* f);
 LUAI_FUNC void luaF_freeproto(lua_State* L, Proto* f);
 LUAI_FUNC const char* luaF_getlocalname(const Proto* func, int local_number, int pc);
 
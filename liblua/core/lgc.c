@@ -172,6 +172,18 @@ void luaC_barrierback_(lua_State* L, Table* t) {
   linkgclist(t, g->grayagain);
 }
 
+/*
+** barrier for a prototype filled after it was created (lazy loading of
+** mapped chunks, see lundump.c): like the back barrier for tables, it
+** becomes gray again to be traversed once more
+*/
+void luaC_protobarrier_(lua_State* L, Proto* p) {
+  global_State* g = G(L);
+  lua_assert(isblack(p) && !isdead(g, p));
+  black2gray(p);
+  linkgclist(p, g->grayagain);
+}
+
 /*
 ** barrier for assignments to closed upvalues. Because upvalues are
 ** shared among closures, it is impossible to know the color of all
@@ -190,6 +202,8 @@ void luaC_fix(lua_State* L, GCObject* o) {
   global_State* g = G(L);
   lua_assert(g->allgc == o); /* object must be 1st in 'allgc' list! */
   white2gray(o); /* they will be gray forever */
+  if (g->genold == o) /* it was the first old object? */
+    g->genold = o->next;
   g->allgc = o->next; /* remove object from 'allgc' list */
   o->next = g->fixedgc; /* link it to 'fixedgc' list */
   g->fixedgc = o;
@@ -324,12 +338,24 @@ static void remarkupvals(global_State* g) {
 /*
 ** mark root set and reset all gray lists, to start a new collection
 */
+/*
+** mark atoms, they live as long as the state
+*/
+static void markatoms(global_State* g) {
+  int i;
+  for (i = 0; i < g->sizeatoms; i++) {
+    if (g->atoms[i] != NULL)
+      markobject(g, g->atoms[i]);
+  }
+}
+
 static void restartcollection(global_State* g) {
   g->gray = g->grayagain = NULL;
   g->weak = g->allweak = g->ephemeron = NULL;
   markobject(g, g->mainthread);
   markvalue(g, &g->l_registry);
   markmt(g);
+  markatoms(g);
   markbeingfnz(g); /* mark any finalizing object left from previous cycle */
 }
 
@@ -474,7 +500,8 @@ static int traverseproto(global_State* g, Proto* f) {
   for (i = 0; i < f->sizelocvars; i++) /* mark local-variable names */
     markobjectN(g, f->locvars[i].varname);
   return sizeof(Proto) + sizeof(Instruction) * f->sizecode + sizeof(Proto*) * f->sizep + sizeof(TValue) * f->sizek +
-         sizeof(int) * f->sizelineinfo + sizeof(LocVar) * f->sizelocvars + sizeof(Upvaldesc) * f->sizeupvalues;
+         sizeof(int) * f->sizelineinfo + sizeof(LocVar) * f->sizelocvars + sizeof(Upvaldesc) * f->sizeupvalues +
+         (f->icache != NULL ? sizeof(unsigned int) * f->sizecode : 0);
 }
 
 static lu_mem traverseCclosure(global_State* g, CClosure* cl) {
@@ -521,7 +548,7 @@ static lu_mem traversethread(global_State* g, lua_State* th) {
       th->twups = g->twups; /* link it back to the list */
       g->twups = th;
     }
-  } else if (g->gckind != KGC_EMERGENCY)
+  } else if (!g->gcemergency)
     luaD_shrinkstack(th); /* do not change stack in emergency cycle */
   return (sizeof(lua_State) + sizeof(TValue) * th->stacksize + sizeof(CallInfo) * th->nci);
 }
@@ -749,7 +776,7 @@ static GCObject** sweeptolive(lua_State* L, GCObject** p) {
 ** If possible, shrink string table
 */
 static void checkSizes(lua_State* L, global_State* g) {
-  if (g->gckind != KGC_EMERGENCY) {
+  if (!g->gcemergency) {
     l_mem olddebt = g->GCdebt;
     if (g->strt.nuse < g->strt.size / 4) /* string table too big? */
       luaS_resize(L, g->strt.size / 2); /* shrink it a little */
@@ -878,6 +905,8 @@ void luaC_checkfinalizer(lua_State* L, GCObject* o, Table* mt) {
     /* search for pointer pointing to 'o' */
     for (p = &g->allgc; *p != o; p = &(*p)->next) { /* empty */
     }
+    if (g->genold == o) /* removing the first old object? */
+      g->genold = o->next;
     *p = o->next; /* remove 'o' from 'allgc' list */
     o->next = g->finobj; /* link it in 'finobj' list */
     g->finobj = o;
@@ -950,7 +979,9 @@ static l_mem atomic(lua_State* L) {
   // thread: propagate mark (maybe change reference after mark, so add to grayagain for propagate in atomic phase)
   // so, only thread will be add to g->grayagain in atomic phase
   // when the thread be added to g->grayagain, it must has been fully propagate mark, no need to propagate again
+  // after atomic, 'grayagain' holds exactly the live threads (generational mode keeps them there)
   GCObject* grayagain = g->grayagain; /* save original list */
+  g->grayagain = NULL;
   lua_assert(g->ephemeron == NULL && g->weak == NULL);
   lua_assert(!iswhite(g->mainthread));
   g->gcstate = GCSinsideatomic;
@@ -959,6 +990,7 @@ static l_mem atomic(lua_State* L) {
   /* registry and global metatables may be changed by API */
   markvalue(g, &g->l_registry);
   markmt(g); /* mark global metatables */
+  markatoms(g); /* atoms created during this cycle */
   /* remark occasional upvalues of (maybe) dead threads */
   remarkupvals(g);
   propagateall(g); /* propagate changes */
@@ -1011,7 +1043,7 @@ static lu_mem singlestep(lua_State* L) {
   global_State* g = G(L);
   switch (g->gcstate) {
     case GCSpause: {
-      g->GCmemtrav = g->strt.size * sizeof(GCObject*);
+      g->GCmemtrav = g->strt.size * sizeof(StrSlot);
       restartcollection(g);
       g->gcstate = GCSpropagate;
       return g->GCmemtrav;
@@ -1028,6 +1060,7 @@ static lu_mem singlestep(lua_State* L) {
       lu_mem work;
       propagateall(g); /* make sure gray list is empty */
       work = atomic(L); /* work is what was traversed by 'atomic' */
+      g->gcmajorcount++;
       entersweep(L);
       g->GCestimate = gettotalbytes(g); /* first estimate */
       ;
@@ -1049,7 +1082,7 @@ static lu_mem singlestep(lua_State* L) {
       return 0;
     }
     case GCScallfin: { /* call remaining finalizers */
-      if (g->tobefnz && g->gckind != KGC_EMERGENCY) {
+      if (g->tobefnz && !g->gcemergency) {
         int n = runafewfinalizers(L);
         return (n * GCFINALIZECOST);
       } else { /* emergency mode or no more finalizers */
@@ -1073,6 +1106,198 @@ void luaC_runtilstate(lua_State* L, int statesmask) {
     singlestep(L);
 }
 
+/* }====================================================== */
+
+/*
+** {======================================================
+** Generational Collector
+** =======================================================
+*/
+
+/*
+** Objects that survive one collection become old: they stay black, so
+** they are neither traversed nor swept by minor collections. New objects
+** are white (young) and are linked in front of 'allgc', 'genold' points
+** to the first old object, so a minor sweep only visits the young prefix.
+** The collector rests in 'GCSpropagate' between collections, thus the
+** barriers keep the invariant: a young object stored into an old one is
+** either marked (forward barrier, linked in 'gray') or the old table is
+** turned gray again (back barrier, linked in 'grayagain'). Threads are
+** always gray and stay in 'grayagain', so every stack is traversed by
+** every minor collection. Old objects are only collected by a major
+** collection, a full mark from the roots.
+*/
+
+/*
+** sweep a list for generational mode: free dead objects, make all
+** survivors old (black) except threads, which stay gray in 'grayagain'.
+** Stop at object 'limit' (the first old object).
+*/
+static void sweepgen(lua_State* L, global_State* g, GCObject** p, GCObject* limit) {
+  int ow = otherwhite(g);
+  GCObject* curr;
+  while ((curr = *p) != limit) {
+    int marked = curr->marked;
+    if (isdeadm(ow, marked)) { /* is 'curr' dead? */
+      *p = curr->next; /* remove 'curr' from list */
+      freeobj(L, curr); /* erase 'curr' */
+    } else {
+      if (curr->tt != LUA_TTHREAD)
+        curr->marked = cast_byte((marked & maskcolors) | bitmask(BLACKBIT));
+      else
+        lua_assert(isgray(curr));
+      p = &curr->next; /* go to next element */
+    }
+  }
+}
+
+/*
+** weak tables left gray by 'atomic' must be black again, otherwise
+** the back barrier would not see new young values stored into them
+*/
+static void blacklist(GCObject* l) {
+  for (; l != NULL; l = gco2t(l)->gclist)
+    gray2black(l);
+}
+
+/* turn every object of list 'p' white */
+static void whitelist(global_State* g, GCObject* p) {
+  for (; p != NULL; p = p->next)
+    makewhite(g, p);
+}
+
+/*
+** clean up after a generational collection (young or full): gray lists
+** other than 'grayagain' (the threads) are empty, the collector goes
+** back to 'GCSpropagate' and pending finalizers are called
+*/
+static void finishgencycle(lua_State* L, global_State* g) {
+  lua_assert(g->gray == NULL);
+  blacklist(g->weak);
+  blacklist(g->allweak);
+  blacklist(g->ephemeron);
+  g->weak = g->allweak = g->ephemeron = NULL;
+  checkSizes(L, g);
+  g->gcstate = GCSpropagate; /* keep the invariant */
+  if (!g->gcemergency) {
+    while (g->tobefnz)
+      GCTM(L, 1); /* call all pending finalizers */
+  }
+}
+
+/*
+** sweep everything after a full mark, all survivors become old
+*/
+static void atomic2gen(lua_State* L, global_State* g) {
+  sweepgen(L, g, &g->allgc, NULL);
+  sweepgen(L, g, &g->finobj, NULL);
+  sweepgen(L, g, &g->tobefnz, NULL);
+  g->genold = g->allgc;
+  g->gckind = KGC_GEN;
+  g->GCestimate = gettotalbytes(g); /* base for major collections */
+  finishgencycle(L, g);
+}
+
+/*
+** enter generational mode: finish any incremental cycle, then do a
+** full mark and make every survivor old
+*/
+static void entergen(lua_State* L, global_State* g) {
+  luaC_runtilstate(L, bitmask(GCSpause)); /* prepare to start a new cycle */
+  luaC_runtilstate(L, bitmask(GCSpropagate)); /* start new cycle */
+  propagateall(g);
+  atomic(L);
+  g->gcmajorcount++;
+  atomic2gen(L, g);
+}
+
+/*
+** enter incremental mode: forget the old generation, turn everything
+** white and restart from 'GCSpause'
+*/
+static void enterinc(global_State* g) {
+  whitelist(g, g->allgc);
+  whitelist(g, g->finobj);
+  whitelist(g, g->tobefnz);
+  makewhite(g, g->mainthread);
+  g->gray = g->grayagain = NULL;
+  g->weak = g->allweak = g->ephemeron = NULL;
+  g->genold = NULL;
+  g->sweepgc = NULL;
+  g->gcstate = GCSpause;
+  g->gckind = KGC_NORMAL;
+}
+
+/*
+** minor collection: mark young objects reachable from the roots, from
+** 'gray' (forward barriers) and from 'grayagain' (threads and old tables
+** hit by the back barrier), then sweep the young prefix of 'allgc'
+*/
+static void youngcollection(lua_State* L, global_State* g) {
+  lua_assert(g->gcstate == GCSpropagate && g->gckind == KGC_GEN);
+  markvalue(g, &g->l_registry);
+  markmt(g);
+  propagateall(g);
+  atomic(L);
+  g->gcminorcount++;
+  sweepgen(L, g, &g->allgc, g->genold);
+  sweepgen(L, g, &g->finobj, NULL);
+  sweepgen(L, g, &g->tobefnz, NULL);
+  g->genold = g->allgc; /* every survivor is old now */
+  finishgencycle(L, g);
+}
+
+/* major collection in generational mode */
+static void fullgen(lua_State* L, global_State* g) {
+  enterinc(g);
+  entergen(L, g);
+}
+
+/*
+** next minor collection after 'gcgenminormul'% of memory growth
+*/
+static void setminordebt(global_State* g) {
+  luaE_setdebt(g, -(cast(l_mem, (gettotalbytes(g) / 100)) * g->gcgenminormul));
+}
+
+/*
+** do a minor collection, or a major one if memory grew more than
+** 'gcgenmajormul'% since the last major collection
+*/
+static void genstep(lua_State* L, global_State* g) {
+  lu_mem majorbase = g->GCestimate;
+  lu_mem majorinc = (majorbase / 100) * g->gcgenmajormul;
+  if (gettotalbytes(g) > majorbase + majorinc)
+    fullgen(L, g);
+  else
+    youngcollection(L, g);
+  setminordebt(g);
+}
+
+/*
+** change collector mode to 'newmode' (KGC_NORMAL or KGC_GEN)
+*/
+void luaC_changemode(lua_State* L, int newmode) {
+  global_State* g = G(L);
+  if (newmode != g->gckind) {
+    if (newmode == KGC_GEN) {
+      entergen(L, g);
+      setminordebt(g);
+    } else {
+      enterinc(g);
+      setpause(g);
+    }
+  }
+}
+
+/* }====================================================== */
+
+/*
+** {======================================================
+** GC steps
+** =======================================================
+*/
+
 /*
 ** get GC debt and convert it from Kb to 'work units' (avoid zero debt
 ** and overflows)
@@ -1099,6 +1324,10 @@ void luaC_step(lua_State* L) {
     luaE_setdebt(g, -GCSTEPSIZE * 10); /* avoid being called too often */
     return;
   }
+  if (isgenerational(g)) {
+    genstep(L, g);
+    return;
+  }
   do { /* repeat until pause or enough "credit" (negative debt) */
     lu_mem work = singlestep(L); /* perform one single step */
     debt -= work;
@@ -1120,6 +1349,10 @@ void luaC_onestep(lua_State* L) {
     luaE_setdebt(g, -GCSTEPSIZE * 10); /* avoid being called too often */
     return;
   }
+  if (isgenerational(g)) { /* one step is one whole collection */
+    genstep(L, g);
+    return;
+  }
   debt -= singlestep(L); /* perform one single step */
   if (g->gcstate == GCSpause)
     setpause(g); /* pause until next cycle */
@@ -1141,9 +1374,16 @@ void luaC_onestep(lua_State* L) {
 */
 void luaC_fullgc(lua_State* L, int isemergency) {
   global_State* g = G(L);
-  lua_assert(g->gckind == KGC_NORMAL);
+  lua_assert(!g->gcemergency);
+  g->gcemergency = cast_byte(isemergency); /* set flag */
   if (isemergency)
-    g->gckind = KGC_EMERGENCY; /* set flag */
+    luaE_freethreadpool(L); /* pooled threads first */
+  if (isgenerational(g)) {
+    fullgen(L, g);
+    g->gcemergency = 0;
+    setminordebt(g);
+    return;
+  }
   if (keepinvariant(g)) { /* black objects? */
     entersweep(L); /* sweep everything to turn them back to white */
   }
@@ -1154,7 +1394,7 @@ void luaC_fullgc(lua_State* L, int isemergency) {
   /* estimate must be correct after a full GC cycle */
   lua_assert(g->GCestimate == gettotalbytes(g));
   luaC_runtilstate(L, bitmask(GCSpause)); /* finish collection */
-  g->gckind = KGC_NORMAL;
+  g->gcemergency = 0;
   setpause(g);
 }
 
@@ -49,10 +49,15 @@
 ** phase may break the invariant, as objects turned white may point to
 ** still-black objects. The invariant is restored when sweep ends and
 ** all objects are white again.
+** In generational mode the collector stays in 'GCSpropagate' between
+** collections, old objects are black and young objects are white, so
+** the invariant is always kept and the barriers are always active.
 */
 
 #define keepinvariant(g) ((g)->gcstate <= GCSatomic)
 
+#define isgenerational(g) ((g)->gckind == KGC_GEN)
+
 /*
 ** some useful bit tricks
 */
@@ -124,6 +129,8 @@
 
 #define luaC_objbarrier(L, p, o) ((isblack(p) && iswhite(o)) ? luaC_barrier_(L, obj2gco(p), obj2gco(o)) : cast_void(0))
 
+#define luaC_protobarrier(L, p) (isblack(p) ? luaC_protobarrier_(L, p) : cast_void(0))
+
 #define luaC_upvalbarrier(L, uv) ((iscollectable((uv)->v) && !upisopen(uv)) ? luaC_upvalbarrier_(L, uv) : cast_void(0))
 
 LUAI_FUNC void luaC_fix(lua_State* L, GCObject* o);
@@ -132,9 +139,11 @@ LUAI_FUNC void luaC_step(lua_State* L);
 LUAI_FUNC void luaC_onestep(lua_State* L);
 LUAI_FUNC void luaC_runtilstate(lua_State* L, int statesmask);
 LUAI_FUNC void luaC_fullgc(lua_State* L, int isemergency);
+LUAI_FUNC void luaC_changemode(lua_State* L, int newmode);
 LUAI_FUNC GCObject* luaC_newobj(lua_State* L, int tt, size_t sz);
 LUAI_FUNC void luaC_barrier_(lua_State* L, GCObject* o, GCObject* v);
 LUAI_FUNC void luaC_barrierback_(lua_State* L, Table* o);
+LUAI_FUNC void luaC_protobarrier_(lua_State* L, Proto* p);
 LUAI_FUNC void luaC_upvalbarrier_(lua_State* L, UpVal* uv);
 LUAI_FUNC void luaC_checkfinalizer(lua_State* L, GCObject* o, Table* mt);
 LUAI_FUNC void luaC_upvdeccount(lua_State* L, UpVal* uv);
@@ -112,7 +112,7 @@ l_noret luaX_syntaxerror(LexState* ls, const char* msg) {
 ** it will not be collected until the end of the compilation
 ** (by that time it should be anchored somewhere)
 */
-// key = &(G(L)->strt.hash[str])
+// key = interned TString of str
 // ls->h[key] = true;
 // return key
 TString* luaX_newstring(LexState* ls, const char* str, size_t l) {
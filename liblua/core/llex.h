@@ -65,6 +65,7 @@ typedef struct LexState {
   struct Dyndata* dyd; /* dynamic structures used by the parser */
   TString* source; /* current source name */
   TString* envn; /* environment variable name */
+  int optimize; /* peephole pass and extra folding (load mode 'O') */
 } LexState;
 
 LUAI_FUNC void luaX_init(lua_State* L);
@@ -174,6 +174,76 @@ typedef unsigned long Instruction;
 #define STRCACHE_M 2
 #endif
 
+/*
+** Size of the content keyed cache for short strings in the API (2^n
+** slots, 'luaS_newlstrapi'). Each slot keeps the last string whose hash
+** falls in it, whatever buffer the string was pushed from.
+*/
+#if !defined(STRCACHE_C)
+#define STRCACHE_C 256
+#endif
+
+/*
+** Maximum number of atoms ('lua_newatom'). Atom names are shared by
+** every state of the process, each state interns them on first use.
+*/
+#if !defined(LUAI_MAXATOMS)
+#define LUAI_MAXATOMS 1024
+#endif
+
+/*
+** Collected threads kept by each state, with their stacks, to be reused
+** by 'lua_newthread'. A thread whose stack grew beyond LUAI_MAXPOOLSTACK
+** slots is freed instead.
+*/
+#if !defined(LUAI_MAXTHREADPOOL)
+#define LUAI_MAXTHREADPOOL 64
+#endif
+
+#if !defined(LUAI_MAXPOOLSTACK)
+#define LUAI_MAXPOOLSTACK (8 * LUA_MINSTACK)
+#endif
+
+/*
+** spin lock around the process wide atom names, only taken to create
+** an atom or to intern it in a state for the first time
+*/
+#if !defined(luai_atomlock)
+#if defined(__GNUC__)
+#define luai_atomlock(l) \
+  while (__sync_lock_test_and_set(&(l), 1)) { \
+  }
+#define luai_atomunlock(l) __sync_lock_release(&(l))
+#elif defined(_MSC_VER)
+#include <intrin.h>
+#define luai_atomlock(l) \
+  while (_InterlockedExchange(&(l), 1)) { \
+  }
+#define luai_atomunlock(l) _InterlockedExchange(&(l), 0)
+#else
+#define luai_atomlock(l) ((void)(l))
+#define luai_atomunlock(l) ((void)(l))
+#endif
+#endif
+
+/*
+** set or clear bits of a 'hookmask' in one instruction, a signal handler
+** arming the asynchronous hook on the same OS thread never sees half of it
+*/
+#if !defined(luai_maskset)
+#if defined(__GNUC__)
+#define luai_maskset(m, b) ((void)__sync_fetch_and_or(&(m), (b)))
+#define luai_maskclear(m, b) ((void)__sync_fetch_and_and(&(m), ~(b)))
+#elif defined(_MSC_VER)
+#include <intrin.h>
+#define luai_maskset(m, b) ((void)_InterlockedOr((volatile long*)&(m), (b)))
+#define luai_maskclear(m, b) ((void)_InterlockedAnd((volatile long*)&(m), ~(b)))
+#else
+#define luai_maskset(m, b) ((m) |= (b))
+#define luai_maskclear(m, b) ((m) &= ~(b))
+#endif
+#endif
+
 /* minimum size for string buffer */
 #if !defined(LUA_MINBUFFER)
 #define LUA_MINBUFFER 32
@@ -183,6 +253,16 @@ typedef unsigned long Instruction;
 ** macros that are executed whenever program enters the Lua core
 ** ('lua_lock') and leaves the core ('lua_unlock')
 */
+#if defined(LUA_USE_THREADLOCK)
+/* one mutex per global_State, see lstate.c */
+LUAI_FUNC void luaE_lock(lua_State* L);
+LUAI_FUNC void luaE_unlock(lua_State* L);
+LUAI_FUNC void luaE_threadyield(lua_State* L);
+#define lua_lock(L) luaE_lock(L)
+#define lua_unlock(L) luaE_unlock(L)
+#define luai_threadyield(L) luaE_threadyield(L)
+#endif
+
 #if !defined(lua_lock)
 #define lua_lock(L) ((void)0)
 #define lua_unlock(L) ((void)0)
@@ -373,7 +373,6 @@ typedef struct TString {
   unsigned int hash;
   union {
     size_t lnglen; /* length for long strings */
-    struct TString* hnext; /* linked list for hash table */
   } u;
 } TString;
 
@@ -486,7 +485,10 @@ typedef struct Proto {
   LocVar* locvars; /* information about local variables (debug information) */
   Upvaldesc* upvalues; /* upvalue information */
   struct LClosure* cache; /* last-created closure with this prototype */
+  unsigned int* icache; /* node index of last lookup, indexed by pc (see luaF_initicache) */
   TString* source; /* used for debug information */
+  struct MapChunk* map; /* chunk holding 'code' and 'lineinfo' when they are mapped (see lundump.c) */
+  size_t lazy; /* offset of its record in 'map' while not loaded yet, 0 otherwise */
   GCObject* gclist;
 } Proto;
 
@@ -63,6 +63,8 @@ const char *const luaP_opnames[NUM_OPCODES+1] = {
   "CLOSURE",
   "VARARG",
   "EXTRAARG",
+  "GETTABUP2",
+  "GETTABLE2",
   NULL
 };
 // clang-format on
@@ -120,5 +122,7 @@ const lu_byte luaP_opmodes[NUM_OPCODES] = {
  ,opmode(0, 1, OpArgU, OpArgN, iABx)		/* OP_CLOSURE */
  ,opmode(0, 1, OpArgU, OpArgN, iABC)		/* OP_VARARG */
  ,opmode(0, 0, OpArgU, OpArgU, iAx)		/* OP_EXTRAARG */
+ ,opmode(0, 1, OpArgU, OpArgK, iABC)		/* OP_GETTABUP2 */
+ ,opmode(0, 1, OpArgR, OpArgK, iABC)		/* OP_GETTABLE2 */
 };
 // clang-format on
@@ -223,10 +223,14 @@ typedef enum {
 
   OP_VARARG, /*	A B	R(A), R(A+1), ..., R(A+B-2) = vararg		*/
 
-  OP_EXTRAARG /*	Ax	extra (larger) argument for previous opcode	*/
+  OP_EXTRAARG, /*	Ax	extra (larger) argument for previous opcode	*/
+
+  /* superinstructions, only emitted by 'luaK_optimize' (see note) */
+  OP_GETTABUP2, /*	A B C	R(A) := UpValue[B][RK(C)]; run next GETTABLE	*/
+  OP_GETTABLE2 /*	A B C	R(A) := R(B)[RK(C)]; run next GETTABLE		*/
 } OpCode;
 
-#define NUM_OPCODES (cast(int, OP_EXTRAARG) + 1)
+#define NUM_OPCODES (cast(int, OP_GETTABLE2) + 1)
 
 /*===========================================================================
   Notes:
@@ -249,6 +253,11 @@ typedef enum {
 
   (*) All 'skips' (pc++) assume that next instruction is a jump.
 
+  (*) OP_GETTABUP2 and OP_GETTABLE2 are followed by an OP_GETTABLE that
+  indexes their result. They execute it in the same dispatch and skip
+  it, so a jump to that OP_GETTABLE still works. Chunks using them are
+  dumped with format LUAC_FORMATOPT.
+
 ===========================================================================*/
 
 /*
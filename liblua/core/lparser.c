@@ -504,6 +504,8 @@ static void close_func(LexState* ls) {
   Proto* f = fs->f;
   luaK_ret(fs, 0, 0); /* final return */
   leaveblock(fs);
+  if (ls->optimize)
+    luaK_optimize(fs);
   luaM_reallocvector(L, f->code, f->sizecode, fs->pc, Instruction);
   f->sizecode = fs->pc;
   luaM_reallocvector(L, f->lineinfo, f->sizelineinfo, fs->pc, int);
@@ -516,6 +518,7 @@ static void close_func(LexState* ls) {
   f->sizelocvars = fs->nlocvars;
   luaM_reallocvector(L, f->upvalues, f->sizeupvalues, fs->nups, Upvaldesc);
   f->sizeupvalues = fs->nups;
+  luaF_initicache(L, f);
   lua_assert(fs->bl == NULL);
   ls->fs = fs->prev;
   luaC_checkGC(L);
@@ -1551,7 +1554,7 @@ static void mainfunc(LexState* ls, FuncState* fs) {
   close_func(ls);
 }
 
-LClosure* luaY_parser(lua_State* L, ZIO* z, Mbuffer* buff, Dyndata* dyd, const char* name, int firstchar) {
+LClosure* luaY_parser(lua_State* L, ZIO* z, Mbuffer* buff, Dyndata* dyd, const char* name, int firstchar, int optimize) {
   LexState lexstate;
   FuncState funcstate;
   LClosure* cl = luaF_newLclosure(L, 1); /* create main closure */
@@ -1565,6 +1568,7 @@ LClosure* luaY_parser(lua_State* L, ZIO* z, Mbuffer* buff, Dyndata* dyd, const c
   lua_assert(iswhite(funcstate.f)); /* do not need barrier here */
   lexstate.buff = buff;
   lexstate.dyd = dyd;
+  lexstate.optimize = optimize;
   dyd->actvar.n = dyd->gt.n = dyd->label.n = 0;
   luaX_setinput(L, &lexstate, z, funcstate.f->source, firstchar);
   mainfunc(&lexstate, &funcstate);
@@ -117,6 +117,6 @@ typedef struct FuncState {
   lu_byte freereg; /* first free register */
 } FuncState;
 
-LUAI_FUNC LClosure* luaY_parser(lua_State* L, ZIO* z, Mbuffer* buff, Dyndata* dyd, const char* name, int firstchar);
+LUAI_FUNC LClosure* luaY_parser(lua_State* L, ZIO* z, Mbuffer* buff, Dyndata* dyd, const char* name, int firstchar, int optimize);
 
 #endif
@@ -12,6 +12,10 @@
 #include <stddef.h>
 #include <string.h>
 
+#if defined(LUA_USE_THREADLOCK)
+#include <sched.h>
+#endif
+
 #include "lua.h"
 
 #include "lapi.h"
@@ -34,6 +38,14 @@
 #define LUAI_GCMUL 200 /* GC runs 'twice the speed' of memory allocation */
 #endif
 
+#if !defined(LUAI_GENMINORMUL)
+#define LUAI_GENMINORMUL 20 /* minor collection after 20% memory growth */
+#endif
+
+#if !defined(LUAI_GENMAJORMUL)
+#define LUAI_GENMAJORMUL 100 /* major collection after doubling memory */
+#endif
+
 /*
 ** a macro to help the creation of a unique random seed when a state is
 ** created; the seed is used to randomize hashes.
@@ -146,19 +158,22 @@ void luaE_shrinkCI(lua_State* L) {
 }
 
 // Init lua stack for a lua_State, (lua thread)
+// a thread taken from the pool already has a stack and a 'ci' list
 static void stack_init(lua_State* L1, lua_State* L) {
   int i;
-  CallInfo* ci;
-  /* initialize stack array */
-  L1->stack = luaM_newvector(L, BASIC_STACK_SIZE, TValue);
-  L1->stacksize = BASIC_STACK_SIZE;
-  for (i = 0; i < BASIC_STACK_SIZE; i++) // clear the TValue's tag type
+  CallInfo* ci = &L1->base_ci; // base_ci are the struct in lua_State, not alloc mem
+  if (L1->stack == NULL) {
+    /* initialize stack array */
+    L1->stack = luaM_newvector(L, BASIC_STACK_SIZE, TValue);
+    L1->stacksize = BASIC_STACK_SIZE;
+    ci->next = NULL;
+  }
+  for (i = 0; i < L1->stacksize; i++) // clear the TValue's tag type
     setnilvalue(L1->stack + i); /* erase new stack */
   L1->top = L1->stack;
   L1->stack_last = L1->stack + L1->stacksize - EXTRA_STACK;
   /* initialize first ci */
-  ci = &L1->base_ci; // base_ci are the struct in lua_State, not alloc mem
-  ci->next = ci->previous = NULL;
+  ci->previous = NULL;
   ci->callstatus = 0;
   ci->func = L1->top; // the first block of stack not used forever
   setnilvalue(L1->top++); /* 'function' entry for this 'ci' */
@@ -235,18 +250,106 @@ static void preinit_thread(lua_State* L, global_State* g) {
 }
 
 // Release a lua process, also Release the global_State
+#if defined(LUA_USE_THREADLOCK)
+
+/*
+** 'lua_lock' for states shared by several OS threads. The uncontended
+** path is a single trylock; a thread that has to block announces itself
+** in 'lockwait', so that 'luaE_threadyield' only gives the lock away
+** when somebody is actually waiting for it.
+*/
+static void initlock(global_State* g) {
+  pthread_mutexattr_t attr;
+  pthread_mutexattr_init(&attr);
+#if defined(LUAI_ASSERT)
+  pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_ERRORCHECK);
+#endif
+  pthread_mutex_init(&g->lock, &attr);
+  pthread_mutexattr_destroy(&attr);
+  g->lockwait = 0;
+  g->lockturn = 0;
+}
+
+void luaE_lock(lua_State* L) {
+  global_State* g = G(L);
+  if (pthread_mutex_trylock(&g->lock) != 0) {
+    int res;
+    __atomic_add_fetch(&g->lockwait, 1, __ATOMIC_RELAXED);
+    res = pthread_mutex_lock(&g->lock);
+    lua_assert(res == 0);
+    (void)res;
+    __atomic_sub_fetch(&g->lockwait, 1, __ATOMIC_RELAXED);
+  }
+  __atomic_add_fetch(&g->lockturn, 1, __ATOMIC_RELAXED);
+}
+
+void luaE_unlock(lua_State* L) {
+  int res = pthread_mutex_unlock(&G(L)->lock);
+  lua_assert(res == 0);
+  (void)res;
+}
+
+/*
+** Hand the lock over to a waiting thread: a plain unlock/lock pair
+** lets the running thread take the mutex straight back, so wait until
+** some other thread has entered the core before competing again.
+*/
+void luaE_threadyield(lua_State* L) {
+  global_State* g = G(L);
+  if (__atomic_load_n(&g->lockwait, __ATOMIC_RELAXED) > 0) {
+    unsigned int turn = g->lockturn;
+    luaE_unlock(L);
+    while (__atomic_load_n(&g->lockturn, __ATOMIC_RELAXED) == turn &&
+           __atomic_load_n(&g->lockwait, __ATOMIC_RELAXED) > 0)
+      sched_yield();
+    luaE_lock(L);
+  }
+}
+
+#define closelock(g) (pthread_mutex_unlock(&(g)->lock), pthread_mutex_destroy(&(g)->lock))
+
+#else
+
+#define initlock(g) ((void)0)
+#define closelock(g) ((void)0)
+
+#endif
+
+/* called with the state locked */
 static void close_state(lua_State* L) {
   global_State* g = G(L);
   luaF_close(L, L->stack); /* close all upvalues for this thread */
   luaC_freeallobjects(L); /* collect all objects */
   if (g->version) /* closing a fully built state? */
     luai_userstateclose(L);
-  luaM_freearray(L, G(L)->strt.hash, G(L)->strt.size);
+  luaM_freearray(L, G(L)->strt.slot, G(L)->strt.size);
+  luaM_freearray(L, g->atoms, g->sizeatoms);
+  luaE_freethreadpool(L);
   freestack(L);
   lua_assert(gettotalbytes(g) == sizeof(LG));
+  closelock(g);
   (*g->frealloc)(g->ud, fromstate(L), sizeof(LG), 0); /* free main block */
 }
 
+/*
+** take a collected thread from the pool: it keeps its stack and 'ci'
+** list (its memory was never given back, so no debt is added), the
+** rest is initialized as for a new thread
+*/
+static lua_State* reusethread(global_State* g) {
+  lua_State* L1 = g->threadpool;
+  StkId stack = L1->stack;
+  int stacksize = L1->stacksize;
+  unsigned short nci = L1->nci;
+  g->threadpool = (L1->next != NULL) ? gco2th(L1->next) : NULL;
+  g->nthreadpool--;
+  preinit_thread(L1, g);
+  L1->stack = stack;
+  L1->stacksize = stacksize;
+  L1->nci = nci;
+  return L1;
+}
+
 // Create a new lua thread, lua_State
 LUA_API lua_State* lua_newthread(lua_State* L) {
   global_State* g = G(L);
@@ -254,7 +357,12 @@ LUA_API lua_State* lua_newthread(lua_State* L) {
   lua_lock(L);
   luaC_checkGC(L);
   /* create new thread */
-  L1 = &cast(LX*, luaM_newobject(L, LUA_TTHREAD, sizeof(LX)))->l;
+  if (g->threadpool != NULL)
+    L1 = reusethread(g);
+  else {
+    L1 = &cast(LX*, luaM_newobject(L, LUA_TTHREAD, sizeof(LX)))->l;
+    preinit_thread(L1, g);
+  }
   L1->marked = luaC_white(g);
   L1->tt = LUA_TTHREAD;
   /* link it on list 'allgc' */
@@ -263,8 +371,7 @@ LUA_API lua_State* lua_newthread(lua_State* L) {
   /* anchor it on L stack */
   setthvalue(L, L->top, L1);
   api_incr_top(L);
-  preinit_thread(L1, g);
-  L1->hookmask = L->hookmask;
+  L1->hookmask = L->hookmask & cast_byte(~MASKASYNC);
   L1->basehookcount = L->basehookcount;
   L1->hook = L->hook;
   resethookcount(L1);
@@ -277,15 +384,60 @@ LUA_API lua_State* lua_newthread(lua_State* L) {
 }
 
 // Release a lua thread 'L1'
+// a thread with a small stack goes to the pool instead, see 'reusethread'
 void luaE_freethread(lua_State* L, lua_State* L1) {
+  global_State* g = G(L);
   LX* l = fromstate(L1);
   luaF_close(L1, L1->stack); /* close all upvalues for this thread */
   lua_assert(L1->openupval == NULL);
   luai_userstatefree(L, L1);
+  if (g->nthreadpool < LUAI_MAXTHREADPOOL && L1->stack != NULL && L1->stacksize <= LUAI_MAXPOOLSTACK && !g->gcemergency) {
+    L1->ci = &L1->base_ci;
+    luaE_shrinkCI(L1);
+    L1->next = (g->threadpool != NULL) ? obj2gco(g->threadpool) : NULL;
+    g->threadpool = L1;
+    g->nthreadpool++;
+    return;
+  }
   freestack(L1);
   luaM_free(L, l);
 }
 
+// give the memory of all pooled threads back
+void luaE_freethreadpool(lua_State* L) {
+  global_State* g = G(L);
+  while (g->threadpool != NULL) {
+    lua_State* L1 = g->threadpool;
+    g->threadpool = (L1->next != NULL) ? gco2th(L1->next) : NULL;
+    freestack(L1);
+    luaM_free(L, fromstate(L1));
+  }
+  g->nthreadpool = 0;
+}
+
+/*
+** unwind a thread that is dead or suspended back to its base level,
+** closing its upvalues, so that it can run a new function; returns the
+** error status that stopped the thread, LUA_OK otherwise
+*/
+LUA_API int lua_resetthread(lua_State* L) {
+  CallInfo* ci;
+  int status;
+  lua_lock(L);
+  status = (L->status == LUA_YIELD) ? LUA_OK : L->status;
+  luaF_close(L, L->stack);
+  L->ci = ci = &L->base_ci; /* unwind CallInfo list */
+  setnilvalue(L->stack); /* 'function' entry for basic 'ci' */
+  ci->func = L->stack;
+  ci->callstatus = 0;
+  L->top = L->stack + 1;
+  ci->top = L->top + LUA_MINSTACK;
+  L->status = LUA_OK;
+  L->errfunc = 0;
+  lua_unlock(L);
+  return status;
+}
+
 // Create a new lua process, a lua_State and a global_State
 LUA_API lua_State* lua_newstate(lua_Alloc f, void* ud) {
   int i;
@@ -304,17 +456,26 @@ LUA_API lua_State* lua_newstate(lua_Alloc f, void* ud) {
   g->frealloc = f;
   g->ud = ud;
   g->mainthread = L;
+  g->running = L;
+  g->asynchook = NULL;
+  initlock(g);
   g->seed = makeseed(L); // seed for calculate the string hash
   g->gcrunning = 0; /* no GC while building state */
   g->GCestimate = 0;
   g->strt.size = g->strt.nuse = 0;
-  g->strt.hash = NULL;
+  g->strt.slot = NULL;
+  g->atoms = NULL;
+  g->sizeatoms = 0;
+  g->threadpool = NULL;
+  g->nthreadpool = 0;
   setnilvalue(&g->l_registry);
   g->panic = NULL;
   g->version = NULL;
   g->gcstate = GCSpause;
   g->gckind = KGC_NORMAL;
+  g->gcemergency = 0;
   g->allgc = g->finobj = g->tobefnz = g->fixedgc = NULL;
+  g->genold = NULL;
   g->sweepgc = NULL;
   g->gray = g->grayagain = NULL;
   g->weak = g->ephemeron = g->allweak = NULL;
@@ -324,10 +485,14 @@ LUA_API lua_State* lua_newstate(lua_Alloc f, void* ud) {
   g->gcfinnum = 0;
   g->gcpause = LUAI_GCPAUSE;
   g->gcstepmul = LUAI_GCMUL;
+  g->gcgenminormul = LUAI_GENMINORMUL;
+  g->gcgenmajormul = LUAI_GENMAJORMUL;
+  g->gcminorcount = g->gcmajorcount = 0;
   for (i = 0; i < LUA_NUMTAGS; i++)
     g->mt[i] = NULL;
   if (luaD_rawrunprotected(L, f_luaopen, NULL) != LUA_OK) {
     /* memory allocation error: free partial state */
+    lua_lock(L);
     close_state(L);
     L = NULL;
   }
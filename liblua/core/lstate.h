@@ -13,6 +13,10 @@
 #include "ltm.h"
 #include "lzio.h"
 
+#if defined(LUA_USE_THREADLOCK)
+#include <pthread.h>
+#endif
+
 /*
 
 ** Some notes about garbage-collected objects: All objects in Lua must
@@ -63,14 +67,21 @@ struct lua_longjmp; /* defined in ldo.c */
 #define BASIC_STACK_SIZE (2 * LUA_MINSTACK)
 
 /* kinds of Garbage Collection */
-#define KGC_NORMAL 0
-#define KGC_EMERGENCY 1 /* gc was forced by an allocation failure */
+#define KGC_NORMAL 0 /* incremental */
+#define KGC_GEN 1 /* generational */
 
-// internal global string table
+// one slot of the string table, the hash is kept next to the pointer
+// so probing never touches the TString itself until the hashes match
+typedef struct StrSlot {
+  TString* ts; // NULL if the slot is empty
+  unsigned int hash; // copy of 'ts->hash'
+} StrSlot;
+
+// internal global string table, open addressing with linear probing
 typedef struct stringtable {
-  TString** hash; // array for hash table
+  StrSlot* slot; // array for hash table
   int nuse; /* number of elements */
-  int size; // size of 'hash' array
+  int size; // size of 'slot' array, always 2^n
 } stringtable;
 
 /*
@@ -139,6 +150,7 @@ typedef struct global_State {
   lu_byte currentwhite;
   lu_byte gcstate; /* state of garbage collector */
   lu_byte gckind; /* kind of GC running */
+  lu_byte gcemergency; /* true if this is an emergency collection */
   lu_byte gcrunning; /* true if GC is running */
   GCObject* allgc; /* list of all collectable objects */ // GCObject.next, weak reference
   GCObject** sweepgc; /* current position of sweep in list */ // GCObject.next
@@ -150,17 +162,34 @@ typedef struct global_State {
   GCObject* allweak; /* list of all-weak tables */ // Table.gclist
   GCObject* tobefnz; /* list of userdata to be GC */ // GCObject.next, strong reference
   GCObject* fixedgc; /* list of objects not to be collected */ // GCObject.next, strong reference
+  GCObject* genold; /* first old object in 'allgc' (generational mode) */
   struct lua_State* twups; /* list of threads with open upvalues */
   unsigned int gcfinnum; /* number of finalizers to call in each GC step */
   int gcpause; /* size of pause between successive GCs */
   int gcstepmul; /* GC 'granularity' */
+  int gcgenminormul; /* memory growth (%) between minor collections */
+  int gcgenmajormul; /* memory growth (%) since last major to do a major */
+  lu_mem gcminorcount; /* number of minor (young) collections */
+  lu_mem gcmajorcount; /* number of major (full mark) collections */
   lua_CFunction panic; /* to be called in unprotected errors */
   struct lua_State* mainthread;
+  struct lua_State* running; /* thread running now, for asynchronous hooks */
+  volatile lua_Hook asynchook; /* called once by 'running', see 'lua_setasynchook' */
   const lua_Number* version; /* pointer to version number */
   TString* memerrmsg; /* memory-error message */
   TString* tmname[TM_N]; /* array with tag-method names */
   struct Table* mt[LUA_NUMTAGS]; /* metatables for basic types */
   TString* strcache[STRCACHE_N][STRCACHE_M]; /* cache for strings in API */
+  TString* strcontent[STRCACHE_C]; /* cache for short strings in API, by content */
+  TString** atoms; /* interned atoms of this state, indexed by atom id */
+  int sizeatoms; /* size of 'atoms' */
+  struct lua_State* threadpool; /* collected threads to be reused, linked by 'next' */
+  int nthreadpool; /* number of threads in 'threadpool' */
+#if defined(LUA_USE_THREADLOCK)
+  pthread_mutex_t lock; /* taken by 'lua_lock' */
+  int lockwait; /* number of OS threads blocked on 'lock' */
+  unsigned int lockturn; /* bumped each time 'lock' changes hands */
+#endif
 } global_State;
 
 /*
@@ -227,6 +256,7 @@ union GCUnion {
 
 LUAI_FUNC void luaE_setdebt(global_State* g, l_mem debt);
 LUAI_FUNC void luaE_freethread(lua_State* L, lua_State* L1);
+LUAI_FUNC void luaE_freethreadpool(lua_State* L);
 LUAI_FUNC CallInfo* luaE_extendCI(lua_State* L);
 LUAI_FUNC void luaE_freeCI(lua_State* L);
 LUAI_FUNC void luaE_shrinkCI(lua_State* L);
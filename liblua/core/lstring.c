@@ -22,14 +22,6 @@
 
 #define MEMERRMSG "not enough memory"
 
-/*
-** Lua will use at most ~(2^LUAI_HASHLIMIT) bytes from a string to
-** compute its hash
-*/
-#if !defined(LUAI_HASHLIMIT)
-#define LUAI_HASHLIMIT 5
-#endif
-
 /*
 ** equality for long strings
 */
@@ -41,6 +33,81 @@ int luaS_eqlngstr(TString* a, TString* b) {
           (memcmp(getstr(a), getstr(b), len) == 0)); /* equal contents */
 }
 
+#if defined(LUA_USE_WORDHASH)
+
+/*
+** Word-at-a-time seeded hash (wyhash style): the string is read 8 bytes
+** at a time and every pair of words is folded with a 64x64->128 bit
+** multiply, so every byte counts and the seed changes all the output.
+*/
+typedef unsigned long long l_hashword;
+
+#define HASH_P0 0xa0761d6478bd642fULL
+#define HASH_P1 0xe7037ed1a0b428dbULL
+#define HASH_P2 0x8ebc6af09c88c6e3ULL
+
+static l_hashword hashmix(l_hashword a, l_hashword b) {
+#if defined(__SIZEOF_INT128__)
+  unsigned __int128 r = (unsigned __int128)a * b;
+  return (l_hashword)r ^ (l_hashword)(r >> 64);
+#else
+  l_hashword ha = a >> 32, la = (unsigned int)a;
+  l_hashword hb = b >> 32, lb = (unsigned int)b;
+  l_hashword rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+  l_hashword t = rl + (rm0 << 32), lo;
+  l_hashword c = t < rl;
+  lo = t + (rm1 << 32);
+  c += lo < t;
+  return lo ^ (rh + (rm0 >> 32) + (rm1 >> 32) + c);
+#endif
+}
+
+static l_hashword read64(const char* p) {
+  l_hashword v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static l_hashword read32(const char* p) {
+  unsigned int v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+// Calculate the string hash value
+unsigned int luaS_hash(const char* str, size_t l, unsigned int seed) {
+  l_hashword h = hashmix(seed ^ HASH_P0, l ^ HASH_P1);
+  l_hashword a, b;
+  size_t n = l;
+  for (; n > 16; n -= 16, str += 16)
+    h = hashmix(read64(str) ^ HASH_P1, read64(str + 8) ^ h);
+  if (n >= 8) { /* 8..16 bytes left: two (maybe overlapping) words */
+    a = read64(str);
+    b = read64(str + n - 8);
+  } else if (n >= 4) {
+    a = (read32(str) << 32) | read32(str + n - 4);
+    b = 0;
+  } else if (n > 0) {
+    a = ((l_hashword)cast_byte(str[0]) << 16) | ((l_hashword)cast_byte(str[n >> 1]) << 8) | cast_byte(str[n - 1]);
+    b = 0;
+  } else {
+    a = b = 0;
+  }
+  h = hashmix(a ^ HASH_P1, b ^ h);
+  h = hashmix(h ^ HASH_P2, l ^ HASH_P1);
+  return cast(unsigned int, h ^ (h >> 32));
+}
+
+#else
+
+/*
+** Lua will use at most ~(2^LUAI_HASHLIMIT) bytes from a string to
+** compute its hash
+*/
+#if !defined(LUAI_HASHLIMIT)
+#define LUAI_HASHLIMIT 5
+#endif
+
 // Calculate the string hash value
 unsigned int luaS_hash(const char* str, size_t l, unsigned int seed) {
   unsigned int h = seed ^ cast(unsigned int, l); // ^ means Bitwise XOR
@@ -51,6 +118,8 @@ unsigned int luaS_hash(const char* str, size_t l, unsigned int seed) {
   return h;
 }
 
+#endif
+
 // Calculate the hash value for long string, default: length > 40
 unsigned int luaS_hashlongstr(TString* ts) {
   lua_assert(ts->tt == LUA_TLNGSTR);
@@ -68,28 +137,22 @@ unsigned int luaS_hashlongstr(TString* ts) {
 void luaS_resize(lua_State* L, int newsize) {
   int i;
   stringtable* tb = &G(L)->strt; // global string table
-  if (newsize > tb->size) { /* grow table if needed */
-    luaM_reallocvector(L, tb->hash, tb->size, newsize, TString*);
-    for (i = tb->size; i < newsize; i++)
-      // open hash table, tb->hash is the pointer for linked list
-      tb->hash[i] = NULL;
-  }
+  StrSlot* old = tb->slot;
+  /* new array first, so a memory error leaves the old table intact */
+  StrSlot* slot = luaM_newvector(L, newsize, StrSlot);
+  lua_assert(tb->nuse < newsize && (newsize & (newsize - 1)) == 0);
+  for (i = 0; i < newsize; i++)
+    slot[i].ts = NULL;
   for (i = 0; i < tb->size; i++) { /* rehash */
-    TString* p = tb->hash[i];
-    tb->hash[i] = NULL;
-    while (p) { /* for each node in the list */
-      TString* hnext = p->u.hnext; /* save next */
-      unsigned int h = lmod(p->hash, newsize); /* new position */
-      p->u.hnext = tb->hash[h]; /* chain it */
-      tb->hash[h] = p;
-      p = hnext;
+    if (old[i].ts != NULL) {
+      unsigned int h = lmod(old[i].hash, newsize); /* new position */
+      while (slot[h].ts != NULL)
+        h = lmod(h + 1, newsize);
+      slot[h] = old[i];
     }
   }
-  if (newsize < tb->size) { /* shrink table if needed */
-    /* vanishing slice should be empty */
-    lua_assert(tb->hash[newsize] == NULL && tb->hash[tb->size - 1] == NULL);
-    luaM_reallocvector(L, tb->hash, tb->size, newsize, TString*);
-  }
+  luaM_freearray(L, old, tb->size);
+  tb->slot = slot;
   tb->size = newsize;
 }
 
@@ -104,6 +167,10 @@ void luaS_clearcache(global_State* g) {
       if (iswhite(g->strcache[i][j])) /* will entry be collected? */
         g->strcache[i][j] = g->memerrmsg; /* replace it with something fixed */
     }
+  for (i = 0; i < STRCACHE_C; i++) {
+    if (iswhite(g->strcontent[i]))
+      g->strcontent[i] = g->memerrmsg;
+  }
 }
 
 /*
@@ -119,6 +186,8 @@ void luaS_init(lua_State* L) {
   for (i = 0; i < STRCACHE_N; i++) /* fill cache with valid strings */
     for (j = 0; j < STRCACHE_M; j++)
       g->strcache[i][j] = g->memerrmsg;
+  for (i = 0; i < STRCACHE_C; i++)
+    g->strcontent[i] = g->memerrmsg;
 }
 
 /*
@@ -148,12 +217,24 @@ TString* luaS_createlngstrobj(lua_State* L, size_t l) {
 }
 
 // remove the TString from internal global string table
+// the following entries of the probe run are shifted back into the hole,
+// so the table never needs tombstones
 void luaS_remove(lua_State* L, TString* ts) {
   stringtable* tb = &G(L)->strt;
-  TString** p = &tb->hash[lmod(ts->hash, tb->size)];
-  while (*p != ts) /* find previous element */
-    p = &(*p)->u.hnext;
-  *p = (*p)->u.hnext; /* remove element from its list */
+  StrSlot* slot = tb->slot;
+  unsigned int mask = cast(unsigned int, tb->size - 1);
+  unsigned int i = lmod(ts->hash, tb->size);
+  unsigned int j;
+  while (slot[i].ts != ts) /* find its slot */
+    i = (i + 1) & mask;
+  for (j = (i + 1) & mask; slot[j].ts != NULL; j = (j + 1) & mask) {
+    unsigned int home = lmod(slot[j].hash, tb->size);
+    if (((j - home) & mask) >= ((j - i) & mask)) { /* 'home' not in (i, j]? */
+      slot[i] = slot[j]; /* fill the hole */
+      i = j;
+    }
+  }
+  slot[i].ts = NULL;
   tb->nuse--;
 }
 
@@ -162,36 +243,45 @@ void luaS_remove(lua_State* L, TString* ts) {
 */
 // the string 'str' should be a short string
 // May Throw LUA_ERRRUN or LUA_ERRMEM
-static TString* internshrstr(lua_State* L, const char* str, size_t l) {
+static TString* internshrstrh(lua_State* L, const char* str, size_t l, unsigned int h) {
   TString* ts;
   global_State* g = G(L);
-  unsigned int h = luaS_hash(str, l, g->seed);
   // g->strt.size always is 2^n, such as 128
   // lmod get the lowest n bit from h
-  // list is a sub array from g->strt.hash
-  TString** list = &g->strt.hash[lmod(h, g->strt.size)];
+  unsigned int mask = cast(unsigned int, g->strt.size - 1);
+  unsigned int i;
+  StrSlot* slot = g->strt.slot;
   lua_assert(str != NULL); /* otherwise 'memcmp'/'memcpy' are undefined */
-  for (ts = *list; ts != NULL; ts = ts->u.hnext) {
-    if (l == ts->shrlen && (memcmp(str, getstr(ts), l * sizeof(char)) == 0)) {
+  for (i = h & mask; (ts = slot[i].ts) != NULL; i = (i + 1) & mask) {
+    if (slot[i].hash == h && l == ts->shrlen && (memcmp(str, getstr(ts), l * sizeof(char)) == 0)) {
       /* found! */
       if (isdead(g, ts)) /* dead (but not collected yet)? */
         changewhite(ts); /* resurrect it */
       return ts;
     }
   }
-  if (g->strt.nuse >= g->strt.size && g->strt.size <= MAX_INT / 2) {
+  /* keep the load factor below 3/4 */
+  if (g->strt.nuse >= g->strt.size - g->strt.size / 4 && g->strt.size <= MAX_INT / 2)
     luaS_resize(L, g->strt.size * 2);
-    list = &g->strt.hash[lmod(h, g->strt.size)]; /* recompute with new size */
-  }
   ts = createstrobj(L, l, LUA_TSHRSTR, h);
   memcpy(getstr(ts), str, l * sizeof(char));
   ts->shrlen = cast_byte(l);
-  ts->u.hnext = *list; // link to the internal global string table
-  *list = ts;
+  /* find the free slot only now: an emergency collection may have moved entries */
+  mask = cast(unsigned int, g->strt.size - 1);
+  slot = g->strt.slot;
+  i = h & mask;
+  while (slot[i].ts != NULL)
+    i = (i + 1) & mask;
+  slot[i].ts = ts; // link to the internal global string table
+  slot[i].hash = h;
   g->strt.nuse++;
   return ts;
 }
 
+static TString* internshrstr(lua_State* L, const char* str, size_t l) {
+  return internshrstrh(L, str, l, luaS_hash(str, l, G(L)->seed));
+}
+
 /*
 ** new string (with explicit length)
 */
@@ -209,6 +299,27 @@ TString* luaS_newlstr(lua_State* L, const char* str, size_t l) {
   }
 }
 
+/*
+** new string pushed through the API. C modules push the same few names
+** from many different buffers, so short strings are first looked up in
+** 'strcontent' by their hash: a hit costs the hash and one compare, and
+** the small cache stays hot where the string table would miss. Entries
+** are never dead, 'luaS_clearcache' drops them before the sweep.
+*/
+// May Throw LUA_ERRRUN or LUA_ERRMEM
+TString* luaS_newlstrapi(lua_State* L, const char* str, size_t l) {
+  if (l <= LUAI_MAXSHORTLEN) {
+    global_State* g = G(L);
+    unsigned int h = luaS_hash(str, l, g->seed);
+    TString** p = &g->strcontent[h & (STRCACHE_C - 1)];
+    if ((*p)->hash == h && (*p)->shrlen == l && memcmp(str, getstr(*p), l * sizeof(char)) == 0)
+      return *p;
+    *p = internshrstrh(L, str, l, h);
+    return *p;
+  }
+  return luaS_newlstr(L, str, l);
+}
+
 /*
 ** Create or reuse a zero-terminated string, first checking in the
 ** cache (using the string address as a key). The cache can contain
@@ -228,7 +339,7 @@ TString* luaS_new(lua_State* L, const char* str) {
   for (j = STRCACHE_M - 1; j > 0; j--)
     p[j] = p[j - 1]; /* move out last element */
   /* new element is first in the list */
-  p[0] = luaS_newlstr(L, str, strlen(str));
+  p[0] = luaS_newlstrapi(L, str, strlen(str));
   return p[0];
 }
 
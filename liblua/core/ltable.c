@@ -400,7 +400,20 @@ void luaH_resize(lua_State* L, Table* t, unsigned int nasize, unsigned int nhsiz
 
 // if resize the array part, the hash part will be replace and reimport all key-value
 void luaH_resizearray(lua_State* L, Table* t, unsigned int nasize) {
-  int nsize = allocsizenode(t);
+  unsigned int nsize = allocsizenode(t);
+  unsigned int i;
+  if (nasize < t->sizearray) { /* shrink? */
+    /* the hash part must hold the vanishing slice without a rehash */
+    nsize = 0;
+    for (i = 0; i < cast(unsigned int, allocsizenode(t)); i++) {
+      if (!ttisnil(gval(gnode(t, i))))
+        nsize++;
+    }
+    for (i = nasize; i < t->sizearray; i++) {
+      if (!ttisnil(&t->array[i]))
+        nsize++;
+    }
+  }
   luaH_resize(L, t, nasize, nsize);
 }
 
@@ -575,6 +588,27 @@ const TValue* luaH_getshortstr(Table* t, TString* key) {
   }
 }
 
+/*
+** inline cache miss, walk the chain and remember the node index for
+** the next lookup (see 'luaH_getshortstrcache')
+*/
+const TValue* luaH_getshortstrslow(Table* t, TString* key, unsigned int* ic) {
+  Node* n = hashstr(t, key);
+  lua_assert(key->tt == LUA_TSHRSTR);
+  for (;;) {
+    const TValue* k = gkey(n);
+    if (ttisshrstring(k) && eqshrstr(tsvalue(k), key)) {
+      *ic = cast(unsigned int, n - t->node);
+      return gval(n);
+    } else {
+      int nx = gnext(n);
+      if (nx == 0)
+        return luaO_nilobject; /* not found, keep the old slot */
+      n += nx;
+    }
+  }
+}
+
 /*
 ** "Generic" get version. (Not that generic: not valid for integers,
 ** which may be in array part, nor for floats with integral values.)
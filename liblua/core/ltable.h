@@ -34,6 +34,20 @@
 /* allocated size for hash nodes */
 #define allocsizenode(t) (isdummy(t) ? 0 : sizenode(t))
 
+/*
+** lookup short string 'key' with an inline cache, '*ic' is the node index
+** of the last hit. The slot is trusted only if it is inside the current
+** node vector and still holds 'key', so 'luaH_resize' (which moves every
+** key into a new node vector) invalidates it without any bookkeeping.
+** A table has at most one node for a given key, so a slot that passes the
+** check is exactly what 'luaH_getshortstr' would find by walking the chain.
+*/
+#define icachekey(t, key, ic) \
+  (*(ic) < cast(unsigned int, sizenode(t)) && ttisshrstring(gkey(gnode(t, *(ic)))) && \
+   tsvalue(gkey(gnode(t, *(ic)))) == (key))
+#define luaH_getshortstrcache(t, key, ic) \
+  (icachekey(t, key, ic) ? cast(const TValue*, gval(gnode(t, *(ic)))) : luaH_getshortstrslow(t, key, ic))
+
 /* returns the key, given the value of a table entry */
 // type of v is TValue*
 #define keyfromval(v) (gkey(cast(Node*, cast(char*, (v)) - offsetof(Node, i_val))))
@@ -41,6 +55,7 @@
 LUAI_FUNC const TValue* luaH_getint(Table* t, lua_Integer key);
 LUAI_FUNC void luaH_setint(lua_State* L, Table* t, lua_Integer key, TValue* value);
 LUAI_FUNC const TValue* luaH_getshortstr(Table* t, TString* key);
+LUAI_FUNC const TValue* luaH_getshortstrslow(Table* t, TString* key, unsigned int* ic);
 LUAI_FUNC const TValue* luaH_getstr(Table* t, TString* key);
 LUAI_FUNC const TValue* luaH_get(Table* t, const TValue* key);
 LUAI_FUNC TValue* luaH_newkey(lua_State* L, Table* t, const TValue* key);
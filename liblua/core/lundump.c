@@ -16,8 +16,11 @@
 #include "ldebug.h"
 #include "ldo.h"
 #include "lfunc.h"
+#include "lgc.h"
 #include "lmem.h"
 #include "lobject.h"
+#include "lopcodes.h"
+#include "lstate.h"
 #include "lstring.h"
 #include "lundump.h"
 #include "lzio.h"
@@ -30,11 +33,14 @@ typedef struct {
   lua_State* L;
   ZIO* Z;
   const char* name;
+  int format; /* LUAC_FORMAT or LUAC_FORMATOPT, maybe with LUAC_FORMATMAP */
+  MapChunk* map; /* chunk read in place (mapped format) */
+  int status; /* LUA_ERRSYNTAX, or LUA_ERRRUN when loading a prototype lazily */
 } LoadState;
 
 static l_noret error(LoadState* S, const char* why) {
   luaO_pushfstring(S->L, "%s: %s precompiled chunk", S->name, why);
-  luaD_throw(S->L, LUA_ERRSYNTAX);
+  luaD_throw(S->L, S->status);
 }
 
 /*
@@ -91,11 +97,21 @@ static TString* LoadString(LoadState* S) {
   }
 }
 
+static void CheckCode(LoadState* S, const Proto* f) {
+  int pc;
+  for (pc = 0; pc < f->sizecode; pc++) { /* superinstructions only in their own format */
+    OpCode op = GET_OPCODE(f->code[pc]);
+    if (op >= NUM_OPCODES || (op > OP_EXTRAARG && !(S->format & LUAC_FORMATOPT)))
+      error(S, "bad opcode in");
+  }
+}
+
 static void LoadCode(LoadState* S, Proto* f) {
   int n = LoadInt(S);
   f->code = luaM_newvector(S->L, n, Instruction);
   f->sizecode = n;
   LoadVector(S, f->code, n);
+  CheckCode(S, f);
 }
 
 static void LoadFunction(LoadState* S, Proto* f, TString* psource);
@@ -127,8 +143,8 @@ static void LoadConstants(LoadState* S, Proto* f) {
       case LUA_TLNGSTR:
         setsvalue2n(S->L, o, LoadString(S));
         break;
-      default:
-        lua_assert(0);
+      default: /* records of mapped chunks are found by offset */
+        error(S, "bad constant in");
     }
   }
 }
@@ -159,13 +175,9 @@ static void LoadUpvalues(LoadState* S, Proto* f) {
   }
 }
 
-static void LoadDebug(LoadState* S, Proto* f) {
+static void LoadDebugNames(LoadState* S, Proto* f) {
   int i, n;
   n = LoadInt(S);
-  f->lineinfo = luaM_newvector(S->L, n, int);
-  f->sizelineinfo = n;
-  LoadVector(S, f->lineinfo, n);
-  n = LoadInt(S);
   f->locvars = luaM_newvector(S->L, n, LocVar);
   f->sizelocvars = n;
   // for (i = 0; i < n; i++)
@@ -180,6 +192,14 @@ static void LoadDebug(LoadState* S, Proto* f) {
     f->upvalues[i].name = LoadString(S);
 }
 
+static void LoadDebug(LoadState* S, Proto* f) {
+  int n = LoadInt(S);
+  f->lineinfo = luaM_newvector(S->L, n, int);
+  f->sizelineinfo = n;
+  LoadVector(S, f->lineinfo, n);
+  LoadDebugNames(S, f);
+}
+
 static void LoadFunction(LoadState* S, Proto* f, TString* psource) {
   f->source = LoadString(S);
   if (f->source == NULL) /* no source in dump? */
@@ -190,6 +210,7 @@ static void LoadFunction(LoadState* S, Proto* f, TString* psource) {
   f->is_vararg = LoadByte(S);
   f->maxstacksize = LoadByte(S);
   LoadCode(S, f);
+  luaF_initicache(S->L, f);
   LoadConstants(S, f);
   LoadUpvalues(S, f);
   LoadProtos(S, f);
@@ -216,7 +237,8 @@ static void checkHeader(LoadState* S) {
   checkliteral(S, signature + 1, "not a"); /* 1st char already checked */
   if (LoadByte(S) != LUAC_VERSION)
     error(S, "version mismatch in");
-  if (LoadByte(S) != LUAC_FORMAT)
+  S->format = LoadByte(S);
+  if ((S->format & ~(LUAC_FORMATOPT | LUAC_FORMATMAP)) != 0)
     error(S, "format mismatch in");
   checkliteral(S, LUAC_DATA, "corrupted");
   checksize(S, int);
@@ -231,25 +253,270 @@ static void checkHeader(LoadState* S) {
 }
 
 /*
-** load precompiled chunk
+** {======================================================
+** Mapped chunks
+** =======================================================
 */
-LClosure* luaU_undump(lua_State* L, ZIO* Z, const char* name) {
-  LoadState S;
-  LClosure* cl;
+
+/*
+** A chunk in mapped format (see 'lua_dumpmap') has the usual header,
+** then one record per function, nested functions before the function
+** defining them, and ends with the offset of the record of the main
+** function and the size of the chunk. Records start at multiples of
+** sizeof(size_t) and are laid out as the usual format, except for:
+**   size_t  offset of the previous sibling record (0 for the first one)
+**   size_t  offset of the last nested function record (0 if none)
+**   int     number of nested functions
+** at their start, and 'code' and 'lineinfo' being aligned to their
+** element size, so that prototypes can point to them instead of having
+** copies. Nested functions are only loaded when their first closure is
+** created.
+*/
+
+/* size of the header plus the number of upvalues of the main function */
+#define MAPSTART \
+  (sizeof(LUA_SIGNATURE) - sizeof(char) + 2 + sizeof(LUAC_DATA) - sizeof(char) + 5 + sizeof(lua_Integer) + sizeof(lua_Number) + 1)
+
+typedef struct MapView {
+  const char* p;
+  size_t n;
+} MapView;
+
+static const char* getview(lua_State* L, void* ud, size_t* size) {
+  MapView* v = (MapView*)ud;
+  (void)L; /* not used */
+  if (v->n == 0)
+    return NULL;
+  *size = v->n;
+  v->n = 0;
+  return v->p;
+}
+
+/* read a record in place, starting at offset 'off' of the chunk */
+static void openrecord(LoadState* S, ZIO* Z, MapView* v, size_t off) {
+  if (off < MAPSTART || off >= S->map->size || off % sizeof(size_t) != 0)
+    error(S, "corrupted");
+  v->p = S->map->base + off;
+  v->n = S->map->size - off;
+  luaZ_init(S->L, Z, getview, v);
+  S->Z = Z;
+}
+
+/* point to 'n' elements of 'size' bytes in the chunk, aligned to 'size' */
+static void* MapVector(LoadState* S, int n, size_t size) {
+  ZIO* Z = S->Z;
+  size_t pad = (size - cast(size_t, Z->p - S->map->base) % size) % size;
+  const char* p;
+  if (Z->n < pad || (Z->n - pad) / size < cast(size_t, n))
+    error(S, "truncated");
+  p = Z->p + pad;
+  Z->p = p + n * size;
+  Z->n -= pad + n * size;
+  return cast(void*, p);
+}
+
+static void LoadRecord(LoadState* S, Proto* f) {
+  lua_State* L = S->L;
+  MapChunk* map = S->map;
+  TString* source;
+  size_t prev, last;
+  int i, n;
+  LoadVar(S, prev); /* only used by the parent */
+  LoadVar(S, last);
+  n = LoadInt(S);
+  source = LoadString(S);
+  if (source != NULL) /* else keep the source of its parent */
+    f->source = source;
+  f->linedefined = LoadInt(S);
+  f->lastlinedefined = LoadInt(S);
+  f->numparams = LoadByte(S);
+  f->is_vararg = LoadByte(S);
+  f->maxstacksize = LoadByte(S);
+  i = LoadInt(S);
+  f->code = cast(Instruction*, MapVector(S, i, sizeof(Instruction)));
+  f->sizecode = i;
+  CheckCode(S, f);
+  luaF_initicache(L, f);
+  LoadConstants(S, f);
+  LoadUpvalues(S, f);
+  f->p = luaM_newvector(L, n, Proto*);
+  f->sizep = n;
+  for (i = 0; i < n; i++)
+    f->p[i] = NULL;
+  for (i = n - 1; i >= 0; i--) { /* siblings are linked backwards */
+    Proto* p;
+    if (last < MAPSTART || last > map->size - sizeof(size_t))
+      error(S, "corrupted");
+    p = f->p[i] = luaF_newproto(L);
+    p->source = f->source;
+    p->map = map;
+    map->refs++;
+    p->lazy = last;
+    memcpy(&last, map->base + last, sizeof(size_t));
+  }
+  if (last != 0)
+    error(S, "corrupted");
+  i = LoadInt(S);
+  f->lineinfo = cast(int*, MapVector(S, i, sizeof(int)));
+  f->sizelineinfo = i;
+  LoadDebugNames(S, f);
+}
+
+/* copy the rest of the stream into the block of 'map' */
+static void LoadRest(LoadState* S, MapChunk* map) {
+  lua_State* L = S->L;
+  ZIO* Z = S->Z;
+  size_t len = MAPSTART; /* the header is not needed again */
+  map->base = luaM_reallocvchar(L, NULL, 0, MAPSTART);
+  map->size = MAPSTART;
+  memset(cast(char*, map->base), 0, MAPSTART);
+  for (;;) {
+    if (Z->n == 0) {
+      if (luaZ_fill(Z) == EOZ)
+        break;
+      Z->n++; /* luaZ_fill consumed first byte; put it back */
+      Z->p--;
+    }
+    if (Z->n > map->size - len) {
+      size_t size = (len + Z->n > 2 * map->size) ? len + Z->n : 2 * map->size;
+      map->base = luaM_reallocvchar(L, cast(char*, map->base), map->size, size);
+      map->size = size;
+    }
+    memcpy(cast(char*, map->base) + len, Z->p, Z->n);
+    len += Z->n;
+    Z->p += Z->n;
+    Z->n = 0;
+  }
+  map->base = luaM_reallocvchar(L, cast(char*, map->base), map->size, len);
+  map->size = len;
+}
+
+/*
+** load the main function of a mapped chunk; 'map' is the chunk given
+** in place by 'lua_loadmap', or NULL to copy it from the stream
+*/
+static void LoadMapped(LoadState* S, Proto* f, MapChunk* map) {
+  lua_State* L = S->L;
+  ZIO z;
+  MapView v;
+  size_t trailer[2]; /* record of the main function and chunk size */
+  if (map == NULL) {
+    map = luaU_newmap(L, NULL, 0, NULL, NULL);
+    if (map == NULL)
+      luaD_throw(L, LUA_ERRMEM);
+    f->map = map; /* 'f' owns it from now on */
+    LoadRest(S, map);
+  } else {
+    lua_assert(S->Z->p == map->base + MAPSTART);
+    f->map = map;
+    map->refs++;
+  }
+  map->format = S->format;
+  S->map = map;
+  if (point2uint(map->base) % sizeof(size_t) != 0)
+    error(S, "misaligned");
+  if (map->size < MAPSTART + sizeof(trailer))
+    error(S, "truncated");
+  memcpy(trailer, map->base + map->size - sizeof(trailer), sizeof(trailer));
+  if (trailer[1] != map->size)
+    error(S, "truncated");
+  openrecord(S, &z, &v, trailer[0]);
+  LoadRecord(S, f);
+}
+
+static void setname(LoadState* S, const char* name) {
   if (*name == '@' || *name == '=')
-    S.name = name + 1;
+    S->name = name + 1;
   else if (*name == LUA_SIGNATURE[0])
-    S.name = "binary string";
+    S->name = "binary string";
   else
-    S.name = name;
+    S->name = name;
+}
+
+/*
+** load a prototype of a mapped chunk when its first closure is created
+*/
+void luaU_loadproto(lua_State* L, Proto* f) {
+  LoadState S;
+  ZIO z;
+  MapView v;
+  lua_assert(f->map != NULL && f->lazy != 0);
+  setname(&S, f->source != NULL ? getstr(f->source) : "=?");
+  S.L = L;
+  S.format = f->map->format;
+  S.map = f->map;
+  S.status = LUA_ERRRUN;
+  luaC_protobarrier(L, f); /* it may have been traversed while empty */
+  if (f->icache != NULL) { /* a previous attempt failed? start again */
+    luaM_freearray(L, f->icache, f->sizecode);
+    f->icache = NULL;
+  }
+  luaM_freearray(L, f->p, f->sizep);
+  luaM_freearray(L, f->k, f->sizek);
+  luaM_freearray(L, f->locvars, f->sizelocvars);
+  luaM_freearray(L, f->upvalues, f->sizeupvalues);
+  f->p = NULL;
+  f->k = NULL;
+  f->locvars = NULL;
+  f->upvalues = NULL;
+  f->sizecode = f->sizep = f->sizek = f->sizelineinfo = f->sizelocvars = f->sizeupvalues = 0;
+  openrecord(&S, &z, &v, f->lazy);
+  LoadRecord(&S, f);
+  f->lazy = 0;
+}
+
+/*
+** blocks are allocated without raising errors, so that 'lua_loadmap'
+** can always give its block back
+*/
+MapChunk* luaU_newmap(lua_State* L, const void* base, size_t size, lua_Unmap unmap, void* ud) {
+  global_State* g = G(L);
+  MapChunk* map = cast(MapChunk*, (*g->frealloc)(g->ud, NULL, 0, sizeof(MapChunk)));
+  if (map != NULL) {
+    map->base = cast(const char*, base);
+    map->size = size;
+    map->refs = 1;
+    map->format = LUAC_FORMAT;
+    map->unmap = unmap;
+    map->ud = ud;
+  }
+  return map;
+}
+
+void luaU_releasemap(lua_State* L, MapChunk* map) {
+  lua_assert(map->refs > 0);
+  if (--map->refs == 0) {
+    global_State* g = G(L);
+    if (map->unmap != NULL)
+      (*map->unmap)(map->ud, cast(void*, map->base), map->size);
+    else if (map->base != NULL)
+      luaM_freemem(L, cast(void*, map->base), map->size);
+    (*g->frealloc)(g->ud, map, sizeof(MapChunk), 0);
+  }
+}
+
+/* }====================================================== */
+
+/*
+** load precompiled chunk
+*/
+LClosure* luaU_undump(lua_State* L, ZIO* Z, const char* name, MapChunk* map) {
+  LoadState S;
+  LClosure* cl;
+  setname(&S, name);
   S.L = L;
   S.Z = Z;
+  S.map = NULL;
+  S.status = LUA_ERRSYNTAX;
   checkHeader(&S);
   cl = luaF_newLclosure(L, LoadByte(&S));
   setclLvalue(L, L->top, cl);
   luaD_inctop(L);
   cl->p = luaF_newproto(L);
-  LoadFunction(&S, cl->p, NULL);
+  if (S.format & LUAC_FORMATMAP)
+    LoadMapped(&S, cl->p, map);
+  else
+    LoadFunction(&S, cl->p, NULL);
   lua_assert(cl->nupvalues == cl->p->sizeupvalues);
   luai_verifycode(L, buff, cl->p);
   return cl;
@@ -20,11 +20,34 @@
 #define MYINT(s) (s[0] - '0')
 #define LUAC_VERSION (MYINT(LUA_VERSION_MAJOR) * 16 + MYINT(LUA_VERSION_MINOR))
 #define LUAC_FORMAT 0 /* this is the official format */
+#define LUAC_FORMATOPT 1 /* official format plus superinstructions (OP_GETTABUP2...) */
+#define LUAC_FORMATMAP 2 /* flag: aligned records that can be used in place (see lundump.c) */
+
+/*
+** a block holding a chunk in mapped format; the 'code' and 'lineinfo'
+** of its prototypes point into it, so it lives until the last of them
+** is collected
+*/
+typedef struct MapChunk {
+  const char* base;
+  size_t size;
+  int refs; /* prototypes (and loaders) still using it */
+  int format; /* format byte of its header */
+  lua_Unmap unmap; /* how to release 'base', NULL if allocated by the loader */
+  void* ud;
+} MapChunk;
+
+/* load the record of a prototype from a mapped chunk on first use */
+#define luaU_checkproto(L, f) ((f)->lazy != 0 ? luaU_loadproto(L, f) : cast_void(0))
 
 /* load one chunk; from lundump.c */
-LUAI_FUNC LClosure* luaU_undump(lua_State* L, ZIO* Z, const char* name);
+LUAI_FUNC LClosure* luaU_undump(lua_State* L, ZIO* Z, const char* name, MapChunk* map);
+LUAI_FUNC void luaU_loadproto(lua_State* L, Proto* f);
+LUAI_FUNC MapChunk* luaU_newmap(lua_State* L, const void* base, size_t size, lua_Unmap unmap, void* ud);
+LUAI_FUNC void luaU_releasemap(lua_State* L, MapChunk* map);
 
 /* dump one chunk; from ldump.c */
 LUAI_FUNC int luaU_dump(lua_State* L, const Proto* f, lua_Writer w, void* data, int strip);
+LUAI_FUNC int luaU_dumpmap(lua_State* L, const Proto* f, lua_Writer w, void* data, int strip);
 
 #endif
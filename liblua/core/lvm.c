@@ -28,8 +28,14 @@
 #include "lstring.h"
 #include "ltable.h"
 #include "ltm.h"
+#include "lundump.h"
 #include "lvm.h"
 
+/* labels as values is a GCC extension (also accepted by Clang), not by MSVC */
+#if defined(LUA_USE_JUMPTABLE) && !defined(__GNUC__)
+#undef LUA_USE_JUMPTABLE
+#endif
+
 /* limit for table tag-method chains (to avoid loops) */
 #define MAXTAGLOOP 2000
 
@@ -654,6 +660,8 @@ void luaV_finishOp(lua_State* L) {
     case OP_LEN:
     case OP_GETTABUP:
     case OP_GETTABLE:
+    case OP_GETTABUP2: /* yielded in its own lookup, the GETTABLE runs next */
+    case OP_GETTABLE2:
     case OP_SELF: {
       setobjs2s(L, base + GETARG_A(inst), --L->top);
       break;
@@ -724,13 +732,25 @@ void luaV_finishOp(lua_State* L) {
 #define RKC(i) \
   check_exp(getCMode(GET_OPCODE(i)) == OpArgK, ISK(GETARG_C(i)) ? k + INDEXK(GETARG_C(i)) : base + GETARG_C(i))
 
-/* execute a jump instruction */
+/*
+** give other OS threads sharing this state a chance to enter the core;
+** the stack may be shrunk by their collections meanwhile
+*/
+#if defined(LUA_USE_THREADLOCK)
+#define threadyield(L) Protect(luai_threadyield(L))
+#else
+#define threadyield(L) ((void)0)
+#endif
+
+/* execute a jump instruction, backward jumps close loops */
 #define dojump(ci, i, e) \
   { \
     int a = GETARG_A(i); \
     if (a != 0) \
       luaF_close(L, ci->u.l.base + a - 1); \
     ci->u.l.savedpc += GETARG_sBx(i) + e; \
+    if (GETARG_sBx(i) < 0) \
+      threadyield(L); \
   }
 
 /* for test instructions, execute the jump instruction that follows it */
@@ -754,7 +774,7 @@ void luaV_finishOp(lua_State* L) {
     luaC_condGC(L, \
                 L->top = (c), /* limit of live values */ \
                 Protect(L->top = ci->top)); /* restore top */ \
-    luai_threadyield(L); \
+    threadyield(L); \
   }
 
 /* fetch an instruction and prepare its execution */
@@ -763,13 +783,17 @@ void luaV_finishOp(lua_State* L) {
 #define vmfetch() \
   { \
     i = *(ci->u.l.savedpc++); \
-    if (L->hookmask & (LUA_MASKLINE | LUA_MASKCOUNT)) \
+    if (L->hookmask & (LUA_MASKLINE | LUA_MASKCOUNT | MASKASYNC)) \
       Protect(luaG_traceexec(L)); \
     ra = RA(i); /* WARNING: any stack reallocation invalidates 'ra' */ \
     lua_assert(base == ci->u.l.base); \
     lua_assert(base <= L->top && L->top < L->stack + L->stacksize); \
   }
 
+/*
+** default dispatch is a plain 'switch', ljumptab.h redefines these
+** three macros to use a computed goto table instead
+*/
 #define vmdispatch(o) switch (o)
 #define vmcase(l) case l:
 #define vmbreak break
@@ -787,6 +811,26 @@ void luaV_finishOp(lua_State* L) {
       Protect(luaV_finishget(L, t, k, v, slot)); \
   }
 
+/*
+** 'gettableProtected' for 'GETTABUP', 'GETTABLE' and 'SELF', when the
+** key is a constant short string, look up through the inline cache of
+** the current instruction instead of walking the hash chain
+*/
+#define gettableCached(L, t, k, v) \
+  { \
+    if (ttistable(t) && ISK(GETARG_C(i)) && ttisshrstring(k)) { \
+      const TValue* slot; \
+      unsigned int* ic = cl->p->icache + pcRel(ci->u.l.savedpc, cl->p); \
+      lua_assert(cl->p->icache != NULL); \
+      slot = luaH_getshortstrcache(hvalue(t), tsvalue(k), ic); \
+      if (!ttisnil(slot)) { \
+        setobj2s(L, v, slot); \
+      } else \
+        Protect(luaV_finishget(L, t, k, v, slot)); \
+    } else \
+      gettableProtected(L, t, k, v); \
+  }
+
 /* same for 'luaV_settable' */
 #define settableProtected(L, t, k, v) \
   { \
@@ -807,6 +851,9 @@ newframe: /* reentry point when frame changes (call/return) */
   cl = clLvalue(ci->func); /* local reference to function's closure */
   k = cl->p->k; /* local reference to function's constant table */
   base = ci->u.l.base; /* local copy of function's base */
+#if defined(LUA_USE_JUMPTABLE)
+#include "ljumptab.h"
+#endif
   /* main loop of interpreter */
   for (;;) {
     Instruction i;
@@ -850,13 +897,44 @@ newframe: /* reentry point when frame changes (call/return) */
       vmcase(OP_GETTABUP) {
         TValue* upval = cl->upvals[GETARG_B(i)]->v;
         TValue* rc = RKC(i);
-        gettableProtected(L, upval, rc, ra); // may fire meta function, reallocate stack, and invalidates 'ra' 'rc'
+        gettableCached(L, upval, rc, ra); // may fire meta function, reallocate stack, and invalidates 'ra' 'rc'
         vmbreak;
       }
       vmcase(OP_GETTABLE) {
         StkId rb = RB(i);
         TValue* rc = RKC(i);
-        gettableProtected(L, rb, rc, ra);
+        gettableCached(L, rb, rc, ra);
+        vmbreak;
+      }
+      vmcase(OP_GETTABUP2) {
+        TValue* upval = cl->upvals[GETARG_B(i)]->v;
+        TValue* rc = RKC(i);
+        StkId rb;
+        gettableCached(L, upval, rc, ra);
+        if (L->hookmask & (LUA_MASKLINE | LUA_MASKCOUNT | MASKASYNC)) {
+          vmbreak; /* hooks must see the GETTABLE, run it through 'vmfetch' */
+        }
+        i = *(ci->u.l.savedpc++); /* the GETTABLE indexing R(A), no dispatch */
+        lua_assert(GET_OPCODE(i) == OP_GETTABLE);
+        ra = RA(i);
+        rb = RB(i);
+        rc = RKC(i);
+        gettableCached(L, rb, rc, ra);
+        vmbreak;
+      }
+      vmcase(OP_GETTABLE2) {
+        StkId rb = RB(i);
+        TValue* rc = RKC(i);
+        gettableCached(L, rb, rc, ra);
+        if (L->hookmask & (LUA_MASKLINE | LUA_MASKCOUNT | MASKASYNC)) {
+          vmbreak;
+        }
+        i = *(ci->u.l.savedpc++); /* same as OP_GETTABUP2 */
+        lua_assert(GET_OPCODE(i) == OP_GETTABLE);
+        ra = RA(i);
+        rb = RB(i);
+        rc = RKC(i);
+        gettableCached(L, rb, rc, ra);
         vmbreak;
       }
       vmcase(OP_SETTABUP) {
@@ -894,7 +972,14 @@ newframe: /* reentry point when frame changes (call/return) */
         TValue* rc = RKC(i);
         TString* key = tsvalue(rc); /* key must be a string */
         setobjs2s(L, ra + 1, rb); // may be ra == rb
-        if (luaV_fastget(L, rb, key, aux, luaH_getstr)) {
+        if (ttistable(rb) && ISK(GETARG_C(i)) && key->tt == LUA_TSHRSTR) {
+          unsigned int* ic = cl->p->icache + pcRel(ci->u.l.savedpc, cl->p);
+          aux = luaH_getshortstrcache(hvalue(rb), key, ic);
+          if (!ttisnil(aux)) {
+            setobj2s(L, ra, aux);
+          } else
+            Protect(luaV_finishget(L, rb, rc, ra, aux));
+        } else if (luaV_fastget(L, rb, key, aux, luaH_getstr)) {
           setobj2s(L, ra, aux);
         } else
           Protect(luaV_finishget(L, rb, rc, ra, aux)); // call meta method, should protect 'base'
@@ -1228,6 +1313,7 @@ newframe: /* reentry point when frame changes (call/return) */
             setfltvalue(ra + 3, idx); /* ...and external index */
           }
         }
+        threadyield(L);
         vmbreak;
       }
       vmcase(OP_FORPREP) {
@@ -1276,6 +1362,7 @@ newframe: /* reentry point when frame changes (call/return) */
         if (!ttisnil(ra + 1)) { /* continue loop? */
           setobjs2s(L, ra, ra + 1); /* save control variable */
           ci->u.l.savedpc += GETARG_sBx(i); /* jump back */
+          threadyield(L);
         }
         vmbreak;
       }
@@ -1304,7 +1391,9 @@ newframe: /* reentry point when frame changes (call/return) */
       }
       vmcase(OP_CLOSURE) {
         Proto* p = cl->p->p[GETARG_Bx(i)];
-        LClosure* ncl = getcached(p, cl->upvals, base); /* cached closure */
+        LClosure* ncl;
+        luaU_checkproto(L, p); /* first closure of a function in a mapped chunk? */
+        ncl = getcached(p, cl->upvals, base); /* cached closure */
         if (ncl == NULL) /* no match? */
           pushclosure(L, p, cl->upvals, base, ra); /* create a new one */
         else
@@ -124,6 +124,7 @@ LUALIB_API int(luaL_inject)(lua_State* L, const char* source, int level);
 
 LUALIB_API lua_State*(luaL_newstate_z)(void);
 LUALIB_API void(luaL_close_z)(lua_State* L);
+LUALIB_API int(luaL_allocstats)(lua_State* L);
 
 #define LUA_ATEXIT "_atexit_"
 LUALIB_API void(luaL_atexit)(lua_State* L);
@@ -155,6 +156,15 @@ LUALIB_API void luaL_printfinish(lua_State* L);
 
 #define luaL_typename(L, i) lua_typename(L, lua_type(L, (i)))
 
+/* push literal 's' through an atom created on first use, ids are process wide */
+#define luaL_pushatomliteral(L, s) \
+  do { \
+    static int atom_ = 0; \
+    if (atom_ == 0) \
+      atom_ = lua_newatom(L, "" s); \
+    lua_pushatom(L, atom_); \
+  } while (0)
+
 #define luaL_dofile(L, fn) (luaL_loadfile(L, fn) || lua_pcall(L, 0, LUA_MULTRET, 0))
 
 #define luaL_dostring(L, s) (luaL_loadstring(L, s) || lua_pcall(L, 0, LUA_MULTRET, 0))
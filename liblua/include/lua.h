@@ -102,6 +102,11 @@ typedef const char* (*lua_Reader)(lua_State* L, void* ud, size_t* sz);
 
 typedef int (*lua_Writer)(lua_State* L, const void* p, size_t sz, void* ud);
 
+/*
+** Type for functions that release a block given to 'lua_loadmap'
+*/
+typedef void (*lua_Unmap)(void* ud, void* p, size_t sz);
+
 /*
 ** Type for memory-allocation functions
 */
@@ -145,6 +150,7 @@ LUA_API const char lua_ident[];
 LUA_API lua_State*(lua_newstate)(lua_Alloc f, void* ud);
 LUA_API void(lua_close)(lua_State* L);
 LUA_API lua_State*(lua_newthread)(lua_State* L);
+LUA_API int(lua_resetthread)(lua_State* L);
 
 LUA_API lua_CFunction(lua_atpanic)(lua_State* L, lua_CFunction panicf);
 
@@ -222,6 +228,8 @@ LUA_API void(lua_pushnumber)(lua_State* L, lua_Number n);
 LUA_API void(lua_pushinteger)(lua_State* L, lua_Integer n);
 LUA_API const char*(lua_pushlstring)(lua_State* L, const char* s, size_t len);
 LUA_API const char*(lua_pushstring)(lua_State* L, const char* s);
+LUA_API int(lua_newatom)(lua_State* L, const char* name);
+LUA_API const char*(lua_pushatom)(lua_State* L, int id);
 LUA_API const char*(lua_pushvfstring)(lua_State* L, const char* fmt, va_list argp);
 LUA_API const char*(lua_pushfstring)(lua_State* L, const char* fmt, ...);
 LUA_API void(lua_pushcclosure)(lua_State* L, lua_CFunction fn, int n);
@@ -244,6 +252,8 @@ LUA_API int(lua_rawgetp)(lua_State* L, int idx, const void* p);
 LUA_API void(lua_createtable)(lua_State* L, int narr, int nrec);
 LUA_API void(lua_copytable)(lua_State* L, int idx, int copykv);
 LUA_API void(lua_rehashtable)(lua_State* L, int idx);
+LUA_API void(lua_resizetable)(lua_State* L, int idx, int narr);
+LUA_API void(lua_filltable)(lua_State* L, int idx, lua_Integer i, lua_Integer j);
 LUA_API void*(lua_newuserdata)(lua_State* L, size_t sz);
 LUA_API int(lua_getmetatable)(lua_State* L, int objindex);
 LUA_API int(lua_getuservalue)(lua_State* L, int idx);
@@ -274,6 +284,9 @@ LUA_API int(lua_load)(lua_State* L, lua_Reader reader, void* dt, const char* chu
 
 LUA_API int(lua_dump)(lua_State* L, lua_Writer writer, void* data, int strip);
 
+LUA_API int(lua_loadmap)(lua_State* L, const void* data, size_t size, const char* chunkname, const char* mode, lua_Unmap unmap, void* ud);
+LUA_API int(lua_dumpmap)(lua_State* L, lua_Writer writer, void* data, int strip);
+
 /*
 ** coroutine functions
 */
@@ -298,6 +311,8 @@ LUA_API int(lua_isyieldable)(lua_State* L);
 #define LUA_GCSETSTEPMUL 7
 #define LUA_GCISRUNNING 9
 #define LUA_GCONESTEP 10
+#define LUA_GCGEN 11 /* data: minor multiplier (0 keeps current), returns previous mode */
+#define LUA_GCINC 12 /* returns previous mode */
 
 LUA_API int(lua_gc)(lua_State* L, int what, int data);
 
@@ -417,6 +432,7 @@ LUA_API void(lua_sethook)(lua_State* L, lua_Hook func, int mask, int count);
 LUA_API lua_Hook(lua_gethook)(lua_State* L);
 LUA_API int(lua_gethookmask)(lua_State* L);
 LUA_API int(lua_gethookcount)(lua_State* L);
+LUA_API void(lua_setasynchook)(lua_State* L, lua_Hook func);
 
 struct lua_Debug {
   int event;
@@ -318,6 +318,50 @@ LUALIB_API const void* luaL_checklbuffer(lua_State* L, int arg, size_t* len);
 LUALIB_API void luaL_releasebuffer(lua_State* L, int arg);
 LUALIB_API luaL_MemBuffer* luaL_tomembuffer(lua_State* L, int arg, luaL_MemBuffer* buf);
 
+/* 'release' must run on the thread which created the buffer, like refcounts or free lists without locks */
+LUALIB_API void luaL_localMemRelease(lua_State* L, luaL_MemRelease release);
+/* reference or thread local buffer, copy it before moving to another thread */
+LUALIB_API int luaL_isMemLocal(lua_State* L, const luaL_MemBuffer* mb);
+/* 'dst' gets a malloc copy of 'src', which can be released on any thread, return 0 when out of memory */
+LUALIB_API int luaL_copyMemBuffer(const luaL_MemBuffer* src, luaL_MemBuffer* dst);
+
+/* }====================================================== */
+
+/*
+** {======================================================
+** Binary Serialize, for moving values between lua_States
+** =======================================================
+*/
+
+/*
+ * nil, boolean, integer, float, string, table and lightuserdata.
+ * Tables referenced more than once are written once, so shared tables and cycles survive.
+ * Metatables are not written. Data is in native byte order.
+ */
+LUALIB_API void luaL_serialize(lua_State* L, int first, int n, luaL_ByteBuffer* b);
+LUALIB_API int luaL_deserialize(lua_State* L, const void* buf, size_t len);
+
+/* }====================================================== */
+
+/*
+** {======================================================
+** Shared Table, frozen table graph readable from many lua_States
+** =======================================================
+*/
+
+/*
+ * Keys may be boolean, number, string or lightuserdata, values may also be tables.
+ * The region is refcounted with atomics, each proxy userdata holds one reference.
+ */
+typedef struct luaL_SharedTable luaL_SharedTable;
+
+LUALIB_API luaL_SharedTable* luaL_freezetable(lua_State* L, int idx); // new region with one reference
+LUALIB_API void luaL_pushsharedtable(lua_State* L, luaL_SharedTable* st); // proxy of the root table
+LUALIB_API luaL_SharedTable* luaL_tosharedtable(lua_State* L, int idx); // region of a proxy or NULL
+LUALIB_API luaL_SharedTable* luaL_retainsharedtable(luaL_SharedTable* st);
+LUALIB_API void luaL_releasesharedtable(luaL_SharedTable* st);
+LUALIB_API size_t luaL_sharedtablesize(luaL_SharedTable* st);
+
 /* }====================================================== */
 
 /*
@@ -20,6 +20,7 @@
 #include "lopcodes.h"
 #include "ldebug.h"
 #include "lctype.h"
+#include "lundump.h"
 
 #include <luautil.h>
 
@@ -309,8 +310,7 @@ LUALIB_API void luaL_pfuncinfo(lua_State* L, int level, int idx, int recursive)
   if (aux_pushfunction(L, level, idx) == 0) {
     return; // get function error
   }
-  StkId o = index2addr(L, -1);
-  if (ttype(o) != LUA_TLCL) {
+  if (lua_iscfunction(L, -1)) {
     fprintf(stderr, "Value is a function, but not a lua closure\n");
   } else {
     const char* info = luaL_protoinfo(L, -1, recursive, NULL);
@@ -898,6 +898,49 @@ static int skipcomment(LoadF* lf, int* cp) {
     return 0; /* no comment */
 }
 
+#if defined(LUA_USE_POSIX) /* { */
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static void unmapfile(void* ud, void* p, size_t sz) {
+  (void)ud; /* not used */
+  munmap(p, sz);
+}
+
+/*
+** Precompiled chunks in mapped format ('luac -m') are mapped instead of
+** read, so the code of their functions stays in the page cache. Returns
+** -1 to let the caller read the file when it is not such a chunk (or
+** cannot be mapped).
+*/
+static int loadmapped(lua_State* L, const char* filename, const char* chunkname, const char* mode) {
+  char header[sizeof(LUA_SIGNATURE) + 1];
+  struct stat st;
+  void* p;
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0)
+    return -1;
+  if (pread(fd, header, sizeof(header), 0) != sizeof(header) || memcmp(header, LUA_SIGNATURE, sizeof(LUA_SIGNATURE) - 1) != 0 ||
+      !(header[sizeof(LUA_SIGNATURE)] & LUAC_FORMATMAP) || fstat(fd, &st) != 0 || st.st_size <= 0) {
+    close(fd);
+    return -1;
+  }
+  p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd); /* the mapping stays valid */
+  if (p == MAP_FAILED)
+    return -1;
+  return lua_loadmap(L, p, (size_t)st.st_size, chunkname, mode, unmapfile, NULL);
+}
+
+#else /* }{ */
+
+#define loadmapped(L, filename, chunkname, mode) (-1)
+
+#endif /* } */
+
 LUALIB_API int luaL_loadfilex(lua_State* L, const char* filename, const char* mode) {
   LoadF lf;
   int status, readstatus;
@@ -915,6 +958,12 @@ LUALIB_API int luaL_loadfilex(lua_State* L, const char* filename, const char* mo
   if (skipcomment(&lf, &c)) /* read initial portion */
     lf.buff[lf.n++] = '\n'; /* add line to correct line numbers */
   if (c == LUA_SIGNATURE[0] && filename) { /* binary file? */
+    status = loadmapped(L, filename, lua_tostring(L, -1), mode);
+    if (status >= 0) { /* mapped? */
+      fclose(lf.f);
+      lua_remove(L, fnameindex);
+      return status;
+    }
     lf.f = freopen(filename, "rb", lf.f); /* reopen in binary mode */
     if (lf.f == NULL)
       return errfile(L, "reopen", fnameindex);
@@ -1450,79 +1499,188 @@ LUALIB_API const char* luaL_gsub(lua_State* L, const char* s, const char* p, con
 
 /*
 ** {======================================================
-** Memory Pool, Maybe Object Pool
+** Size-Class Slab Allocator
 ** =======================================================
 */
 
-#define arrayaddr(mem, sblock, index) ((void*)(((char*)mem) + (sblock * index)))
-#define setpointer(addr, value) (*(void**)(addr) = (value))
-#define getpointer(addr) (*(void**)addr)
-#define isinpool(p, ptr) (ptr >= p->first && ptr <= p->last)
-#define isempty(p) (p->list == NULL)
+/*
+** Blocks up to SLAB_MAXSIZE bytes come from per-class free lists, one
+** class every SLAB_ALIGN bytes, which covers TString, Table, small Node
+** arrays, LClosure, UpVal, CallInfo and Udata headers. Each class
+** carves its blocks out of its own arenas; bigger blocks go to realloc.
+** The allocator belongs to one global_State and is only entered by the
+** thread running that state, so free lists need no lock. With
+** LUA_USE_THREADLOCK several OS threads run one state and C functions
+** (or 'lua_getallocf' callers) allocate outside of 'lua_lock', so every
+** call takes the mutex of the allocator. Arenas are never returned one
+** by one, all of them are released by 'luaL_close_z'.
+*/
 
-typedef struct MemPool {
-  void* first;
-  void* last;
-  void* list; // free list head
-  size_t size;
-  size_t sblock; // size of block
-} MemPool;
+#if defined(LUA_USE_THREADLOCK)
+#include <pthread.h>
+#define slab_lock(s) pthread_mutex_lock(&(s)->lock)
+#define slab_unlock(s) pthread_mutex_unlock(&(s)->lock)
+#else
+#define slab_lock(s) ((void)(s))
+#define slab_unlock(s) ((void)(s))
+#endif
+
+#define SLAB_ALIGN 16
+#define SLAB_MAXSIZE 512
+#define SLAB_NCLASS (SLAB_MAXSIZE / SLAB_ALIGN)
+#define SLAB_ARENASIZE (16 * 1024)
 
-static MemPool* pool_new(size_t size, size_t sblock) {
-  MemPool* p = (MemPool*)malloc(sizeof(MemPool));
-  void* mem = malloc(size * sblock);
-  void* last = arrayaddr(mem, sblock, size - 1);
+#define slabclass(size) (((size)-1) / SLAB_ALIGN)
+#define classsize(c) (((size_t)(c) + 1) * SLAB_ALIGN)
+#define issmall(size) ((size) > 0 && (size) <= SLAB_MAXSIZE)
+#define setpointer(addr, value) (*(void**)(addr) = (value))
+#define getpointer(addr) (*(void**)(addr))
 
-  p->first = mem;
-  p->last = last;
-  p->list = mem; // list points to the first block
-  p->size = size;
-  p->sblock = sblock;
+typedef union SlabArena {
+  union SlabArena* next; // all arenas of a state, in one list
+  char pad[SLAB_ALIGN]; // keep blocks after the header aligned
+} SlabArena;
 
-  setpointer(last, NULL); // last block points to nothing
-  for (size_t i = 0, j = 1; j < size; i++, j++) { // initial list
-    setpointer(arrayaddr(mem, sblock, i), arrayaddr(mem, sblock, j));
+typedef struct SlabClass {
+  void* list; // free list head
+  char* top; // next untouched block in the newest arena
+  char* limit; // end of the newest arena
+  size_t inuse; // blocks in use
+  size_t allocs; // total allocations
+  size_t frees; // total deallocations
+  size_t arenas; // arenas owned by this class
+} SlabClass;
+
+typedef struct Slab {
+  SlabClass classes[SLAB_NCLASS];
+  SlabArena* arenas;
+  size_t biginuse; // blocks larger than SLAB_MAXSIZE
+  size_t bigbytes;
+  size_t bigallocs;
+  size_t bigfrees;
+#if defined(LUA_USE_THREADLOCK)
+  pthread_mutex_t lock;
+#endif
+} Slab;
+
+static Slab* slab_new(void) {
+  Slab* s = (Slab*)malloc(sizeof(Slab));
+  if (s != NULL) {
+    memset(s, 0, sizeof(Slab));
+#if defined(LUA_USE_THREADLOCK)
+    pthread_mutex_init(&s->lock, NULL);
+#endif
   }
-  return p;
+  return s;
 }
 
-static void pool_release(MemPool* p) {
-  free(p->first);
-  free(p);
+static void slab_release(Slab* s) {
+  SlabArena* a = s->arenas;
+  while (a != NULL) {
+    SlabArena* next = a->next;
+    free(a);
+    a = next;
+  }
+#if defined(LUA_USE_THREADLOCK)
+  pthread_mutex_destroy(&s->lock);
+#endif
+  free(s);
 }
 
-static void* pool_malloc(MemPool* p) {
-  void* addr = p->list;
-  p->list = getpointer(addr);
-  return addr;
+static void* slab_malloc(Slab* s, size_t size) {
+  SlabClass* c = &s->classes[slabclass(size)];
+  void* block = c->list;
+  if (block != NULL) {
+    c->list = getpointer(block);
+  } else {
+    size_t sblock = classsize(slabclass(size));
+    if (c->top + sblock > c->limit) { // newest arena is full
+      SlabArena* a = (SlabArena*)malloc(SLAB_ARENASIZE);
+      if (a == NULL)
+        return NULL;
+      a->next = s->arenas;
+      s->arenas = a;
+      c->top = (char*)(a + 1);
+      c->limit = (char*)a + SLAB_ARENASIZE;
+      c->arenas++;
+    }
+    block = c->top;
+    c->top += sblock;
+  }
+  c->inuse++;
+  c->allocs++;
+  return block;
 }
 
-static void pool_free(MemPool* p, void* ptr) {
-  setpointer(ptr, p->list);
-  p->list = ptr;
+static void slab_free(Slab* s, void* ptr, size_t size) {
+  SlabClass* c = &s->classes[slabclass(size)];
+  setpointer(ptr, c->list);
+  c->list = ptr;
+  c->inuse--;
+  c->frees++;
 }
 
 /* }====================================================== */
 
-static void* l_alloc_z(void* ud, void* ptr, size_t osize, size_t nsize) {
-  MemPool* p = (MemPool*)ud;
-  if (nsize == 0) {
-    if (isinpool(p, ptr)) {
-      pool_free(p, ptr);
-    } else {
-      free(ptr);
+static void* big_realloc(Slab* s, void* ptr, size_t osize, size_t nsize) {
+  void* nptr = realloc(ptr, nsize);
+  if (nptr != NULL) {
+    if (ptr == NULL) {
+      s->biginuse++;
+      s->bigallocs++;
     }
-    return NULL;
+    s->bigbytes += nsize - osize;
   }
-  if (ptr == NULL && !isempty(p)) {
-    if (nsize == sizeof(Table) && osize == LUA_TTABLE) {
-      return pool_malloc(p);
-    }
+  return nptr;
+}
+
+static void big_free(Slab* s, void* ptr, size_t osize) {
+  free(ptr);
+  s->biginuse--;
+  s->bigbytes -= osize;
+  s->bigfrees++;
+}
+
+/*
+** 'osize' always is the real size of 'ptr' when 'ptr' is not NULL,
+** so the size alone tells which class (or realloc) owns a block.
+*/
+static void* slab_alloc(Slab* s, void* ptr, size_t osize, size_t nsize) {
+  void* nptr;
+  if (ptr == NULL)
+    osize = 0; /* 'osize' is the object type */
+  if (nsize == 0) {
+    if (issmall(osize))
+      slab_free(s, ptr, osize);
+    else if (ptr != NULL)
+      big_free(s, ptr, osize);
+    return NULL;
   }
-  if (isinpool(p, ptr)) {
-    return NULL; // error occur
+  if (!issmall(nsize) && !issmall(osize)) /* large to large */
+    return big_realloc(s, ptr, osize, nsize);
+  if (issmall(nsize) && issmall(osize) && slabclass(osize) == slabclass(nsize))
+    return ptr; /* same class, block already fits */
+  if (issmall(nsize))
+    nptr = slab_malloc(s, nsize);
+  else
+    nptr = big_realloc(s, NULL, 0, nsize);
+  if (nptr != NULL && ptr != NULL) { /* move to another class */
+    memcpy(nptr, ptr, osize < nsize ? osize : nsize);
+    if (issmall(osize))
+      slab_free(s, ptr, osize);
+    else
+      big_free(s, ptr, osize);
   }
-  return realloc(ptr, nsize);
+  return nptr;
+}
+
+static void* l_alloc_z(void* ud, void* ptr, size_t osize, size_t nsize) {
+  Slab* s = (Slab*)ud;
+  void* nptr;
+  slab_lock(s);
+  nptr = slab_alloc(s, ptr, osize, nsize);
+  slab_unlock(s);
+  return nptr;
 }
 
 static void* l_alloc(void* ud, void* ptr, size_t osize, size_t nsize) {
@@ -1557,37 +1715,78 @@ LUALIB_API void luaL_checkversion_(lua_State* L, lua_Number ver, size_t sz) {
     luaL_error(L, "version mismatch: app. needs %f, Lua core provides %f", (LUAI_UACNUMBER)ver, (LUAI_UACNUMBER)*v);
 }
 
-#define POOL_SIZE 2048
-
+/*
+** Like 'luaL_newstate', with the slab allocator above. The allocator is
+** tied to the OS thread running the state: without LUA_USE_THREADLOCK it
+** has no lock, so the state (and every 'lua_getallocf' caller) must stay
+** on one OS thread at a time. Close it with 'luaL_close_z'.
+*/
 LUALIB_API lua_State* luaL_newstate_z(void) {
-  MemPool* p = pool_new(POOL_SIZE, sizeof(Table));
-#if 0
-  void* tmp = pool_malloc(p);
-  assert(tmp == p->first);
-  pool_free(p, tmp);
-  assert(p->list == p->first);
-  void* ptr[POOL_SIZE];
-  for (size_t i = 0; i < POOL_SIZE; i++) {
-    ptr[i] = pool_malloc(p);
-    assert(isinpool(p, ptr[i]));
-  }
-  assert(ptr[POOL_SIZE - 1] == p->last);
-  assert(p->list == NULL);
-  for (size_t i = 0; i < POOL_SIZE; i++) {
-    pool_free(p, ptr[i]);
-    assert(isinpool(p, p->list));
-  }
-  assert(p->list == p->first);
-#endif
-  lua_State* L = lua_newstate(l_alloc_z, (void*)p);
+  Slab* s = slab_new();
+  if (s == NULL)
+    return NULL;
+  lua_State* L = lua_newstate(l_alloc_z, (void*)s);
   if (L)
     lua_atpanic(L, &panic);
+  else
+    slab_release(s);
   return L;
 }
 
 LUALIB_API void luaL_close_z(lua_State* L) {
-  pool_release((MemPool*)L->l_G->ud);
+  void* ud;
+  lua_Alloc f = lua_getallocf(L, &ud);
   lua_close(L);
+  if (f == l_alloc_z)
+    slab_release((Slab*)ud); /* every arena at once */
+}
+
+/*
+** Push a table with the statistics of the slab allocator, one entry
+** per size class plus the 'large' blocks. Return 0 (and push nothing)
+** when the state was not created by 'luaL_newstate_z'.
+*/
+LUALIB_API int luaL_allocstats(lua_State* L) {
+  void* ud;
+  Slab* s;
+  Slab snap;
+  int i;
+  if (lua_getallocf(L, &ud) != l_alloc_z)
+    return 0;
+  s = (Slab*)ud;
+  slab_lock(s);
+  snap = *s; /* counters only, building the tables below allocates */
+  slab_unlock(s);
+  s = &snap;
+  lua_createtable(L, SLAB_NCLASS, 3);
+  for (i = 0; i < SLAB_NCLASS; i++) {
+    SlabClass* c = &s->classes[i];
+    lua_createtable(L, 0, 5);
+    lua_pushinteger(L, (lua_Integer)classsize(i));
+    lua_setfield(L, -2, "size");
+    lua_pushinteger(L, (lua_Integer)c->inuse);
+    lua_setfield(L, -2, "inuse");
+    lua_pushinteger(L, (lua_Integer)c->allocs);
+    lua_setfield(L, -2, "allocs");
+    lua_pushinteger(L, (lua_Integer)c->frees);
+    lua_setfield(L, -2, "frees");
+    lua_pushinteger(L, (lua_Integer)c->arenas);
+    lua_setfield(L, -2, "arenas");
+    lua_rawseti(L, -2, i + 1);
+  }
+  lua_createtable(L, 0, 4);
+  lua_pushinteger(L, (lua_Integer)s->biginuse);
+  lua_setfield(L, -2, "inuse");
+  lua_pushinteger(L, (lua_Integer)s->bigbytes);
+  lua_setfield(L, -2, "bytes");
+  lua_pushinteger(L, (lua_Integer)s->bigallocs);
+  lua_setfield(L, -2, "allocs");
+  lua_pushinteger(L, (lua_Integer)s->bigfrees);
+  lua_setfield(L, -2, "frees");
+  lua_setfield(L, -2, "large");
+  lua_pushinteger(L, SLAB_ARENASIZE);
+  lua_setfield(L, -2, "arenasize");
+  return 1;
 }
 
 static void insert_registry_funcs(lua_State* L, const char* name) {
@@ -1730,6 +1929,8 @@ static const short luaP_opprefixmask[] = {
  ,opprefix(R_, P_, N_)        /* OP_CLOSURE */
  ,opprefix(R_, V_, N_)        /* OP_VARARG */
  ,opprefix(V_, N_, N_)        /* OP_EXTRAARG */
+ ,opprefix(R_, U_, RK)        /* OP_GETTABUP2 */
+ ,opprefix(R_, R_, RK)        /* OP_GETTABLE2 */
 };
 // clang-format on
 
@@ -1853,6 +2054,7 @@ static void proto_printinstructionadditions_z(const Proto* f, luaL_ByteBuffer* s
       luaBB_addfstring(sb, "\t; %s", UPVALNAME(b));
       break;
     case OP_GETTABUP:
+    case OP_GETTABUP2:
       luaBB_addfstring(sb, "\t; %s", UPVALNAME(b));
       if (ISK(c)) {
         luaBB_addliteral(sb, " ");
@@ -1877,6 +2079,7 @@ static void proto_printinstructionadditions_z(const Proto* f, luaL_ByteBuffer* s
       }
       break;
     case OP_GETTABLE:
+    case OP_GETTABLE2:
     case OP_SELF:
       if (ISK(c)) {
         luaBB_addliteral(sb, "\t; ");
@@ -2014,6 +2217,7 @@ static void proto_printinstructionadditions(const Proto* f, luaL_ByteBuffer* sb,
       luaBB_addfstring(sb, "\t; %s", UPVALNAME(b));
       break;
     case OP_GETTABUP:
+    case OP_GETTABUP2:
       luaBB_addfstring(sb, "\t; %s", UPVALNAME(b));
       if (ISK(c)) {
         luaBB_addliteral(sb, " ");
@@ -2032,6 +2236,7 @@ static void proto_printinstructionadditions(const Proto* f, luaL_ByteBuffer* sb,
       }
       break;
     case OP_GETTABLE:
+    case OP_GETTABLE2:
     case OP_SELF:
       if (ISK(c)) {
         luaBB_addliteral(sb, "\t; ");
@@ -2231,18 +2436,18 @@ static void proto_printproto(const Proto* f, luaL_ByteBuffer* b, const char* opt
   }
 }
 
-static void proto_printprotos(const Proto* f, luaL_ByteBuffer* b, int recursive, const char* options, int z) {
+static void proto_printprotos(lua_State* L, const Proto* f, luaL_ByteBuffer* b, int recursive, const char* options, int z) {
   proto_printproto(f, b, options, z);
   if (recursive) {
     for (int i = 0; i < f->sizep; i++) {
-      proto_printprotos(f->p[i], b, recursive, options, z);
+      luaU_checkproto(L, f->p[i]); // not loaded yet if it comes from a mapped chunk
+      proto_printprotos(L, f->p[i], b, recursive, options, z);
     }
   }
 }
 
 LUALIB_API const char* luaL_protoinfo(lua_State* L, int idx, int recursive, const char* options) {
-  StkId o = index2addr(L, idx);
-  if (ttype(o) != LUA_TLCL) {
+  if (lua_type(L, idx) != LUA_TFUNCTION || lua_iscfunction(L, idx)) {
     luaL_error(L, "only lua closure has proto");
   }
   options = options != NULL ? options : "hcklupz";
@@ -2251,8 +2456,10 @@ LUALIB_API const char* luaL_protoinfo(lua_State* L, int idx, int recursive, cons
   luaL_ByteBuffer b[1];
   luaBB_init(b, DEFAULT_BUFFER_SIZE);
 
-  const Proto* f = clLvalue(o)->p;
-  proto_printprotos(f, b, recursive, options, z);
+  lua_lock(L); /* loading mapped protos touches the core */
+  const Proto* f = clLvalue(index2addr(L, idx))->p;
+  proto_printprotos(L, f, b, recursive, options, z);
+  lua_unlock(L);
 
   const char* result = lua_pushlstring(L, (const char*)b->b, b->n); // [-0, +1]
   luaBB_destroy(b);
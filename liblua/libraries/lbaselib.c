@@ -194,6 +194,8 @@ static int luaB_collectgarbage(lua_State* L) {
       "setstepmul",
       "isrunning",
       "onestep",
+      "generational",
+      "incremental",
       NULL,
   };
   static const int optsnum[] = {
@@ -206,6 +208,8 @@ static int luaB_collectgarbage(lua_State* L) {
       LUA_GCSETSTEPMUL,
       LUA_GCISRUNNING,
       LUA_GCONESTEP,
+      LUA_GCGEN,
+      LUA_GCINC,
   };
   int o = optsnum[luaL_checkoption(L, 1, "collect", opts)];
   int ex = (int)luaL_optinteger(L, 2, 0);
@@ -222,6 +226,11 @@ static int luaB_collectgarbage(lua_State* L) {
       lua_pushboolean(L, res);
       return 1;
     }
+    case LUA_GCGEN:
+    case LUA_GCINC: { /* previous mode */
+      lua_pushstring(L, (res == LUA_GCGEN) ? "generational" : "incremental");
+      return 1;
+    }
     default: {
       lua_pushinteger(L, res);
       return 1;
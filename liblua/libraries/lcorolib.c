@@ -125,6 +125,28 @@ static int luaB_costatus(lua_State* L) {
   return 1;
 }
 
+/*
+** reset a dead or suspended coroutine so it runs 'f' on next resume,
+** reusing its stack instead of creating a new coroutine
+*/
+static int luaB_corecycle(lua_State* L) {
+  lua_State* co = getco(L);
+  lua_Debug ar;
+  if (L == co)
+    return luaL_error(L, "cannot recycle a running coroutine");
+  if (lua_status(co) == LUA_OK && lua_getstack(co, 0, &ar) > 0)
+    return luaL_error(L, "cannot recycle a normal coroutine");
+  if (!lua_isnoneornil(L, 2))
+    luaL_checktype(L, 2, LUA_TFUNCTION);
+  lua_resetthread(co);
+  if (!lua_isnoneornil(L, 2)) {
+    lua_pushvalue(L, 2);
+    lua_xmove(L, co, 1); /* move function from L to co */
+  }
+  lua_settop(L, 1);
+  return 1;
+}
+
 static int luaB_yieldable(lua_State* L) {
   lua_pushboolean(L, lua_isyieldable(L));
   return 1;
@@ -144,6 +166,7 @@ static const luaL_Reg co_funcs[] = {
     {"wrap", luaB_cowrap},
     {"yield", luaB_yield},
     {"isyieldable", luaB_yieldable},
+    {"recycle", luaB_corecycle},
     {NULL, NULL},
 };
 
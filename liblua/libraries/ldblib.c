@@ -540,15 +540,48 @@ static int db_sizeofstruct(lua_State* L) {
 static int db_tablemem(lua_State* L) {
   luaL_checktype(L, 1, LUA_TTABLE);
   Table* tbl = (Table*)lua_topointer(L, 1);
-  lua_Integer array = sizeof(TValue) * tbl->sizearray;
+  lua_lock(L);
+  lua_Integer sizearray = (lua_Integer)tbl->sizearray;
+  lua_Integer lsizenode = (lua_Integer)tbl->lsizenode;
   lua_Integer node = sizeof(Node) * allocsizenode(tbl);
-  lua_pushinteger(L, (lua_Integer)(sizeof(Table) + array + node));
-  lua_pushinteger(L, (lua_Integer)tbl->sizearray);
-  lua_pushinteger(L, (lua_Integer)tbl->lsizenode);
-  lua_pushboolean(L, isdummy(tbl));
+  int dummy = isdummy(tbl);
+  lua_unlock(L);
+  lua_pushinteger(L, (lua_Integer)(sizeof(Table) + sizeof(TValue) * sizearray + node));
+  lua_pushinteger(L, sizearray);
+  lua_pushinteger(L, lsizenode);
+  lua_pushboolean(L, dummy);
   return 4;
 }
 
+// probes needed to find every interned short string
+static int db_strtabstats(lua_State* L) {
+  stringtable* tb = &G(L)->strt;
+  lua_lock(L);
+  unsigned int mask = (unsigned int)tb->size - 1;
+  lua_Integer total = 0, max = 0;
+  lua_Integer nuse = tb->nuse, size = tb->size;
+  for (int i = 0; i < tb->size; i++) {
+    if (tb->slot[i].ts != NULL) {
+      lua_Integer probe = (lua_Integer)((i - lmod(tb->slot[i].hash, tb->size)) & mask) + 1;
+      total += probe;
+      if (probe > max)
+        max = probe;
+    }
+  }
+  lua_unlock(L);
+  lua_pushinteger(L, nuse);
+  lua_pushinteger(L, size);
+  lua_pushinteger(L, max);
+  lua_pushnumber(L, nuse > 0 ? (lua_Number)total / nuse : 0);
+  return 4;
+}
+
+static int db_allocstats(lua_State* L) {
+  if (!luaL_allocstats(L)) /* not the slab allocator? */
+    lua_pushnil(L);
+  return 1;
+}
+
 static int db_getgcstate(lua_State* L) {
   static const char* allstatus[] = {
       "GCSpropagate",
@@ -560,8 +593,16 @@ static int db_getgcstate(lua_State* L) {
       "GCScallfin",
       "GCSpause",
   };
-  lua_pushstring(L, allstatus[L->l_G->gcstate]);
-  return 1;
+  global_State* g = L->l_G;
+  lua_lock(L);
+  int gcstate = g->gcstate, gen = g->gckind == KGC_GEN;
+  lua_Integer minor = (lua_Integer)g->gcminorcount, major = (lua_Integer)g->gcmajorcount;
+  lua_unlock(L);
+  lua_pushstring(L, allstatus[gcstate]);
+  lua_pushstring(L, gen ? "generational" : "incremental");
+  lua_pushinteger(L, minor);
+  lua_pushinteger(L, major);
+  return 4;
 }
 
 static int db_protoinfo(lua_State* L) {
@@ -603,6 +644,8 @@ static const luaL_Reg dblib[] = {
     {"sizeofstruct", db_sizeofstruct},
     {"tablemem", db_tablemem},
     {"getgcstate", db_getgcstate},
+    {"allocstats", db_allocstats},
+    {"strtabstats", db_strtabstats},
     {"protoinfo", db_protoinfo},
     {"upvalues", db_upvalues},
     {"locals", db_locals},
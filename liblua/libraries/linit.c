@@ -52,6 +52,7 @@ static const luaL_Reg loadedlibs[] = {
 #endif
     {LUA_UTILLIBNAME, luaopen_util},
     {LUA_ASMLIBNAME, luaopen_asm},
+    {LUA_PROFLIBNAME, luaopen_profiler},
     {NULL, NULL},
 };
 
@@ -0,0 +1,505 @@
+/*
+** Sampling CPU profiler, output in folded stacks for flamegraph tools
+** See Copyright Notice in lua.h
+*/
+
+#define lproflib_c
+#define LUA_LIB
+
+#include "lprefix.h"
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lua.h"
+
+#include "lauxlib.h"
+#include "lualib.h"
+
+#include "lapi.h"
+#include "lgc.h"
+#include "lobject.h"
+#include "lstate.h" // for CallInfo and 'running'
+
+/*
+** A SIGPROF timer raises a flag and arms an asynchronous hook, which the
+** running thread calls once at its next instruction, wherever coroutine
+** switches take it. The hook walks the CallInfo chain and counts the stack
+** in a hash map. Hooks set with debug.sethook are left alone, and between
+** samples nothing is armed, so the VM runs at full speed. Frame labels are
+** built once per function, the first time it is seen.
+*/
+
+#define PROF_MAXDEPTH 128
+#define PROF_DEFAULTHZ 1000
+
+typedef struct ProfFrame {
+  const void* id; // Proto* for Lua functions, lua_CFunction for C
+  char* label;
+} ProfFrame;
+
+typedef struct ProfStack {
+  unsigned int hash;
+  int depth;
+  size_t first; // index of the root frame in 'pool'
+  lua_Integer count;
+} ProfStack;
+
+typedef struct Profiler {
+  lua_State* L; // main thread of the profiled state
+  volatile sig_atomic_t pending; // a timer tick not sampled yet
+  volatile sig_atomic_t inC; // the tick landed in a C function
+  int running;
+  int hz;
+  lua_Integer samples;
+  /* frame table: open addressing on 'id', size is 2^n */
+  ProfFrame* frames;
+  int* framemap; // index + 1 into 'frames', 0 is empty
+  int nframes, sizeframes, sizeframemap;
+  /* stack table: open addressing on the frame indices */
+  ProfStack* stacks;
+  int* stackmap;
+  int nstacks, sizestacks, sizestackmap;
+  int* pool; // frame indices of every stack, root first
+  size_t npool, sizepool;
+} Profiler;
+
+static Profiler prof;
+
+static const char* const PROF_ANCHOR = "PROF_ANCHOR"; // registry key, keeps sampled closures alive
+
+static void* prof_grow(void* block, int* size, size_t elemsize, int minsize) {
+  int newsize = *size > 0 ? *size * 2 : minsize;
+  void* newblock = realloc(block, (size_t)newsize * elemsize);
+  if (newblock == NULL)
+    return NULL;
+  *size = newsize;
+  return newblock;
+}
+
+static void prof_free(void) {
+  int i;
+  for (i = 0; i < prof.nframes; i++)
+    free(prof.frames[i].label);
+  free(prof.frames);
+  free(prof.framemap);
+  free(prof.stacks);
+  free(prof.stackmap);
+  free(prof.pool);
+  prof.frames = NULL;
+  prof.framemap = NULL;
+  prof.stacks = NULL;
+  prof.stackmap = NULL;
+  prof.pool = NULL;
+  prof.nframes = prof.sizeframes = prof.sizeframemap = 0;
+  prof.nstacks = prof.sizestacks = prof.sizestackmap = 0;
+  prof.npool = prof.sizepool = 0;
+  prof.samples = 0;
+}
+
+static unsigned int prof_hashptr(const void* p) {
+  size_t h = (size_t)p;
+  h ^= h >> 17;
+  h *= 0x9e3779b1u;
+  return (unsigned int)(h ^ (h >> 15));
+}
+
+/* rebuild an index map of 'newsize' slots (2^n) */
+static int* prof_rehash(int n, int newsize, unsigned int (*hashof)(int)) {
+  int* map = (int*)calloc((size_t)newsize, sizeof(int));
+  int i;
+  if (map == NULL)
+    return NULL;
+  for (i = 0; i < n; i++) {
+    unsigned int h = hashof(i) & (newsize - 1);
+    while (map[h] != 0)
+      h = (h + 1) & (newsize - 1);
+    map[h] = i + 1;
+  }
+  return map;
+}
+
+static unsigned int prof_framehash(int i) {
+  return prof_hashptr(prof.frames[i].id);
+}
+
+static unsigned int prof_stackhash(int i) {
+  return prof.stacks[i].hash;
+}
+
+#define PROF_CLEAF ((const void*)&prof.inC) // id of the unnamed C leaf frame
+
+static char* prof_strdup(const char* s) {
+  size_t len = strlen(s);
+  char* dup = (char*)malloc(len + 1);
+  if (dup != NULL)
+    memcpy(dup, s, len + 1);
+  return dup;
+}
+
+/* label of a frame: "name (source:line)", ';' is the folded separator */
+static char* prof_label(lua_State* L, CallInfo* ci) {
+  lua_Debug ar;
+  char buff[LUA_IDSIZE + 128];
+  char* label;
+  memset(&ar, 0, sizeof(ar));
+  ar.i_ci = ci;
+  lua_getinfo(L, "Sn", &ar);
+  if (*ar.what == 'C')
+    snprintf(buff, sizeof(buff), "%s [C]", ar.name ? ar.name : "?");
+  else if (*ar.what == 'm')
+    snprintf(buff, sizeof(buff), "main chunk (%s)", ar.short_src);
+  else
+    snprintf(buff, sizeof(buff), "%s (%s:%d)", ar.name ? ar.name : "?", ar.short_src, ar.linedefined);
+  label = prof_strdup(buff);
+  if (label != NULL) {
+    char* p;
+    for (p = label; *p; p++) {
+      if (*p == ';' || *p == '\n')
+        *p = ',';
+    }
+  }
+  return label;
+}
+
+/* keep the closure of a Lua frame alive, so its Proto* stays unique */
+static void prof_anchor(lua_State* L, CallInfo* ci, const void* id) {
+  if (lua_rawgetp(L, LUA_REGISTRYINDEX, PROF_ANCHOR) == LUA_TTABLE) {
+    lua_pushlightuserdata(L, (void*)id);
+    lua_lock(L);
+    setobj2s(L, L->top, ci->func);
+    api_incr_top(L);
+    lua_unlock(L);
+    lua_rawset(L, -3);
+  }
+  lua_pop(L, 1);
+}
+
+/* index of the frame running in 'ci', -1 on memory error */
+static int prof_frame(lua_State* L, CallInfo* ci, const void* id) {
+  unsigned int h;
+  int i;
+  if (prof.sizeframemap > 0) {
+    h = prof_hashptr(id) & (prof.sizeframemap - 1);
+    while ((i = prof.framemap[h]) != 0) {
+      if (prof.frames[i - 1].id == id)
+        return i - 1;
+      h = (h + 1) & (prof.sizeframemap - 1);
+    }
+  }
+  if (prof.nframes == prof.sizeframes) {
+    ProfFrame* frames = (ProfFrame*)prof_grow(prof.frames, &prof.sizeframes, sizeof(ProfFrame), 64);
+    if (frames == NULL)
+      return -1;
+    prof.frames = frames;
+  }
+  if ((prof.nframes + 1) * 2 > prof.sizeframemap) { /* keep load below 1/2 */
+    int size = prof.sizeframemap > 0 ? prof.sizeframemap * 2 : 128;
+    int* map = prof_rehash(prof.nframes, size, prof_framehash);
+    if (map == NULL)
+      return -1;
+    free(prof.framemap);
+    prof.framemap = map;
+    prof.sizeframemap = size;
+  }
+  i = prof.nframes;
+  prof.frames[i].id = id;
+  prof.frames[i].label = id == PROF_CLEAF ? prof_strdup("[C]") : prof_label(L, ci);
+  if (prof.frames[i].label == NULL)
+    return -1;
+  if (isLua(ci))
+    prof_anchor(L, ci, id);
+  h = prof_hashptr(id) & (prof.sizeframemap - 1);
+  while (prof.framemap[h] != 0)
+    h = (h + 1) & (prof.sizeframemap - 1);
+  prof.framemap[h] = i + 1;
+  prof.nframes++;
+  return i;
+}
+
+static const void* prof_frameid(CallInfo* ci) {
+  const TValue* func = ci->func;
+  if (ttisLclosure(func))
+    return clLvalue(func)->p;
+  else if (ttislcf(func))
+    return (const void*)fvalue(func);
+  else if (ttisCclosure(func))
+    return (const void*)clCvalue(func)->f;
+  return NULL;
+}
+
+/* add one hit to the stack made of 'ids' (root first) */
+static void prof_count(const int* ids, int depth) {
+  unsigned int hash = 2166136261u;
+  unsigned int h;
+  int i, s;
+  for (i = 0; i < depth; i++)
+    hash = (hash ^ (unsigned int)ids[i]) * 16777619u;
+  if (prof.sizestackmap > 0) {
+    h = hash & (prof.sizestackmap - 1);
+    while ((s = prof.stackmap[h]) != 0) {
+      ProfStack* st = &prof.stacks[s - 1];
+      if (st->hash == hash && st->depth == depth && memcmp(prof.pool + st->first, ids, depth * sizeof(int)) == 0) {
+        st->count++;
+        return;
+      }
+      h = (h + 1) & (prof.sizestackmap - 1);
+    }
+  }
+  if (prof.nstacks == prof.sizestacks) {
+    ProfStack* stacks = (ProfStack*)prof_grow(prof.stacks, &prof.sizestacks, sizeof(ProfStack), 64);
+    if (stacks == NULL)
+      return;
+    prof.stacks = stacks;
+  }
+  while (prof.npool + depth > prof.sizepool) {
+    int size = (int)prof.sizepool;
+    int* pool = (int*)prof_grow(prof.pool, &size, sizeof(int), 1024);
+    if (pool == NULL)
+      return;
+    prof.pool = pool;
+    prof.sizepool = (size_t)size;
+  }
+  if ((prof.nstacks + 1) * 2 > prof.sizestackmap) {
+    int size = prof.sizestackmap > 0 ? prof.sizestackmap * 2 : 128;
+    int* map;
+    prof.stacks[prof.nstacks].hash = hash; /* not counted yet, rehash skips it */
+    map = prof_rehash(prof.nstacks, size, prof_stackhash);
+    if (map == NULL)
+      return;
+    free(prof.stackmap);
+    prof.stackmap = map;
+    prof.sizestackmap = size;
+  }
+  s = prof.nstacks++;
+  prof.stacks[s].hash = hash;
+  prof.stacks[s].depth = depth;
+  prof.stacks[s].first = prof.npool;
+  prof.stacks[s].count = 1;
+  memcpy(prof.pool + prof.npool, ids, depth * sizeof(int));
+  prof.npool += depth;
+  h = hash & (prof.sizestackmap - 1);
+  while (prof.stackmap[h] != 0)
+    h = (h + 1) & (prof.sizestackmap - 1);
+  prof.stackmap[h] = s + 1;
+}
+
+static void prof_sample(lua_State* L, int inC) {
+  int ids[PROF_MAXDEPTH + 1];
+  int depth = 0;
+  int top = PROF_MAXDEPTH + 1;
+  CallInfo* ci;
+  if (inC) { /* the tick hit a C function that returned before the hook */
+    int f = prof_frame(L, L->ci, PROF_CLEAF);
+    if (f < 0)
+      return;
+    ids[--top] = f;
+  }
+  for (ci = L->ci; ci != &L->base_ci && top > 0; ci = ci->previous) {
+    const void* id = prof_frameid(ci);
+    int f;
+    if (id == NULL)
+      continue;
+    f = prof_frame(L, ci, id);
+    if (f < 0)
+      return;
+    ids[--top] = f;
+  }
+  depth = PROF_MAXDEPTH + 1 - top;
+  if (depth > 0)
+    prof_count(ids + top, depth);
+  prof.samples++;
+}
+
+static void prof_hook(lua_State* L, lua_Debug* ar) {
+  (void)ar;
+  if (prof.running && prof.pending && G(L) == G(prof.L)) {
+    int inC = prof.inC;
+    prof.pending = 0;
+    prof.inC = 0;
+    prof_sample(L, inC);
+  }
+}
+
+#if defined(LUA_USE_POSIX)
+
+#include <pthread.h>
+#include <sys/time.h>
+
+static struct sigaction prof_oldaction;
+static pthread_t prof_owner; // the OS thread which started profiling and runs 'prof.L'
+
+/*
+** SIGPROF goes to whichever thread of the process is on the CPU, like a
+** lproc worker or the libuv threadpool. Only the owner may look at its
+** state, others forward the tick to it.
+*/
+static void prof_signal(int sig) {
+  if (!prof.running)
+    return;
+  if (!pthread_equal(pthread_self(), prof_owner)) {
+    pthread_kill(prof_owner, sig);
+    return;
+  }
+  if (!prof.pending) {
+#if defined(LUA_USE_THREADLOCK)
+    prof.inC = 0; /* another OS thread may hold the state, its CallInfo list is not safe to read */
+#else
+    prof.inC = !isLua(G(prof.L)->running->ci);
+#endif
+    prof.pending = 1;
+  }
+  lua_setasynchook(prof.L, prof_hook); /* again if pending, a tick may have hit a thread switch */
+}
+
+static int prof_settimer(int hz) {
+  struct itimerval tv;
+  long usec = hz > 0 ? 1000000 / hz : 0;
+  tv.it_interval.tv_sec = usec / 1000000; /* tv_usec must stay below a second */
+  tv.it_interval.tv_usec = usec % 1000000;
+  tv.it_value = tv.it_interval;
+  return setitimer(ITIMER_PROF, &tv, NULL);
+}
+
+static int prof_startclock(lua_State* L, int hz) {
+  struct sigaction sa;
+  prof_owner = pthread_self();
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = prof_signal;
+  sa.sa_flags = SA_RESTART;
+  sigemptyset(&sa.sa_mask);
+  if (sigaction(SIGPROF, &sa, &prof_oldaction) != 0)
+    return luaL_error(L, "cannot install SIGPROF handler");
+  if (prof_settimer(hz) != 0) {
+    sigaction(SIGPROF, &prof_oldaction, NULL);
+    return luaL_error(L, "cannot start profiling timer");
+  }
+  return 0;
+}
+
+static void prof_stopclock(void) {
+  prof_settimer(0);
+  sigaction(SIGPROF, &prof_oldaction, NULL);
+}
+
+#else
+
+static int prof_startclock(lua_State* L, int hz) {
+  (void)hz;
+  return luaL_error(L, "profiler needs SIGPROF, not available on this platform");
+}
+
+static void prof_stopclock(void) {
+}
+
+#endif
+
+static void prof_stop(void) {
+  if (prof.running) {
+    prof_stopclock();
+    prof.running = 0;
+    prof.pending = 0;
+    lua_setasynchook(prof.L, NULL);
+  }
+}
+
+/* stop before the profiled state goes away */
+static int prof_gc(lua_State* L) {
+  if (prof.L != NULL && G(prof.L) == G(L)) {
+    prof_stop();
+    prof_free();
+    prof.L = NULL;
+  }
+  return 0;
+}
+
+// profiler.start([hz])
+static int prof_start(lua_State* L) {
+  int hz = (int)luaL_optinteger(L, 1, PROF_DEFAULTHZ);
+  luaL_argcheck(L, 0 < hz && hz <= 100000, 1, "frequency out of range");
+  if (prof.running)
+    return luaL_error(L, "profiler is already running");
+  prof_free();
+  prof.L = G(L)->mainthread;
+  prof.hz = hz;
+  prof.pending = prof.inC = 0;
+  lua_newtable(L);
+  lua_rawsetp(L, LUA_REGISTRYINDEX, PROF_ANCHOR);
+  if (lua_rawgetp(L, LUA_REGISTRYINDEX, &prof) == LUA_TNIL) { /* a replaced one would stop this run when collected */
+    lua_newuserdata(L, 1); /* closes the profiler with the state */
+    lua_newtable(L);
+    lua_pushcfunction(L, prof_gc);
+    lua_setfield(L, -2, "__gc");
+    lua_setmetatable(L, -2);
+    lua_rawsetp(L, LUA_REGISTRYINDEX, &prof);
+  }
+  lua_pop(L, 1);
+  prof_startclock(L, hz);
+  prof.running = 1; /* not on error, ticks before this are ignored */
+  lua_pushboolean(L, 1);
+  return 1;
+}
+
+// profiler.stop() => samples
+static int prof_stopfunc(lua_State* L) {
+  if (prof.L != NULL && G(prof.L) == G(L))
+    prof_stop();
+  lua_pushinteger(L, prof.samples);
+  return 1;
+}
+
+// profiler.dump([filename]) => folded stacks string | true
+static int prof_dump(lua_State* L) {
+  const char* filename = luaL_optstring(L, 1, NULL);
+  luaL_Buffer b;
+  int s, i;
+  luaL_buffinit(L, &b);
+  if (prof.L != NULL && G(prof.L) == G(L)) {
+    for (s = 0; s < prof.nstacks; s++) {
+      const ProfStack* st = &prof.stacks[s];
+      for (i = 0; i < st->depth; i++) {
+        if (i > 0)
+          luaL_addchar(&b, ';');
+        luaL_addstring(&b, prof.frames[prof.pool[st->first + i]].label);
+      }
+      lua_pushfstring(L, " %I\n", st->count);
+      luaL_addvalue(&b);
+    }
+  }
+  luaL_pushresult(&b);
+  if (filename != NULL) {
+    size_t len;
+    const char* str = lua_tolstring(L, -1, &len);
+    FILE* f = fopen(filename, "w");
+    if (f == NULL)
+      return luaL_fileresult(L, 0, filename);
+    fwrite(str, 1, len, f);
+    fclose(f);
+    lua_pushboolean(L, 1);
+  }
+  return 1;
+}
+
+// profiler.isrunning() => boolean, hz, samples
+static int prof_isrunning(lua_State* L) {
+  int mine = prof.L != NULL && G(prof.L) == G(L);
+  lua_pushboolean(L, mine && prof.running);
+  lua_pushinteger(L, mine ? prof.hz : 0);
+  lua_pushinteger(L, mine ? prof.samples : 0);
+  return 3;
+}
+
+static const luaL_Reg prof_funcs[] = {
+    {"start", prof_start},
+    {"stop", prof_stopfunc},
+    {"dump", prof_dump},
+    {"isrunning", prof_isrunning},
+    {NULL, NULL},
+};
+
+LUAMOD_API int luaopen_profiler(lua_State* L) {
+  luaL_newlib(L, prof_funcs);
+  return 1;
+}
@@ -409,6 +409,29 @@ static int create(lua_State* L) {
   return 1;
 }
 
+// table.resize(t, narr)
+static int resize(lua_State* L) {
+  luaL_checktype(L, 1, LUA_TTABLE);
+  lua_Integer narr = luaL_checkinteger(L, 2);
+  luaL_argcheck(L, 0 <= narr && narr < INT_MAX, 2, "array size out of range");
+  lua_resizetable(L, 1, (int)narr);
+  lua_settop(L, 1);
+  return 1;
+}
+
+// table.fill(t, v [, i [, j]])
+static int fill(lua_State* L) {
+  luaL_checktype(L, 1, LUA_TTABLE);
+  luaL_checkany(L, 2);
+  lua_Integer i = luaL_optinteger(L, 3, 1);
+  lua_Integer j = luaL_opt(L, luaL_checkinteger, 4, (lua_Integer)lua_rawlen(L, 1));
+  luaL_argcheck(L, i >= 1, 3, "position out of bounds");
+  luaL_argcheck(L, j < INT_MAX, 4, "position out of bounds");
+  lua_settop(L, 2);
+  lua_filltable(L, 1, i, j);
+  return 1;
+}
+
 static int copy(lua_State* L) {
   luaL_checktype(L, 1, LUA_TTABLE);
   int copykv = luaL_optboolean(L, 2, 1);
@@ -683,6 +706,8 @@ static const luaL_Reg tab_funcs[] = {
     {"move", tmove},
     {"sort", sort},
     {"create", create},
+    {"resize", resize},
+    {"fill", fill},
     {"copy", copy},
     {"rehash", rehash},
     {"every", every},
@@ -1,10 +1,12 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <CuTest.h>
 #include <lua.h>
 #include <lualib.h>
 #include <lauxlib.h>
+#include <luautil.h>
 
 void Test_luaL_tolstringex(CuTest* tc) {
   lua_State* L = luaL_newstate();
@@ -175,6 +177,626 @@ void Test_db_tablemem(CuTest* tc) {
   lua_close(L);
 }
 
+void Test_lua_gc_generational(CuTest* tc) {
+  lua_State* L = luaL_newstate();
+  luaL_openlibs(L);
+  CuAssertIntEquals(tc, LUA_GCINC, lua_gc(L, LUA_GCGEN, 0));
+  CuAssertIntEquals(tc, LUA_GCGEN, lua_gc(L, LUA_GCGEN, 0));
+  int status = luaL_dostring(L,
+                             "local old = {}\n"
+                             "for i = 1, 1000 do old[i] = {i} end\n"
+                             "local weak = setmetatable({}, {__mode = 'v'})\n"
+                             "for i = 1, 1000 do\n"
+                             "  old[i][2] = {i}\n" // young object stored into an old one
+                             "  weak[i] = {}\n"
+                             "  collectgarbage('step')\n"
+                             "end\n"
+                             "for i = 1, 1000 do assert(old[i][2][1] == i) end\n"
+                             "collectgarbage()\n"
+                             "assert(next(weak) == nil)\n"
+                             "local state, kind, minor, major = debug.getgcstate()\n"
+                             "assert(kind == 'generational' and minor >= 1000 and major >= 2)\n");
+  if (status != LUA_OK) {
+    printf("dostring error: %s\n", lua_tostring(L, -1));
+    lua_pop(L, 1);
+  }
+  CuAssertIntEquals(tc, LUA_OK, status);
+  CuAssertIntEquals(tc, LUA_GCGEN, lua_gc(L, LUA_GCINC, 0));
+  CuAssertIntEquals(tc, 0, lua_gettop(L));
+  lua_close(L);
+}
+
+void Test_luaL_allocstats(CuTest* tc) {
+  lua_State* L = luaL_newstate();
+  CuAssertIntEquals(tc, 0, luaL_allocstats(L)); // not the slab allocator
+  lua_close(L);
+  L = luaL_newstate_z();
+  luaL_openlibs(L);
+  int status = luaL_dostring(L,
+                             "local t = {}\n"
+                             "for i = 1, 10000 do t[i] = {x = i, s = 'key' .. i} end\n"
+                             "local s = debug.allocstats()\n"
+                             "local inuse = 0\n"
+                             "for _, c in ipairs(s) do\n"
+                             "  assert(c.allocs - c.frees == c.inuse)\n"
+                             "  inuse = inuse + c.inuse\n"
+                             "end\n"
+                             "assert(inuse > 20000 and s.large.inuse > 0)\n"
+                             "t = nil\n"
+                             "collectgarbage()\n"
+                             "local after = 0\n"
+                             "for _, c in ipairs(debug.allocstats()) do after = after + c.inuse end\n"
+                             "assert(after < inuse - 20000)\n");
+  if (status != LUA_OK) {
+    printf("dostring error: %s\n", lua_tostring(L, -1));
+    lua_pop(L, 1);
+  }
+  CuAssertIntEquals(tc, LUA_OK, status);
+  CuAssertIntEquals(tc, 0, lua_gettop(L));
+  luaL_close_z(L);
+}
+
+void Test_lua_filltable(CuTest* tc) {
+  lua_State* L = luaL_newstate();
+  luaL_openlibs(L);
+  lua_createtable(L, 0, 0);
+  lua_resizetable(L, -1, 100);
+  lua_pushinteger(L, 7);
+  lua_filltable(L, -2, 1, 100);
+  CuAssertIntEquals(tc, 100, (int)lua_rawlen(L, -1));
+  CuAssertIntEquals(tc, LUA_TNUMBER, lua_rawgeti(L, -1, 100));
+  CuAssertIntEquals(tc, 7, (int)lua_tointeger(L, -1));
+  lua_pop(L, 2);
+  int status = luaL_dostring(L,
+                             "local t = table.fill(table.create(0, 4), 'x', 1, 1000)\n"
+                             "assert(#t == 1000 and t[1] == 'x' and t[1000] == 'x')\n"
+                             "t.k = 1\n"
+                             "table.fill(t, false, 10, 20)\n"
+                             "assert(t[9] == 'x' and t[10] == false and t[20] == false and t[21] == 'x')\n"
+                             "assert(table.resize(t, 10) == t and t[10] == false and t[21] == 'x' and t.k == 1)\n"
+                             "table.fill(t, nil, 1, 5)\n"
+                             "assert(t[5] == nil and t[6] == 'x' and t[1000] == 'x')\n"
+                             "collectgarbage()\n"
+                             "local u = table.fill({}, {})\n"
+                             "assert(next(u) == nil)\n"
+                             "assert(not pcall(table.fill, t, 1, 0, 2))\n");
+  if (status != LUA_OK) {
+    printf("dostring error: %s\n", lua_tostring(L, -1));
+    lua_pop(L, 1);
+  }
+  CuAssertIntEquals(tc, LUA_OK, status);
+  CuAssertIntEquals(tc, 0, lua_gettop(L));
+  lua_close(L);
+}
+
+void Test_table_icache(CuTest* tc) {
+  lua_State* L = luaL_newstate();
+  luaL_openlibs(L);
+  int status = luaL_dostring(L,
+                             "local function get(t) return t.a, t.b, t.c end\n"
+                             "local function deep(t) return t.p.q end\n"
+                             "local function call(o) return o:m() end\n"
+                             "function gcheck() return gx end\n"
+                             // GETTABLE: warm, then grow past the node size
+                             "local t = {a = 1, b = 2, c = 3}\n"
+                             "for i = 1, 3 do get(t) end\n"
+                             "for i = 1, 100 do t['k' .. i] = i end\n"
+                             "t.a = 10\n"
+                             "local a, b, c = get(t)\n"
+                             "assert(a == 10 and b == 2 and c == 3)\n"
+                             // delete and reinsert across a rehash
+                             "t.b = nil\n"
+                             "assert(select(2, get(t)) == nil)\n"
+                             "for i = 1, 100 do t['k' .. i] = nil end\n"
+                             "collectgarbage()\n"
+                             "for i = 101, 300 do t['k' .. i] = i end\n"
+                             "t.b = 20\n"
+                             "a, b, c = get(t)\n"
+                             "assert(a == 10 and b == 20 and c == 3)\n"
+                             // tables of the same shape, keys in other nodes
+                             "local s1, s2 = {a = 1, b = 2, c = 3}, {c = 30, b = 20, a = 10, d = 0}\n"
+                             "s2.d = nil\n"
+                             "for i = 1, 10 do\n"
+                             "  local x = i % 2 == 1 and s1 or s2\n"
+                             "  a, b, c = get(x)\n"
+                             "  assert(a == x.a and b == x.b and c == x.c and a == (i % 2 == 1 and 1 or 10))\n"
+                             "end\n"
+                             "local d = {p = {q = 1}}\n"
+                             "for i = 1, 3 do assert(deep(d) == 1) end\n"
+                             "for i = 1, 50 do d.p['x' .. i] = i end\n"
+                             "d.p.q = 2\n"
+                             "assert(deep(d) == 2 and deep({p = {q = 3}}) == 3)\n"
+                             // SELF
+                             "local o1 = {m = function() return 1 end}\n"
+                             "local o2 = setmetatable({}, {__index = {m = function() return 2 end}})\n"
+                             "for i = 1, 10 do assert(call(o1) == 1 and call(o2) == 2) end\n"
+                             "for i = 1, 50 do o1['x' .. i] = i end\n"
+                             "o1.m = function() return 3 end\n"
+                             "assert(call(o1) == 3 and call(o2) == 2)\n"
+                             "o1.m = nil\n"
+                             "assert(not pcall(call, o1))\n"
+                             // GETTABUP on _ENV
+                             "gx = 1\n"
+                             "assert(gcheck() == 1)\n"
+                             "for i = 1, 200 do _ENV['g' .. i] = i end\n"
+                             "gx = 2\n"
+                             "assert(gcheck() == 2)\n"
+                             "gx = nil\n"
+                             "assert(gcheck() == nil)\n"
+                             "for i = 1, 200 do _ENV['g' .. i] = nil end\n"
+                             "collectgarbage()\n"
+                             "for i = 201, 300 do _ENV['g' .. i] = i end\n"
+                             "gx = 3\n"
+                             "assert(gcheck() == 3)\n");
+  if (status != LUA_OK) {
+    printf("dostring error: %s\n", lua_tostring(L, -1));
+    lua_pop(L, 1);
+  }
+  CuAssertIntEquals(tc, LUA_OK, status);
+  lua_close(L);
+}
+
+void Test_luaL_serialize(CuTest* tc) {
+  lua_State* L = luaL_newstate();
+  luaL_openlibs(L);
+  int status = luaL_dostring(L,
+                             "local shared = {name = 'shared'}\n"
+                             "cfg = {1, 2.5, 'three', a = shared, b = shared, [false] = {n = math.mininteger}}\n"
+                             "cfg.self = cfg\n");
+  CuAssertIntEquals(tc, LUA_OK, status);
+  luaL_ByteBuffer b[1];
+  luaBB_init(b, 0);
+  lua_getglobal(L, "cfg");
+  lua_pushinteger(L, 42);
+  luaL_serialize(L, -2, 2, b);
+  CuAssertIntEquals(tc, 2, lua_gettop(L));
+  lua_pop(L, 2);
+
+  lua_State* L2 = luaL_newstate(); // the values move into another state
+  luaL_openlibs(L2);
+  CuAssertIntEquals(tc, 2, luaL_deserialize(L2, b->b, b->n));
+  CuAssertIntEquals(tc, 42, (int)lua_tointeger(L2, -1));
+  lua_pop(L2, 1);
+  lua_setglobal(L2, "cfg");
+  status = luaL_dostring(L2,
+                         "assert(cfg[1] == 1 and cfg[2] == 2.5 and cfg[3] == 'three')\n"
+                         "assert(cfg.a == cfg.b and cfg.a.name == 'shared' and cfg.self == cfg)\n"
+                         "assert(cfg[false].n == math.mininteger and math.type(cfg[1]) == 'integer')\n"
+                         "local mb = util.serialize(cfg, nil)\n"
+                         "local c, n = util.deserialize(mb)\n"
+                         "assert(c.self == c and n == nil)\n"
+                         "assert(not pcall(util.serialize, {f = print}))\n"
+                         "assert(not pcall(util.deserialize, mb:toString():sub(1, -2)))\n");
+  if (status != LUA_OK) {
+    printf("dostring error: %s\n", lua_tostring(L2, -1));
+    lua_pop(L2, 1);
+  }
+  CuAssertIntEquals(tc, LUA_OK, status);
+  CuAssertIntEquals(tc, 0, lua_gettop(L2));
+
+  // results of a LUA_MULTRET call fill the stack up to ci->top, nothing is left to push into
+  luaBB_clear(b);
+  status = luaL_dostring(L2, "return function() return table.unpack({}, 1, 8000) end");
+  CuAssertIntEquals(tc, LUA_OK, status);
+  lua_call(L2, 0, LUA_MULTRET);
+  CuAssertIntEquals(tc, 8000, lua_gettop(L2));
+  luaL_serialize(L2, 1, 8000, b);
+  lua_settop(L2, 0);
+  CuAssertIntEquals(tc, 8000, luaL_deserialize(L2, b->b, b->n));
+  lua_settop(L2, 0);
+
+  luaBB_destroy(b);
+  lua_close(L2);
+  lua_close(L);
+}
+
+void Test_luaL_sharedtable(CuTest* tc) {
+  lua_State* L = luaL_newstate();
+  luaL_openlibs(L);
+  int status = luaL_dostring(L,
+                             "cfg = {10, 20, 30, name = 'cfg', [2.5] = true, sub = {x = 1}}\n"
+                             "cfg.self = cfg\n");
+  CuAssertIntEquals(tc, LUA_OK, status);
+  lua_getglobal(L, "cfg");
+  luaL_SharedTable* st = luaL_freezetable(L, -1);
+  lua_pop(L, 1);
+  CuAssertTrue(tc, luaL_sharedtablesize(st) > 0);
+  lua_close(L); // the region outlives the state which built it
+
+  lua_State* L2 = luaL_newstate();
+  luaL_openlibs(L2);
+  luaL_pushsharedtable(L2, st);
+  CuAssertPtrEquals(tc, st, luaL_tosharedtable(L2, -1));
+  lua_setglobal(L2, "cfg");
+  luaL_releasesharedtable(st); // only the proxy holds it now
+  status = luaL_dostring(L2,
+                         "assert(#cfg == 3 and cfg[2] == 20 and cfg.name == 'cfg' and cfg[2.5] == true)\n"
+                         "assert(cfg.self == cfg and cfg.sub.x == 1 and cfg.none == nil)\n"
+                         "local n = 0\n"
+                         "for k, v in pairs(cfg) do n = n + 1 end\n"
+                         "assert(n == 7)\n"
+                         "assert(not pcall(function() cfg.name = 'x' end))\n"
+                         "local f = util.freeze(util.serialize({a = {1, 2}}))\n"
+                         "assert(f.a[2] == 2 and util.sharedTable(util.sharedHandle(f)) == f)\n");
+  if (status != LUA_OK) {
+    printf("dostring error: %s\n", lua_tostring(L2, -1));
+    lua_pop(L2, 1);
+  }
+  CuAssertIntEquals(tc, LUA_OK, status);
+  lua_close(L2);
+}
+
+void Test_lua_atom(CuTest* tc) {
+  lua_State* L = luaL_newstate();
+  int id = lua_newatom(L, "atom_name");
+  CuAssertTrue(tc, id > 0);
+  CuAssertIntEquals(tc, id, lua_newatom(L, "atom_name"));
+  CuAssertTrue(tc, id != lua_newatom(L, "atom_other"));
+  lua_gc(L, LUA_GCCOLLECT, 0);
+  CuAssertStrEquals(tc, "atom_name", lua_pushatom(L, id));
+  lua_pushliteral(L, "atom_name");
+  CuAssertTrue(tc, lua_rawequal(L, -1, -2));
+  lua_pop(L, 2);
+  lua_State* L2 = luaL_newstate(); // same id in another state
+  CuAssertIntEquals(tc, id, lua_newatom(L2, "atom_name"));
+  lua_gc(L2, LUA_GCGEN, 0);
+  lua_newtable(L2);
+  for (int i = 0; i < 1000; i++) {
+    luaL_pushatomliteral(L2, "atom_field");
+    lua_pushinteger(L2, i);
+    lua_rawset(L2, -3);
+    lua_gc(L2, LUA_GCSTEP, 0);
+  }
+  CuAssertIntEquals(tc, LUA_TNUMBER, lua_getfield(L2, -1, "atom_field"));
+  CuAssertIntEquals(tc, 999, (int)lua_tointeger(L2, -1));
+  CuAssertStrEquals(tc, "atom_name", lua_pushatom(L2, id));
+  lua_pop(L2, 3);
+  lua_close(L2);
+  char* heap = (char*)malloc(16); // the name may go away, like a literal of an unloaded module
+  strcpy(heap, "atom_heap");
+  int hid = lua_newatom(L, heap);
+  memset(heap, 'x', 9);
+  free(heap);
+  CuAssertTrue(tc, hid != lua_newatom(L, "atom_after_free"));
+  CuAssertIntEquals(tc, hid, lua_newatom(L, "atom_heap"));
+  L2 = luaL_newstate();
+  CuAssertStrEquals(tc, "atom_heap", lua_pushatom(L2, hid));
+  lua_pop(L2, 1);
+  lua_close(L2);
+  lua_close(L);
+}
+
+void Test_lua_pushlstring_cache(CuTest* tc) {
+  lua_State* L = luaL_newstate();
+  char buf[128];
+  for (int i = 0; i < 2000; i++) { // same names from a reused buffer, collected in between
+    snprintf(buf, sizeof(buf), "field_%d", i % 300);
+    lua_pushstring(L, buf);
+    snprintf(buf, sizeof(buf), "field_%d", i % 300);
+    lua_pushlstring(L, buf, strlen(buf));
+    CuAssertTrue(tc, lua_rawequal(L, -1, -2));
+    CuAssertStrEquals(tc, buf, lua_tostring(L, -1));
+    lua_pop(L, 2);
+    if (i % 97 == 0)
+      lua_gc(L, LUA_GCCOLLECT, 0);
+  }
+  memset(buf, 'k', sizeof(buf)); // long strings bypass the cache
+  lua_pushlstring(L, buf, sizeof(buf));
+  CuAssertIntEquals(tc, (int)sizeof(buf), (int)luaL_len(L, -1));
+  lua_close(L);
+}
+
+void Test_profiler(CuTest* tc) {
+  lua_State* L = luaL_newstate();
+  luaL_openlibs(L);
+  const char* code = "profiler.start(1000)\n"
+                     "local function spin() local s = 0 for i = 1, 1e5 do s = s + #tostring(i) end return s end\n"
+                     "local t = os.clock() + 0.3\n"
+                     "while os.clock() < t do spin() end\n"
+                     "local n = profiler.stop()\n"
+                     "return n, profiler.dump(), (profiler.isrunning())";
+  CuAssertIntEquals(tc, LUA_OK, luaL_dostring(L, code));
+  CuAssertTrue(tc, lua_tointeger(L, -3) > 0);
+  const char* folded = lua_tostring(L, -2);
+  CuAssertPtrNotNull(tc, strstr(folded, "spin ([string"));
+  CuAssertPtrNotNull(tc, strstr(folded, "main chunk ([string"));
+  CuAssertTrue(tc, !lua_toboolean(L, -1));
+  lua_pop(L, 3);
+  // a second run must not be stopped by the garbage of the first one
+  code = "profiler.start(1000)\n"
+         "local t = os.clock() + 0.1\n"
+         "while os.clock() < t do collectgarbage() end\n"
+         "return profiler.stop()";
+  CuAssertIntEquals(tc, LUA_OK, luaL_dostring(L, code));
+  CuAssertTrue(tc, lua_tointeger(L, -1) > 0);
+  lua_pop(L, 1);
+  // a debug.sethook hook keeps running while sampling and is still set afterwards
+  code = "local calls = 0\n"
+         "local function hook() calls = calls + 1 end\n"
+         "debug.sethook(hook, '', 1000)\n"
+         "profiler.start(1000)\n"
+         "local t = os.clock() + 0.1\n"
+         "while os.clock() < t do end\n"
+         "local before = calls\n"
+         "for i = 1, 1e5 do end\n" // at least 1e5 instructions after the ticks
+         "local n = profiler.stop()\n"
+         "local h, mask, count = debug.gethook()\n"
+         "debug.sethook()\n"
+         "return n, h == hook and mask == '' and count == 1000, calls - before";
+  CuAssertIntEquals(tc, LUA_OK, luaL_dostring(L, code));
+  CuAssertTrue(tc, lua_tointeger(L, -3) > 0);
+  CuAssertTrue(tc, lua_toboolean(L, -2));
+  CuAssertTrue(tc, lua_tointeger(L, -1) >= 100);
+  lua_pop(L, 3);
+  // a tick in a coroutine that never runs Lua code again is sampled by the thread that goes on
+  code = "profiler.start(1000)\n"
+         "coroutine.wrap(string.rep)('x', 1 << 27)\n"
+         "local t = os.clock() + 0.1\n"
+         "while os.clock() < t do end\n"
+         "return profiler.stop()";
+  CuAssertIntEquals(tc, LUA_OK, luaL_dostring(L, code));
+  CuAssertTrue(tc, lua_tointeger(L, -1) > 0);
+  lua_pop(L, 1);
+  CuAssertIntEquals(tc, LUA_OK, luaL_dostring(L, "profiler.start(1) profiler.stop()")); // a one second period
+  CuAssertIntEquals(tc, LUA_OK, luaL_dostring(L, "profiler.start(100)")); // closing the state stops it
+  lua_close(L);
+}
+
+#if !defined(_WIN32)
+#include <pthread.h>
+
+static void* profiler_busy(void* ud) {
+  lua_State* L = (lua_State*)ud;
+  lua_pushboolean(L, luaL_dostring(L, "local t = os.clock() + 0.2 local s = 0 while os.clock() < t do s = s + 1 end") == LUA_OK);
+  return NULL;
+}
+
+void Test_profiler_threads(CuTest* tc) {
+  // ticks landing on another OS thread, which runs its own state, go to the profiled one
+  lua_State* L = luaL_newstate();
+  lua_State* L2 = luaL_newstate();
+  luaL_openlibs(L);
+  luaL_openlibs(L2);
+  pthread_t tid;
+  CuAssertIntEquals(tc, LUA_OK, luaL_dostring(L, "profiler.start(1000)"));
+  CuAssertIntEquals(tc, 0, pthread_create(&tid, NULL, profiler_busy, L2));
+  CuAssertIntEquals(tc, LUA_OK, luaL_dostring(L, "local function spin() local t = os.clock() + 0.4 while os.clock() < t do end end\n"
+                                                 "spin()\n"
+                                                 "return profiler.stop(), profiler.dump()"));
+  pthread_join(tid, NULL);
+  CuAssertTrue(tc, lua_tointeger(L, -2) > 0);
+  CuAssertPtrNotNull(tc, strstr(lua_tostring(L, -1), "spin ([string"));
+  CuAssertTrue(tc, lua_toboolean(L2, -1));
+  CuAssertIntEquals(tc, 0, lua_gethookmask(L2));
+  lua_close(L2);
+  lua_close(L);
+}
+#endif
+
+static int writer_buffer(lua_State* L, const void* p, size_t sz, void* ud) {
+  (void)L;
+  luaL_addlstring((luaL_Buffer*)ud, (const char*)p, sz);
+  return 0;
+}
+
+static int hook_count;
+static void count_hook(lua_State* L, lua_Debug* ar) {
+  (void)L;
+  (void)ar;
+  hook_count++;
+}
+
+void Test_load_optimize(CuTest* tc) {
+  lua_State* L = luaL_newstate();
+  luaL_openlibs(L);
+  const char* code = "local t = {a = {b = 40}}\n"
+                     "local x, y\n"
+                     "x, y = t.a.b + 2, math.floor(1 / 0 > 1e308 and 1.5 or 0)\n"
+                     "return x, y, 1 < 2";
+  const char* modes[] = {"t", "tO"};
+  for (int m = 0; m < 2; m++) {
+    CuAssertIntEquals(tc, LUA_OK, luaL_loadbufferx(L, code, strlen(code), "=opt", modes[m]));
+    lua_pushvalue(L, -1);
+    CuAssertIntEquals(tc, LUA_OK, lua_pcall(L, 0, 3, 0));
+    CuAssertIntEquals(tc, 42, (int)lua_tointeger(L, -3));
+    CuAssertIntEquals(tc, 1, (int)lua_tointeger(L, -2));
+    CuAssertTrue(tc, lua_toboolean(L, -1));
+    lua_pop(L, 3);
+    luaL_Buffer b; // the format byte follows signature and version
+    luaL_buffinit(L, &b);
+    CuAssertIntEquals(tc, 0, lua_dump(L, writer_buffer, &b, 0));
+    luaL_pushresult(&b);
+    size_t len;
+    const char* chunk = lua_tolstring(L, -1, &len);
+    CuAssertIntEquals(tc, m, chunk[5]);
+    CuAssertIntEquals(tc, LUA_OK, luaL_loadbufferx(L, chunk, len, "=opt", "b"));
+    CuAssertIntEquals(tc, LUA_OK, lua_pcall(L, 0, 1, 0));
+    CuAssertIntEquals(tc, 42, (int)lua_tointeger(L, -1));
+    lua_pop(L, 3);
+  }
+  const char* chain = "local t = {a = {b = {c = 1}}}\n"
+                      "return t.a.b.c + g.a.b";
+  int counts[2];
+  lua_newtable(L);
+  lua_newtable(L);
+  lua_pushinteger(L, 2);
+  lua_setfield(L, -2, "b");
+  lua_setfield(L, -2, "a");
+  lua_setglobal(L, "g");
+  for (int m = 0; m < 2; m++) { // the fused lookups still count as two instructions
+    CuAssertIntEquals(tc, LUA_OK, luaL_loadbufferx(L, chain, strlen(chain), "=chain", modes[m]));
+    hook_count = 0;
+    lua_sethook(L, count_hook, LUA_MASKCOUNT, 1);
+    CuAssertIntEquals(tc, LUA_OK, lua_pcall(L, 0, 1, 0));
+    lua_sethook(L, NULL, 0, 0);
+    CuAssertIntEquals(tc, 3, (int)lua_tointeger(L, -1));
+    lua_pop(L, 1);
+    counts[m] = hook_count;
+  }
+  CuAssertIntEquals(tc, counts[0], counts[1]);
+  lua_close(L);
+}
+
+static void unmap_free(void* ud, void* p, size_t sz) {
+  (void)sz;
+  ++*(int*)ud;
+  free(p);
+}
+
+void Test_load_mapped(CuTest* tc) {
+  lua_State* L = luaL_newstate();
+  luaL_openlibs(L);
+  const char* code = "local n = ...\n"
+                     "local function add(a, b) return a + b end\n"
+                     "local function unused() return 'never' end\n"
+                     "return function(x) return add(x, n) end, add(1, 2), unused";
+  int unmapped = 0;
+  CuAssertIntEquals(tc, LUA_OK, luaL_loadbufferx(L, code, strlen(code), "=map", "t"));
+  luaL_Buffer b;
+  luaL_buffinit(L, &b);
+  CuAssertIntEquals(tc, 0, lua_dumpmap(L, writer_buffer, &b, 0));
+  luaL_pushresult(&b);
+  size_t len;
+  const char* chunk = lua_tolstring(L, -1, &len);
+  CuAssertIntEquals(tc, 2, chunk[5]); // LUAC_FORMATMAP
+  char* block = (char*)malloc(len);
+  memcpy(block, chunk, len);
+  CuAssertIntEquals(tc, LUA_OK, lua_loadmap(L, block, len, "=map", "b", unmap_free, &unmapped));
+  lua_pushinteger(L, 40);
+  CuAssertIntEquals(tc, LUA_OK, lua_pcall(L, 1, 3, 0));
+  CuAssertIntEquals(tc, 3, (int)lua_tointeger(L, -2));
+  lua_pushvalue(L, -3);
+  lua_pushinteger(L, 2);
+  CuAssertIntEquals(tc, LUA_OK, lua_pcall(L, 1, 1, 0));
+  CuAssertIntEquals(tc, 42, (int)lua_tointeger(L, -1));
+  lua_pop(L, 4);
+  CuAssertIntEquals(tc, 0, unmapped); // still used by the closures
+  CuAssertIntEquals(tc, LUA_OK, luaL_loadbufferx(L, chunk, len, "=map", "b")); // copied from the stream
+  lua_pushinteger(L, 1);
+  CuAssertIntEquals(tc, LUA_OK, lua_pcall(L, 1, 2, 0));
+  CuAssertIntEquals(tc, 3, (int)lua_tointeger(L, -1));
+  lua_pop(L, 2);
+  block = (char*)malloc(len / 2);
+  memcpy(block, chunk, len / 2);
+  CuAssertIntEquals(tc, LUA_ERRSYNTAX, lua_loadmap(L, block, len / 2, "=map", "b", unmap_free, &unmapped));
+  CuAssertPtrNotNull(tc, strstr(lua_tostring(L, -1), "truncated"));
+  lua_pop(L, 2);
+  block = (char*)malloc(strlen(code));
+  memcpy(block, code, strlen(code));
+  CuAssertIntEquals(tc, LUA_OK, lua_loadmap(L, block, strlen(code), "=map", NULL, unmap_free, &unmapped));
+  CuAssertIntEquals(tc, 1, unmapped); // not a mapped chunk, released right away
+  lua_pop(L, 1);
+  lua_gc(L, LUA_GCCOLLECT, 0);
+  CuAssertIntEquals(tc, 3, unmapped);
+  lua_close(L);
+}
+
+void Test_lua_resetthread(CuTest* tc) {
+  lua_State* L = luaL_newstate();
+  luaL_openlibs(L);
+  lua_State* co = lua_newthread(L);
+  lua_pop(L, 1);
+  lua_gc(L, LUA_GCCOLLECT, 0);
+  CuAssertPtrEquals(tc, co, lua_newthread(L)); // taken back from the pool
+  CuAssertIntEquals(tc, 0, lua_gettop(co));
+  CuAssertIntEquals(tc, LUA_OK, luaL_loadstring(co, "error('stop')"));
+  CuAssertIntEquals(tc, LUA_ERRRUN, lua_resume(co, L, 0));
+  CuAssertIntEquals(tc, LUA_ERRRUN, lua_resetthread(co));
+  CuAssertIntEquals(tc, LUA_OK, lua_status(co));
+  CuAssertIntEquals(tc, 0, lua_gettop(co));
+  CuAssertIntEquals(tc, LUA_OK, luaL_loadstring(co, "local a = ... coroutine.yield(a) return a + 1"));
+  lua_pushinteger(co, 41);
+  CuAssertIntEquals(tc, LUA_YIELD, lua_resume(co, L, 1));
+  CuAssertIntEquals(tc, LUA_OK, lua_resetthread(co)); // abandon the suspended call
+  CuAssertIntEquals(tc, 0, lua_gettop(co));
+  CuAssertIntEquals(tc, LUA_OK, luaL_dostring(L, "local co = coroutine.create(function() return 1 end)\n"
+                                                 "coroutine.resume(co)\n"
+                                                 "assert(coroutine.recycle(co, function(x) return x * 2 end) == co)\n"
+                                                 "local _, v = coroutine.resume(co, 21)\n"
+                                                 "assert(v == 42 and coroutine.status(co) == 'dead')"));
+  lua_close(L);
+}
+
+#if defined(LUA_USE_THREADLOCK)
+#include <pthread.h>
+
+static void* threadlock_drive(void* co) {
+  lua_State* L1 = (lua_State*)co;
+  lua_getglobal(L1, "work");
+  if (lua_pcall(L1, 0, 0, 0) != LUA_OK)
+    lua_pushboolean(L1, 0); // leave a mark for the checker
+  return NULL;
+}
+
+void Test_threadlock(CuTest* tc) {
+  lua_State* L = luaL_newstate();
+  luaL_openlibs(L);
+  const char* code = "total = 0\n"
+                     "function work()\n"
+                     "  local co = coroutine.wrap(function() while true do coroutine.yield({}) end end)\n"
+                     "  for i = 1, 20000 do co(); total = total + 1 end\n"
+                     "end";
+  CuAssertIntEquals(tc, LUA_OK, luaL_dostring(L, code));
+  pthread_t tids[4];
+  lua_State* cos[4];
+  for (int i = 0; i < 4; i++) {
+    cos[i] = lua_newthread(L);
+    CuAssertIntEquals(tc, 0, pthread_create(&tids[i], NULL, threadlock_drive, cos[i]));
+  }
+  for (int i = 0; i < 4; i++) {
+    pthread_join(tids[i], NULL);
+    CuAssertIntEquals(tc, 0, lua_gettop(cos[i]));
+  }
+  lua_getglobal(L, "total");
+  CuAssertIntEquals(tc, 80000, (int)lua_tointeger(L, -1));
+  lua_close(L);
+}
+
+// allocate straight from the allocator, outside of lua_lock like resizebox
+static int threadlock_churn(lua_State* L) {
+  void* ud;
+  lua_Alloc f = lua_getallocf(L, &ud);
+  for (int i = 0; i < 1024; i++) {
+    void* p = f(ud, NULL, LUA_TUSERDATA, 16 + (size_t)(i % 64) * 8);
+    if (p == NULL)
+      return luaL_error(L, "not enough memory");
+    memset(p, i, 16);
+    f(ud, p, 16 + (size_t)(i % 64) * 8, 0);
+  }
+  return 0;
+}
+
+void Test_threadlock_slab(CuTest* tc) {
+  lua_State* L = luaL_newstate_z();
+  luaL_openlibs(L);
+  lua_register(L, "churn", threadlock_churn);
+  const char* code = "total = 0\n"
+                     "function work()\n"
+                     "  local co = coroutine.wrap(function() while true do coroutine.yield({}) end end)\n"
+                     "  for i = 1, 2000 do co(); churn(); local t = {tostring(i), i}; total = total + #t end\n"
+                     "end";
+  CuAssertIntEquals(tc, LUA_OK, luaL_dostring(L, code));
+  pthread_t tids[4];
+  lua_State* cos[4];
+  for (int i = 0; i < 4; i++) {
+    cos[i] = lua_newthread(L);
+    CuAssertIntEquals(tc, 0, pthread_create(&tids[i], NULL, threadlock_drive, cos[i]));
+  }
+  for (int i = 0; i < 4; i++) {
+    pthread_join(tids[i], NULL);
+    CuAssertIntEquals(tc, 0, lua_gettop(cos[i]));
+  }
+  lua_getglobal(L, "total");
+  CuAssertIntEquals(tc, 16000, (int)lua_tointeger(L, -1));
+  lua_pop(L, 1);
+  // every free list is intact: what is in use adds up
+  CuAssertIntEquals(tc, LUA_OK, luaL_dostring(L, "local t = debug.allocstats()\n"
+                                                 "for _, c in ipairs(t) do assert(c.allocs - c.frees == c.inuse) end\n"
+                                                 "collectgarbage()"));
+  luaL_close_z(L);
+}
+#endif
+
 CuSuite* LuaGetSuite() {
   CuSuite* suite = CuSuiteNew();
 
@@ -184,6 +806,25 @@ CuSuite* LuaGetSuite() {
   SUITE_ADD_TEST(suite, Test_db_getspecialkeys);
   SUITE_ADD_TEST(suite, Test_db_sizeofstruct);
   SUITE_ADD_TEST(suite, Test_db_tablemem);
+  SUITE_ADD_TEST(suite, Test_lua_gc_generational);
+  SUITE_ADD_TEST(suite, Test_luaL_allocstats);
+  SUITE_ADD_TEST(suite, Test_lua_filltable);
+  SUITE_ADD_TEST(suite, Test_table_icache);
+  SUITE_ADD_TEST(suite, Test_luaL_serialize);
+  SUITE_ADD_TEST(suite, Test_luaL_sharedtable);
+  SUITE_ADD_TEST(suite, Test_lua_atom);
+  SUITE_ADD_TEST(suite, Test_lua_pushlstring_cache);
+  SUITE_ADD_TEST(suite, Test_profiler);
+#if !defined(_WIN32)
+  SUITE_ADD_TEST(suite, Test_profiler_threads);
+#endif
+  SUITE_ADD_TEST(suite, Test_load_optimize);
+  SUITE_ADD_TEST(suite, Test_load_mapped);
+  SUITE_ADD_TEST(suite, Test_lua_resetthread);
+#if defined(LUA_USE_THREADLOCK)
+  SUITE_ADD_TEST(suite, Test_threadlock);
+  SUITE_ADD_TEST(suite, Test_threadlock_slab);
+#endif
 
   return suite;
 }
@@ -63,6 +63,98 @@ static int util_MemBuffer(lua_State* L) {
 */
 /* }====================================================== */
 
+/*
+** {======================================================
+** Serialize
+** =======================================================
+*/
+
+static int util_serialize_protected(lua_State* L) {
+  luaL_ByteBuffer* b = (luaL_ByteBuffer*)lua_touserdata(L, 1);
+  luaL_serialize(L, 2, lua_gettop(L) - 1, b);
+  return 0;
+}
+
+static void util_releaseBuffer(const luaL_MemBuffer* mb) {
+  luaBB_destroybuffer((uint8_t*)mb->ptr);
+}
+
+// serialize(...) => MemBuffer
+static int util_serialize(lua_State* L) {
+  luaL_ByteBuffer b[1];
+  int n = lua_gettop(L);
+  luaBB_init(b, 0);
+  lua_pushcfunction(L, util_serialize_protected);
+  lua_pushlightuserdata(L, (void*)b);
+  lua_rotate(L, 1, 2);
+  if (lua_pcall(L, n + 1, 0, 0) != LUA_OK) {
+    luaBB_destroy(b);
+    return lua_error(L);
+  }
+  uint32_t len = 0;
+  const uint8_t* ptr = luaBB_movebuffer(b, &len);
+  luaL_MemBuffer* mb = luaL_newmembuffer(L);
+  MEMBUFFER_SETINIT(mb, ptr, len, util_releaseBuffer, NULL);
+  return 1;
+}
+
+// deserialize(string | MemBuffer) => ...
+static int util_deserialize(lua_State* L) {
+  size_t len;
+  const void* buf = luaL_checklbuffer(L, 1, &len);
+  return luaL_deserialize(L, buf, len);
+}
+
+/* }====================================================== */
+
+/*
+** {======================================================
+** Shared Table
+** =======================================================
+*/
+
+// freeze(table | string | MemBuffer) => SharedTable, strings and MemBuffers are serialized data
+static int util_freeze(lua_State* L) {
+  if (!lua_istable(L, 1)) {
+    size_t len;
+    const void* buf = luaL_checklbuffer(L, 1, &len);
+    lua_settop(L, 1);
+    luaL_deserialize(L, buf, len);
+    luaL_checktype(L, 2, LUA_TTABLE);
+  }
+  luaL_SharedTable* st = luaL_freezetable(L, -1);
+  luaL_pushsharedtable(L, st);
+  luaL_releasesharedtable(st);
+  return 1;
+}
+
+// sharedHandle(SharedTable) => lightuserdata, holds one reference until sharedTable(handle)
+static int util_sharedHandle(lua_State* L) {
+  luaL_SharedTable* st = luaL_tosharedtable(L, 1);
+  luaL_argcheck(L, st != NULL, 1, "SharedTable expected");
+  lua_pushlightuserdata(L, luaL_retainsharedtable(st));
+  return 1;
+}
+
+// sharedTable(handle) => SharedTable, consumes the handle, may run in another lua_State
+static int util_sharedTable(lua_State* L) {
+  luaL_checktype(L, 1, LUA_TLIGHTUSERDATA);
+  luaL_SharedTable* st = (luaL_SharedTable*)lua_touserdata(L, 1);
+  luaL_pushsharedtable(L, st);
+  luaL_releasesharedtable(st);
+  return 1;
+}
+
+// sharedSize(SharedTable) => bytes of the region
+static int util_sharedSize(lua_State* L) {
+  luaL_SharedTable* st = luaL_tosharedtable(L, 1);
+  luaL_argcheck(L, st != NULL, 1, "SharedTable expected");
+  lua_pushinteger(L, (lua_Integer)luaL_sharedtablesize(st));
+  return 1;
+}
+
+/* }====================================================== */
+
 /*
 ** {======================================================
 ** Print Buffer
@@ -86,13 +178,21 @@ static const luaL_Reg util_funcs[] = {
     // {"MemBuffer", util_MemBuffer},
     {"printBuffer", util_printBuffer},
     {"printFinish", util_printFinish},
+    {"serialize", util_serialize},
+    {"deserialize", util_deserialize},
+    {"freeze", util_freeze},
+    {"sharedHandle", util_sharedHandle},
+    {"sharedTable", util_sharedTable},
+    {"sharedSize", util_sharedSize},
     {NULL, NULL},
 };
 
 void membuf_init(lua_State* L);
+void sharetable_init(lua_State* L);
 
 LUAMOD_API int(luaopen_util)(lua_State* L) {
   luaL_newlib(L, util_funcs);
   membuf_init(L);
+  sharetable_init(L);
   return 1;
 }
@@ -54,14 +54,11 @@ static void MEMBUF_FUNCTION(releaseBuffer)(const luaL_MemBuffer* mb) {
 }
 static int MEMBUF_FUNCTION(makeCopy)(lua_State* L) {
   luaL_MemBuffer* src = luaL_checkmembuffer(L, 1);
-  if (MEMBUFFER_HAS_DATA(src)) {
-    void* ptr = malloc(src->sz);
-    if (ptr != NULL) {
-      memcpy(ptr, src->ptr, src->sz);
-      luaL_MemBuffer* dst = luaL_newmembuffer(L);
-      MEMBUFFER_SETINIT(dst, ptr, src->sz, MEMBUF_FUNCTION(releaseBuffer), NULL);
-      return 1;
-    }
+  luaL_MemBuffer copy[1];
+  if (MEMBUFFER_HAS_DATA(src) && luaL_copyMemBuffer(src, copy)) {
+    luaL_MemBuffer* dst = luaL_newmembuffer(L);
+    MEMBUFFER_MOVEINIT(copy, dst);
+    return 1;
   }
   return 0;
 }
@@ -179,4 +176,47 @@ LUALIB_API luaL_MemBuffer* luaL_tomembuffer(lua_State* L, int arg, luaL_MemBuffe
   return luaL_checkmembuffer(L, arg);
 }
 
+static const char localReleaseKey = 'k';
+LUALIB_API void luaL_localMemRelease(lua_State* L, luaL_MemRelease release) {
+  if (lua_rawgetp(L, LUA_REGISTRYINDEX, &localReleaseKey) != LUA_TTABLE) {
+    lua_pop(L, 1);
+    lua_newtable(L);
+    lua_pushvalue(L, -1);
+    lua_rawsetp(L, LUA_REGISTRYINDEX, &localReleaseKey);
+  }
+  lua_pushboolean(L, 1);
+  lua_rawsetp(L, -2, (void*)release);
+  lua_pop(L, 1);
+}
+LUALIB_API int luaL_isMemLocal(lua_State* L, const luaL_MemBuffer* mb) {
+  switch (MEMBUFFER_TYPE(mb)) {
+    case MT_Reference:
+      return 1;
+    case MT_Dynamic:
+      break;
+    default:
+      return 0;
+  }
+  int local = 0;
+  if (lua_rawgetp(L, LUA_REGISTRYINDEX, &localReleaseKey) == LUA_TTABLE) {
+    local = lua_rawgetp(L, -1, (void*)mb->release) != LUA_TNIL;
+    lua_pop(L, 1);
+  }
+  lua_pop(L, 1);
+  return local;
+}
+LUALIB_API int luaL_copyMemBuffer(const luaL_MemBuffer* src, luaL_MemBuffer* dst) {
+  if (!MEMBUFFER_HAS_DATA(src)) {
+    MEMBUFFER_SETNULL(dst);
+    return 1;
+  }
+  void* ptr = malloc(src->sz);
+  if (ptr == NULL) {
+    return 0;
+  }
+  memcpy(ptr, src->ptr, src->sz);
+  MEMBUFFER_SETINIT(dst, ptr, src->sz, MEMBUF_FUNCTION(releaseBuffer), NULL);
+  return 1;
+}
+
 /* }====================================================== */
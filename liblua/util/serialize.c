@@ -0,0 +1,398 @@
+#define serialize_c
+#define LUA_LIB
+
+#include <luautil.h>
+#include <lauxlib.h>
+
+#include <limits.h>
+#include <string.h>
+
+/*
+** {======================================================
+** Binary Serialize
+** =======================================================
+*/
+
+/*
+ * Format, all in native byte order:
+ *   varint count, then count values
+ *   value: 1 byte tag, followed by
+ *     SR_INTEGER  zigzag varint
+ *     SR_NUMBER   8 byte lua_Number
+ *     SR_STRING   varint len, bytes
+ *     SR_TABLE    varint narr, u32 nhash, narr values, nhash key value pairs
+ *     SR_REF      varint id of a table written before, ids start from 1
+ *     SR_LIGHTUD  pointer
+ */
+enum {
+  SR_NIL,
+  SR_FALSE,
+  SR_TRUE,
+  SR_INTEGER,
+  SR_NUMBER,
+  SR_STRING,
+  SR_TABLE,
+  SR_REF,
+  SR_LIGHTUD,
+};
+
+#define SERIALIZE_MAXDEPTH 200
+#define VARINT_MAXLEN 10
+
+/* open addressing map of table address -> id, kept in a userdata so errors need no cleanup */
+typedef struct {
+  const void* key;
+  lua_Integer id;
+} SeenSlot;
+
+typedef struct {
+  lua_State* L;
+  luaL_ByteBuffer* b;
+  int seen; // stack index of the SeenSlot userdata
+  SeenSlot* slots;
+  size_t mask;
+  lua_Integer ntables;
+  int depth;
+} Serializer;
+
+#define SEEN_INIT_SIZE 64
+#define seen_hash(S, p) (((size_t)(uintptr_t)(p) >> 4) * (size_t)0x9E3779B97F4A7C15ull & (S)->mask)
+
+static void seen_resize(Serializer* S, size_t size) {
+  lua_State* L = S->L;
+  SeenSlot* old = S->slots;
+  size_t oldsize = old == NULL ? 0 : S->mask + 1;
+  size_t i;
+  S->slots = (SeenSlot*)lua_newuserdata(L, sizeof(SeenSlot) * size);
+  S->mask = size - 1;
+  memset(S->slots, 0, sizeof(SeenSlot) * size);
+  for (i = 0; i < oldsize; i++) {
+    if (old[i].key != NULL) {
+      size_t h = seen_hash(S, old[i].key);
+      while (S->slots[h].key != NULL) {
+        h = (h + 1) & S->mask;
+      }
+      S->slots[h] = old[i];
+    }
+  }
+  lua_replace(L, S->seen);
+}
+
+/* id of a table written before, or 0 after recording it with a new id */
+static lua_Integer seen_mark(Serializer* S, const void* p) {
+  size_t h = seen_hash(S, p);
+  while (S->slots[h].key != NULL) {
+    if (S->slots[h].key == p) {
+      return S->slots[h].id;
+    }
+    h = (h + 1) & S->mask;
+  }
+  S->slots[h].key = p;
+  S->slots[h].id = ++S->ntables;
+  if ((size_t)S->ntables * 2 > S->mask) { /* keep load under a half */
+    seen_resize(S, (S->mask + 1) * 2);
+  }
+  return 0;
+}
+
+static uint8_t* sr_reserve(Serializer* S, uint32_t len) {
+  luaL_ByteBuffer* b = S->b;
+  if (b->size - b->n < len) {
+    if (len > UINT32_MAX - b->n || luaBB_appendbytes(b, len) == NULL) {
+      luaL_error(S->L, "serialize: output too large");
+    }
+    b->n -= len;
+  }
+  return b->b + b->n;
+}
+#define sr_commit(S, len) ((S)->b->n += (uint32_t)(len))
+
+static uint32_t sr_varint(uint8_t* p, uint64_t v) {
+  uint32_t n = 0;
+  while (v >= 0x80) {
+    p[n++] = (uint8_t)(v | 0x80);
+    v >>= 7;
+  }
+  p[n++] = (uint8_t)v;
+  return n;
+}
+
+static void sr_tagvarint(Serializer* S, uint8_t tag, uint64_t v) {
+  uint8_t* p = sr_reserve(S, 1 + VARINT_MAXLEN);
+  p[0] = tag;
+  sr_commit(S, 1 + sr_varint(p + 1, v));
+}
+
+static void sr_tagraw(Serializer* S, uint8_t tag, const void* v, uint32_t len) {
+  uint8_t* p = sr_reserve(S, 1 + len);
+  p[0] = tag;
+  memcpy(p + 1, v, len);
+  sr_commit(S, 1 + len);
+}
+
+static void sr_value(Serializer* S, int idx);
+
+static void sr_table(Serializer* S, int idx) {
+  lua_State* L = S->L;
+  lua_Integer id = seen_mark(S, lua_topointer(L, idx));
+  if (id != 0) { /* shared or cycle */
+    sr_tagvarint(S, SR_REF, (uint64_t)id);
+    return;
+  }
+  if (S->depth >= SERIALIZE_MAXDEPTH) {
+    luaL_error(L, "serialize: table nested too deep");
+  }
+  luaL_checkstack(L, 4, "serialize: table nested too deep");
+  S->depth++;
+
+  lua_Unsigned narr = lua_rawlen(L, idx);
+  uint32_t nhash = 0;
+  lua_Unsigned i;
+  sr_tagvarint(S, SR_TABLE, (uint64_t)narr);
+  uint32_t countAt = S->b->n;
+  sr_reserve(S, sizeof(nhash));
+  sr_commit(S, sizeof(nhash));
+  for (i = 1; i <= narr; i++) {
+    lua_rawgeti(L, idx, (lua_Integer)i);
+    sr_value(S, lua_gettop(L));
+    lua_pop(L, 1);
+  }
+  lua_pushnil(L);
+  while (lua_next(L, idx)) {
+    if (lua_isinteger(L, -2)) {
+      lua_Integer k = lua_tointeger(L, -2);
+      if (k >= 1 && (lua_Unsigned)k <= narr) { /* written in the array part */
+        lua_pop(L, 1);
+        continue;
+      }
+    }
+    int top = lua_gettop(L);
+    sr_value(S, top - 1);
+    sr_value(S, top);
+    nhash++;
+    lua_pop(L, 1);
+  }
+  memcpy(S->b->b + countAt, &nhash, sizeof(nhash));
+  S->depth--;
+}
+
+static void sr_value(Serializer* S, int idx) {
+  lua_State* L = S->L;
+  switch (lua_type(L, idx)) {
+    case LUA_TNIL:
+      *sr_reserve(S, 1) = SR_NIL;
+      sr_commit(S, 1);
+      break;
+    case LUA_TBOOLEAN:
+      *sr_reserve(S, 1) = lua_toboolean(L, idx) ? SR_TRUE : SR_FALSE;
+      sr_commit(S, 1);
+      break;
+    case LUA_TNUMBER:
+      if (lua_isinteger(L, idx)) {
+        lua_Unsigned u = (lua_Unsigned)lua_tointeger(L, idx);
+        sr_tagvarint(S, SR_INTEGER, (uint64_t)((u << 1) ^ (0 - (u >> (sizeof(u) * 8 - 1))))); /* zigzag */
+      } else {
+        lua_Number n = lua_tonumber(L, idx);
+        sr_tagraw(S, SR_NUMBER, &n, sizeof(n));
+      }
+      break;
+    case LUA_TSTRING: {
+      size_t len;
+      const char* str = lua_tolstring(L, idx, &len);
+      if (len > UINT32_MAX - VARINT_MAXLEN - 1) {
+        luaL_error(L, "serialize: string too large");
+      }
+      sr_tagvarint(S, SR_STRING, (uint64_t)len);
+      memcpy(sr_reserve(S, (uint32_t)len), str, len);
+      sr_commit(S, len);
+      break;
+    }
+    case LUA_TTABLE:
+      sr_table(S, idx);
+      break;
+    case LUA_TLIGHTUSERDATA: {
+      void* ptr = lua_touserdata(L, idx);
+      sr_tagraw(S, SR_LIGHTUD, &ptr, sizeof(ptr));
+      break;
+    }
+    default:
+      luaL_error(L, "serialize: unsupported type %s", luaL_typename(L, idx));
+      break;
+  }
+}
+
+// [-0, +0, e]
+LUALIB_API void luaL_serialize(lua_State* L, int first, int n, luaL_ByteBuffer* b) {
+  Serializer S[1];
+  int i;
+  luaL_checkstack(L, 2, "serialize"); /* seen map slot, may be called with top == ci->top after LUA_MULTRET */
+  first = lua_absindex(L, first);
+  luaBB_appendbytes(b, 0); /* move unread data to the front, writes go to b->b + b->n */
+  S->L = L;
+  S->b = b;
+  S->ntables = 0;
+  S->depth = 0;
+  lua_pushnil(L);
+  S->seen = lua_gettop(L);
+  S->slots = NULL;
+  seen_resize(S, SEEN_INIT_SIZE);
+  uint8_t* p = sr_reserve(S, VARINT_MAXLEN);
+  sr_commit(S, sr_varint(p, (uint64_t)n));
+  for (i = 0; i < n; i++) {
+    sr_value(S, first + i);
+  }
+  lua_pop(L, 1);
+}
+
+typedef struct {
+  lua_State* L;
+  const uint8_t* p;
+  const uint8_t* end;
+  int refs; // stack index of id -> table
+  lua_Integer ntables;
+  int depth;
+} Deserializer;
+
+static void ds_malformed(Deserializer* D) {
+  luaL_error(D->L, "deserialize: malformed data");
+}
+
+static uint64_t ds_varint(Deserializer* D) {
+  uint64_t v = 0;
+  int shift = 0;
+  while (D->p < D->end && shift < 64) {
+    uint8_t c = *D->p++;
+    v |= (uint64_t)(c & 0x7f) << shift;
+    if (c < 0x80) {
+      return v;
+    }
+    shift += 7;
+  }
+  ds_malformed(D);
+  return 0;
+}
+
+static const uint8_t* ds_bytes(Deserializer* D, size_t len) {
+  if ((size_t)(D->end - D->p) < len) {
+    ds_malformed(D);
+  }
+  const uint8_t* p = D->p;
+  D->p += len;
+  return p;
+}
+
+static void ds_value(Deserializer* D);
+
+static void ds_table(Deserializer* D) {
+  lua_State* L = D->L;
+  uint64_t narr = ds_varint(D);
+  uint32_t nhash;
+  uint64_t i;
+  memcpy(&nhash, ds_bytes(D, sizeof(nhash)), sizeof(nhash));
+  /* every value takes at least one byte, do not trust the counts before allocating */
+  if (narr > (uint64_t)(D->end - D->p) || nhash > (uint64_t)(D->end - D->p) / 2) {
+    ds_malformed(D);
+  }
+  if (D->depth >= SERIALIZE_MAXDEPTH) {
+    luaL_error(L, "deserialize: table nested too deep");
+  }
+  luaL_checkstack(L, 4, "deserialize: table nested too deep");
+  lua_createtable(L, (int)narr, (int)nhash);
+  lua_pushvalue(L, -1);
+  lua_rawseti(L, D->refs, ++D->ntables); /* before the content, cycles refer to it */
+  D->depth++;
+  for (i = 1; i <= narr; i++) {
+    ds_value(D);
+    lua_rawseti(L, -2, (lua_Integer)i);
+  }
+  for (i = 0; i < nhash; i++) {
+    ds_value(D);
+    if (lua_isnil(L, -1)) {
+      ds_malformed(D);
+    }
+    ds_value(D);
+    lua_rawset(L, -3);
+  }
+  D->depth--;
+}
+
+static void ds_value(Deserializer* D) {
+  lua_State* L = D->L;
+  uint8_t tag = *ds_bytes(D, 1);
+  switch (tag) {
+    case SR_NIL:
+      lua_pushnil(L);
+      break;
+    case SR_FALSE:
+    case SR_TRUE:
+      lua_pushboolean(L, tag == SR_TRUE);
+      break;
+    case SR_INTEGER: {
+      uint64_t u = ds_varint(D);
+      lua_pushinteger(L, (lua_Integer)((u >> 1) ^ (0 - (u & 1))));
+      break;
+    }
+    case SR_NUMBER: {
+      lua_Number n;
+      memcpy(&n, ds_bytes(D, sizeof(n)), sizeof(n));
+      lua_pushnumber(L, n);
+      break;
+    }
+    case SR_STRING: {
+      uint64_t len = ds_varint(D);
+      if (len > (uint64_t)(D->end - D->p)) {
+        ds_malformed(D);
+      }
+      lua_pushlstring(L, (const char*)ds_bytes(D, (size_t)len), (size_t)len);
+      break;
+    }
+    case SR_TABLE:
+      ds_table(D);
+      break;
+    case SR_REF: {
+      uint64_t id = ds_varint(D);
+      if (id == 0 || id > (uint64_t)D->ntables) {
+        ds_malformed(D);
+      }
+      lua_rawgeti(L, D->refs, (lua_Integer)id);
+      break;
+    }
+    case SR_LIGHTUD: {
+      void* ptr;
+      memcpy(&ptr, ds_bytes(D, sizeof(ptr)), sizeof(ptr));
+      lua_pushlightuserdata(L, ptr);
+      break;
+    }
+    default:
+      ds_malformed(D);
+      break;
+  }
+}
+
+// [-0, +n, e] push all values, return n
+LUALIB_API int luaL_deserialize(lua_State* L, const void* buf, size_t len) {
+  Deserializer D[1];
+  uint64_t i;
+  D->L = L;
+  D->p = (const uint8_t*)buf;
+  D->end = D->p + len;
+  D->ntables = 0;
+  D->depth = 0;
+  uint64_t n = ds_varint(D);
+  if (n > (uint64_t)(D->end - D->p) || n > INT_MAX - LUA_MINSTACK) {
+    ds_malformed(D);
+  }
+  luaL_checkstack(L, (int)n + 1, "deserialize: too many values");
+  lua_createtable(L, 0, 0);
+  D->refs = lua_gettop(L);
+  for (i = 0; i < n; i++) {
+    ds_value(D);
+  }
+  if (D->p != D->end) {
+    ds_malformed(D);
+  }
+  lua_remove(L, D->refs);
+  return (int)n;
+}
+
+/* }====================================================== */
@@ -0,0 +1,872 @@
+#define sharetable_c
+#define LUA_LIB
+
+#include <luautil.h>
+#include <lauxlib.h>
+
+#include "lstring.h" // luaS_hash
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <limits.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define st_atomicinc(p) _InterlockedIncrement((volatile long*)(p))
+#define st_atomicdec(p) _InterlockedDecrement((volatile long*)(p))
+#else
+#define st_atomicinc(p) __sync_add_and_fetch((p), 1)
+#define st_atomicdec(p) __sync_sub_and_fetch((p), 1)
+#endif
+
+/*
+** {======================================================
+** Shared Table, immutable table graph outside of any global_State
+** =======================================================
+*/
+
+/*
+ * Layout mirrors ltable.c: an array part for keys 1..sizearray sized by the same
+ * 'more than half used' rule, and a node part of 2^lsizenode chained scatter slots
+ * with Brent's variation. Strings are hashed with luaS_hash and a per region seed,
+ * so lookups work from any lua_State.
+ */
+
+enum {
+  ST_NIL,
+  ST_FALSE,
+  ST_TRUE,
+  ST_INT,
+  ST_FLT,
+  ST_STR,
+  ST_TABLE,
+  ST_LUD,
+};
+
+typedef struct SString {
+  unsigned int hash;
+  size_t len;
+  char data[1];
+} SString;
+
+struct STable;
+
+typedef struct SValue {
+  union {
+    lua_Integer i;
+    lua_Number n;
+    const SString* s;
+    const struct STable* t;
+    void* p;
+  } u;
+  int tt;
+} SValue;
+
+typedef struct SNode {
+  SValue val;
+  SValue key;
+  int next; // offset to the next node in the chain, 0 for the end
+} SNode;
+
+typedef struct STable {
+  unsigned int sizearray;
+  unsigned int sizenode; // 0 or power of 2
+  SValue* array;
+  SNode* node;
+} STable;
+
+typedef struct SBlock {
+  struct SBlock* next;
+  size_t used;
+  size_t size;
+  union {
+    lua_Number n;
+    void* p;
+    lua_Integer i;
+  } data[1]; // for alignment
+} SBlock;
+
+struct luaL_SharedTable {
+  volatile long ref;
+  unsigned int seed;
+  const STable* root;
+  SBlock* blocks;
+  size_t bytes;
+};
+
+#define SHARED_TABLE_TYPE "luaL_SharedTable*"
+#define SBLOCK_SIZE (64 * 1024)
+#define SHARE_MAXDEPTH 200
+
+static const SValue nilvalue = {{0}, ST_NIL};
+
+static void* st_alloc(luaL_SharedTable* st, size_t sz) {
+  SBlock* b = st->blocks;
+  sz = (sz + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+  if (b == NULL || b->size - b->used < sz) {
+    size_t size = sz > SBLOCK_SIZE / 4 ? sz : SBLOCK_SIZE;
+    b = (SBlock*)malloc(offsetof(SBlock, data) + size);
+    if (b == NULL) {
+      return NULL;
+    }
+    b->used = 0;
+    b->size = size;
+    if (st->blocks != NULL && size != SBLOCK_SIZE) { /* keep filling the current block */
+      b->next = st->blocks->next;
+      st->blocks->next = b;
+    } else {
+      b->next = st->blocks;
+      st->blocks = b;
+    }
+    st->bytes += offsetof(SBlock, data) + size;
+  }
+  void* p = (char*)b->data + b->used;
+  b->used += sz;
+  return p;
+}
+
+static void st_free(luaL_SharedTable* st) {
+  SBlock* b = st->blocks;
+  while (b != NULL) {
+    SBlock* next = b->next;
+    free(b);
+    b = next;
+  }
+  free(st);
+}
+
+LUALIB_API luaL_SharedTable* luaL_retainsharedtable(luaL_SharedTable* st) {
+  st_atomicinc(&st->ref);
+  return st;
+}
+
+LUALIB_API void luaL_releasesharedtable(luaL_SharedTable* st) {
+  if (st_atomicdec(&st->ref) == 0) {
+    st_free(st);
+  }
+}
+
+LUALIB_API size_t luaL_sharedtablesize(luaL_SharedTable* st) {
+  return st->bytes;
+}
+
+/* }====================================================== */
+
+/*
+** {======================================================
+** Hash, same main positions as ltable.c
+** =======================================================
+*/
+
+static int l_hashfloat(lua_Number n) {
+  int i = 0;
+  lua_Integer ni = 0;
+  n = l_mathop(frexp)(n, &i) * -(lua_Number)INT_MIN;
+  if (!lua_numbertointeger(n, &ni)) { /* is 'n' inf/-inf/NaN? */
+    return 0;
+  } else { /* normal case */
+    unsigned int u = (unsigned int)i + (unsigned int)ni;
+    return (int)(u <= (unsigned int)INT_MAX ? u : ~u);
+  }
+}
+
+#define hashpow2(t, n) (&(t)->node[(unsigned int)(n) & ((t)->sizenode - 1)])
+#define hashmod(t, n) (&(t)->node[(n) % (((t)->sizenode - 1) | 1)])
+
+static const SNode* mainposition(const STable* t, const SValue* key) {
+  switch (key->tt) {
+    case ST_INT:
+      return hashpow2(t, key->u.i);
+    case ST_FLT:
+      return hashmod(t, (unsigned int)l_hashfloat(key->u.n));
+    case ST_STR:
+      return hashpow2(t, key->u.s->hash);
+    case ST_FALSE:
+    case ST_TRUE:
+      return hashpow2(t, key->tt == ST_TRUE);
+    case ST_LUD:
+      return hashmod(t, (unsigned int)((size_t)key->u.p & UINT_MAX));
+    default:
+      lua_assert(0);
+      return NULL;
+  }
+}
+
+static int st_keyequal(const SValue* a, const SValue* b) {
+  if (a->tt != b->tt) {
+    return 0;
+  }
+  switch (a->tt) {
+    case ST_INT:
+      return a->u.i == b->u.i;
+    case ST_FLT:
+      return a->u.n == b->u.n;
+    case ST_STR:
+      return a->u.s == b->u.s || (a->u.s->hash == b->u.s->hash && a->u.s->len == b->u.s->len &&
+                                  memcmp(a->u.s->data, b->u.s->data, a->u.s->len) == 0);
+    case ST_LUD:
+      return a->u.p == b->u.p;
+    default: /* booleans */
+      return 1;
+  }
+}
+
+static const SNode* st_findnode(const STable* t, const SValue* key) {
+  if (t->sizenode == 0) {
+    return NULL;
+  }
+  const SNode* n = mainposition(t, key);
+  for (;;) {
+    if (st_keyequal(&n->key, key)) {
+      return n;
+    }
+    if (n->next == 0) {
+      return NULL;
+    }
+    n += n->next;
+  }
+}
+
+static const SValue* st_getint(const STable* t, lua_Integer key) {
+  if ((lua_Unsigned)key - 1 < t->sizearray) {
+    return &t->array[key - 1];
+  }
+  if (t->sizenode == 0) {
+    return &nilvalue;
+  }
+  const SNode* n = hashpow2(t, key);
+  for (;;) {
+    if (n->key.tt == ST_INT && n->key.u.i == key) {
+      return &n->val;
+    }
+    if (n->next == 0) {
+      return &nilvalue;
+    }
+    n += n->next;
+  }
+}
+
+static const SNode* st_findstr(const STable* t, unsigned int h, const char* str, size_t len) {
+  if (t->sizenode == 0) {
+    return NULL;
+  }
+  const SNode* n = hashpow2(t, h);
+  for (;;) {
+    if (n->key.tt == ST_STR && n->key.u.s->hash == h && n->key.u.s->len == len &&
+        memcmp(n->key.u.s->data, str, len) == 0) {
+      return n;
+    }
+    if (n->next == 0) {
+      return NULL;
+    }
+    n += n->next;
+  }
+}
+
+/* }====================================================== */
+
+/*
+** {======================================================
+** Freeze, build a region from a Lua table graph
+** =======================================================
+*/
+
+typedef struct {
+  SValue key;
+  SValue val;
+} SEntry;
+
+/* userdata on the stack while freezing, errors free everything in __gc */
+typedef struct {
+  luaL_SharedTable* st;
+  SEntry* entries;
+  size_t n;
+  size_t cap;
+} Freezer;
+
+typedef struct {
+  lua_State* L;
+  Freezer* F;
+  int tables; // stack index, Lua table -> STable* lightuserdata
+  int strings; // stack index, Lua string -> SString* lightuserdata
+  int depth;
+} FreezeState;
+
+static int freezer_gc(lua_State* L) {
+  Freezer* F = (Freezer*)lua_touserdata(L, 1);
+  free(F->entries);
+  F->entries = NULL;
+  if (F->st != NULL) {
+    st_free(F->st);
+    F->st = NULL;
+  }
+  return 0;
+}
+
+static void* fs_alloc(FreezeState* S, size_t sz) {
+  void* p = st_alloc(S->F->st, sz);
+  if (p == NULL) {
+    luaL_error(S->L, "freeze: not enough memory");
+  }
+  return p;
+}
+
+static SEntry* fs_pushentry(FreezeState* S) {
+  Freezer* F = S->F;
+  if (F->n == F->cap) {
+    size_t cap = F->cap == 0 ? 64 : F->cap * 2;
+    SEntry* entries = (SEntry*)realloc(F->entries, sizeof(SEntry) * cap);
+    if (entries == NULL) {
+      luaL_error(S->L, "freeze: not enough memory");
+    }
+    F->entries = entries;
+    F->cap = cap;
+  }
+  return &F->entries[F->n++];
+}
+
+static const SString* fs_string(FreezeState* S, int idx) {
+  lua_State* L = S->L;
+  lua_pushvalue(L, idx);
+  if (lua_rawget(L, S->strings) == LUA_TLIGHTUSERDATA) {
+    const SString* s = (const SString*)lua_touserdata(L, -1);
+    lua_pop(L, 1);
+    return s;
+  }
+  lua_pop(L, 1);
+  size_t len;
+  const char* str = lua_tolstring(L, idx, &len);
+  SString* s = (SString*)fs_alloc(S, offsetof(SString, data) + len + 1);
+  s->hash = luaS_hash(str, len, S->F->st->seed);
+  s->len = len;
+  memcpy(s->data, str, len);
+  s->data[len] = '\0';
+  lua_pushvalue(L, idx);
+  lua_pushlightuserdata(L, s);
+  lua_rawset(L, S->strings);
+  return s;
+}
+
+static const STable* fs_table(FreezeState* S, int idx);
+
+static void fs_value(FreezeState* S, int idx, SValue* v, int bKey) {
+  lua_State* L = S->L;
+  switch (lua_type(L, idx)) {
+    case LUA_TBOOLEAN:
+      v->tt = lua_toboolean(L, idx) ? ST_TRUE : ST_FALSE;
+      break;
+    case LUA_TNUMBER:
+      if (lua_isinteger(L, idx)) {
+        v->tt = ST_INT;
+        v->u.i = lua_tointeger(L, idx);
+      } else {
+        v->tt = ST_FLT;
+        v->u.n = lua_tonumber(L, idx);
+      }
+      break;
+    case LUA_TSTRING:
+      v->tt = ST_STR;
+      v->u.s = fs_string(S, idx);
+      break;
+    case LUA_TLIGHTUSERDATA:
+      v->tt = ST_LUD;
+      v->u.p = lua_touserdata(L, idx);
+      break;
+    case LUA_TTABLE:
+      if (!bKey) {
+        v->tt = ST_TABLE;
+        v->u.t = fs_table(S, idx);
+        break;
+      }
+      /* FALLTHROUGH */
+    default:
+      luaL_error(L, "freeze: unsupported %s %s", bKey ? "key" : "value", luaL_typename(L, idx));
+      break;
+  }
+}
+
+static unsigned int ceillog2(unsigned int x) {
+  unsigned int l = 0;
+  x--;
+  while (x > 0) {
+    l++;
+    x >>= 1;
+  }
+  return l;
+}
+
+static unsigned int computesizes(unsigned int nums[], unsigned int* pna) {
+  int i;
+  unsigned int twotoi;
+  unsigned int a = 0;
+  unsigned int na = 0;
+  unsigned int optimal = 0;
+  for (i = 0, twotoi = 1; twotoi > 0 && *pna > twotoi / 2; i++, twotoi *= 2) {
+    if (nums[i] > 0) {
+      a += nums[i];
+      if (a > twotoi / 2) {
+        optimal = twotoi;
+        na = a;
+      }
+    }
+  }
+  *pna = na;
+  return optimal;
+}
+
+static SNode* getfreepos(STable* t, SNode** lastfree) {
+  while (*lastfree > t->node) {
+    (*lastfree)--;
+    if ((*lastfree)->key.tt == ST_NIL) {
+      return *lastfree;
+    }
+  }
+  return NULL;
+}
+
+/* same steps as luaH_newkey, the node part is big enough so it never rehashes */
+static void st_newkey(STable* t, SNode** lastfree, const SValue* key, const SValue* val) {
+  SNode* mp = (SNode*)mainposition(t, key);
+  if (mp->key.tt != ST_NIL) {
+    SNode* f = getfreepos(t, lastfree);
+    SNode* othern = (SNode*)mainposition(t, &mp->key);
+    lua_assert(f != NULL);
+    if (othern != mp) {
+      while (othern + othern->next != mp) {
+        othern += othern->next;
+      }
+      othern->next = (int)(f - othern);
+      *f = *mp;
+      if (mp->next != 0) {
+        f->next += (int)(mp - f);
+        mp->next = 0;
+      }
+    } else {
+      if (mp->next != 0) {
+        f->next = (int)((mp + mp->next) - f);
+      }
+      mp->next = (int)(f - mp);
+      mp = f;
+    }
+  }
+  mp->key = *key;
+  mp->val = *val;
+}
+
+static void fs_build(FreezeState* S, STable* t, size_t base) {
+  Freezer* F = S->F;
+  unsigned int nums[sizeof(unsigned int) * CHAR_BIT + 1];
+  unsigned int na = 0;
+  size_t total = F->n - base;
+  size_t i;
+  memset(nums, 0, sizeof(nums));
+  for (i = base; i < F->n; i++) {
+    const SValue* k = &F->entries[i].key;
+    if (k->tt == ST_INT && (lua_Unsigned)k->u.i - 1 < (lua_Unsigned)INT_MAX) {
+      nums[ceillog2((unsigned int)k->u.i)]++;
+      na++;
+    }
+  }
+  t->sizearray = computesizes(nums, &na);
+  size_t nhash = total - na;
+  if (nhash > (size_t)1 << (sizeof(int) * CHAR_BIT - 2)) {
+    luaL_error(S->L, "freeze: table overflow");
+  }
+  t->sizenode = nhash == 0 ? 0 : 1u << ceillog2((unsigned int)nhash);
+  t->array = t->sizearray == 0 ? NULL : (SValue*)fs_alloc(S, sizeof(SValue) * t->sizearray);
+  t->node = t->sizenode == 0 ? NULL : (SNode*)fs_alloc(S, sizeof(SNode) * t->sizenode);
+  for (i = 0; i < t->sizearray; i++) {
+    t->array[i] = nilvalue;
+  }
+  for (i = 0; i < t->sizenode; i++) {
+    t->node[i].key = nilvalue;
+    t->node[i].val = nilvalue;
+    t->node[i].next = 0;
+  }
+  SNode* lastfree = t->node + t->sizenode;
+  for (i = base; i < F->n; i++) {
+    const SEntry* e = &F->entries[i];
+    if (e->key.tt == ST_INT && (lua_Unsigned)e->key.u.i - 1 < t->sizearray) {
+      t->array[e->key.u.i - 1] = e->val;
+    } else {
+      st_newkey(t, &lastfree, &e->key, &e->val);
+    }
+  }
+  F->n = base;
+}
+
+static const STable* fs_table(FreezeState* S, int idx) {
+  lua_State* L = S->L;
+  lua_pushvalue(L, idx);
+  if (lua_rawget(L, S->tables) == LUA_TLIGHTUSERDATA) { /* shared or cycle */
+    const STable* t = (const STable*)lua_touserdata(L, -1);
+    lua_pop(L, 1);
+    return t;
+  }
+  lua_pop(L, 1);
+  if (S->depth >= SHARE_MAXDEPTH) {
+    luaL_error(L, "freeze: table nested too deep");
+  }
+  luaL_checkstack(L, 4, "freeze: table nested too deep");
+  STable* t = (STable*)fs_alloc(S, sizeof(STable));
+  memset(t, 0, sizeof(STable));
+  lua_pushvalue(L, idx);
+  lua_pushlightuserdata(L, t);
+  lua_rawset(L, S->tables);
+  S->depth++;
+  size_t base = S->F->n;
+  lua_pushnil(L);
+  while (lua_next(L, idx)) {
+    int top = lua_gettop(L);
+    SEntry e;
+    fs_value(S, top - 1, &e.key, 1);
+    fs_value(S, top, &e.val, 0);
+    *fs_pushentry(S) = e; /* nested tables pushed and popped their own entries */
+    lua_pop(L, 1);
+  }
+  fs_build(S, t, base);
+  S->depth--;
+  return t;
+}
+
+static int freeze_protected(lua_State* L) {
+  Freezer* F = (Freezer*)lua_touserdata(L, 1);
+  FreezeState S[1];
+  S->L = L;
+  S->F = F;
+  S->depth = 0;
+  lua_newtable(L);
+  S->tables = lua_gettop(L);
+  lua_newtable(L);
+  S->strings = lua_gettop(L);
+  F->st->root = fs_table(S, 2);
+  return 0;
+}
+
+// [-0, +0, e] freeze the table at idx into a new region with one reference
+LUALIB_API luaL_SharedTable* luaL_freezetable(lua_State* L, int idx) {
+  idx = lua_absindex(L, idx);
+  luaL_checktype(L, idx, LUA_TTABLE);
+  luaL_SharedTable* st = (luaL_SharedTable*)malloc(sizeof(luaL_SharedTable));
+  if (st == NULL) {
+    luaL_error(L, "freeze: not enough memory");
+  }
+  st->ref = 1;
+  st->seed = (unsigned int)((size_t)st >> 4);
+  st->root = NULL;
+  st->blocks = NULL;
+  st->bytes = sizeof(luaL_SharedTable);
+  Freezer* F = (Freezer*)lua_newuserdata(L, sizeof(Freezer)); /* collected with the region on error */
+  F->st = st;
+  F->entries = NULL;
+  F->n = 0;
+  F->cap = 0;
+  lua_createtable(L, 0, 1);
+  lua_pushcfunction(L, freezer_gc);
+  lua_setfield(L, -2, "__gc");
+  lua_setmetatable(L, -2);
+  lua_pushcfunction(L, freeze_protected);
+  lua_pushvalue(L, -2);
+  lua_pushvalue(L, idx);
+  if (lua_pcall(L, 2, 0, 0) != LUA_OK) {
+    lua_remove(L, -2);
+    lua_error(L);
+  }
+  free(F->entries);
+  F->entries = NULL;
+  F->st = NULL;
+  lua_pop(L, 1);
+  return st;
+}
+
+/* }====================================================== */
+
+/*
+** {======================================================
+** Proxy, userdata per STable per lua_State
+** =======================================================
+*/
+
+typedef struct {
+  luaL_SharedTable* st;
+  const STable* t;
+} SProxy;
+
+/*
+ * proxies carry no finalizer, each one keeps the region anchor of its state
+ * as user value, the anchor holds the only reference of this state.
+ */
+#define SHARED_TABLE_REF "luaL_SharedTable*.ref"
+
+static char proxyCacheKey; // weak valued table, STable* -> SProxy userdata, also upvalue 1 of the metamethods
+
+/* push the proxy of t from the cache at index 'cache', created with the anchor of proxy 'anchor' or a new one if 0 */
+static void st_pushproxy(lua_State* L, int cache, luaL_SharedTable* st, const STable* t, int anchor) {
+  lua_pushvalue(L, cache);
+  if (lua_rawgetp(L, -1, t) != LUA_TUSERDATA) {
+    lua_pop(L, 1);
+    SProxy* p = (SProxy*)lua_newuserdata(L, sizeof(SProxy));
+    p->st = st;
+    p->t = t;
+    if (anchor == 0) {
+      luaL_setmetatable(L, SHARED_TABLE_TYPE);
+      luaL_SharedTable** ref = (luaL_SharedTable**)lua_newuserdata(L, sizeof(luaL_SharedTable*));
+      *ref = luaL_retainsharedtable(st);
+      luaL_setmetatable(L, SHARED_TABLE_REF);
+    } else {
+      lua_getmetatable(L, anchor);
+      lua_setmetatable(L, -2);
+      lua_getuservalue(L, anchor);
+    }
+    lua_setuservalue(L, -2);
+    lua_pushvalue(L, -1);
+    lua_rawsetp(L, -3, t);
+  }
+  lua_remove(L, -2);
+}
+
+/* push v read through the proxy at 'owner', only from the metamethods */
+static void st_pushvalue(lua_State* L, int owner, const SValue* v) {
+  switch (v->tt) {
+    case ST_NIL:
+      lua_pushnil(L);
+      break;
+    case ST_FALSE:
+    case ST_TRUE:
+      lua_pushboolean(L, v->tt == ST_TRUE);
+      break;
+    case ST_INT:
+      lua_pushinteger(L, v->u.i);
+      break;
+    case ST_FLT:
+      lua_pushnumber(L, v->u.n);
+      break;
+    case ST_STR:
+      lua_pushlstring(L, v->u.s->data, v->u.s->len);
+      break;
+    case ST_TABLE:
+      st_pushproxy(L, lua_upvalueindex(1), ((SProxy*)lua_touserdata(L, owner))->st, v->u.t, owner);
+      break;
+    case ST_LUD:
+      lua_pushlightuserdata(L, v->u.p);
+      break;
+  }
+}
+
+/* non string key at idx for lookup, 0 if no such key can exist */
+static int st_tokey(lua_State* L, int idx, SValue* key) {
+  switch (lua_type(L, idx)) {
+    case LUA_TNUMBER:
+      if (lua_isinteger(L, idx)) {
+        key->tt = ST_INT;
+        key->u.i = lua_tointeger(L, idx);
+      } else {
+        lua_Number n = lua_tonumber(L, idx);
+        lua_Integer i = 0;
+        if (lua_numbertointeger(n, &i) && (lua_Number)i == n) { /* float with an integer value */
+          key->tt = ST_INT;
+          key->u.i = i;
+        } else {
+          key->tt = ST_FLT;
+          key->u.n = n;
+        }
+      }
+      return 1;
+    case LUA_TBOOLEAN:
+      key->tt = lua_toboolean(L, idx) ? ST_TRUE : ST_FALSE;
+      return 1;
+    case LUA_TLIGHTUSERDATA:
+      key->tt = ST_LUD;
+      key->u.p = lua_touserdata(L, idx);
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+/* node of the key at idx, NULL if absent */
+static const SNode* st_findkey(lua_State* L, SProxy* p, int idx) {
+  SValue key;
+  if (lua_type(L, idx) == LUA_TSTRING) {
+    size_t len;
+    const char* str = lua_tolstring(L, idx, &len);
+    return st_findstr(p->t, luaS_hash(str, len, p->st->seed), str, len);
+  }
+  if (!st_tokey(L, idx, &key)) {
+    return NULL;
+  }
+  return st_findnode(p->t, &key);
+}
+
+static int st_index(lua_State* L) {
+  SProxy* p = (SProxy*)lua_touserdata(L, 1);
+  const SValue* v;
+  SValue key;
+  if (lua_isinteger(L, 2)) {
+    v = st_getint(p->t, lua_tointeger(L, 2));
+  } else if (lua_type(L, 2) != LUA_TSTRING && st_tokey(L, 2, &key) && key.tt == ST_INT) {
+    v = st_getint(p->t, key.u.i);
+  } else {
+    const SNode* n = st_findkey(L, p, 2);
+    v = n == NULL ? &nilvalue : &n->val;
+  }
+  st_pushvalue(L, 1, v);
+  return 1;
+}
+
+static int st_newindex(lua_State* L) {
+  return luaL_error(L, "attempt to modify a frozen table");
+}
+
+static lua_Unsigned st_unbound(const STable* t, lua_Unsigned j) {
+  lua_Unsigned i = j;
+  j++;
+  while (st_getint(t, (lua_Integer)j)->tt != ST_NIL) {
+    i = j;
+    if (j > (lua_Unsigned)LUA_MAXINTEGER / 2) {
+      i = 1;
+      while (st_getint(t, (lua_Integer)i)->tt != ST_NIL) {
+        i++;
+      }
+      return i - 1;
+    }
+    j *= 2;
+  }
+  while (j - i > 1) {
+    lua_Unsigned m = (i + j) / 2;
+    if (st_getint(t, (lua_Integer)m)->tt == ST_NIL) {
+      j = m;
+    } else {
+      i = m;
+    }
+  }
+  return i;
+}
+
+/* same border as luaH_getn */
+static int st_len(lua_State* L) {
+  SProxy* p = (SProxy*)lua_touserdata(L, 1);
+  const STable* t = p->t;
+  unsigned int j = t->sizearray;
+  if (j > 0 && t->array[j - 1].tt == ST_NIL) {
+    unsigned int i = 0;
+    while (j - i > 1) {
+      unsigned int m = (i + j) / 2;
+      if (t->array[m - 1].tt == ST_NIL) {
+        j = m;
+      } else {
+        i = m;
+      }
+    }
+    lua_pushinteger(L, (lua_Integer)i);
+  } else if (t->sizenode == 0) {
+    lua_pushinteger(L, (lua_Integer)j);
+  } else {
+    lua_pushinteger(L, (lua_Integer)st_unbound(t, j));
+  }
+  return 1;
+}
+
+/* same order as luaH_next, array part then node part */
+static int st_next(lua_State* L) {
+  SProxy* p = (SProxy*)luaL_checkudata(L, 1, SHARED_TABLE_TYPE);
+  const STable* t = p->t;
+  size_t i = 0;
+  lua_settop(L, 2);
+  if (!lua_isnil(L, 2)) {
+    lua_Integer k = lua_isinteger(L, 2) ? lua_tointeger(L, 2) : 0;
+    if ((lua_Unsigned)k - 1 < t->sizearray) {
+      i = (size_t)k;
+    } else {
+      const SNode* n = st_findkey(L, p, 2);
+      if (n == NULL) {
+        return luaL_error(L, "invalid key to 'next'");
+      }
+      i = (size_t)(n - t->node) + 1 + t->sizearray;
+    }
+  }
+  for (; i < t->sizearray; i++) {
+    if (t->array[i].tt != ST_NIL) {
+      lua_pushinteger(L, (lua_Integer)i + 1);
+      st_pushvalue(L, 1, &t->array[i]);
+      return 2;
+    }
+  }
+  for (i -= t->sizearray; i < t->sizenode; i++) {
+    const SNode* n = &t->node[i];
+    if (n->val.tt != ST_NIL) {
+      st_pushvalue(L, 1, &n->key);
+      st_pushvalue(L, 1, &n->val);
+      return 2;
+    }
+  }
+  lua_pushnil(L);
+  return 1;
+}
+
+static int st_pairs(lua_State* L) {
+  luaL_checkudata(L, 1, SHARED_TABLE_TYPE);
+  lua_pushvalue(L, lua_upvalueindex(1));
+  lua_pushcclosure(L, st_next, 1);
+  lua_pushvalue(L, 1);
+  lua_pushnil(L);
+  return 3;
+}
+
+static int st_tostring(lua_State* L) {
+  SProxy* p = (SProxy*)lua_touserdata(L, 1);
+  lua_pushfstring(L, "luaL_SharedTable*: %p", p->t);
+  return 1;
+}
+
+static int st_refgc(lua_State* L) {
+  luaL_SharedTable** ref = (luaL_SharedTable**)lua_touserdata(L, 1);
+  if (*ref != NULL) {
+    luaL_releasesharedtable(*ref);
+    *ref = NULL;
+  }
+  return 0;
+}
+
+static const luaL_Reg st_metafuncs[] = {
+    {"__index", st_index},
+    {"__newindex", st_newindex},
+    {"__len", st_len},
+    {"__pairs", st_pairs},
+    {"__tostring", st_tostring},
+    {NULL, NULL},
+};
+
+void sharetable_init(lua_State* L) {
+  luaL_newmetatable(L, SHARED_TABLE_TYPE);
+  lua_newtable(L);
+  lua_createtable(L, 0, 1);
+  lua_pushliteral(L, "v");
+  lua_setfield(L, -2, "__mode");
+  lua_setmetatable(L, -2);
+  lua_pushvalue(L, -1);
+  lua_rawsetp(L, LUA_REGISTRYINDEX, &proxyCacheKey);
+  luaL_setfuncs(L, st_metafuncs, 1);
+  lua_pop(L, 1);
+  luaL_newmetatable(L, SHARED_TABLE_REF);
+  lua_pushcfunction(L, st_refgc);
+  lua_setfield(L, -2, "__gc");
+  lua_pop(L, 1);
+}
+
+// [-0, +1, e] push the root proxy, takes one more reference
+LUALIB_API void luaL_pushsharedtable(lua_State* L, luaL_SharedTable* st) {
+  if (lua_rawgetp(L, LUA_REGISTRYINDEX, &proxyCacheKey) != LUA_TTABLE) {
+    luaL_error(L, "shared tables need the util library");
+  }
+  st_pushproxy(L, lua_gettop(L), st, st->root, 0);
+  lua_remove(L, -2);
+}
+
+LUALIB_API luaL_SharedTable* luaL_tosharedtable(lua_State* L, int idx) {
+  SProxy* p = (SProxy*)luaL_testudata(L, idx, SHARED_TABLE_TYPE);
+  return p == NULL ? NULL : p->st;
+}
+
+/* }====================================================== */
@@ -33,9 +33,9 @@ function tostring(value, level) end
 ---@return string
 function typedetail(value) end
 
----@param opt string | '"stop"' | '"restart"' | '"collect"' | '"count"' | '"step"' | '"setpause"' | '"setstepmul"' | '"isrunning"' | '"onestep"'
+---@param opt string | '"stop"' | '"restart"' | '"collect"' | '"count"' | '"step"' | '"setpause"' | '"setstepmul"' | '"isrunning"' | '"onestep"' | '"generational"' | '"incremental"'
 ---@param arg integer
----@return number | boolean
+---@return number | boolean | string
 function collectgarbage(opt, arg) end
 
 ---@param callback fun():void
@@ -92,9 +92,26 @@ function debug.sizeofstruct() end
 ---@return integer, integer, integer, boolean @totalByteSize, sizearray, lsizenode, isdummy
 function debug.tablemem(value) end
 
----@return string
+---@return string, string, integer, integer @state, "incremental" | "generational", minorCount, majorCount
 function debug.getgcstate() end
 
+---@class AllocClassStats
+---@field public size integer @block size of this class
+---@field public inuse integer
+---@field public allocs integer
+---@field public frees integer
+---@field public arenas integer
+
+---@class AllocStats
+---@field public large table @{inuse, bytes, allocs, frees} of blocks bigger than the largest class
+---@field public arenasize integer
+
+---@return AllocStats | AllocClassStats[] | nil @nil if the state was not created by luaL_newstate_z
+function debug.allocstats() end
+
+---@return integer, integer, integer, number @nuse, size, maxProbe, averageProbe
+function debug.strtabstats() end
+
 ---@overload fun(func:function):string
 ---@overload fun(func:function, recursive:boolean):string
 ---@overload fun(func:function, recursive:boolean, options:string):string
@@ -139,6 +156,20 @@ function os.sysname() end
 
 -- }======================================================
 
+--[[
+** {======================================================
+** coroutine
+** =======================================================
+--]]
+
+---@overload fun(co:thread):thread
+---@param co thread @dead or suspended coroutine
+---@param func fun(...):any @function to run on next resume
+---@return thread
+function coroutine.recycle(co, func) end
+
+-- }======================================================
+
 --[[
 ** {======================================================
 ** utf8
@@ -230,6 +261,20 @@ function io.writefile(fileName, data) end
 ---@return table
 function table.create(narr, nrec) end
 
+---@param tbl table
+---@param narr integer @new size of the array part, the hash part keeps its size
+---@return table
+function table.resize(tbl, narr) end
+
+---@overload fun(tbl:table, value:any):table
+---@overload fun(tbl:table, value:any, first:integer):table
+---@param tbl table
+---@param value any
+---@param first integer @default is 1
+---@param last integer @default is #tbl
+---@return table
+function table.fill(tbl, value, first, last) end
+
 ---@overload fun(tbl:table):table
 ---@overload fun(tbl:table, copykv:boolean):table
 ---@param tbl table
@@ -344,6 +389,36 @@ function util.printBuffer() end
 ---@return string
 function util.printFinish() end
 
+-- binary form of nil/boolean/number/string/table/lightuserdata, shared tables and cycles are kept, metatables are not
+---@vararg any
+---@return luaL_MemBuffer
+function util.serialize(...) end
+
+---@param buf string | luaL_MemBuffer
+---@return any
+function util.deserialize(buf) end
+
+---@class luaL_SharedTable:table
+
+-- immutable copy of a table (or of util.serialize output) in a region readable from any lua_State
+---@param t table | string | luaL_MemBuffer
+---@return luaL_SharedTable
+function util.freeze(t) end
+
+-- +1 reference to the region, hand it to another lua_State and open it there with util.sharedTable
+---@param st luaL_SharedTable
+---@return lightuserdata
+function util.sharedHandle(st) end
+
+---@param handle lightuserdata
+---@return luaL_SharedTable
+function util.sharedTable(handle) end
+
+-- bytes held by the region
+---@param st luaL_SharedTable
+---@return integer
+function util.sharedSize(st) end
+
 -- }======================================================
 
 --[[
@@ -420,3 +495,29 @@ function util.printFinish() end
 function asm.closure(numParam, isVararg, fillPrototype) end
 
 -- }======================================================
+
+--[[
+** {======================================================
+** profiler
+** =======================================================
+--]]
+
+--- start sampling with a SIGPROF timer, drop the previous samples
+---@overload fun():boolean
+---@param hz integer @samples per second of CPU time, default 1000
+---@return boolean
+function profiler.start(hz) end
+
+---@return integer @number of samples
+function profiler.stop() end
+
+--- folded stacks, one "root;...;leaf count" per line, for flamegraph.pl or speedscope
+---@overload fun():string
+---@param filename string
+---@return string | boolean
+function profiler.dump(filename) end
+
+---@return boolean, integer, integer @running, hz, samples
+function profiler.isrunning() end
+
+-- }======================================================
@@ -122,6 +122,43 @@ function json.parse(str)
 	return value
 end
 
+-- decode straight into lua tables, integers stay integers, JSON null becomes `null` (default nil)
+---@param str string | luaL_MemBuffer
+---@param null any
+---@return any, string
+function json.decode(str, null)
+	return c.decode(str, null)
+end
+
+---@class JsonEncodeOpts
+---@field sortkeys boolean @object keys in byte order
+---@field uselength boolean @tables with #t > 0 are arrays of #t items, other keys are dropped
+---@field sparse integer @arrays may have holes while max index <= count * sparse, holes become null
+---@field emptyobject boolean @empty table as {} instead of []
+---@field null any @value written as null
+
+-- encode straight into a buffer, no cJSON tree, no lua string
+---@param value any
+---@param opts JsonEncodeOpts
+---@return luaL_MemBuffer, string
+function json.encode(value, opts)
+	return c.encode(value, opts)
+end
+
+---@class JsonDecoder
+---@field feed fun(self:JsonDecoder, chunk:string | luaL_MemBuffer):void
+---@field next fun(self:JsonDecoder):boolean, any @true, value / false when need more input / nil, errmsg
+---@field finish fun(self:JsonDecoder):void @no more input, complete the trailing scalar
+---@field pending fun(self:JsonDecoder):integer @bytes buffered but not decoded yet
+---@field reset fun(self:JsonDecoder):void
+
+-- incremental decoder for chunked input, yields whitespace separated documents one by one
+---@param null any
+---@return JsonDecoder
+function json.decoder(null)
+	return c.decoder(null)
+end
+
 ---@param str string
 ---@return string
 function json.minify(str)
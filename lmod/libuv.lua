@@ -185,11 +185,12 @@ libuv.pipe = pipe
 ---@field public readStartAsync fun(self:uv_pipe_t, callback:PipeReadSignature):void @uv_stream_t
 ---@field public readStartCache fun(self:uv_pipe_t, maxCache:integer):void
 ---@field public readCacheWait fun(self:uv_pipe_t):status, luaL_MemBuffer | nil
----@field public writeAsync fun(self:uv_pipe_t, data:string | luaL_MemBuffer, callback:StatusPipeSignature):void @uv_stream_t
----@field public writeAsyncWait fun(self:uv_pipe_t, data:string | luaL_MemBuffer):integer @uv_stream_t
----@field public write2Async fun(self:uv_pipe_t, data:string | luaL_MemBuffer, sendHandle:uv_stream_t, callback:StatusPipeSignature):void @uv_stream_t
----@field public write2AsyncWait fun(self:uv_pipe_t, data:string | luaL_MemBuffer, sendHandle:uv_stream_t):integer @uv_stream_t
----@field public tryWrite fun(self:uv_pipe_t, data:string | luaL_MemBuffer):integer @uv_stream_t
+---@field public readStartBatchAsync fun(self:uv_pipe_t, callback:fun(nread:integer, data:luaL_MemBuffer[] | luaL_MemBuffer | nil, handle:uv_pipe_t):void, contiguous:boolean | nil, blockSize:integer | nil):void @uv_stream_t
+---@field public writeAsync fun(self:uv_pipe_t, data:string | luaL_MemBuffer | (string | luaL_MemBuffer)[], callback:StatusPipeSignature):void @uv_stream_t
+---@field public writeAsyncWait fun(self:uv_pipe_t, data:string | luaL_MemBuffer | (string | luaL_MemBuffer)[]):integer @uv_stream_t
+---@field public write2Async fun(self:uv_pipe_t, data:string | luaL_MemBuffer | (string | luaL_MemBuffer)[], sendHandle:uv_stream_t, callback:StatusPipeSignature):void @uv_stream_t
+---@field public write2AsyncWait fun(self:uv_pipe_t, data:string | luaL_MemBuffer | (string | luaL_MemBuffer)[], sendHandle:uv_stream_t):integer @uv_stream_t
+---@field public tryWrite fun(self:uv_pipe_t, data:string | luaL_MemBuffer | (string | luaL_MemBuffer)[]):integer @uv_stream_t
 
 ---@param ipc boolean
 ---@return uv_pipe_t
@@ -206,6 +207,7 @@ end
 --]]
 
 ---@alias ReadCallbackSignature fun(nread:integer, str:luaL_MemBuffer | nil, handle:uv_stream_t):void
+---@alias ReadBatchCallbackSignature fun(nread:integer, data:luaL_MemBuffer[] | luaL_MemBuffer | nil, handle:uv_stream_t):void @data is one MemBuffer when contiguous
 ---@alias StatusStreamSignature fun(status:integer, handle:uv_stream_t):void
 
 ---@class uv_stream_t:uv_handle_t
@@ -218,12 +220,13 @@ end
 ---@field public readStartAsync fun(self:uv_stream_t, callback:ReadCallbackSignature):void
 ---@field public readStartCache fun(self:uv_stream_t, maxCache:integer):void
 ---@field public readCacheWait fun(self:uv_stream_t):status, luaL_MemBuffer | nil
+---@field public readStartBatchAsync fun(self:uv_stream_t, callback:ReadBatchCallbackSignature, contiguous:boolean | nil, blockSize:integer | nil):void @reads in one loop iteration with one call
 ---@field public readStop fun(self:uv_stream_t):void
----@field public writeAsync fun(self:uv_stream_t, data:string | luaL_MemBuffer, callback:StatusStreamSignature | nil):void @callback version in child class
----@field public writeAsyncWait fun(self:uv_stream_t, data:string | luaL_MemBuffer):integer
----@field public write2Async fun(self:uv_stream_t, data:string | luaL_MemBuffer, sendHandle:uv_stream_t, callback:StatusStreamSignature | nil):void @callback version in child class
----@field public write2AsyncWait fun(self:uv_stream_t, data:string | luaL_MemBuffer, sendHandle:uv_stream_t):integer
----@field public tryWrite fun(self:uv_stream_t, data:string | luaL_MemBuffer):integer
+---@field public writeAsync fun(self:uv_stream_t, data:string | luaL_MemBuffer | (string | luaL_MemBuffer)[], callback:StatusStreamSignature | nil):void @callback version in child class
+---@field public writeAsyncWait fun(self:uv_stream_t, data:string | luaL_MemBuffer | (string | luaL_MemBuffer)[]):integer
+---@field public write2Async fun(self:uv_stream_t, data:string | luaL_MemBuffer | (string | luaL_MemBuffer)[], sendHandle:uv_stream_t, callback:StatusStreamSignature | nil):void @callback version in child class
+---@field public write2AsyncWait fun(self:uv_stream_t, data:string | luaL_MemBuffer | (string | luaL_MemBuffer)[], sendHandle:uv_stream_t):integer
+---@field public tryWrite fun(self:uv_stream_t, data:string | luaL_MemBuffer | (string | luaL_MemBuffer)[]):integer
 ---@field public isReadable fun(self:uv_stream_t):boolean
 ---@field public isWritable fun(self:uv_stream_t):boolean
 ---@field public setBlocking fun(self:uv_stream_t, block:boolean):void
@@ -264,11 +267,12 @@ libuv.tcp = tcp
 ---@field public readStartAsync fun(self:uv_tcp_t, callback:TcpReadSignature):void @uv_stream_t
 ---@field public readStartCache fun(self:uv_tcp_t, maxCache:integer):void
 ---@field public readCacheWait fun(self:uv_tcp_t):status, luaL_MemBuffer | nil
----@field public writeAsync fun(self:uv_tcp_t, data:string | luaL_MemBuffer, callback:StatusTcpSignature):void @uv_stream_t
----@field public writeAsyncWait fun(self:uv_tcp_t, data:string | luaL_MemBuffer):integer @uv_stream_t
----@field public write2Async fun(self:uv_tcp_t, data:string | luaL_MemBuffer, sendHandle:uv_stream_t, callback:StatusTcpSignature):void @uv_stream_t
----@field public write2AsyncWait fun(self:uv_tcp_t, data:string | luaL_MemBuffer, sendHandle:uv_stream_t):integer @uv_stream_t
----@field public tryWrite fun(self:uv_tcp_t, data:string | luaL_MemBuffer):integer @uv_stream_t
+---@field public readStartBatchAsync fun(self:uv_tcp_t, callback:fun(nread:integer, data:luaL_MemBuffer[] | luaL_MemBuffer | nil, handle:uv_tcp_t):void, contiguous:boolean | nil, blockSize:integer | nil):void @uv_stream_t
+---@field public writeAsync fun(self:uv_tcp_t, data:string | luaL_MemBuffer | (string | luaL_MemBuffer)[], callback:StatusTcpSignature):void @uv_stream_t
+---@field public writeAsyncWait fun(self:uv_tcp_t, data:string | luaL_MemBuffer | (string | luaL_MemBuffer)[]):integer @uv_stream_t
+---@field public write2Async fun(self:uv_tcp_t, data:string | luaL_MemBuffer | (string | luaL_MemBuffer)[], sendHandle:uv_stream_t, callback:StatusTcpSignature):void @uv_stream_t
+---@field public write2AsyncWait fun(self:uv_tcp_t, data:string | luaL_MemBuffer | (string | luaL_MemBuffer)[], sendHandle:uv_stream_t):integer @uv_stream_t
+---@field public tryWrite fun(self:uv_tcp_t, data:string | luaL_MemBuffer | (string | luaL_MemBuffer)[]):integer @uv_stream_t
 
 ---@overload fun():uv_tcp_t
 ---@overload fun(flags:libuv_address_family):uv_tcp_t
@@ -313,11 +317,12 @@ libuv.tty = tty
 ---@field public readStartAsync fun(self:uv_tty_t, callback:TtyReadSignature):void @uv_stream_t
 ---@field public readStartCache fun(self:uv_tty_t, maxCache:integer):void
 ---@field public readCacheWait fun(self:uv_tty_t):status, luaL_MemBuffer | nil
----@field public writeAsync fun(self:uv_tty_t, data:string | luaL_MemBuffer, callback:StatusTtySignature):void @uv_stream_t
----@field public writeAsyncWait fun(self:uv_tty_t, data:string | luaL_MemBuffer):integer @uv_stream_t
----@field public write2Async fun(self:uv_tty_t, data:string | luaL_MemBuffer, sendHandle:uv_stream_t, callback:StatusTtySignature):void @uv_stream_t
----@field public write2AsyncWait fun(self:uv_tty_t, data:string | luaL_MemBuffer, sendHandle:uv_stream_t):integer @uv_stream_t
----@field public tryWrite fun(self:uv_tty_t, data:string | luaL_MemBuffer):integer @uv_stream_t
+---@field public readStartBatchAsync fun(self:uv_tty_t, callback:fun(nread:integer, data:luaL_MemBuffer[] | luaL_MemBuffer | nil, handle:uv_tty_t):void, contiguous:boolean | nil, blockSize:integer | nil):void @uv_stream_t
+---@field public writeAsync fun(self:uv_tty_t, data:string | luaL_MemBuffer | (string | luaL_MemBuffer)[], callback:StatusTtySignature):void @uv_stream_t
+---@field public writeAsyncWait fun(self:uv_tty_t, data:string | luaL_MemBuffer | (string | luaL_MemBuffer)[]):integer @uv_stream_t
+---@field public write2Async fun(self:uv_tty_t, data:string | luaL_MemBuffer | (string | luaL_MemBuffer)[], sendHandle:uv_stream_t, callback:StatusTtySignature):void @uv_stream_t
+---@field public write2AsyncWait fun(self:uv_tty_t, data:string | luaL_MemBuffer | (string | luaL_MemBuffer)[], sendHandle:uv_stream_t):integer @uv_stream_t
+---@field public tryWrite fun(self:uv_tty_t, data:string | luaL_MemBuffer | (string | luaL_MemBuffer)[]):integer @uv_stream_t
 
 ---@param fd integer
 ---@return uv_tty_t
@@ -746,6 +751,25 @@ function timer.Timer()
 	return libtimer.Timer(loopCtx)
 end
 
+---@alias TimerWheelSignature fun(ids:integer[], n:integer, wheel:uv_timer_wheel_t):void
+
+-- many coarse one shot timers on one uv_timer_t, start/stop/again are O(1)
+---@class uv_timer_wheel_t:uv_handle_t
+---@field public start fun(self:uv_timer_wheel_t, timeOut:integer):integer @id, fires within one tick after timeOut
+---@field public stop fun(self:uv_timer_wheel_t, id:integer):boolean @false if fired or stopped
+---@field public again fun(self:uv_timer_wheel_t, id:integer, timeOut:integer):boolean @reschedule, keeps the id
+---@field public getCount fun(self:uv_timer_wheel_t):integer
+---@field public getTick fun(self:uv_timer_wheel_t):integer
+---@field public closeAsync fun(self:uv_timer_wheel_t, callback:fun(handle:uv_timer_wheel_t):void):void @uv_handle_t
+---@field public closeAsyncWait fun(self:uv_timer_wheel_t):void @uv_handle_t
+
+---@param tick integer @ms per tick
+---@param callback TimerWheelSignature @all timers expired since the last tick, in one call
+---@return uv_timer_wheel_t
+function timer.TimerWheel(tick, callback)
+	return libtimer.TimerWheel(loopCtx, tick, callback)
+end
+
 -- }======================================================
 
 --[[
@@ -760,6 +784,7 @@ libuv.udp = udp
 
 ---@alias SendCallbackSignature fun(status:integer, handle:uv_udp_t):void
 ---@alias RecvCallbackSignature fun(nread:integer, data:luaL_MemBuffer | nil, addr:sockaddr | nil, flags:libuv_udp_flag, handle:uv_udp_t):void
+---@alias RecvBatchCallbackSignature fun(count:integer, data:luaL_MemBuffer | nil, lens:integer[] | nil, addrs:sockaddr[] | nil, handle:uv_udp_t):void @datagrams back to back in data, count < 0 is an error
 
 ---@class uv_udp_t:uv_handle_t
 ---@field public bind fun(self:uv_udp_t, addr:sockaddr, flags:libuv_udp_flag):uv_udp_t
@@ -772,10 +797,12 @@ libuv.udp = udp
 ---@field public setMulticastInterface fun(self:uv_udp_t, interfaceAddr:string):uv_udp_t
 ---@field public setBroadcast fun(self:uv_udp_t, on:boolean):uv_udp_t
 ---@field public setTtl fun(self:uv_udp_t, ttl:integer):uv_udp_t
----@field public sendAsync fun(self:uv_udp_t, data:string | luaL_MemBuffer, addr:sockaddr, callback:SendCallbackSignature | nil):void
----@field public sendAsyncWait fun(self:uv_udp_t, data:string | luaL_MemBuffer, addr:sockaddr):integer
----@field public trySend fun(self:uv_udp_t, data:string | luaL_MemBuffer, addr:sockaddr):void
+---@field public sendAsync fun(self:uv_udp_t, data:string | luaL_MemBuffer | (string | luaL_MemBuffer)[], addr:sockaddr, callback:SendCallbackSignature | nil):void
+---@field public sendAsyncWait fun(self:uv_udp_t, data:string | luaL_MemBuffer | (string | luaL_MemBuffer)[], addr:sockaddr):integer
+---@field public trySend fun(self:uv_udp_t, data:string | luaL_MemBuffer | (string | luaL_MemBuffer)[], addr:sockaddr):integer
+---@field public sendBatch fun(self:uv_udp_t, datagrams:(string | luaL_MemBuffer)[], addrs:sockaddr | sockaddr[] | nil):integer @sent count or error, nothing is moved
 ---@field public recvStartAsync fun(self:uv_udp_t, callback:RecvCallbackSignature):void
+---@field public recvStartBatchAsync fun(self:uv_udp_t, callback:RecvBatchCallbackSignature, maxCount:integer | nil, slotSize:integer | nil, withAddr:boolean | nil):void @up to maxCount(64) datagrams per call, longer than slotSize(2048) are truncated
 ---@field public recvStop fun(self:uv_udp_t):void
 ---@field public getSendQueueSize fun(self:uv_udp_t):integer
 ---@field public getSendQueueCount fun(self:uv_udp_t):integer
@@ -2224,6 +2251,40 @@ function libuv.queueWorkAsyncWait(worker, arg)
 	return yield()
 end
 
+-- Lua worker pool: one lua_State per threadpool thread, arguments and results go through util.serialize
+---@overload fun():void
+---@overload fun(preload:string[]):void
+---@param preload string[] | nil @modules required once in every worker state
+---@param callback fun():void | nil @all worker states are created
+function libuv.luaWorkSetup(preload, callback)
+	uvwrap.luaWorkSetup(loopCtx, preload, callback)
+end
+---@param name string @'global' or 'module.function' in the worker state
+---@param callback (fun(ok:boolean, ...):void) | nil @results or the error message, like pcall
+---@vararg any
+function libuv.queueLuaWorkAsync(name, callback, ...)
+	uvwrap.queueLuaWork(loopCtx, name, callback, ...)
+end
+local function luaWorkResult(ok, ...)
+	if not ok then error(..., 2) end
+	return ...
+end
+---@param name string
+---@vararg any
+---@return any
+function libuv.queueLuaWorkAsyncWait(name, ...)
+	local co, main = running()
+	if main then error(ASYNC_WAIT_MSG) end
+	uvwrap.queueLuaWork(loopCtx, name, function(...)
+		resume(co, ...)
+	end, ...)
+	return luaWorkResult(yield())
+end
+---@return integer, integer, integer, integer @poolSize, states, queued, running
+function libuv.luaWorkStat()
+	return uvwrap.luaWorkStat()
+end
+
 ---@type integer
 libuv.version = uvwrap.version
 ---@type string
@@ -2427,8 +2488,10 @@ end
 
 ---@class PacketManager:userdata
 ---@field public packPacket fun(self:PacketManager, type:string, data:string | luaL_MemBuffer, bUseString:boolean):string | luaL_MemBuffer @ Must using the return MemBuffer before next call to PacketManager
----@field public addPackData fun(self:PacketManager, packData:string | luaL_MemBuffer):void
----@field public getPacket fun(self:PacketManager, bUseString:boolean):libuv_packet_status, string | nil, string | luaL_MemBuffer | nil @ Must using the return MemBuffer before next call to PacketManager
+---@field public packFrame fun(self:PacketManager, type:string, data:string | luaL_MemBuffer, iov:table | nil):(string | luaL_MemBuffer)[] @ {header, data} for writeAsync, data is not copied
+---@field public addPackData fun(self:PacketManager, packData:string | luaL_MemBuffer):void @ MemBuffer moves in without copy
+---@field public getPacket fun(self:PacketManager, bUseString:boolean):libuv_packet_status, string | nil, string | luaL_MemBuffer | nil @ MemBuffer is a slice of the added data
+---@field public getPackets fun(self:PacketManager, types:string[], datas:(string | luaL_MemBuffer)[], bUseString:boolean | nil):integer, libuv_packet_status @ all complete packets, count and the status after them
 ---@field public eachPacket fun(self:PacketManager, bUseString:boolean):NextPacketSignature, PacketManager
 ---@field public getRemainForRead fun(self:PacketManager):integer
 
@@ -666,7 +666,11 @@ static int pmain(lua_State* L) {
 
 int main(int argc, char** argv) {
   int status, result;
-  lua_State* L = luaL_newstate(); /* create state */
+#if defined(LUA_USE_THREADLOCK)
+  lua_State* L = luaL_newstate(); /* create state, shared by OS threads */
+#else
+  lua_State* L = luaL_newstate_z(); /* create state, with slab allocator */
+#endif
   if (L == NULL) {
     l_message(argv[0], "cannot create state: not enough memory");
     return EXIT_FAILURE;
@@ -677,6 +681,6 @@ int main(int argc, char** argv) {
   status = lua_pcall(L, 2, 1, 0); /* do the call */
   result = lua_toboolean(L, -1); /* get result */
   report(L, status);
-  lua_close(L);
+  luaL_close_z(L); /* plain lua_close for a 'luaL_newstate' one */
   return (result && status == LUA_OK) ? EXIT_SUCCESS : EXIT_FAILURE;
 }
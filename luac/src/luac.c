@@ -30,6 +30,8 @@
 static int listing = 0; /* list bytecodes? */
 static int dumping = 1; /* dump bytecodes? */
 static int stripping = 0; /* strip debug information? */
+static int optimizing = 0; /* run the peephole pass? */
+static int mapping = 0; /* dump in mapped format? */
 static char Output[] = {OUTPUT}; /* default output file name */
 static const char* output = Output; /* actual output file name */
 static const char* progname = PROGNAME; /* actual program name */
@@ -54,6 +56,8 @@ static void usage(const char* message) {
           "Available options are:\n"
           "  -l       list to stdout(use -l -l for full listing)\n"
           "  (use -l -l -l for list instructions in different style)\n"
+          "  -m       dump in mapped format (functions loaded on first use)\n"
+          "  -O       optimize (peephole pass and superinstructions)\n"
           "  -o name  output to file 'name' (default is \"%s\")\n"
           "  (use -o - for output to stdout)\n"
           "  -p       parse only\n"
@@ -84,7 +88,11 @@ static int doargs(int argc, char* argv[]) {
         usage("'-o' needs argument");
       if (IS("-"))
         output = NULL;
-    } else if (IS("-p")) /* parse only */
+    } else if (IS("-m")) /* mapped format */
+      mapping = 1;
+    else if (IS("-O")) /* optimize */
+      optimizing = 1;
+    else if (IS("-p")) /* parse only */
       dumping = 0;
     else if (IS("-s")) /* strip debug information */
       stripping = 1;
@@ -184,7 +192,7 @@ static int pmain(lua_State* L) {
   // load all codes to 3, ..., 3 + argc - 1
   for (i = 0; i < argc; i++) {
     const char* filename = IS("-") ? NULL : argv[i];
-    if (luaL_loadfile(L, filename) != LUA_OK)
+    if (luaL_loadfilex(L, filename, optimizing ? "btO" : NULL) != LUA_OK)
       fatal(lua_tostring(L, -1));
   }
   // combine between 3 and 3 + argc - 1 to one function, push to the top of stack
@@ -195,7 +203,10 @@ static int pmain(lua_State* L) {
     FILE* D = (output == NULL) ? stdout : fopen(output, "wb");
     if (D == NULL)
       cannot("open");
-    lua_dump(L, writer, D, stripping);
+    if (mapping)
+      lua_dumpmap(L, writer, D, stripping);
+    else
+      lua_dump(L, writer, D, stripping);
     if (ferror(D))
       cannot("write");
     if (fclose(D))